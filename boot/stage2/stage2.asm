@@ -24,6 +24,12 @@ BOOT_RECOVERY   equ 2
 BOOT_REBOOT     equ 3
 NUM_BOOT_OPTIONS equ 4          ; Total number of boot options
 
+; Boot timestamp block handed to the kernel (see kernel/include/boottime.h)
+BOOT_TS_ADDR    equ 0x0500      ; Physical address (free low memory)
+BOOT_TS_MAGIC   equ 0x54425344  ; "DSBT"
+BOOT_TS_ENTRY   equ 8           ; Offset of the stage 2 entry TSC
+BOOT_TS_HANDOFF equ 16          ; Offset of the hand-off TSC
+
 ; Entry point
 start:
     ; Set up segment registers and stack
@@ -33,6 +39,17 @@ start:
     mov ss, ax
     mov sp, 0xFFF0      ; Set stack to 64K - 16 bytes
     
+    ; Timestamp stage 2 entry for the kernel's boot timeline, and clear
+    ; any hand-off time left over from a previous boot
+    xor ax, ax
+    mov es, ax
+    mov dword [es:BOOT_TS_ADDR + BOOT_TS_HANDOFF], 0
+    mov dword [es:BOOT_TS_ADDR + BOOT_TS_HANDOFF + 4], 0
+    mov ax, cs
+    mov es, ax
+    mov di, BOOT_TS_ENTRY
+    call record_tsc
+    
     ; Clear screen
     call clear_screen
     
@@ -375,6 +392,10 @@ load_kernel:
 
 ; Function to switch to long mode and jump to kernel
 switch_to_long_mode:
+    ; Timestamp the hand-off to the kernel
+    mov di, BOOT_TS_HANDOFF
+    call record_tsc
+    
     ; This is a simplified placeholder - a real implementation would:
     ; 1. Check CPU capabilities
     ; 2. Set up GDT for 64-bit
@@ -402,6 +423,24 @@ switch_to_long_mode:
     hlt
     jmp $
 
+; Function: record_tsc
+; Stores the TSC in the boot timestamp block and marks the block valid
+; Input: DI = offset of the field within the block
+record_tsc:
+    pushad
+    push es
+    
+    xor ax, ax
+    mov es, ax
+    rdtsc
+    mov [es:BOOT_TS_ADDR + di], eax
+    mov [es:BOOT_TS_ADDR + di + 4], edx
+    mov dword [es:BOOT_TS_ADDR], BOOT_TS_MAGIC
+    
+    pop es
+    popad
+    ret
+
 ; Error handlers
 disk_error:
     mov si, diskErrorMsg
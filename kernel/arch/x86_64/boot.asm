@@ -17,7 +17,18 @@ multiboot_header:
     dd MULTIBOOT_HEADER_LENGTH
     dd CHECKSUM
     
+    ; Framebuffer request (optional, so text mode still boots): the
+    ; loader's choice comes back in the framebuffer info tag
+    align 8, db 0
+    dw 5    ; type
+    dw 1    ; flags (optional)
+    dd 20   ; size
+    dd 1024 ; width
+    dd 768  ; height
+    dd 32   ; depth
+    
     ; End tags
+    align 8, db 0
     dw 0    ; type
     dw 0    ; flags
     dd 8    ; size
@@ -73,10 +84,23 @@ global multiboot_info_ptr
 multiboot_info_ptr:
     resq 1
 
+; Boot timeline timestamps (see kernel/lib/boottime.c)
+global boot_tsc_start
+global boot_tsc_kernel_main
+boot_tsc_start:
+    resq 1
+boot_tsc_kernel_main:
+    resq 1
+
 section .text
 bits 32
 global _start
 _start:
+    ; Timestamp kernel entry first (clobbers only eax/edx; ebx holds the multiboot info)
+    rdtsc
+    mov [boot_tsc_start - KERNEL_VIRTUAL_BASE], eax
+    mov [boot_tsc_start - KERNEL_VIRTUAL_BASE + 4], edx
+    
     ; Save multiboot info pointer
     mov [multiboot_info_ptr - KERNEL_VIRTUAL_BASE], ebx
     
@@ -158,12 +182,18 @@ higher_half_start:
     ; Now we're running in the higher half
     ; Set up the stack
     mov rsp, boot_stack_top
-    mov rbp, rsp
+    xor ebp, ebp        ; Null frame pointer ends stack walks at kernel_main
     
     ; Clear rflags
     push 0
     popf
     
+    ; Timestamp the hand-off to C
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov [boot_tsc_kernel_main], rax
+    
     ; Call kernel main with multiboot info
     mov rdi, [multiboot_info_ptr]
     
@@ -0,0 +1,62 @@
+/**
+ * @file debugcon.c
+ * @brief Port 0xE9 debug console (QEMU -debugcon, Bochs)
+ * 
+ * The emulator takes every byte written to port 0xE9 and passes it
+ * straight to its chardev. There is no line status to poll and no baud
+ * rate, so a block of text goes out with one rep outsb. Under KVM that
+ * is handled as a single string I/O exit per page rather than one exit
+ * per byte.
+ */
+
+#include "../../include/kernel.h"
+#include "../../include/initcall.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DEBUGCON_PORT        0xE9
+#define DEBUGCON_MAGIC       0xE9               // Read back from the port when present
+
+/**
+ * @brief Write a block of text to the debug console
+ * 
+ * @param data Text to write
+ * @param len Number of bytes to write
+ */
+static void debugcon_write(const char* data, size_t len) {
+    __asm__ volatile("rep outsb"
+                     : "+S"(data), "+c"(len)
+                     : "d"((uint16_t)DEBUGCON_PORT)
+                     : "memory");
+}
+
+static const printf_sink_t debugcon_sink = { debugcon_write, NULL };
+
+/**
+ * @brief Check whether the emulator has a debug console attached
+ * 
+ * QEMU and Bochs return 0xE9 on reads; an unclaimed port reads 0xFF.
+ * 
+ * @return true if present
+ */
+static bool debugcon_detect(void) {
+    return inb(DEBUGCON_PORT) == DEBUGCON_MAGIC;
+}
+
+/**
+ * @brief Initcall: register and enable the debugcon printf sink
+ * 
+ * @return 0 (running without a debug console is not an error)
+ */
+static int debugcon_initcall(void) {
+    if (!debugcon_detect()) {
+        return 0;
+    }
+    
+    kprintf_register_sink(PRINTF_MODE_DEBUGCON, &debugcon_sink);
+    kprintf_set_mode(kprintf_get_mode() | PRINTF_MODE_DEBUGCON);
+    kprintf("debugcon: port 0x%x\n", DEBUGCON_PORT);
+    return 0;
+}
+INITCALL(debugcon, debugcon_initcall, "");
@@ -0,0 +1,424 @@
+/**
+ * @file fbcon.c
+ * @brief Linear framebuffer text console
+ * 
+ * Text goes into a cell shadow (character and VGA attribute per cell)
+ * and a dirty rectangle grows around every change. fbcon_flush() walks
+ * the rectangle, compares each row with what is on screen, and redraws
+ * only the span of cells that differ. A span's scanlines are assembled
+ * from glyph cache rows in RAM, and each is then written to the
+ * framebuffer as one contiguous run of 64-bit stores, which is what
+ * write-combining memory wants. The framebuffer is never read.
+ * 
+ * Glyphs are rasterized once per character and attribute into the
+ * cache, already in the framebuffer's pixel format. Scrolling moves the
+ * cell shadow up a row and leaves the rest to the next flush, so a
+ * burst of log output costs one screen update however far it scrolls.
+ * 
+ * The cursor lives in terminal_row/terminal_column. Like the VGA
+ * console, writers are serialized by the kernel log drain.
+ * 
+ * framebuffer_base and its geometry come from the loader's Multiboot2
+ * framebuffer tag. Without one, fbcon_init() fails and the VGA text
+ * console stays in use.
+ */
+
+#include "../../include/kernel.h"
+#include "../../include/font.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Character cell size; font rows are drawn twice
+#define FBCON_CELL_W        FONT_WIDTH
+#define FBCON_CELL_H        (FONT_HEIGHT * 2)
+
+// Largest text grid kept in the shadow (2048x2048 pixels)
+#define FBCON_MAX_COLS      256
+#define FBCON_MAX_ROWS      128
+
+// Glyph cache slots, direct-mapped by character and attribute
+#define FBCON_CACHE_SLOTS   256
+#define FBCON_MAX_BPP_BYTES 4
+#define FBCON_GLYPH_ROW     (FBCON_CELL_W * FBCON_MAX_BPP_BYTES)
+
+#define FBCON_DEFAULT_ATTR  ((VGA_COLOR_BLACK << 4) | VGA_COLOR_LIGHT_GREY)
+
+/**
+ * @brief Rasterized glyph in the framebuffer's pixel format
+ */
+typedef struct {
+    uint32_t key;                       // FBCON_CACHE_KEY(), 0 if empty
+    uint8_t pixels[FBCON_CELL_H][FBCON_GLYPH_ROW];
+} fbcon_glyph_t;
+
+#define FBCON_CACHE_KEY(ch, attr) (0x10000u | ((uint32_t)(attr) << 8) | (uint8_t)(ch))
+
+// Standard VGA palette as 0xRRGGBB
+static uint32_t fbcon_palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+static bool fbcon_active = false;
+static uint8_t* fbcon_base;
+static uint32_t fbcon_pitch;
+static uint32_t fbcon_bytes_pp;         // Bytes per pixel (2, 3 or 4)
+static uint32_t fbcon_span;             // Bytes per glyph row (8 pixels)
+static uint32_t fbcon_cols;
+static uint32_t fbcon_rows;
+static uint8_t fbcon_attr = FBCON_DEFAULT_ATTR;
+
+// What should be on screen, and what is
+static uint16_t fbcon_cells[FBCON_MAX_ROWS * FBCON_MAX_COLS];
+static uint16_t fbcon_shown[FBCON_MAX_ROWS * FBCON_MAX_COLS];
+
+// Cells changed since the last flush: [x0, x1) x [y0, y1)
+static uint32_t fbcon_dirty_x0, fbcon_dirty_x1;
+static uint32_t fbcon_dirty_y0, fbcon_dirty_y1;
+
+static fbcon_glyph_t fbcon_cache[FBCON_CACHE_SLOTS];
+
+// The scanlines of a span, assembled before they are written out
+static uint8_t fbcon_lines[FBCON_CELL_H][FBCON_MAX_COLS * FBCON_GLYPH_ROW] ALIGN(64);
+
+/**
+ * @brief Build a shadow cell
+ * 
+ * @param c Character
+ * @param attr VGA attribute
+ * @return Cell value
+ */
+static inline uint16_t fbcon_cell(char c, uint8_t attr) {
+    return (uint16_t)(uint8_t)c | ((uint16_t)attr << 8);
+}
+
+/**
+ * @brief Grow the dirty rectangle to cover a run of cells on one row
+ * 
+ * @param x0 First column
+ * @param x1 One past the last column
+ * @param y Row
+ */
+static void fbcon_mark_dirty(uint32_t x0, uint32_t x1, uint32_t y) {
+    if (fbcon_dirty_x0 >= fbcon_dirty_x1) {
+        fbcon_dirty_x0 = x0;
+        fbcon_dirty_x1 = x1;
+        fbcon_dirty_y0 = y;
+        fbcon_dirty_y1 = y + 1;
+        return;
+    }
+    
+    if (x0 < fbcon_dirty_x0) fbcon_dirty_x0 = x0;
+    if (x1 > fbcon_dirty_x1) fbcon_dirty_x1 = x1;
+    if (y < fbcon_dirty_y0) fbcon_dirty_y0 = y;
+    if (y + 1 > fbcon_dirty_y1) fbcon_dirty_y1 = y + 1;
+}
+
+/**
+ * @brief Convert a 0xRRGGBB color to the framebuffer's pixel format
+ * 
+ * @param rgb Color
+ * @return Pixel value in the low fbcon_bytes_pp bytes
+ */
+static uint32_t fbcon_pack(uint32_t rgb) {
+    if (fbcon_bytes_pp == 2) {
+        uint32_t r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+        return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+    }
+    return rgb & 0xFFFFFF;
+}
+
+/**
+ * @brief Store a pixel in the framebuffer's byte order
+ * 
+ * @param dst Destination
+ * @param pixel Value from fbcon_pack()
+ */
+static inline void fbcon_put_pixel(uint8_t* dst, uint32_t pixel) {
+    for (uint32_t i = 0; i < fbcon_bytes_pp; i++) {
+        dst[i] = (uint8_t)(pixel >> (8 * i));
+    }
+}
+
+/**
+ * @brief Find a glyph in the cache, rasterizing it on a miss
+ * 
+ * @param cell Shadow cell (character and attribute)
+ * @return Rasterized glyph
+ */
+static const fbcon_glyph_t* fbcon_glyph(uint16_t cell) {
+    uint8_t ch = cell & 0xFF;
+    uint8_t attr = cell >> 8;
+    uint32_t key = FBCON_CACHE_KEY(ch, attr);
+    fbcon_glyph_t* glyph = &fbcon_cache[(ch ^ (attr * 0x3B)) % FBCON_CACHE_SLOTS];
+    
+    if (glyph->key == key) {
+        return glyph;
+    }
+    
+    uint32_t fg = fbcon_pack(fbcon_palette[attr & 0x0F]);
+    uint32_t bg = fbcon_pack(fbcon_palette[(attr >> 4) & 0x0F]);
+    const uint8_t* bits = (ch >= FONT_FIRST && ch <= FONT_LAST) ? font8x8[ch - FONT_FIRST] : font8x8[0];
+    
+    for (uint32_t y = 0; y < FBCON_CELL_H; y++) {
+        uint8_t row = bits[y * FONT_HEIGHT / FBCON_CELL_H];
+        for (uint32_t x = 0; x < FBCON_CELL_W; x++) {
+            fbcon_put_pixel(&glyph->pixels[y][x * fbcon_bytes_pp], (row & (0x80 >> x)) ? fg : bg);
+        }
+    }
+    glyph->key = key;
+    
+    return glyph;
+}
+
+/**
+ * @brief Redraw a run of cells on one text row
+ * 
+ * Each glyph is copied out as soon as it is looked up, since a later
+ * cell of the span may evict it from the cache.
+ * 
+ * @param y Text row
+ * @param x0 First column
+ * @param x1 One past the last column
+ */
+static void fbcon_draw_span(uint32_t y, uint32_t x0, uint32_t x1) {
+    const uint16_t* cells = &fbcon_cells[y * FBCON_MAX_COLS];
+    uint32_t count = x1 - x0;
+    size_t bytes = (size_t)count * fbcon_span;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        const fbcon_glyph_t* glyph = fbcon_glyph(cells[x0 + i]);
+        for (uint32_t line = 0; line < FBCON_CELL_H; line++) {
+            memcpy(&fbcon_lines[line][i * fbcon_span], glyph->pixels[line], fbcon_span);
+        }
+    }
+    
+    uint8_t* dst = fbcon_base + (size_t)y * FBCON_CELL_H * fbcon_pitch + (size_t)x0 * fbcon_span;
+    
+    // Spans are whole glyph rows, so always a multiple of 8 bytes
+    for (uint32_t line = 0; line < FBCON_CELL_H; line++) {
+        const uint64_t* src = (const uint64_t*)fbcon_lines[line];
+        volatile uint64_t* out = (volatile uint64_t*)dst;
+        for (size_t q = 0; q < bytes / 8; q++) {
+            out[q] = src[q];
+        }
+        dst += fbcon_pitch;
+    }
+}
+
+/**
+ * @brief Bring the framebuffer up to date with the cell shadow
+ */
+void fbcon_flush(void) {
+    if (!fbcon_active || fbcon_dirty_x0 >= fbcon_dirty_x1) {
+        return;
+    }
+    
+    for (uint32_t y = fbcon_dirty_y0; y < fbcon_dirty_y1; y++) {
+        uint16_t* cells = &fbcon_cells[y * FBCON_MAX_COLS];
+        uint16_t* shown = &fbcon_shown[y * FBCON_MAX_COLS];
+        uint32_t x0 = fbcon_dirty_x0;
+        uint32_t x1 = fbcon_dirty_x1;
+        
+        // Trim the span to the cells that actually changed
+        while (x0 < x1 && cells[x0] == shown[x0]) {
+            x0++;
+        }
+        while (x1 > x0 && cells[x1 - 1] == shown[x1 - 1]) {
+            x1--;
+        }
+        if (x0 == x1) {
+            continue;
+        }
+        
+        fbcon_draw_span(y, x0, x1);
+        memcpy(&shown[x0], &cells[x0], (x1 - x0) * sizeof(uint16_t));
+    }
+    
+    fbcon_dirty_x0 = fbcon_dirty_x1 = 0;
+    fbcon_dirty_y0 = fbcon_dirty_y1 = 0;
+}
+
+/**
+ * @brief Fill a text row with blanks in the current attribute
+ * 
+ * @param y Text row
+ */
+static void fbcon_blank_row(uint32_t y) {
+    uint16_t blank = fbcon_cell(' ', fbcon_attr);
+    uint16_t* cells = &fbcon_cells[y * FBCON_MAX_COLS];
+    
+    for (uint32_t x = 0; x < fbcon_cols; x++) {
+        cells[x] = blank;
+    }
+    fbcon_mark_dirty(0, fbcon_cols, y);
+}
+
+/**
+ * @brief Scroll the text up by one row
+ * 
+ * Only the shadow moves; the next flush redraws the cells that differ.
+ */
+static void fbcon_scroll(void) {
+    memmove(fbcon_cells, &fbcon_cells[FBCON_MAX_COLS],
+            (size_t)(fbcon_rows - 1) * FBCON_MAX_COLS * sizeof(uint16_t));
+    fbcon_mark_dirty(0, fbcon_cols, 0);
+    fbcon_blank_row(fbcon_rows - 1);
+}
+
+/**
+ * @brief Move the cursor to the start of the next row
+ */
+static void fbcon_newline(void) {
+    terminal_column = 0;
+    if (terminal_row + 1 < fbcon_rows) {
+        terminal_row++;
+    } else {
+        fbcon_scroll();
+    }
+}
+
+/**
+ * @brief Put a character at the cursor without flushing
+ * 
+ * @param c Character to put
+ */
+static void fbcon_put_raw(char c) {
+    // Panic code may move the cursor directly
+    if (terminal_row >= fbcon_rows) terminal_row = fbcon_rows - 1;
+    if (terminal_column >= fbcon_cols) terminal_column = 0;
+    
+    switch (c) {
+        case '\n':
+            fbcon_newline();
+            break;
+        
+        case '\r':
+            terminal_column = 0;
+            break;
+        
+        case '\b':
+            if (terminal_column > 0) {
+                terminal_column--;
+                fbcon_cells[terminal_row * FBCON_MAX_COLS + terminal_column] = fbcon_cell(' ', fbcon_attr);
+                fbcon_mark_dirty(terminal_column, terminal_column + 1, terminal_row);
+            }
+            break;
+        
+        case '\t':
+            terminal_column = (terminal_column + 8) & ~7u;
+            if (terminal_column >= fbcon_cols) {
+                fbcon_newline();
+            }
+            break;
+        
+        default:
+            fbcon_cells[terminal_row * FBCON_MAX_COLS + terminal_column] = fbcon_cell(c, fbcon_attr);
+            fbcon_mark_dirty(terminal_column, terminal_column + 1, terminal_row);
+            if (++terminal_column >= fbcon_cols) {
+                fbcon_newline();
+            }
+            break;
+    }
+}
+
+/**
+ * @brief Write a block of characters into the cell shadow
+ * 
+ * Nothing reaches the screen until fbcon_flush().
+ * 
+ * @param data Characters to write
+ * @param len Number of characters
+ */
+void fbcon_write(const char* data, size_t len) {
+    if (!fbcon_active) {
+        return;
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        fbcon_put_raw(data[i]);
+    }
+}
+
+/**
+ * @brief Set the attribute used for new text
+ * 
+ * @param fg Foreground color (0-15)
+ * @param bg Background color (0-15)
+ */
+void fbcon_set_color(uint8_t fg, uint8_t bg) {
+    fbcon_attr = (uint8_t)(((bg & 0x0F) << 4) | (fg & 0x0F));
+}
+
+/**
+ * @brief Clear the console to a solid background color
+ * 
+ * The color replaces palette entry 0 (black), so text written with a
+ * black background afterwards sits on it without a box around it.
+ * 
+ * @param rgb Background as 0xRRGGBB
+ */
+void fbcon_clear(uint32_t rgb) {
+    if (!fbcon_active) {
+        return;
+    }
+    
+    fbcon_palette[VGA_COLOR_BLACK] = rgb;
+    for (size_t i = 0; i < FBCON_CACHE_SLOTS; i++) {
+        fbcon_cache[i].key = 0;
+    }
+    
+    // Force every cell to be redrawn
+    for (size_t i = 0; i < FBCON_MAX_ROWS * FBCON_MAX_COLS; i++) {
+        fbcon_shown[i] = 0xFFFF;
+    }
+    for (uint32_t y = 0; y < fbcon_rows; y++) {
+        fbcon_blank_row(y);
+    }
+    
+    terminal_row = 0;
+    terminal_column = 0;
+    fbcon_flush();
+}
+
+/**
+ * @brief Check whether console output goes to the framebuffer
+ * 
+ * @return true once fbcon_init() has succeeded
+ */
+bool fbcon_is_active(void) {
+    return fbcon_active;
+}
+
+/**
+ * @brief Take over the console on the boot framebuffer
+ * 
+ * @return 0 on success, -1 if there is no usable framebuffer
+ */
+int fbcon_init(void) {
+    if (framebuffer_base == NULL || framebuffer_width < FBCON_CELL_W ||
+        framebuffer_height < FBCON_CELL_H) {
+        return -1;
+    }
+    if (framebuffer_bpp != 16 && framebuffer_bpp != 24 && framebuffer_bpp != 32) {
+        kprintf("fbcon: unsupported %u bpp framebuffer\n", framebuffer_bpp);
+        return -1;
+    }
+    
+    fbcon_base = (uint8_t*)framebuffer_base;
+    fbcon_pitch = framebuffer_pitch;
+    fbcon_bytes_pp = framebuffer_bpp / 8;
+    fbcon_span = FBCON_CELL_W * fbcon_bytes_pp;
+    fbcon_cols = framebuffer_width / FBCON_CELL_W;
+    fbcon_rows = framebuffer_height / FBCON_CELL_H;
+    if (fbcon_cols > FBCON_MAX_COLS) fbcon_cols = FBCON_MAX_COLS;
+    if (fbcon_rows > FBCON_MAX_ROWS) fbcon_rows = FBCON_MAX_ROWS;
+    
+    fbcon_active = true;
+    fbcon_clear(fbcon_palette[VGA_COLOR_BLACK]);
+    
+    kprintf("fbcon: %ux%u %u bpp, %ux%u text\n", framebuffer_width, framebuffer_height,
+            framebuffer_bpp, fbcon_cols, fbcon_rows);
+    return 0;
+}
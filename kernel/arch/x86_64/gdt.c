@@ -30,13 +30,7 @@ typedef struct {
     uint64_t rsp1;         // Stack pointer for ring 1
     uint64_t rsp2;         // Stack pointer for ring 2
     uint64_t reserved2;
-    uint64_t ist1;         // Interrupt stack table pointer 1
-    uint64_t ist2;         // Interrupt stack table pointer 2
-    uint64_t ist3;         // Interrupt stack table pointer 3
-    uint64_t ist4;         // Interrupt stack table pointer 4
-    uint64_t ist5;         // Interrupt stack table pointer 5
-    uint64_t ist6;         // Interrupt stack table pointer 6
-    uint64_t ist7;         // Interrupt stack table pointer 7
+    uint64_t ist[7];       // Interrupt stack table pointers 1-7
     uint64_t reserved3;
     uint16_t reserved4;
     uint16_t iomap_base;   // I/O map base address
@@ -73,6 +67,7 @@ static gdt_ptr_t gdt_ptr;
 // TSS entry and kernel stacks
 static tss_entry_t tss;
 static uint8_t kernel_stack[KERNEL_STACK_SIZE] ALIGN(16);
+static uint8_t ist_stacks[IST_COUNT][IST_STACK_SIZE] ALIGN(16);
 
 // External assembly function
 extern void gdt_flush(uint64_t gdt_ptr);
@@ -138,6 +133,11 @@ static void tss_init(void) {
     // Set up the kernel stack pointer
     tss.rsp0 = (uint64_t)kernel_stack + KERNEL_STACK_SIZE;
     
+    // Set up the IST stacks (slot n is ist[n - 1])
+    for (int i = 0; i < IST_COUNT; i++) {
+        tss.ist[i] = (uint64_t)ist_stacks[i] + IST_STACK_SIZE;
+    }
+    
     // Set the I/O map base address
     tss.iomap_base = sizeof(tss);
     
@@ -4,6 +4,11 @@
  */
 
 #include "../../include/kernel.h"
+#include "../../include/trace.h"
+#include "../../include/irqstat.h"
+#include "../../include/kstat.h"
+#include "../../include/text_poke.h"
+#include "../../include/spinlock.h"
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
@@ -41,8 +46,38 @@ static idt_entry_t idt[IDT_ENTRIES];
 // The IDT pointer
 static idt_ptr_t idt_ptr;
 
-// Interrupt handlers
-static interrupt_handler_t interrupt_handlers[IDT_ENTRIES];
+// Handlers attached to a vector
+typedef struct irq_action {
+    irq_handler_t handler;
+    void* cookie;
+    const char* name;
+    uint32_t flags;
+    struct irq_action* next;
+} irq_action_t;
+
+// Actions come from a fixed pool; interrupts are set up before the heap
+#define IRQ_MAX_ACTIONS 64
+
+static irq_action_t irq_action_pool[IRQ_MAX_ACTIONS];
+
+// Handler chain per vector, walked without a lock by interrupt_handler()
+static irq_action_t* irq_actions[IDT_ENTRIES];
+
+// Serializes request_irq() and free_irq()
+DEFINE_SPINLOCK(irq_desc_lock);
+
+// Hardware interrupt nesting depth
+static DEFINE_PER_CPU(uint32_t, irq_nesting);
+
+// Register frame of the innermost interrupt being handled
+static DEFINE_PER_CPU(irq_context_t*, irq_regs);
+
+// IRQ stacks; irq_common switches to irq_stack_top unless already on it
+static uint8_t irq_stacks[MAX_CPUS][IRQ_STACK_SIZE] ALIGN(16);
+DEFINE_PER_CPU(uintptr_t, irq_stack_top);
+
+KSTAT_COUNTER(irq_count, "irq.count", "interrupts dispatched");
+KSTAT_COUNTER(irq_unhandled, "irq.unhandled", "interrupts no handler claimed");
 
 // Exception messages
 static const char* exception_messages[32] = {
@@ -114,26 +149,10 @@ extern void isr29(void);
 extern void isr30(void);
 extern void isr31(void);
 
-// IRQs (32-47)
-extern void irq0(void);
-extern void irq1(void);
-extern void irq2(void);
-extern void irq3(void);
-extern void irq4(void);
-extern void irq5(void);
-extern void irq6(void);
-extern void irq7(void);
-extern void irq8(void);
-extern void irq9(void);
-extern void irq10(void);
-extern void irq11(void);
-extern void irq12(void);
-extern void irq13(void);
-extern void irq14(void);
-extern void irq15(void);
+// Entry stubs for vectors 32-255, one every IRQ_STUB_SIZE bytes
+extern char irq_entry_stubs[];
 
-// General-purpose interrupt (48-255)
-extern void int_dispatch(void);
+#define IRQ_STUB_SIZE   16
 
 /**
  * @brief Set an entry in the IDT
@@ -142,15 +161,17 @@ extern void int_dispatch(void);
  * @param base Handler address
  * @param selector Code segment selector
  * @param flags Entry flags
+ * @param ist Interrupt Stack Table slot to switch to, or 0 to stay on
+ *            the current stack
  */
-static void idt_set_gate(uint8_t num, uint64_t base, uint16_t selector, uint8_t flags) {
+static void idt_set_gate(uint8_t num, uint64_t base, uint16_t selector, uint8_t flags, uint8_t ist) {
     idt[num].offset_low = (uint16_t)(base & 0xFFFF);
     idt[num].offset_mid = (uint16_t)((base >> 16) & 0xFFFF);
     idt[num].offset_high = (uint32_t)((base >> 32) & 0xFFFFFFFF);
     idt[num].selector = selector;
     idt[num].reserved = 0;
     idt[num].type_attr = flags;
-    idt[num].ist = 0;
+    idt[num].ist = ist;
 }
 
 /**
@@ -163,65 +184,51 @@ void idt_init(void) {
     
     // Clear the IDT and handler table
     memset(&idt, 0, sizeof(idt));
-    memset(&interrupt_handlers, 0, sizeof(interrupt_handlers));
+    memset(&irq_actions, 0, sizeof(irq_actions));
     
     // Set up exception handlers (0-31)
-    idt_set_gate(0, (uint64_t)isr0, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(1, (uint64_t)isr1, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(2, (uint64_t)isr2, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(3, (uint64_t)isr3, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(4, (uint64_t)isr4, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(5, (uint64_t)isr5, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(6, (uint64_t)isr6, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(7, (uint64_t)isr7, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(8, (uint64_t)isr8, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(9, (uint64_t)isr9, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(10, (uint64_t)isr10, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(11, (uint64_t)isr11, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(12, (uint64_t)isr12, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(13, (uint64_t)isr13, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(14, (uint64_t)isr14, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(15, (uint64_t)isr15, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(16, (uint64_t)isr16, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(17, (uint64_t)isr17, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(18, (uint64_t)isr18, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(19, (uint64_t)isr19, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(20, (uint64_t)isr20, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(21, (uint64_t)isr21, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(22, (uint64_t)isr22, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(23, (uint64_t)isr23, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(24, (uint64_t)isr24, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(25, (uint64_t)isr25, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(26, (uint64_t)isr26, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(27, (uint64_t)isr27, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(28, (uint64_t)isr28, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(29, (uint64_t)isr29, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(30, (uint64_t)isr30, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(31, (uint64_t)isr31, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
+    idt_set_gate(0, (uint64_t)isr0, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(1, (uint64_t)isr1, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(2, (uint64_t)isr2, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, IST_NMI);
+    idt_set_gate(3, (uint64_t)isr3, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(4, (uint64_t)isr4, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(5, (uint64_t)isr5, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(6, (uint64_t)isr6, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(7, (uint64_t)isr7, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(8, (uint64_t)isr8, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, IST_DOUBLE_FAULT);
+    idt_set_gate(9, (uint64_t)isr9, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(10, (uint64_t)isr10, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(11, (uint64_t)isr11, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(12, (uint64_t)isr12, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(13, (uint64_t)isr13, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(14, (uint64_t)isr14, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(15, (uint64_t)isr15, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(16, (uint64_t)isr16, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(17, (uint64_t)isr17, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(18, (uint64_t)isr18, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, IST_MACHINE_CHECK);
+    idt_set_gate(19, (uint64_t)isr19, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(20, (uint64_t)isr20, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(21, (uint64_t)isr21, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(22, (uint64_t)isr22, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(23, (uint64_t)isr23, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(24, (uint64_t)isr24, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(25, (uint64_t)isr25, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(26, (uint64_t)isr26, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(27, (uint64_t)isr27, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(28, (uint64_t)isr28, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(29, (uint64_t)isr29, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(30, (uint64_t)isr30, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
+    idt_set_gate(31, (uint64_t)isr31, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
     
-    // Set up IRQ handlers (32-47)
-    idt_set_gate(32, (uint64_t)irq0, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(33, (uint64_t)irq1, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(34, (uint64_t)irq2, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(35, (uint64_t)irq3, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(36, (uint64_t)irq4, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(37, (uint64_t)irq5, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(38, (uint64_t)irq6, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(39, (uint64_t)irq7, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(40, (uint64_t)irq8, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(41, (uint64_t)irq9, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(42, (uint64_t)irq10, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(43, (uint64_t)irq11, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(44, (uint64_t)irq12, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(45, (uint64_t)irq13, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(46, (uint64_t)irq14, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    idt_set_gate(47, (uint64_t)irq15, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
-    
-    // Set up general-purpose interrupt handlers (48-255)
-    for (int i = 48; i < 256; i++) {
-        idt_set_gate(i, (uint64_t)int_dispatch, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE);
+    // Set up hardware and software interrupts (32-255)
+    for (int i = 32; i < IDT_ENTRIES; i++) {
+        uint64_t stub = (uint64_t)irq_entry_stubs + (uint64_t)(i - 32) * IRQ_STUB_SIZE;
+        idt_set_gate(i, stub, 0x08, IDT_PRESENT | IDT_DPL_0 | IDT_INT_GATE, 0);
     }
     
+    // IRQ stack of the boot CPU
+    this_cpu_write(irq_stack_top, (uintptr_t)irq_stacks[smp_processor_id()] + IRQ_STACK_SIZE);
+    
     // Load the IDT (implemented in assembly)
     idt_flush((uint64_t)&idt_ptr);
     
@@ -229,31 +236,112 @@ void idt_init(void) {
 }
 
 /**
- * @brief Register an interrupt handler
+ * @brief Take an action from the pool
  * 
- * @param interrupt Interrupt number
+ * @return Free action, or NULL if the pool is exhausted
+ */
+static irq_action_t* irq_action_alloc(void) {
+    for (size_t i = 0; i < IRQ_MAX_ACTIONS; i++) {
+        if (irq_action_pool[i].handler == NULL) {
+            return &irq_action_pool[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Attach a handler to an interrupt vector
+ * 
+ * A vector takes several handlers only if all of them pass IRQF_SHARED.
+ * Shared handlers are called in registration order and must return
+ * IRQ_NONE when their device did not raise the interrupt.
+ * 
+ * @param vector Interrupt vector (32-255)
  * @param handler Handler function
+ * @param flags IRQF_* flags
+ * @param name Owner, for diagnostics
+ * @param cookie Passed to the handler, and identifies it to free_irq()
+ * @return 0 on success, -1 on error
  */
-void register_interrupt_handler(uint8_t interrupt, interrupt_handler_t handler) {
-    interrupt_handlers[interrupt] = handler;
+int request_irq(uint8_t vector, irq_handler_t handler, uint32_t flags, const char* name, void* cookie) {
+    if (vector < 32 || handler == NULL) {
+        return -1;
+    }
+    
+    uint64_t irq_flags = spin_lock_irqsave(&irq_desc_lock);
+    
+    irq_action_t* head = irq_actions[vector];
+    if (head != NULL && !((head->flags & flags) & IRQF_SHARED)) {
+        spin_unlock_irqrestore(&irq_desc_lock, irq_flags);
+        kprintf("IRQ: vector %u busy (%s), cannot add %s\n", vector, head->name, name);
+        return -1;
+    }
+    
+    irq_action_t* action = irq_action_alloc();
+    if (action == NULL) {
+        spin_unlock_irqrestore(&irq_desc_lock, irq_flags);
+        kprintf("IRQ: out of actions for %s\n", name);
+        return -1;
+    }
+    
+    action->cookie = cookie;
+    action->name = name;
+    action->flags = flags;
+    action->next = NULL;
+    action->handler = handler;
+    
+    // Link at the tail; the action is complete before it becomes visible
+    irq_action_t** link = &irq_actions[vector];
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+    __atomic_store_n(link, action, __ATOMIC_RELEASE);
+    
+    spin_unlock_irqrestore(&irq_desc_lock, irq_flags);
+    return 0;
 }
 
 /**
- * @brief Default interrupt handler if no specific handler is registered
+ * @brief Detach a handler from an interrupt vector
  * 
- * @param regs CPU registers
+ * Interrupts are off while the chain is edited, and only this CPU takes
+ * interrupts, so the action is unused once it is unlinked.
+ * 
+ * @param vector Interrupt vector
+ * @param cookie Cookie the handler was requested with
  */
-static void default_interrupt_handler(void) {
-    // Do nothing for unhandled interrupts
+void free_irq(uint8_t vector, void* cookie) {
+    uint64_t irq_flags = spin_lock_irqsave(&irq_desc_lock);
+    
+    for (irq_action_t** link = &irq_actions[vector]; *link != NULL; link = &(*link)->next) {
+        irq_action_t* action = *link;
+        if (action->cookie == cookie) {
+            __atomic_store_n(link, action->next, __ATOMIC_RELEASE);
+            action->handler = NULL;
+            break;
+        }
+    }
+    
+    spin_unlock_irqrestore(&irq_desc_lock, irq_flags);
 }
 
 /**
  * @brief Exception handler
  * 
  * @param regs CPU registers
+ * @return Address to resume at instead of rip, or 0 to return to rip
  */
-void exception_handler(uint64_t rip, uint64_t cs, uint64_t rflags, uint64_t rsp, uint64_t ss, 
-                      uint64_t int_no, uint64_t error_code) {
+uint64_t exception_handler(uint64_t rip, uint64_t cs, uint64_t rflags, uint64_t rsp, uint64_t ss, 
+                           uint64_t int_no, uint64_t error_code) {
+    // A breakpoint over code being patched; checked before anything
+    // that could run into another such site
+    if (int_no == 3) {
+        uint64_t resume = text_poke_int3_handler(rip);
+        if (resume != 0) {
+            return resume;
+        }
+    }
+    
     if (int_no < 32) {
         // Handle CPU exception
         char error_msg[256];
@@ -262,20 +350,71 @@ void exception_handler(uint64_t rip, uint64_t cs, uint64_t rflags, uint64_t rsp,
         
         panic(PANIC_CRITICAL, error_msg, __FILE__, __LINE__);
     }
+    
+    return 0;
 }
 
 /**
  * @brief General interrupt handler
  * 
- * @param regs CPU registers
+ * @param ctx Context saved by the entry stub
+ * @param entry_tsc TSC taken by the entry stub
  */
-void interrupt_handler(uint64_t int_no) {
-    // Call the registered handler if any
-    if (interrupt_handlers[int_no]) {
-        interrupt_handlers[int_no]();
-    } else {
-        default_interrupt_handler();
+void interrupt_handler(irq_context_t* ctx, uint64_t entry_tsc) {
+    uint8_t vector = (uint8_t)ctx->vector;
+    irq_context_t* outer = this_cpu_read(irq_regs);
+    this_cpu_write(irq_regs, ctx);
+    
+    irq_action_t* action = __atomic_load_n(&irq_actions[vector], __ATOMIC_ACQUIRE);
+    
+    // The CPU turned interrupts off on entry; iretq turns them back on
+    if (static_branch_unlikely(&irqsoff_key)) {
+        irqsoff_start(action ? (uintptr_t)action->handler : (uintptr_t)ctx->rip);
     }
+    
+    this_cpu_inc(irq_nesting);
+    kstat_inc(irq_count);
+    trace_event(TRACE_IRQ_ENTRY, vector, 0, 0);
+    
+    uint64_t start_tsc = rdtsc();
+    
+    // Offer the interrupt to every handler on the vector
+    int ret = IRQ_NONE;
+    for (; action != NULL; action = __atomic_load_n(&action->next, __ATOMIC_ACQUIRE)) {
+        ret |= action->handler(ctx, action->cookie);
+    }
+    if (ret == IRQ_NONE) {
+        kstat_inc(irq_unhandled);
+    }
+    
+    irq_stats_record(vector, entry_tsc, start_tsc, rdtsc());
+    
+    trace_event(TRACE_IRQ_EXIT, vector, 0, 0);
+    this_cpu_dec(irq_nesting);
+    
+    if (static_branch_unlikely(&irqsoff_key)) {
+        irqsoff_stop(current_ip());
+    }
+    
+    this_cpu_write(irq_regs, outer);
+}
+
+/**
+ * @brief Check whether we are running in hardware interrupt context
+ * 
+ * @return true if called from within an interrupt handler
+ */
+bool in_interrupt(void) {
+    return this_cpu_read(irq_nesting) != 0;
+}
+
+/**
+ * @brief Get the registers of the context the current interrupt interrupted
+ * 
+ * @return Saved context, or NULL outside interrupt context
+ */
+irq_context_t* get_irq_regs(void) {
+    return this_cpu_read(irq_regs);
 }
 
 /**
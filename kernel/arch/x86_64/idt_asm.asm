@@ -4,6 +4,10 @@
 [GLOBAL idt_flush]
 [EXTERN interrupt_handler]
 [EXTERN exception_handler]
+[EXTERN irq_stack_top]
+
+; Size of the per-CPU IRQ stacks (IRQ_STACK_SIZE in kernel.h)
+%define IRQ_STACK_SIZE 16384
 
 ; Common ISR stub that calls C handlers
 %macro ISR_NOERRCODE 1
@@ -23,25 +27,6 @@
         jmp     isr_common  ; Jump to common handler
 %endmacro
 
-%macro IRQ 2
-    [GLOBAL irq%1]
-    irq%1:
-        cli                 ; Disable interrupts
-        push    0           ; Push dummy error code
-        push    %2          ; Push interrupt number
-        jmp     irq_common  ; Jump to common handler
-%endmacro
-
-; General purpose interrupt handler (for interrupts 48-255)
-[GLOBAL int_dispatch]
-int_dispatch:
-    cli                     ; Disable interrupts
-    push    rax             ; Save RAX
-    mov     rax, [rsp+8]    ; Get interrupt number from stack
-    push    0               ; Push dummy error code
-    push    rax             ; Push interrupt number
-    jmp     irq_common      ; Jump to common handler
-
 ; ISRs for exceptions (0-31)
 ISR_NOERRCODE 0    ; Divide by zero
 ISR_NOERRCODE 1    ; Debug
@@ -76,24 +61,6 @@ ISR_NOERRCODE 29   ; VMM communication exception
 ISR_ERRCODE   30   ; Security exception
 ISR_NOERRCODE 31   ; Reserved
 
-; ISRs for IRQs (32-47)
-IRQ 0, 32    ; Programmable Interrupt Timer
-IRQ 1, 33    ; Keyboard
-IRQ 2, 34    ; Cascade for 8259A Slave controller
-IRQ 3, 35    ; COM2
-IRQ 4, 36    ; COM1
-IRQ 5, 37    ; LPT2
-IRQ 6, 38    ; Floppy Disk
-IRQ 7, 39    ; LPT1 / Unreliable "spurious" interrupt
-IRQ 8, 40    ; CMOS Real-time clock
-IRQ 9, 41    ; Free for peripherals / legacy SCSI / NIC
-IRQ 10, 42   ; Free for peripherals / SCSI / NIC
-IRQ 11, 43   ; Free for peripherals / SCSI / NIC
-IRQ 12, 44   ; PS2 Mouse
-IRQ 13, 45   ; FPU / Coprocessor / Inter-processor
-IRQ 14, 46   ; Primary ATA channel
-IRQ 15, 47   ; Secondary ATA channel
-
 ; Common ISR handler for exceptions
 isr_common:
     ; Save all registers
@@ -123,28 +90,36 @@ isr_common:
     mov     rax, gs
     push    rax
 
-    ; Load kernel data segment
+    ; Load kernel data segment. GS is left alone: loading a selector
+    ; would clear the GS base, which points at this CPU's per-CPU area
     mov     ax, 0x10
     mov     ds, ax
     mov     es, ax
     mov     fs, ax
-    mov     gs, ax
 
     ; Call C exception handler
-    mov     rdi, [rsp + 152]   ; RIP
-    mov     rsi, [rsp + 160]   ; CS
-    mov     rdx, [rsp + 168]   ; RFLAGS
-    mov     rcx, [rsp + 176]   ; RSP
-    mov     r8, [rsp + 184]    ; SS
-    mov     r9, [rsp + 144]    ; int_no
-    mov     rax, [rsp + 136]   ; error_code
+    ; 19 saved registers (152 bytes) sit below int_no, error_code and
+    ; the CPU's frame
+    mov     rdi, [rsp + 168]   ; RIP
+    mov     rsi, [rsp + 176]   ; CS
+    mov     rdx, [rsp + 184]   ; RFLAGS
+    mov     rcx, [rsp + 192]   ; RSP
+    mov     r8, [rsp + 200]    ; SS
+    mov     r9, [rsp + 152]    ; int_no
+    mov     rax, [rsp + 160]   ; error_code
     push    rax                ; error_code as additional parameter
     call    exception_handler
     add     rsp, 8             ; Clean up error_code from stack
 
-    ; Restore segment registers
+    ; Resume elsewhere if the handler asked to (breakpoint over a site
+    ; being patched, see text_poke.c)
+    test    rax, rax
+    jz      .resume
+    mov     [rsp + 168], rax   ; RIP
+.resume:
+
+    ; Restore segment registers (the saved GS is only for the frame)
     pop     rax
-    mov     gs, ax
     pop     rax
     mov     fs, ax
     pop     rax
@@ -175,77 +150,79 @@ isr_common:
     ; Return from interrupt
     iretq
 
-; Common IRQ handler for hardware interrupts
+; Entry stubs for vectors 32-255, IRQ_STUB_SIZE (16) bytes apart so
+; idt_init() can compute their addresses. Each pushes its vector in the
+; slot where exceptions have their error code. The CPU has already
+; cleared IF on entry through an interrupt gate.
+align 16
+[GLOBAL irq_entry_stubs]
+irq_entry_stubs:
+%assign vector 32
+%rep 224
+    align 16
+    push    qword vector
+    jmp     irq_common
+%assign vector vector + 1
+%endrep
+
+; Common entry for hardware and software interrupts
+;
+; Only the registers the C handlers may clobber are saved, plus RBP so
+; the interrupted stack can be walked; the callee-saved ones are
+; preserved by interrupt_handler() itself. Segment registers are left
+; alone: the kernel runs in ring 0 with flat segments, so there is
+; nothing to reload, and GS holds the per-CPU base. The resulting
+; layout is irq_context_t.
 irq_common:
-    ; Save all registers
+    push    rbp
     push    rax
-    push    rbx
     push    rcx
     push    rdx
     push    rsi
     push    rdi
-    push    rbp
     push    r8
     push    r9
     push    r10
     push    r11
-    push    r12
-    push    r13
-    push    r14
-    push    r15
-
-    ; Save segment registers
-    mov     rax, ds
-    push    rax
-    mov     rax, es
-    push    rax
-    mov     rax, fs
-    push    rax
-    mov     rax, gs
-    push    rax
 
-    ; Load kernel data segment
-    mov     ax, 0x10
-    mov     ds, ax
-    mov     es, ax
-    mov     fs, ax
-    mov     gs, ax
-
-    ; Call C interrupt handler with interrupt number
-    mov     rdi, [rsp + 144]   ; int_no
+    ; Timestamp entry for the latency statistics
+    rdtsc
+    shl     rdx, 32
+    or      rdx, rax
+
+    mov     rdi, rsp           ; irq_context_t*
+    mov     rsi, rdx           ; entry TSC
+
+    ; Move to this CPU's IRQ stack, unless a nested interrupt is
+    ; already on it. Both its top and the context (five words from the
+    ; CPU, the vector and ten registers) are 16-byte aligned, and the
+    ; two words below keep it so for the call.
+    mov     rax, [gs:irq_stack_top]
+    mov     rcx, rax
+    sub     rcx, rsp
+    cmp     rcx, IRQ_STACK_SIZE
+    jb      .on_irq_stack
+    mov     rsp, rax
+.on_irq_stack:
+    push    rdi                ; Interrupted stack, for the way back
+    sub     rsp, 8
     call    interrupt_handler
+    mov     rsp, [rsp + 8]
 
-    ; Restore segment registers
-    pop     rax
-    mov     gs, ax
-    pop     rax
-    mov     fs, ax
-    pop     rax
-    mov     es, ax
-    pop     rax
-    mov     ds, ax
-
-    ; Restore registers
-    pop     r15
-    pop     r14
-    pop     r13
-    pop     r12
     pop     r11
     pop     r10
     pop     r9
     pop     r8
-    pop     rbp
     pop     rdi
     pop     rsi
     pop     rdx
     pop     rcx
-    pop     rbx
     pop     rax
+    pop     rbp
 
-    ; Clean up error code and interrupt number
-    add     rsp, 16
+    ; Drop the vector
+    add     rsp, 8
 
-    ; Return from interrupt
     iretq
 
 ; Function to load the IDT
@@ -4,6 +4,7 @@
  */
 
 #include "../../include/kernel.h"
+#include "../../include/initcall.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -347,8 +348,15 @@ static void kb_handle_scancode(uint8_t scancode) {
 
 /**
  * @brief Keyboard interrupt handler
+ * 
+ * @param ctx Interrupted context
+ * @param cookie Unused
+ * @return IRQ_HANDLED
  */
-static void kb_interrupt_handler(void) {
+static int kb_interrupt_handler(irq_context_t* ctx, void* cookie) {
+    (void)ctx;
+    (void)cookie;
+    
     // Read scancode from keyboard
     uint8_t scancode = inb(KB_DATA_PORT);
     
@@ -360,6 +368,8 @@ static void kb_interrupt_handler(void) {
     
     // Send EOI to PIC
     pic_send_eoi(KEYBOARD_IRQ);
+    
+    return IRQ_HANDLED;
 }
 
 /**
@@ -442,7 +452,7 @@ void kb_init(void) {
     kb_update_leds();
     
     // Register interrupt handler
-    register_interrupt_handler(KEYBOARD_IRQ + 32, kb_interrupt_handler);
+    request_irq(KEYBOARD_IRQ + 32, kb_interrupt_handler, 0, "keyboard", NULL);
     
     // Unmask the keyboard IRQ
     pic_unmask_irq(KEYBOARD_IRQ);
@@ -454,6 +464,17 @@ void kb_init(void) {
     kprintf("Keyboard: Initialized\n");
 }
 
+/**
+ * @brief Initcall: set up the PS/2 keyboard
+ * 
+ * @return 0
+ */
+static int kb_initcall(void) {
+    kb_init();
+    return 0;
+}
+INITCALL(kbd, kb_initcall, "");
+
 /**
  * @brief Get a character from the keyboard
  * 
@@ -0,0 +1,46 @@
+/**
+ * @file pat.c
+ * @brief Page attribute table setup
+ */
+
+#include "../../include/kernel.h"
+#include "../../include/memory.h"
+#include <stdint.h>
+
+#define CR0_NW              (1ULL << 29)        // Not write-through
+#define CR0_CD              (1ULL << 30)        // Cache disable
+
+// Power-on layout with entry 4 turned into write-combining
+#define PAT_LAYOUT                                                          \
+    (PAT_ENTRY(0, PAT_WB) | PAT_ENTRY(1, PAT_WT) |                          \
+     PAT_ENTRY(2, PAT_UC_MINUS) | PAT_ENTRY(3, PAT_UC) |                    \
+     PAT_ENTRY(4, PAT_WC) | PAT_ENTRY(5, PAT_WT) |                          \
+     PAT_ENTRY(6, PAT_UC_MINUS) | PAT_ENTRY(7, PAT_UC))
+
+/**
+ * @brief Program the page attribute table on this CPU
+ * 
+ * Follows the SDM sequence for changing memory types: caching is
+ * disabled with CR0.CD and caches and TLB are flushed around the MSR
+ * write, so no line or translation cached under the old type survives.
+ * Every long-mode CPU has PAT.
+ */
+void pat_init(void) {
+    uint64_t flags = local_irq_save();
+    uintptr_t cr0, cr3;
+    
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %0, %%cr0" : : "r"((cr0 | CR0_CD) & ~CR0_NW) : "memory");
+    
+    wbinvd();
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+    
+    wrmsr(MSR_PAT, PAT_LAYOUT);
+    
+    wbinvd();
+    __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+    
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+    local_irq_restore(flags);
+}
@@ -0,0 +1,210 @@
+/**
+ * @file pci.c
+ * @brief PCI configuration space access
+ * 
+ * Uses configuration mechanism #1 (ports 0xCF8/0xCFC), which every PC
+ * chipset and hypervisor supports. The address/data pair is shared, so
+ * each access runs under pci_config_lock. PCI drivers depend on the
+ * "pci" initcall, which fails if the mechanism is missing.
+ */
+
+#include "../../include/kernel.h"
+#include "../../include/initcall.h"
+#include "../../include/pci.h"
+#include "../../include/spinlock.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PCI_CONFIG_ADDRESS   0xCF8
+#define PCI_CONFIG_DATA      0xCFC
+#define PCI_CONFIG_ENABLE    0x80000000u
+
+#define PCI_MAX_BUS          256
+#define PCI_MAX_DEV          32
+#define PCI_MAX_FUNC         8
+
+DEFINE_SPINLOCK(pci_config_lock);
+
+/**
+ * @brief Build the CONFIG_ADDRESS value for a register
+ * 
+ * @param addr Function to access
+ * @param offset Register offset
+ * @return Value for port 0xCF8
+ */
+static uint32_t pci_config_address(pci_addr_t addr, uint8_t offset) {
+    return PCI_CONFIG_ENABLE |
+           ((uint32_t)addr.bus << 16) |
+           ((uint32_t)(addr.dev & 0x1F) << 11) |
+           ((uint32_t)(addr.func & 0x07) << 8) |
+           (offset & 0xFC);
+}
+
+/**
+ * @brief Read a configuration dword
+ * 
+ * @param addr Function to read
+ * @param offset Register offset (dword aligned)
+ * @return Register value
+ */
+uint32_t pci_config_read32(pci_addr_t addr, uint8_t offset) {
+    uint64_t flags = spin_lock_irqsave(&pci_config_lock);
+    uint32_t value;
+    
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(addr, offset));
+    value = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_config_lock, flags);
+    
+    return value;
+}
+
+/**
+ * @brief Read a configuration word
+ * 
+ * @param addr Function to read
+ * @param offset Register offset (word aligned)
+ * @return Register value
+ */
+uint16_t pci_config_read16(pci_addr_t addr, uint8_t offset) {
+    uint64_t flags = spin_lock_irqsave(&pci_config_lock);
+    uint16_t value;
+    
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(addr, offset));
+    value = inw((uint16_t)(PCI_CONFIG_DATA + (offset & 2)));
+    spin_unlock_irqrestore(&pci_config_lock, flags);
+    
+    return value;
+}
+
+/**
+ * @brief Write a configuration dword
+ * 
+ * @param addr Function to write
+ * @param offset Register offset (dword aligned)
+ * @param value Value to write
+ */
+void pci_config_write32(pci_addr_t addr, uint8_t offset, uint32_t value) {
+    uint64_t flags = spin_lock_irqsave(&pci_config_lock);
+    
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(addr, offset));
+    outl(PCI_CONFIG_DATA, value);
+    spin_unlock_irqrestore(&pci_config_lock, flags);
+}
+
+/**
+ * @brief Write a configuration word
+ * 
+ * @param addr Function to write
+ * @param offset Register offset (word aligned)
+ * @param value Value to write
+ */
+void pci_config_write16(pci_addr_t addr, uint8_t offset, uint16_t value) {
+    uint64_t flags = spin_lock_irqsave(&pci_config_lock);
+    
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(addr, offset));
+    outw((uint16_t)(PCI_CONFIG_DATA + (offset & 2)), value);
+    spin_unlock_irqrestore(&pci_config_lock, flags);
+}
+
+/**
+ * @brief Find the first function with a vendor and device ID
+ * 
+ * Scans every bus. Functions 1-7 are only probed on multi-function
+ * devices, since single-function devices may alias function 0 there.
+ * 
+ * @param vendor Vendor ID
+ * @param device Device ID
+ * @param addr Receives the function's address
+ * @return true if found
+ */
+bool pci_find_device(uint16_t vendor, uint16_t device, pci_addr_t* addr) {
+    for (int bus = 0; bus < PCI_MAX_BUS; bus++) {
+        for (int dev = 0; dev < PCI_MAX_DEV; dev++) {
+            pci_addr_t fn0 = { (uint8_t)bus, (uint8_t)dev, 0 };
+            if (pci_config_read16(fn0, PCI_VENDOR_ID) == PCI_VENDOR_NONE) {
+                continue;
+            }
+            
+            bool multifunc = (pci_config_read16(fn0, PCI_HEADER_TYPE) & PCI_HEADER_MULTIFUNC) != 0;
+            int funcs = multifunc ? PCI_MAX_FUNC : 1;
+            
+            for (int func = 0; func < funcs; func++) {
+                pci_addr_t fn = { (uint8_t)bus, (uint8_t)dev, (uint8_t)func };
+                uint32_t id = pci_config_read32(fn, PCI_VENDOR_ID);
+                
+                if ((id & 0xFFFF) == vendor && (id >> 16) == device) {
+                    *addr = fn;
+                    return true;
+                }
+            }
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Turn on I/O and memory decoding and bus mastering
+ * 
+ * @param addr Function to enable
+ */
+void pci_enable_device(pci_addr_t addr) {
+    uint16_t command = pci_config_read16(addr, PCI_COMMAND);
+    command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+    pci_config_write16(addr, PCI_COMMAND, command);
+}
+
+/**
+ * @brief Get the I/O port base of an I/O BAR
+ * 
+ * @param addr Function to read
+ * @param bar BAR number (0-5)
+ * @return Port base, or 0 if the BAR is not an I/O BAR
+ */
+uint16_t pci_bar_io(pci_addr_t addr, int bar) {
+    if (bar < 0 || bar > 5) {
+        return 0;
+    }
+    
+    uint32_t value = pci_config_read32(addr, (uint8_t)(PCI_BAR0 + bar * 4));
+    if (!(value & PCI_BAR_IO)) {
+        return 0;
+    }
+    
+    return (uint16_t)(value & PCI_BAR_IO_MASK);
+}
+
+/**
+ * @brief Check that configuration mechanism #1 is present
+ * 
+ * CONFIG_ADDRESS holds what was written to it on a chipset that
+ * implements the mechanism, and floats on one that does not.
+ * 
+ * @return true if present
+ */
+static bool pci_detect(void) {
+    uint64_t flags = spin_lock_irqsave(&pci_config_lock);
+    uint32_t saved = inl(PCI_CONFIG_ADDRESS);
+    outl(PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE);
+    bool present = inl(PCI_CONFIG_ADDRESS) == PCI_CONFIG_ENABLE;
+    outl(PCI_CONFIG_ADDRESS, saved);
+    spin_unlock_irqrestore(&pci_config_lock, flags);
+    
+    return present;
+}
+
+/**
+ * @brief Initcall: check for PCI before any PCI driver probes
+ * 
+ * @return 0 on success, -1 without configuration mechanism #1
+ */
+static int pci_initcall(void) {
+    if (!pci_detect()) {
+        kprintf("pci: no configuration mechanism #1\n");
+        return -1;
+    }
+    
+    return 0;
+}
+INITCALL(pci, pci_initcall, "");
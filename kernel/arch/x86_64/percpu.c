@@ -0,0 +1,74 @@
+/**
+ * @file percpu.c
+ * @brief Per-CPU data areas
+ * 
+ * The linker reserves MAX_CPUS areas in .bss, each as large as the
+ * .percpu template rounded up to a cache line, so per-CPU data needs no
+ * allocator and no two CPUs share a line. A CPU's GS base is the offset
+ * from the template to its area. The kernel only runs in ring 0, so the
+ * base is never swapped on entry.
+ */
+
+#include "../../include/kernel.h"
+#include "../../include/percpu.h"
+#include <stdint.h>
+#include <stddef.h>
+
+DEFINE_PER_CPU(unsigned int, cpu_number);
+DEFINE_PER_CPU(uintptr_t, this_cpu_off);
+
+uintptr_t per_cpu_offset[MAX_CPUS];
+
+// Template and areas, from linker.ld
+extern char __start_percpu[];
+extern char __stop_percpu[];
+extern char __percpu_areas[];
+extern char __percpu_areas_end[];
+
+/**
+ * @brief Get the size of one per-CPU area
+ * 
+ * @return Template size rounded up to a cache line
+ */
+static size_t percpu_area_size(void) {
+    return ALIGN_UP((size_t)(__stop_percpu - __start_percpu), 64);
+}
+
+/**
+ * @brief Instantiate a CPU's per-CPU area
+ * 
+ * @param cpu CPU number below MAX_CPUS
+ */
+void percpu_setup_cpu(unsigned int cpu) {
+    char* area = __percpu_areas + cpu * percpu_area_size();
+    uintptr_t offset = (uintptr_t)area - (uintptr_t)__start_percpu;
+    
+    memcpy(area, __start_percpu, (size_t)(__stop_percpu - __start_percpu));
+    per_cpu_offset[cpu] = offset;
+    per_cpu(cpu_number, cpu) = cpu;
+    per_cpu(this_cpu_off, cpu) = offset;
+}
+
+/**
+ * @brief Point the running CPU's GS base at its per-CPU area
+ * 
+ * @param cpu Number of the running CPU
+ */
+void percpu_load(unsigned int cpu) {
+    wrmsr(MSR_GS_BASE, per_cpu_offset[cpu]);
+}
+
+/**
+ * @brief Set up the bootstrap processor's per-CPU area
+ */
+void percpu_init(void) {
+    // linker.ld sizes the reservation with its own copy of MAX_CPUS
+    if ((size_t)(__percpu_areas_end - __percpu_areas) < MAX_CPUS * percpu_area_size()) {
+        panic(PANIC_CRITICAL, "Per-CPU area reservation too small", __FILE__, __LINE__);
+    }
+    
+    percpu_setup_cpu(0);
+    percpu_load(0);
+    
+    kprintf("PERCPU: %llu bytes per CPU\n", (uint64_t)percpu_area_size());
+}
@@ -4,6 +4,7 @@
  */
 
 #include "../../include/kernel.h"
+#include "../../include/kstat.h"
 #include <stdint.h>
 
 // PIC controller ports
@@ -176,6 +177,15 @@ uint16_t pic_get_irq_mask(void) {
     return irq_mask;
 }
 
+/**
+ * @brief Read the IRQ mask, for the pic.irq_mask gauge
+ */
+static uint64_t pic_stat_irq_mask(void) {
+    return pic_get_irq_mask();
+}
+
+KSTAT_GAUGE(pic_irq_mask, "pic.irq_mask", pic_stat_irq_mask, "masked IRQ lines (bit n = IRQ n)");
+
 /**
  * @brief Set the IRQ mask (mask multiple IRQs at once)
  * 
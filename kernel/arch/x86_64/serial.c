@@ -1,9 +1,25 @@
 /**
  * @file serial.c
  * @brief Serial port driver
+ * 
+ * Ports run interrupt-driven once their IRQ is set up. Writers copy into
+ * a transmit ring and return; the THRE interrupt refills the whole FIFO
+ * (16 bytes, or 64 on a 16750) each time it drains. Received bytes go
+ * to a receive ring from the interrupt handler, and serial_read_char()
+ * takes them from there without touching the UART.
+ * 
+ * Both rings are single-producer, single-consumer with acquire/release
+ * indices. Writers are serialized among themselves by tx_lock, and
+ * moving bytes into the FIFO belongs to whoever holds tx_owner, the
+ * interrupt handler or a writer kicking an idle transmitter. Before
+ * interrupts are set up, and after serial_panic_flush(), writes are
+ * polled in FIFO-sized bursts.
  */
 
 #include "../../include/kernel.h"
+#include "../../include/initcall.h"
+#include "../../include/spinlock.h"
+#include "../../include/kstat.h"
 #include <stdarg.h>
 #include <stdbool.h>
 
@@ -17,6 +33,7 @@
 #define UART_DATA        0x00  // Data register (R/W)
 #define UART_INT_ENABLE  0x01  // Interrupt enable (R/W)
 #define UART_FIFO_CTRL   0x02  // FIFO control (W)
+#define UART_INT_ID      0x02  // Interrupt identification (R)
 #define UART_LINE_CTRL   0x03  // Line control (R/W)
 #define UART_MODEM_CTRL  0x04  // Modem control (R/W)
 #define UART_LINE_STATUS 0x05  // Line status (R)
@@ -35,6 +52,24 @@
 #define UART_LSR_TEMT    0x40  // Transmitter empty
 #define UART_LSR_FIFO_ERR 0x80 // FIFO error
 
+// UART interrupt enable register bits
+#define UART_IER_RDI     0x01  // Received data available
+#define UART_IER_THRI    0x02  // Transmitter holding register empty
+#define UART_IER_RLSI    0x04  // Receiver line status
+#define UART_IER_MSI     0x08  // Modem status
+
+// UART interrupt identification register bits
+#define UART_IIR_NO_INT  0x01  // No interrupt pending
+#define UART_IIR_ID_MASK 0x0E  // Interrupt source
+#define UART_IIR_MSI     0x00  // Modem status changed
+#define UART_IIR_THRI    0x02  // Transmitter holding register empty
+#define UART_IIR_RDI     0x04  // Received data available
+#define UART_IIR_RLSI    0x06  // Receiver line status
+#define UART_IIR_CTI     0x0C  // Character timeout (data left in the RX FIFO)
+#define UART_IIR_FIFO_64 0x20  // 64-byte FIFO enabled (16750)
+#define UART_IIR_FIFO_MASK 0xC0 // FIFO state
+#define UART_IIR_FIFO_OK 0xC0  // FIFO enabled and working
+
 // UART line control register bits
 #define UART_LCR_CS5     0x00  // 5 bits per char
 #define UART_LCR_CS6     0x01  // 6 bits per char
@@ -55,6 +90,7 @@
 #define UART_FCR_CLEAR_RX 0x02 // Clear receive FIFO
 #define UART_FCR_CLEAR_TX 0x04 // Clear transmit FIFO
 #define UART_FCR_DMA     0x08  // DMA mode select
+#define UART_FCR_FIFO_64 0x20  // 64-byte FIFO (16750, written with DLAB set)
 #define UART_FCR_TRIGGER_1 0x00 // Trigger level 1 (1 byte)
 #define UART_FCR_TRIGGER_4 0x40 // Trigger level 2 (4 bytes)
 #define UART_FCR_TRIGGER_8 0x80 // Trigger level 3 (8 bytes)
@@ -67,12 +103,30 @@
 #define UART_MCR_OUT2    0x08  // Auxiliary output 2 (enables UART interrupts)
 #define UART_MCR_LOOPBACK 0x10 // Loopback mode
 
+// Ring sizes (powers of 2)
+#define SERIAL_TX_RING   8192
+#define SERIAL_RX_RING   256
+#define SERIAL_TX_MASK   (SERIAL_TX_RING - 1)
+#define SERIAL_RX_MASK   (SERIAL_RX_RING - 1)
+
 // Serial port structure
 struct serial_port_t {
     uint16_t port;             // Base I/O port address
     uint32_t baud_rate;        // Current baud rate
     bool initialized;          // Whether the port is initialized
     uint8_t line_config;       // Line configuration
+    uint8_t irq;               // Legacy IRQ line
+    uint8_t fifo_size;         // Transmit FIFO depth (1, 16 or 64)
+    uint8_t ier;               // Interrupt enable register, as last written
+    volatile bool irq_driven;  // Rings in use; false for polled I/O
+    spinlock_t tx_lock;        // Serializes writers
+    volatile uint32_t tx_owner; // Held while moving bytes into the FIFO
+    volatile uint32_t tx_head; // Next byte to queue (writers)
+    volatile uint32_t tx_tail; // Next byte to send (FIFO refill)
+    volatile uint32_t rx_head; // Next byte to store (interrupt handler)
+    volatile uint32_t rx_tail; // Next byte to read (reader)
+    char* tx_buf;              // Transmit ring
+    uint8_t* rx_buf;           // Receive ring
 };
 
 // Default debug port (COM1)
@@ -80,12 +134,24 @@ serial_port_t* debug_port = NULL;
 
 // Available COM ports
 static serial_port_t com_ports[4] = {
-    { COM1_PORT, 0, false, 0 },
-    { COM2_PORT, 0, false, 0 },
-    { COM3_PORT, 0, false, 0 },
-    { COM4_PORT, 0, false, 0 }
+    { .port = COM1_PORT, .irq = 4 },
+    { .port = COM2_PORT, .irq = 3 },
+    { .port = COM3_PORT, .irq = 4 },
+    { .port = COM4_PORT, .irq = 3 }
 };
 
+// Rings, kept out of com_ports so they stay in .bss
+static char serial_tx_rings[4][SERIAL_TX_RING];
+static uint8_t serial_rx_rings[4][SERIAL_RX_RING];
+
+// IRQ lines with a handler installed
+static bool serial_irq_requested[16];
+
+LOCK_CLASS(serial_tx_lock);
+
+KSTAT_COUNTER(serial_tx_full, "serial.tx_full", "writes that waited for transmit ring space");
+KSTAT_COUNTER(serial_rx_dropped, "serial.rx_dropped", "received bytes lost to a full ring");
+
 /**
  * @brief Check if a serial port exists
  * 
@@ -132,6 +198,175 @@ static uint16_t serial_get_divisor(uint32_t baud_rate) {
     return base_clock / baud_rate;
 }
 
+/**
+ * @brief Check whether queued bytes could go out now with nobody to send them
+ * 
+ * @param port Serial port
+ * @return true if the ring is not empty and the FIFO is, or no THRE
+ *         interrupt is armed to refill it
+ */
+static bool serial_tx_pending(serial_port_t* port) {
+    if (port->tx_tail == __atomic_load_n(&port->tx_head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    
+    return (port->ier & UART_IER_THRI) == 0 ||
+           (inb(port->port + UART_LINE_STATUS) & UART_LSR_THRE) != 0;
+}
+
+/**
+ * @brief Move queued bytes into the transmit FIFO
+ * 
+ * THRE means the whole FIFO is empty, so up to fifo_size bytes go out
+ * per call. The THRE interrupt stays enabled while bytes are queued.
+ * Only the holder of tx_owner does the work; a caller that finds it
+ * taken returns. The holder looks at the ring and LSR.THRE again after
+ * letting go: a THRE interrupt that arrives while tx_owner is held is
+ * consumed by its IIR read without filling the FIFO, and would not be
+ * raised again.
+ * 
+ * @param port Serial port
+ */
+static void serial_tx_fill(serial_port_t* port) {
+    do {
+        if (__atomic_exchange_n(&port->tx_owner, 1, __ATOMIC_ACQUIRE) != 0) {
+            return;
+        }
+        
+        uint32_t tail = port->tx_tail;
+        uint32_t head = __atomic_load_n(&port->tx_head, __ATOMIC_ACQUIRE);
+        
+        if (tail != head && (inb(port->port + UART_LINE_STATUS) & UART_LSR_THRE) != 0) {
+            for (uint32_t n = 0; n < port->fifo_size && tail != head; n++, tail++) {
+                outb(port->port + UART_DATA, port->tx_buf[tail & SERIAL_TX_MASK]);
+            }
+            __atomic_store_n(&port->tx_tail, tail, __ATOMIC_RELEASE);
+        }
+        
+        uint8_t ier = (tail != head) ? (port->ier | UART_IER_THRI) : (port->ier & ~UART_IER_THRI);
+        if (ier != port->ier) {
+            port->ier = ier;
+            outb(port->port + UART_INT_ENABLE, ier);
+        }
+        
+        __atomic_store_n(&port->tx_owner, 0, __ATOMIC_RELEASE);
+    } while (serial_tx_pending(port));
+}
+
+/**
+ * @brief Move received bytes from the FIFO to the receive ring
+ * 
+ * @param port Serial port
+ */
+static void serial_rx_drain(serial_port_t* port) {
+    uint32_t head = port->rx_head;
+    
+    while ((inb(port->port + UART_LINE_STATUS) & UART_LSR_DR) != 0) {
+        uint8_t c = inb(port->port + UART_DATA);
+        if (head - __atomic_load_n(&port->rx_tail, __ATOMIC_ACQUIRE) < SERIAL_RX_RING) {
+            port->rx_buf[head & SERIAL_RX_MASK] = c;
+            head++;
+        } else {
+            kstat_inc(serial_rx_dropped);
+        }
+    }
+    
+    __atomic_store_n(&port->rx_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Interrupt handler for one legacy IRQ line
+ * 
+ * COM1/COM3 and COM2/COM4 share a line, so every port on it is asked.
+ * 
+ * @param ctx Interrupted context
+ * @param cookie IRQ line
+ * @return IRQ_HANDLED if a port had an interrupt pending
+ */
+static int serial_irq_handler(irq_context_t* ctx, void* cookie) {
+    uint8_t irq = (uint8_t)(uintptr_t)cookie;
+    int ret = IRQ_NONE;
+    (void)ctx;
+    
+    for (int i = 0; i < 4; i++) {
+        serial_port_t* port = &com_ports[i];
+        if (!port->irq_driven || port->irq != irq) {
+            continue;
+        }
+        
+        uint8_t iir;
+        while (((iir = inb(port->port + UART_INT_ID)) & UART_IIR_NO_INT) == 0) {
+            ret = IRQ_HANDLED;
+            switch (iir & UART_IIR_ID_MASK) {
+                case UART_IIR_RDI:
+                case UART_IIR_CTI:
+                    serial_rx_drain(port);
+                    break;
+                case UART_IIR_THRI:
+                    serial_tx_fill(port);
+                    break;
+                case UART_IIR_RLSI:
+                    inb(port->port + UART_LINE_STATUS);
+                    break;
+                default:
+                    inb(port->port + UART_MODEM_STATUS);
+                    break;
+            }
+        }
+    }
+    
+    pic_send_eoi(irq);
+    
+    return ret;
+}
+
+/**
+ * @brief Switch a port to interrupt-driven I/O
+ * 
+ * Leaves the port polled if its IRQ line cannot be had.
+ * 
+ * @param port Serial port
+ */
+static void serial_enable_irq(serial_port_t* port) {
+    if (!serial_irq_requested[port->irq]) {
+        if (request_irq(port->irq + 32, serial_irq_handler, IRQF_SHARED, "serial",
+                        (void*)(uintptr_t)port->irq) != 0) {
+            return;
+        }
+        serial_irq_requested[port->irq] = true;
+        pic_unmask_irq(port->irq);
+    }
+    
+    port->irq_driven = true;
+    port->ier = UART_IER_RDI | UART_IER_RLSI;
+    outb(port->port + UART_INT_ENABLE, port->ier);
+}
+
+/**
+ * @brief Enable the FIFOs and find out how deep they are
+ * 
+ * A 16750 only takes the 64-byte enable while DLAB is set. The IIR then
+ * reports whether the FIFOs work (not on an 8250/16450, or a 16550 with
+ * its FIFO bug) and whether the 64-byte mode stuck.
+ * 
+ * @param port Base port address
+ * @param line_config Line control value to leave in place
+ * @return Transmit FIFO depth
+ */
+static uint8_t serial_detect_fifo(uint16_t port, uint8_t line_config) {
+    outb(port + UART_LINE_CTRL, line_config | UART_LCR_DLAB);
+    outb(port + UART_FIFO_CTRL, UART_FCR_ENABLE | UART_FCR_CLEAR_RX | UART_FCR_CLEAR_TX |
+                                UART_FCR_FIFO_64 | UART_FCR_TRIGGER_14);
+    outb(port + UART_LINE_CTRL, line_config);
+    
+    uint8_t iir = inb(port + UART_INT_ID);
+    if ((iir & UART_IIR_FIFO_MASK) != UART_IIR_FIFO_OK) {
+        outb(port + UART_FIFO_CTRL, 0);
+        return 1;
+    }
+    return (iir & UART_IIR_FIFO_64) ? 64 : 16;
+}
+
 /**
  * @brief Initialize a serial port
  * 
@@ -176,17 +411,25 @@ serial_port_t* serial_init(uint16_t port, uint32_t baud_rate) {
     uint8_t line_config = UART_LCR_CS8 | UART_LCR_NO_PARITY | UART_LCR_STOP1;
     outb(port + UART_LINE_CTRL, line_config);
     
-    // Enable FIFO, clear them, 14-byte threshold
-    outb(port + UART_FIFO_CTRL, UART_FCR_ENABLE | UART_FCR_CLEAR_RX | UART_FCR_CLEAR_TX | UART_FCR_TRIGGER_14);
+    // Enable FIFO, clear them, 14-byte threshold (56 on a 16750)
+    uint8_t fifo_size = serial_detect_fifo(port, line_config);
     
     // IRQs enabled, RTS/DSR set, Aux output 2 (required for interrupts)
     outb(port + UART_MODEM_CTRL, UART_MCR_DTR | UART_MCR_RTS | UART_MCR_OUT2);
     
     // Update port information
+    int index = (int)(serial_port - com_ports);
+    spin_lock_init(&serial_port->tx_lock, &LOCK_CLASS_NAME(serial_tx_lock));
+    serial_port->tx_buf = serial_tx_rings[index];
+    serial_port->rx_buf = serial_rx_rings[index];
+    serial_port->fifo_size = fifo_size;
+    serial_port->ier = 0;
     serial_port->initialized = true;
     serial_port->baud_rate = baud_rate;
     serial_port->line_config = line_config;
     
+    serial_enable_irq(serial_port);
+    
     return serial_port;
 }
 
@@ -210,6 +453,17 @@ void serial_init_all(void) {
     }
 }
 
+/**
+ * @brief Initcall: probe the COM ports
+ * 
+ * @return 0 (a machine without serial ports is not an error)
+ */
+static int serial_initcall(void) {
+    serial_init_all();
+    return 0;
+}
+INITCALL(serial, serial_initcall, "");
+
 /**
  * @brief Check if a serial port is initialized
  * 
@@ -240,6 +494,73 @@ static bool serial_data_ready(serial_port_t* port) {
     return (inb(port->port + UART_LINE_STATUS) & UART_LSR_DR) != 0;
 }
 
+/**
+ * @brief Write bytes by polling, a FIFO's worth per THRE
+ * 
+ * @param port Serial port to write to
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+static void serial_write_polled(serial_port_t* port, const char* data, size_t len) {
+    uint16_t data_port = port->port + UART_DATA;
+    uint8_t burst = port->fifo_size ? port->fifo_size : 1;
+    
+    while (len > 0) {
+        // Wait for the FIFO to empty
+        while (!serial_transmitter_empty(port)) {
+            cpu_relax();
+        }
+        
+        size_t n = len < burst ? len : burst;
+        for (size_t i = 0; i < n; i++) {
+            outb(data_port, data[i]);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Queue bytes on the transmit ring
+ * 
+ * Returns as soon as the bytes are queued. When the ring is full the
+ * caller refills the FIFO itself until there is room, which also works
+ * with interrupts off.
+ * 
+ * @param port Serial port to write to
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+static void serial_write_queued(serial_port_t* port, const char* data, size_t len) {
+    while (len > 0) {
+        uint64_t flags = spin_lock_irqsave(&port->tx_lock);
+        
+        uint32_t head = port->tx_head;
+        uint32_t space = SERIAL_TX_RING - (head - __atomic_load_n(&port->tx_tail, __ATOMIC_ACQUIRE));
+        size_t n = len < space ? len : space;
+        for (size_t i = 0; i < n; i++) {
+            port->tx_buf[(head + i) & SERIAL_TX_MASK] = data[i];
+        }
+        __atomic_store_n(&port->tx_head, head + (uint32_t)n, __ATOMIC_RELEASE);
+        
+        spin_unlock_irqrestore(&port->tx_lock, flags);
+        
+        data += n;
+        len -= n;
+        
+        // Start the transmitter if it is idle
+        serial_tx_fill(port);
+        
+        if (len > 0) {
+            kstat_inc(serial_tx_full);
+            while (port->tx_head - __atomic_load_n(&port->tx_tail, __ATOMIC_ACQUIRE) == SERIAL_TX_RING) {
+                cpu_relax();
+                serial_tx_fill(port);
+            }
+        }
+    }
+}
+
 /**
  * @brief Write a byte to the serial port
  * 
@@ -248,18 +569,31 @@ static bool serial_data_ready(serial_port_t* port) {
  * @return true on success, false on failure
  */
 bool serial_write_char(serial_port_t* port, char c) {
+    return serial_write(port, &c, 1);
+}
+
+/**
+ * @brief Write a block of bytes to the serial port
+ * 
+ * Validates the port once for the whole block rather than per byte.
+ * Bytes are sent verbatim (no newline translation).
+ * 
+ * @param port Serial port to write to
+ * @param data Bytes to write
+ * @param len Number of bytes
+ * @return true on success, false on failure
+ */
+bool serial_write(serial_port_t* port, const char* data, size_t len) {
     if (!serial_is_initialized(port)) {
         return false;
     }
     
-    // Wait for transmitter to be empty
-    while (!serial_transmitter_empty(port)) {
-        // Could add a timeout here
+    if (port->irq_driven) {
+        serial_write_queued(port, data, len);
+    } else {
+        serial_write_polled(port, data, len);
     }
     
-    // Send the byte
-    outb(port->port + UART_DATA, c);
-    
     return true;
 }
 
@@ -276,19 +610,75 @@ bool serial_write_str(serial_port_t* port, const char* str) {
     }
     
     while (*str) {
-        // Handle CR+LF for newlines
-        if (*str == '\n') {
-            serial_write_char(port, '\r');
+        const char* end = str;
+        while (*end && *end != '\n') {
+            end++;
         }
+        serial_write(port, str, (size_t)(end - str));
         
-        if (!serial_write_char(port, *str++)) {
-            return false;
+        // Handle CR+LF for newlines
+        if (*end == '\n') {
+            serial_write(port, "\r\n", 2);
+            end++;
         }
+        str = end;
     }
     
     return true;
 }
 
+/**
+ * @brief Wait until everything queued on a port has been sent
+ * 
+ * @param port Serial port
+ */
+void serial_flush(serial_port_t* port) {
+    if (!serial_is_initialized(port)) {
+        return;
+    }
+    
+    while (port->tx_tail != __atomic_load_n(&port->tx_head, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+        serial_tx_fill(port);
+    }
+    while ((inb(port->port + UART_LINE_STATUS) & UART_LSR_TEMT) == 0) {
+        cpu_relax();
+    }
+}
+
+/**
+ * @brief Send everything queued and switch every port to polled output
+ * 
+ * For panic: interrupts are off for good and the context that was
+ * refilling a FIFO may never resume, so the rings are drained here
+ * and later writes go straight to the UART.
+ */
+void serial_panic_flush(void) {
+    for (int i = 0; i < 4; i++) {
+        serial_port_t* port = &com_ports[i];
+        if (!port->initialized || !port->irq_driven) {
+            continue;
+        }
+        
+        port->irq_driven = false;
+        port->ier = 0;
+        outb(port->port + UART_INT_ENABLE, 0);
+        
+        uint32_t tail = port->tx_tail;
+        uint32_t head = port->tx_head;
+        while (tail != head) {
+            char chunk[64];
+            size_t n = 0;
+            while (n < sizeof(chunk) && tail != head) {
+                chunk[n++] = port->tx_buf[tail++ & SERIAL_TX_MASK];
+            }
+            serial_write_polled(port, chunk, n);
+        }
+        port->tx_tail = tail;
+        port->tx_owner = 0;
+    }
+}
+
 /**
  * @brief Read a byte from the serial port
  * 
@@ -300,6 +690,17 @@ int serial_read_char(serial_port_t* port) {
         return -1;
     }
     
+    // Take it from the ring if the interrupt handler is filling it
+    if (port->irq_driven) {
+        uint32_t tail = port->rx_tail;
+        if (tail == __atomic_load_n(&port->rx_head, __ATOMIC_ACQUIRE)) {
+            return -1;  // No data available
+        }
+        uint8_t c = port->rx_buf[tail & SERIAL_RX_MASK];
+        __atomic_store_n(&port->rx_tail, tail + 1, __ATOMIC_RELEASE);
+        return c;
+    }
+    
     // Wait for data to be available
     if (!serial_data_ready(port)) {
         return -1;  // No data available
@@ -437,6 +838,9 @@ bool serial_configure(serial_port_t* port, uint32_t baud_rate, int data_bits, in
     // Set line config
     outb(port->port + UART_LINE_CTRL, line_config);
     
+    // Re-enable the interrupts in use
+    outb(port->port + UART_INT_ENABLE, port->ier);
+    
     // Update port information
     port->baud_rate = baud_rate;
     port->line_config = line_config;
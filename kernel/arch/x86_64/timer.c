@@ -4,6 +4,9 @@
  */
 
 #include "../../include/kernel.h"
+#include "../../include/trace.h"
+#include "../../include/profile.h"
+#include "../../include/kstat.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -17,10 +20,20 @@
 // IRQ line for the PIT
 #define PIT_IRQ         0
 
+// PC speaker / channel 2 gate control port
+#define PIT_GATE_PORT   0x61
+#define PIT_GATE_ENABLE 0x01    // Channel 2 gate input
+#define PIT_SPEAKER     0x02    // Speaker data enable
+#define PIT_OUT2_HIGH   0x20    // Channel 2 output state
+
+// TSC calibration window
+#define TSC_CALIBRATE_MS 10
+
 // Timer state
 static uint32_t timer_frequency = 0;    // Current timer frequency
 static uint64_t timer_ticks = 0;        // Number of ticks since boot
 static uint64_t last_tick_ms = 0;       // Last timer tick in milliseconds
+static uint64_t tsc_khz = 0;            // Calibrated TSC frequency in kHz
 
 // Sleep timer callback
 typedef struct {
@@ -62,10 +75,18 @@ static void set_pit_frequency(uint32_t frequency) {
 
 /**
  * @brief PIT timer interrupt handler
+ * 
+ * @param ctx Interrupted context
+ * @param cookie Unused
+ * @return IRQ_HANDLED
  */
-static void timer_handler(void) {
+static int timer_handler(irq_context_t* ctx, void* cookie) {
+    (void)cookie;
+    
     timer_ticks++;
     last_tick_ms = timer_ticks * (1000 / timer_frequency);
+    trace_event(TRACE_TIMER_TICK, timer_ticks, 0, 0);
+    profile_tick(ctx);
     
     // Check for sleep timers
     if (sleep_enabled) {
@@ -81,6 +102,8 @@ static void timer_handler(void) {
     
     // Send EOI to PIC (acknowledge interrupt)
     pic_send_eoi(PIT_IRQ);
+    
+    return IRQ_HANDLED;
 }
 
 /**
@@ -94,16 +117,83 @@ void timer_init(uint32_t frequency) {
     timer_ticks = 0;
     last_tick_ms = 0;
     
+    // Measure the TSC rate while channel 0 is still idle
+    tsc_calibrate();
+    
     // Set PIT frequency
     set_pit_frequency(frequency);
     
     // Register interrupt handler
-    register_interrupt_handler(PIT_IRQ + 32, timer_handler);
+    request_irq(PIT_IRQ + 32, timer_handler, 0, "timer", NULL);
     
     // Unmask IRQ0 (enable timer interrupts)
     pic_unmask_irq(PIT_IRQ);
     
     kprintf("Timer: Initialized at %u Hz\n", frequency);
+    kprintf("Timer: TSC running at %llu kHz\n", tsc_khz);
+}
+
+/**
+ * @brief Calibrate the TSC against PIT channel 2
+ * 
+ * Channel 2 is run as a one-shot over a fixed window with its gate
+ * controlled through port 0x61, so the measurement does not depend on
+ * timer interrupts being enabled.
+ * 
+ * @return TSC frequency in kHz
+ */
+uint64_t tsc_calibrate(void) {
+    uint16_t count = (uint16_t)(PIT_BASE_FREQ / (1000 / TSC_CALIBRATE_MS));
+    
+    // Gate low, speaker off
+    uint8_t gate = inb(PIT_GATE_PORT) & ~(PIT_SPEAKER | PIT_GATE_ENABLE);
+    outb(PIT_GATE_PORT, gate);
+    
+    // Channel 2, lobyte/hibyte access, mode 0 (interrupt on terminal count)
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+    
+    // Raise the gate to start counting
+    outb(PIT_GATE_PORT, gate | PIT_GATE_ENABLE);
+    uint64_t start = rdtsc();
+    
+    // OUT2 goes high when the count reaches zero
+    while ((inb(PIT_GATE_PORT) & PIT_OUT2_HIGH) == 0) {
+        cpu_relax();
+    }
+    
+    uint64_t end = rdtsc();
+    
+    // Drop the gate again
+    outb(PIT_GATE_PORT, gate);
+    
+    tsc_khz = (end - start) / TSC_CALIBRATE_MS;
+    return tsc_khz;
+}
+
+/**
+ * @brief Get the calibrated TSC frequency
+ * 
+ * @return TSC frequency in kHz, or 0 if not calibrated yet
+ */
+uint64_t tsc_get_khz(void) {
+    return tsc_khz;
+}
+
+/**
+ * @brief Convert a TSC cycle count to nanoseconds
+ * 
+ * @param cycles Number of TSC cycles
+ * @return Equivalent number of nanoseconds, or 0 if the TSC is not calibrated
+ */
+uint64_t tsc_to_ns(uint64_t cycles) {
+    if (tsc_khz == 0) {
+        return 0;
+    }
+    
+    // Split to avoid overflowing the intermediate product
+    return (cycles / tsc_khz) * 1000000ULL + ((cycles % tsc_khz) * 1000000ULL) / tsc_khz;
 }
 
 /**
@@ -115,6 +205,8 @@ uint64_t timer_get_ticks(void) {
     return timer_ticks;
 }
 
+KSTAT_GAUGE(timer_ticks, "timer.ticks", timer_get_ticks, "timer interrupts since boot");
+
 /**
  * @brief Get the number of milliseconds since boot
  * 
@@ -234,10 +326,7 @@ void timer_set_frequency(uint32_t frequency) {
     }
     
     // Disable interrupts temporarily
-    bool interrupts_enabled = (get_eflags() & (1 << 9)) != 0;
-    if (interrupts_enabled) {
-        disable_interrupts();
-    }
+    uint64_t irq_flags = local_irq_save();
     
     // Update frequency and reset state
     timer_frequency = frequency;
@@ -246,9 +335,7 @@ void timer_set_frequency(uint32_t frequency) {
     set_pit_frequency(frequency);
     
     // Restore interrupts if they were enabled
-    if (interrupts_enabled) {
-        enable_interrupts();
-    }
+    local_irq_restore(irq_flags);
     
     kprintf("Timer: Frequency changed to %u Hz\n", frequency);
 }
@@ -1,6 +1,11 @@
 /**
  * @file vga.c
  * @brief VGA text mode driver
+ * 
+ * Text is written into a RAM shadow of a 200-row virtual buffer, and
+ * each row written to is marked in a dirty bitmap. vga_flush() copies
+ * the dirty rows that are on screen into text memory. Scrolling moves
+ * the CRTC start address instead of copying the screen up a row.
  */
 
 #include "../../include/kernel.h"
@@ -15,19 +20,34 @@
 #define VGA_WIDTH  80
 #define VGA_HEIGHT 25
 
+// Rows of the virtual buffer the screen scrolls over (fills the 32 KiB window)
+#define VGA_VIRT_ROWS   200
+#define VGA_DIRTY_WORDS ((VGA_VIRT_ROWS + 63) / 64)
+
 // VGA controller ports
 #define VGA_CTRL_REGISTER   0x3D4
 #define VGA_DATA_REGISTER   0x3D5
+#define VGA_START_HIGH      0x0C
+#define VGA_START_LOW       0x0D
 #define VGA_CURSOR_HIGH     0x0E
 #define VGA_CURSOR_LOW      0x0F
 
 // Current state
-static uint16_t* vga_buffer = (uint16_t*)VGA_TEXT_BUFFER;
+static volatile uint16_t* vga_buffer = (volatile uint16_t*)VGA_TEXT_BUFFER;
 static uint8_t vga_color = 0;
 static uint8_t vga_cursor_x = 0;
 static uint8_t vga_cursor_y = 0;
 static bool vga_cursor_enabled = true;
 
+// RAM copy of the virtual buffer; text memory is only written on flush
+static uint16_t vga_shadow[VGA_VIRT_ROWS * VGA_WIDTH] ALIGN(64);
+static uint64_t vga_dirty[VGA_DIRTY_WORDS];
+
+// Virtual row shown at the top of the screen, and what the CRTC has
+static int vga_top = 0;
+static int vga_hw_top = -1;
+static int vga_hw_cursor = -1;
+
 /**
  * @brief Create a VGA color attribute
  * 
@@ -47,7 +67,93 @@ uint8_t vga_make_color(uint8_t fg, uint8_t bg) {
  * @return VGA character entry
  */
 static uint16_t vga_make_char(char c, uint8_t color) {
-    return (uint16_t)c | ((uint16_t)color << 8);
+    return (uint16_t)(uint8_t)c | ((uint16_t)color << 8);
+}
+
+/**
+ * @brief Write a CRTC register pair
+ * 
+ * @param high_reg Index of the high byte register
+ * @param value 16-bit value
+ */
+static void vga_crtc_write16(uint8_t high_reg, uint16_t value) {
+    outb(VGA_CTRL_REGISTER, high_reg);
+    outb(VGA_DATA_REGISTER, (value >> 8) & 0xFF);
+    outb(VGA_CTRL_REGISTER, high_reg + 1);
+    outb(VGA_DATA_REGISTER, value & 0xFF);
+}
+
+/**
+ * @brief Mark a virtual row as changed since the last flush
+ * 
+ * @param row Virtual row
+ */
+static inline void vga_mark_dirty(int row) {
+    vga_dirty[row / 64] |= 1ULL << (row % 64);
+}
+
+/**
+ * @brief Fill a virtual row with blanks in the current color
+ * 
+ * @param row Virtual row
+ */
+static void vga_blank_row(int row) {
+    uint16_t blank = vga_make_char(' ', vga_color);
+    uint16_t* cells = &vga_shadow[row * VGA_WIDTH];
+    
+    for (int x = 0; x < VGA_WIDTH; x++) {
+        cells[x] = blank;
+    }
+    vga_mark_dirty(row);
+}
+
+/**
+ * @brief Point the hardware cursor at the current position
+ */
+static void vga_sync_cursor(void) {
+    if (!vga_cursor_enabled) {
+        return;
+    }
+    
+    int pos = (vga_top + vga_cursor_y) * VGA_WIDTH + vga_cursor_x;
+    if (pos != vga_hw_cursor) {
+        vga_crtc_write16(VGA_CURSOR_HIGH, (uint16_t)pos);
+        vga_hw_cursor = pos;
+    }
+}
+
+/**
+ * @brief Copy changed visible rows to text memory and move the display
+ * 
+ * Rows go out as 64-bit stores, and rows that scrolled out of view
+ * before being flushed are never written at all. Text memory is updated
+ * before the start address, so the screen never shows a stale row.
+ */
+void vga_flush(void) {
+    for (int y = 0; y < VGA_HEIGHT; y++) {
+        int row = vga_top + y;
+        if (!(vga_dirty[row / 64] & (1ULL << (row % 64)))) {
+            continue;
+        }
+        
+        const uint64_t* src = (const uint64_t*)&vga_shadow[row * VGA_WIDTH];
+        volatile uint64_t* dst = (volatile uint64_t*)&vga_buffer[row * VGA_WIDTH];
+        for (int i = 0; i < VGA_WIDTH / 4; i++) {
+            dst[i] = src[i];
+        }
+    }
+    
+    // Off-screen rows are blanked again before they come into view
+    for (int i = 0; i < VGA_DIRTY_WORDS; i++) {
+        vga_dirty[i] = 0;
+    }
+    
+    if (vga_top != vga_hw_top) {
+        vga_crtc_write16(VGA_START_HIGH, (uint16_t)(vga_top * VGA_WIDTH));
+        vga_hw_top = vga_top;
+    }
+    
+    vga_sync_cursor();
 }
 
 /**
@@ -67,15 +173,7 @@ void vga_set_cursor_pos(int x, int y) {
     vga_cursor_x = x;
     vga_cursor_y = y;
     
-    // Only update hardware cursor if enabled
-    if (vga_cursor_enabled) {
-        uint16_t pos = y * VGA_WIDTH + x;
-        
-        outb(VGA_CTRL_REGISTER, VGA_CURSOR_HIGH);
-        outb(VGA_DATA_REGISTER, (pos >> 8) & 0xFF);
-        outb(VGA_CTRL_REGISTER, VGA_CURSOR_LOW);
-        outb(VGA_DATA_REGISTER, pos & 0xFF);
-    }
+    vga_sync_cursor();
 }
 
 /**
@@ -95,7 +193,8 @@ void vga_enable_cursor(bool enable) {
         outb(VGA_DATA_REGISTER, (inb(VGA_DATA_REGISTER) & 0xE0) | 15);
         
         // Update cursor position
-        vga_set_cursor_pos(vga_cursor_x, vga_cursor_y);
+        vga_hw_cursor = -1;
+        vga_sync_cursor();
     } else {
         // Disable cursor (set bit 5 of cursor start register)
         outb(VGA_CTRL_REGISTER, 0x0A);
@@ -130,35 +229,42 @@ void vga_set_color(uint8_t fg, uint8_t bg) {
  * @param color Background color for cleared screen
  */
 void vga_clear_screen(uint8_t color) {
-    uint16_t blank = vga_make_char(' ', vga_make_color(VGA_COLOR_WHITE, color));
+    uint8_t saved = vga_color;
     
+    vga_color = vga_make_color(VGA_COLOR_WHITE, color);
+    vga_top = 0;
     for (int y = 0; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            vga_buffer[y * VGA_WIDTH + x] = blank;
-        }
+        vga_blank_row(y);
     }
+    vga_color = saved;
     
-    vga_set_cursor_pos(0, 0);
+    vga_cursor_x = 0;
+    vga_cursor_y = 0;
+    vga_flush();
 }
 
 /**
  * @brief Scroll the screen up by one line
+ * 
+ * Scrolling moves the CRTC start address down one row of the virtual
+ * buffer; no text is copied. When the bottom of the virtual buffer is
+ * reached, the visible rows are moved back to its top, once every
+ * VGA_VIRT_ROWS - VGA_HEIGHT lines.
  */
 static void vga_scroll(void) {
-    // Get a blank character with current color
-    uint16_t blank = vga_make_char(' ', vga_color);
-    
-    // Move all lines up by one
-    for (int y = 0; y < VGA_HEIGHT - 1; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            vga_buffer[y * VGA_WIDTH + x] = vga_buffer[(y + 1) * VGA_WIDTH + x];
+    if (vga_top + VGA_HEIGHT < VGA_VIRT_ROWS) {
+        vga_top++;
+    } else {
+        memmove(vga_shadow, &vga_shadow[(vga_top + 1) * VGA_WIDTH],
+                (VGA_HEIGHT - 1) * VGA_WIDTH * sizeof(uint16_t));
+        vga_top = 0;
+        for (int y = 0; y < VGA_HEIGHT - 1; y++) {
+            vga_mark_dirty(y);
         }
     }
     
     // Clear the last line
-    for (int x = 0; x < VGA_WIDTH; x++) {
-        vga_buffer[(VGA_HEIGHT - 1) * VGA_WIDTH + x] = blank;
-    }
+    vga_blank_row(vga_top + VGA_HEIGHT - 1);
 }
 
 /**
@@ -176,7 +282,9 @@ static void vga_putchar_at(char c, uint8_t color, int x, int y) {
     }
     
     // Put the character
-    vga_buffer[y * VGA_WIDTH + x] = vga_make_char(c, color);
+    int row = vga_top + y;
+    vga_shadow[row * VGA_WIDTH + x] = vga_make_char(c, color);
+    vga_mark_dirty(row);
 }
 
 /**
@@ -194,11 +302,11 @@ static void vga_newline(void) {
 }
 
 /**
- * @brief Put a character at the current cursor position
+ * @brief Put a character at the current cursor position without flushing
  * 
  * @param c Character to put
  */
-void vga_putchar(char c) {
+static void vga_put_raw(char c) {
     // Handle special characters
     switch (c) {
         case '\n':  // Newline
@@ -238,9 +346,44 @@ void vga_putchar(char c) {
             }
             break;
     }
-    
-    // Update cursor position
-    vga_set_cursor_pos(vga_cursor_x, vga_cursor_y);
+}
+
+/**
+ * @brief Put a character at the current cursor position
+ * 
+ * @param c Character to put
+ */
+void vga_putchar(char c) {
+    vga_put_raw(c);
+    vga_flush();
+}
+
+/**
+ * @brief Write a block of characters into the shadow buffer
+ * 
+ * Nothing reaches the screen until vga_flush().
+ * 
+ * @param data Characters to write
+ * @param len Number of characters
+ */
+static void vga_write_deferred(const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        vga_put_raw(data[i]);
+    }
+}
+
+/**
+ * @brief Write a block of characters at the current cursor position
+ * 
+ * The block lands in the shadow buffer and is flushed once, so text
+ * memory and the CRTC are touched once per block, not per character.
+ * 
+ * @param data Characters to write
+ * @param len Number of characters
+ */
+void vga_write(const char* data, size_t len) {
+    vga_write_deferred(data, len);
+    vga_flush();
 }
 
 /**
@@ -249,13 +392,13 @@ void vga_putchar(char c) {
  * @param str String to put
  */
 void vga_print(const char* str) {
-    while (*str) {
-        vga_putchar(*str++);
-    }
+    vga_write(str, strlen(str));
 }
 
 /**
  * @brief Initialize the VGA driver
+ * 
+ * Called first thing from kernel_main() as the early console.
  */
 void vga_init(void) {
     // Set default colors (white on black)
@@ -267,7 +410,8 @@ void vga_init(void) {
     // Enable cursor
     vga_enable_cursor(true);
     
-    kprintf("VGA: Initialized text mode %dx%d\n", VGA_WIDTH, VGA_HEIGHT);
+    kprintf("VGA: Initialized text mode %dx%d, %d rows of scrollback memory\n",
+            VGA_WIDTH, VGA_HEIGHT, VGA_VIRT_ROWS);
 }
 
 /**
@@ -289,11 +433,41 @@ int vga_printf(const char* fmt, ...) {
     return ret;
 }
 
+/**
+ * @brief Terminal block write implementation for kernel printf
+ * 
+ * Goes to the framebuffer console once it has taken over, and to text
+ * mode before that. The screen is updated by terminal_flush(), once per
+ * batch of log records rather than once per record.
+ * 
+ * @param data Characters to output
+ * @param len Number of characters
+ */
+void terminal_write(const char* data, size_t len) {
+    if (fbcon_is_active()) {
+        fbcon_write(data, len);
+    } else {
+        vga_write_deferred(data, len);
+    }
+}
+
+/**
+ * @brief Terminal flush implementation for kernel printf
+ */
+void terminal_flush(void) {
+    if (fbcon_is_active()) {
+        fbcon_flush();
+    } else {
+        vga_flush();
+    }
+}
+
 /**
  * @brief Terminal implementation for kernel printf
  * 
  * @param c Character to output
  */
 void terminal_putchar(char c) {
-    vga_putchar(c);
+    terminal_write(&c, 1);
+    terminal_flush();
 }
@@ -0,0 +1,322 @@
+/**
+ * @file virtio_console.c
+ * @brief virtio-console output sink (legacy virtio-pci)
+ * 
+ * Bulk export channel for logs, traces and profiles under QEMU:
+ * 
+ *   -device virtio-serial-pci -device virtconsole,chardev=vc0
+ *   -chardev file,id=vc0,path=dsos.log
+ * 
+ * Output is copied into one of VIRTIO_CONS_BUFS multi-page buffers. A
+ * buffer is handed to the transmit queue when it fills or the sink is
+ * flushed, which costs one notify for up to VIRTIO_CONS_BUF_SIZE bytes,
+ * and the device moves it to the chardev without further guest work.
+ * Completed buffers are reclaimed by polling the used ring; the device's
+ * interrupt stays suppressed.
+ * 
+ * Only the legacy I/O BAR interface is driven, and only port 0's
+ * transmit queue: no features are negotiated and nothing is received.
+ * Writers are serialized by the kernel log drain (or run synchronously
+ * before it is up and after a panic), so the driver takes no lock.
+ */
+
+#include "../../include/kernel.h"
+#include "../../include/initcall.h"
+#include "../../include/memory.h"
+#include "../../include/kstat.h"
+#include "../../include/pci.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define VIRTIO_PCI_VENDOR          0x1AF4
+#define VIRTIO_PCI_DEVICE_CONSOLE  0x1003       // Transitional console device
+
+// Legacy virtio-pci registers (offsets into I/O BAR0)
+#define VIRTIO_PCI_HOST_FEATURES   0x00
+#define VIRTIO_PCI_GUEST_FEATURES  0x04
+#define VIRTIO_PCI_QUEUE_PFN       0x08
+#define VIRTIO_PCI_QUEUE_NUM       0x0C
+#define VIRTIO_PCI_QUEUE_SEL       0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY    0x10
+#define VIRTIO_PCI_STATUS          0x12
+
+// Device status bits
+#define VIRTIO_STATUS_ACK          0x01
+#define VIRTIO_STATUS_DRIVER       0x02
+#define VIRTIO_STATUS_DRIVER_OK    0x04
+#define VIRTIO_STATUS_FAILED       0x80
+
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT 12          // Queue PFN unit
+#define VIRTIO_VRING_ALIGN         PAGE_SIZE    // Legacy used ring alignment
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+#define VIRTIO_CONS_TX_QUEUE       1            // Port 0 transmitq
+#define VIRTIO_CONS_QUEUE_MAX      256          // Largest queue the ring memory fits
+#define VIRTIO_CONS_BUFS           4            // Transmit buffers in flight
+#define VIRTIO_CONS_BUF_SIZE       (4 * PAGE_SIZE)
+#define VIRTIO_CONS_WAIT_MS        100          // Give up on a stuck buffer after this
+
+// Ring memory for VIRTIO_CONS_QUEUE_MAX entries: descriptors and avail
+// ring in the first two pages, the used ring page aligned after them
+#define VIRTIO_CONS_RING_SIZE      (3 * PAGE_SIZE)
+
+/**
+ * @brief Split virtqueue layout
+ */
+typedef struct PACKED {
+    uint64_t addr;                      // Guest physical address
+    uint32_t len;                       // Length in bytes
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+typedef struct PACKED {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} vring_avail_t;
+
+typedef struct PACKED {
+    uint32_t id;                        // Head descriptor of the chain
+    uint32_t len;
+} vring_used_elem_t;
+
+typedef struct PACKED {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[];
+} vring_used_t;
+
+/**
+ * @brief Driver state
+ */
+typedef struct {
+    uint16_t io;                        // I/O BAR base
+    uint16_t qsize;                     // Transmit queue entries
+    bool ready;
+    vring_desc_t* desc;
+    volatile vring_avail_t* avail;
+    volatile vring_used_t* used;
+    uint16_t avail_idx;                 // Next avail ring slot
+    uint16_t last_used;                 // Used ring entries reclaimed
+    bool busy[VIRTIO_CONS_BUFS];        // Buffer is owned by the device
+    int cur;                            // Buffer being filled
+    size_t cur_len;                     // Bytes in it
+} virtio_cons_t;
+
+static virtio_cons_t virtio_cons;
+
+static uint8_t virtio_cons_ring[VIRTIO_CONS_RING_SIZE] ALIGN(PAGE_SIZE);
+static char virtio_cons_bufs[VIRTIO_CONS_BUFS][VIRTIO_CONS_BUF_SIZE] ALIGN(PAGE_SIZE);
+
+KSTAT_COUNTER(virtio_cons_kicks, "virtio_cons.kicks", "transmit buffers handed to the device");
+KSTAT_COUNTER(virtio_cons_dropped, "virtio_cons.dropped", "bytes dropped waiting for a stuck buffer");
+
+/**
+ * @brief Physical address of kernel image memory
+ * 
+ * @param ptr Address inside the kernel image
+ * @return Physical address
+ */
+static uint64_t virtio_cons_phys(const void* ptr) {
+    return (uint64_t)(uintptr_t)ptr - KERNEL_VIRTUAL_BASE;
+}
+
+/**
+ * @brief Take back the buffers the device has finished with
+ */
+static void virtio_cons_reclaim(void) {
+    virtio_cons_t* vc = &virtio_cons;
+    uint16_t used_idx = __atomic_load_n(&vc->used->idx, __ATOMIC_ACQUIRE);
+    
+    while (vc->last_used != used_idx) {
+        uint32_t id = vc->used->ring[vc->last_used % vc->qsize].id;
+        if (id < VIRTIO_CONS_BUFS) {
+            vc->busy[id] = false;
+        }
+        vc->last_used++;
+    }
+}
+
+/**
+ * @brief Wait for the current buffer to come back from the device
+ * 
+ * @return true if it is free, false if the device stopped consuming
+ */
+static bool virtio_cons_wait_current(void) {
+    virtio_cons_t* vc = &virtio_cons;
+    
+    if (!vc->busy[vc->cur]) {
+        return true;
+    }
+    
+    uint64_t khz = tsc_get_khz();
+    uint64_t deadline = rdtsc() + (khz ? khz : 1000000) * VIRTIO_CONS_WAIT_MS;
+    
+    while (vc->busy[vc->cur]) {
+        virtio_cons_reclaim();
+        if (rdtsc() > deadline) {
+            return false;
+        }
+        cpu_relax();
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Hand the current buffer to the transmit queue
+ * 
+ * Buffer i always uses descriptor i, so only the avail ring changes.
+ */
+static void virtio_cons_submit(void) {
+    virtio_cons_t* vc = &virtio_cons;
+    
+    if (vc->cur_len == 0) {
+        return;
+    }
+    
+    vring_desc_t* desc = &vc->desc[vc->cur];
+    desc->len = (uint32_t)vc->cur_len;
+    
+    vc->avail->ring[vc->avail_idx % vc->qsize] = (uint16_t)vc->cur;
+    vc->avail_idx++;
+    __atomic_store_n(&vc->avail->idx, vc->avail_idx, __ATOMIC_RELEASE);
+    
+    // The notify write is ordered after the index store on x86
+    outw(vc->io + VIRTIO_PCI_QUEUE_NOTIFY, VIRTIO_CONS_TX_QUEUE);
+    kstat_inc(virtio_cons_kicks);
+    
+    vc->busy[vc->cur] = true;
+    vc->cur = (vc->cur + 1) % VIRTIO_CONS_BUFS;
+    vc->cur_len = 0;
+}
+
+/**
+ * @brief Write a block of text to the console
+ * 
+ * @param data Text to write
+ * @param len Number of bytes to write
+ */
+static void virtio_cons_write(const char* data, size_t len) {
+    virtio_cons_t* vc = &virtio_cons;
+    
+    if (!vc->ready) {
+        return;
+    }
+    
+    while (len > 0) {
+        if (!virtio_cons_wait_current()) {
+            kstat_add(virtio_cons_dropped, len);
+            return;
+        }
+        
+        size_t chunk = VIRTIO_CONS_BUF_SIZE - vc->cur_len;
+        if (chunk > len) {
+            chunk = len;
+        }
+        
+        memcpy(&virtio_cons_bufs[vc->cur][vc->cur_len], data, chunk);
+        vc->cur_len += chunk;
+        data += chunk;
+        len -= chunk;
+        
+        if (vc->cur_len == VIRTIO_CONS_BUF_SIZE) {
+            virtio_cons_submit();
+        }
+    }
+}
+
+/**
+ * @brief Hand a partly filled buffer to the device
+ */
+static void virtio_cons_flush(void) {
+    if (virtio_cons.ready) {
+        virtio_cons_submit();
+    }
+}
+
+static const printf_sink_t virtio_cons_sink = { virtio_cons_write, virtio_cons_flush };
+
+/**
+ * @brief Set up the transmit queue
+ * 
+ * @param vc Driver state
+ * @return 0 on success, -1 if the queue is missing or too large
+ */
+static int virtio_cons_setup_queue(virtio_cons_t* vc) {
+    outw(vc->io + VIRTIO_PCI_QUEUE_SEL, VIRTIO_CONS_TX_QUEUE);
+    
+    uint16_t qsize = inw(vc->io + VIRTIO_PCI_QUEUE_NUM);
+    if (qsize == 0 || qsize > VIRTIO_CONS_QUEUE_MAX) {
+        return -1;
+    }
+    
+    size_t avail_off = (size_t)qsize * sizeof(vring_desc_t);
+    size_t used_off = ALIGN_UP(avail_off + sizeof(vring_avail_t) + (size_t)qsize * sizeof(uint16_t) + 2,
+                               VIRTIO_VRING_ALIGN);
+    
+    memset(virtio_cons_ring, 0, sizeof(virtio_cons_ring));
+    vc->qsize = qsize;
+    vc->desc = (vring_desc_t*)virtio_cons_ring;
+    vc->avail = (volatile vring_avail_t*)(virtio_cons_ring + avail_off);
+    vc->used = (volatile vring_used_t*)(virtio_cons_ring + used_off);
+    vc->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    
+    // One fixed descriptor per buffer; only its length changes
+    for (int i = 0; i < VIRTIO_CONS_BUFS; i++) {
+        vc->desc[i].addr = virtio_cons_phys(virtio_cons_bufs[i]);
+        vc->desc[i].flags = 0;
+        vc->desc[i].next = 0;
+    }
+    
+    outl(vc->io + VIRTIO_PCI_QUEUE_PFN,
+         (uint32_t)(virtio_cons_phys(virtio_cons_ring) >> VIRTIO_PCI_QUEUE_ADDR_SHIFT));
+    return 0;
+}
+
+/**
+ * @brief Initcall: find the device and register the printf sink
+ * 
+ * @return 0 (running without virtio-console is not an error)
+ */
+static int virtio_cons_initcall(void) {
+    virtio_cons_t* vc = &virtio_cons;
+    pci_addr_t addr;
+    
+    if (!pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_CONSOLE, &addr)) {
+        return 0;
+    }
+    
+    vc->io = pci_bar_io(addr, 0);
+    if (vc->io == 0) {
+        kprintf("virtio_cons: %02x:%02x.%x has no legacy I/O BAR\n", addr.bus, addr.dev, addr.func);
+        return 0;
+    }
+    pci_enable_device(addr);
+    
+    // Reset, then walk the status handshake
+    outb(vc->io + VIRTIO_PCI_STATUS, 0);
+    outb(vc->io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK);
+    outb(vc->io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+    outl(vc->io + VIRTIO_PCI_GUEST_FEATURES, 0);
+    
+    if (virtio_cons_setup_queue(vc) != 0) {
+        outb(vc->io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        kprintf("virtio_cons: unusable transmit queue\n");
+        return 0;
+    }
+    
+    outb(vc->io + VIRTIO_PCI_STATUS,
+         VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    vc->ready = true;
+    
+    kprintf_register_sink(PRINTF_MODE_VIRTIO, &virtio_cons_sink);
+    kprintf_set_mode(kprintf_get_mode() | PRINTF_MODE_VIRTIO);
+    kprintf("virtio_cons: %02x:%02x.%x io 0x%x, %u entries, %u x %u KiB buffers\n",
+            addr.bus, addr.dev, addr.func, vc->io, vc->qsize,
+            VIRTIO_CONS_BUFS, VIRTIO_CONS_BUF_SIZE / 1024);
+    return 0;
+}
+INITCALL(virtio_cons, virtio_cons_initcall, "pci");
@@ -0,0 +1,99 @@
+/**
+ * @file alloctrace.h
+ * @brief Heap allocation trace recorder
+ */
+
+#ifndef _ALLOCTRACE_H
+#define _ALLOCTRACE_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Ring geometry
+ */
+#define ALLOCTRACE_RING_RECORDS  1024           // Records per CPU (power of 2)
+#define ALLOCTRACE_CHUNK_RECORDS 64             // Records per stream chunk
+
+/**
+ * @brief Recorded operations
+ */
+#define ALLOCTRACE_KMALLOC         0            // kmalloc or kzalloc
+#define ALLOCTRACE_KMALLOC_ALIGNED 1            // kmalloc_aligned
+#define ALLOCTRACE_KREALLOC        2            // krealloc
+#define ALLOCTRACE_KFREE           3            // kfree
+
+/**
+ * @brief Allocation trace record
+ * 
+ * Records are stored and streamed in this exact little-endian layout.
+ */
+typedef struct {
+    uint64_t tsc;                       // TSC when the call returned
+    uint64_t ptr;                       // Returned (or, for kfree, freed) pointer
+    uint64_t old_ptr;                   // krealloc: pointer passed in
+    uint64_t size;                      // Requested size
+    uint64_t site;                      // Return address of the caller
+    uint32_t align;                     // Requested alignment (0 if none)
+    uint8_t op;                         // ALLOCTRACE_* operation
+    uint8_t cpu;                        // CPU that made the call
+    uint8_t reserved[2];
+} alloctrace_record_t;
+
+// Global switch, checked inline by every heap entry point
+DECLARE_STATIC_KEY(alloctrace_key);
+
+/**
+ * @brief Record a heap call (slow path of alloctrace)
+ * 
+ * @param op ALLOCTRACE_* operation
+ * @param ptr Returned or freed pointer
+ * @param old_ptr Pointer passed to krealloc
+ * @param size Requested size
+ * @param align Requested alignment
+ * @param site Return address of the caller
+ */
+void alloctrace_record(uint8_t op, void* ptr, void* old_ptr, size_t size, size_t align, void* site);
+
+/**
+ * @brief Heap tracepoint
+ * 
+ * Must be expanded directly in the public heap function, so that the
+ * recorded call site is that function's caller.
+ */
+#define alloctrace(op, ptr, old_ptr, size, align)                           \
+    do {                                                                    \
+        if (static_branch_unlikely(&alloctrace_key))                        \
+            alloctrace_record((op), (ptr), (old_ptr), (size), (align),      \
+                              __builtin_return_address(0));                 \
+    } while (0)
+
+/**
+ * @brief Start recording heap calls
+ * 
+ * Recording can start before any serial port is up; records are kept
+ * in the rings until the first flush.
+ */
+void alloctrace_start(void);
+
+/**
+ * @brief Stop recording and write the end-of-stream trailer
+ * 
+ * @param port Serial port the stream goes to
+ */
+void alloctrace_stop(serial_port_t* port);
+
+/**
+ * @brief Stream recorded calls to a serial port
+ * 
+ * Called from the idle loop. The stream is decoded on the host by
+ * tests/host/alloc_replay.
+ * 
+ * @param port Serial port to write to
+ * @return Number of records written
+ */
+size_t alloctrace_flush(serial_port_t* port);
+
+#endif /* _ALLOCTRACE_H */
@@ -0,0 +1,65 @@
+/**
+ * @file boottime.h
+ * @brief Boot timeline profiler
+ */
+
+#ifndef _BOOTTIME_H
+#define _BOOTTIME_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Timestamp block left in low memory by stage 2
+ * 
+ * Optional: only present when dsBoot loaded the kernel.
+ */
+#define BOOT_TS_ADDR    0x0500                  // Physical address of the block
+#define BOOT_TS_MAGIC   0x54425344              // "DSBT"
+
+typedef struct {
+    uint32_t magic;                     // BOOT_TS_MAGIC if valid
+    uint32_t reserved;
+    uint64_t stage2_entry;              // TSC when stage 2 started
+    uint64_t stage2_handoff;            // TSC when stage 2 jumped to the kernel, 0 if not reached
+} PACKED boot_ts_block_t;
+
+/**
+ * @brief Maximum number of timeline entries
+ */
+#define BOOT_MARKS_MAX  32
+
+/**
+ * @brief Start the timeline
+ * 
+ * Collects the stage 2 and boot.asm timestamps. Must be the first thing
+ * kernel_main() does.
+ */
+void boot_timeline_init(void);
+
+/**
+ * @brief Record the end of a boot step
+ * 
+ * The time since the previous mark is attributed to this step.
+ * 
+ * @param name Step name (must be a string literal)
+ */
+void boot_mark(const char* name);
+
+/**
+ * @brief Write the timeline to a serial port as a single JSON line
+ * 
+ * The line starts with "BOOTTIME " so it can be picked out of a capture:
+ * 
+ *   BOOTTIME {"tsc_khz":N,"total_us":N,"steps":[{"name":"...","tsc":N,
+ *             "at_us":N,"delta_us":N},...]}
+ * 
+ * Times are relative to the earliest timestamp (stage 2 entry when
+ * available, otherwise _start). Needs the TSC to be calibrated.
+ * 
+ * @param port Serial port to write to
+ */
+void boot_timeline_report(serial_port_t* port);
+
+#endif /* _BOOTTIME_H */
@@ -0,0 +1,25 @@
+/**
+ * @file font.h
+ * @brief Built-in console font
+ */
+
+#ifndef _FONT_H
+#define _FONT_H
+
+#include <stdint.h>
+
+/**
+ * @brief Font geometry
+ */
+#define FONT_WIDTH       8
+#define FONT_HEIGHT      8
+#define FONT_FIRST       0x20                   // First character with a glyph
+#define FONT_LAST        0x7E                   // Last character with a glyph
+#define FONT_GLYPHS      (FONT_LAST - FONT_FIRST + 1)
+
+/**
+ * @brief Glyph bitmaps, one byte per row, MSB leftmost
+ */
+extern const uint8_t font8x8[FONT_GLYPHS][FONT_HEIGHT];
+
+#endif /* _FONT_H */
@@ -0,0 +1,111 @@
+/**
+ * @file ftrace.h
+ * @brief Function-entry tracer
+ */
+
+#ifndef _FTRACE_H
+#define _FTRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Ring geometry
+ */
+#define FTRACE_RING_RECORDS  2048               // Records per CPU (power of 2)
+#define FTRACE_MAX_DEPTH     64                 // Hijacked returns per CPU
+
+/**
+ * @brief Record types
+ */
+#define FTRACE_ENTRY         0                  // Function entered
+#define FTRACE_EXIT          1                  // Function returned
+
+/**
+ * @brief Function trace record
+ */
+typedef struct {
+    uint64_t tsc;                       // TSC at entry or exit
+    uint64_t func;                      // Address of the traced function
+    uint64_t data;                      // Entry: call site, exit: duration in cycles
+    uint8_t type;                       // FTRACE_ENTRY or FTRACE_EXIT
+    uint8_t depth;                      // Call depth within the traced graph
+    uint8_t cpu;                        // CPU that recorded the event
+    uint8_t reserved[5];
+} ftrace_record_t;
+
+#ifdef CONFIG_FTRACE
+
+/**
+ * @brief Validate the patch sites recorded by the compiler
+ * 
+ * All sites start out as NOPs; nothing is traced until enabled.
+ */
+void ftrace_init(void);
+
+/**
+ * @brief Enable or disable tracing of every function in an address range
+ * 
+ * A range can cover a single function or a whole module.
+ * 
+ * @param start First address of the range
+ * @param end Address one past the end of the range
+ * @param enable true to patch in the tracer call, false to restore the NOP
+ * @return Number of sites changed
+ */
+size_t ftrace_set_range(uintptr_t start, uintptr_t end, bool enable);
+
+/**
+ * @brief Enable or disable tracing of one function
+ * 
+ * @param func Function to trace
+ * @param enable true to trace, false to stop
+ * @return true if the function has a patch site
+ */
+bool ftrace_set_function(void* func, bool enable);
+
+/**
+ * @brief Enable or disable tracing of every instrumented function
+ * 
+ * @param enable true to trace, false to stop
+ */
+void ftrace_set_all(bool enable);
+
+/**
+ * @brief Get the number of patch sites in the kernel image
+ * 
+ * @return Number of instrumented functions
+ */
+size_t ftrace_site_count(void);
+
+/**
+ * @brief Discard all recorded calls
+ */
+void ftrace_reset(void);
+
+/**
+ * @brief Print the recorded call graph with durations
+ */
+void ftrace_dump(void);
+
+#else /* !CONFIG_FTRACE */
+
+// Built without instrumentation: there is nothing to patch
+static inline void ftrace_init(void) {}
+static inline size_t ftrace_set_range(uintptr_t start, uintptr_t end, bool enable) {
+    (void)start; (void)end; (void)enable;
+    return 0;
+}
+static inline bool ftrace_set_function(void* func, bool enable) {
+    (void)func; (void)enable;
+    return false;
+}
+static inline void ftrace_set_all(bool enable) { (void)enable; }
+static inline size_t ftrace_site_count(void) { return 0; }
+static inline void ftrace_reset(void) {}
+static inline void ftrace_dump(void) {}
+
+#endif /* CONFIG_FTRACE */
+
+#endif /* _FTRACE_H */
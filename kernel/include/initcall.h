@@ -0,0 +1,75 @@
+/**
+ * @file initcall.h
+ * @brief Dependency-ordered initcalls
+ */
+
+#ifndef _INITCALL_H
+#define _INITCALL_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Maximum number of registered initcalls
+ */
+#define INITCALL_MAX        64
+
+/**
+ * @brief Initcall function
+ * 
+ * @return 0 on success, negative on failure (dependents are skipped)
+ */
+typedef int (*initcall_fn_t)(void);
+
+/**
+ * @brief Initcall descriptor, placed in the .initcall section
+ */
+typedef struct {
+    const char* name;                   // Name other initcalls depend on
+    initcall_fn_t fn;                   // Function to run
+    const char* deps;                   // Space-separated names that must finish first
+} ALIGN(8) initcall_t;
+
+/**
+ * @brief Register an initcall
+ * 
+ * The initcall runs once every initcall named in deps has succeeded.
+ * Initcalls with no path between them in the dependency graph may run
+ * in any order, or at the same time.
+ * 
+ *   INITCALL(virtio_cons, virtio_cons_initcall, "pci");
+ * 
+ * @param name Identifier naming the initcall
+ * @param fn Function to run
+ * @param deps Space-separated dependency names ("" for none)
+ * 
+ * The explicit alignment stops the compiler from padding descriptors,
+ * which would break walking the section as an array.
+ */
+#define INITCALL(name, fn, deps)                                            \
+    static const initcall_t __initcall_##name USED SECTION(".initcall")     \
+        ALIGN(8) = { #name, fn, deps }
+
+/**
+ * @brief Run every registered initcall in dependency order
+ * 
+ * Initcalls are grouped into waves: each wave holds the initcalls whose
+ * dependencies all completed in earlier waves, so the members of a wave
+ * are independent of each other. An initcall that fails, names an
+ * unknown dependency or sits on a dependency cycle is reported, and its
+ * dependents are skipped.
+ * 
+ * @return Number of initcalls that failed or were skipped
+ */
+int initcall_run_all(void);
+
+/**
+ * @brief Wait until every dispatched initcall has finished
+ * 
+ * The completion barrier that must be passed before userspace starts.
+ */
+void initcall_wait_all(void);
+
+#endif /* _INITCALL_H */
@@ -0,0 +1,142 @@
+/**
+ * @file irqaffinity.h
+ * @brief Interrupt CPU affinity and balancing
+ */
+
+#ifndef _IRQAFFINITY_H
+#define _IRQAFFINITY_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Set of CPUs, one bit per CPU number
+ */
+typedef uint32_t cpumask_t;
+
+#define CPUMASK_NONE         ((cpumask_t)0)
+#define CPUMASK_ALL          ((cpumask_t)((1ULL << MAX_CPUS) - 1))
+#define cpumask_of(cpu)      ((cpumask_t)1 << (cpu))
+#define cpumask_test(mask, cpu) (((mask) >> (cpu)) & 1)
+
+/**
+ * @brief Balancer tuning
+ */
+#define IRQ_BALANCE_INTERVAL_MS  1000           // Time between balancing passes
+#define IRQ_BALANCE_MAX_MOVES    4              // Vectors moved per pass
+#define IRQ_BALANCE_MIN_CYCLES   100000         // Ignore CPUs less busy than this per pass
+
+/**
+ * @brief Retarget a vector's delivery to a CPU
+ * 
+ * Supplied by the interrupt controller that delivers the vector (IOAPIC
+ * redirection entry, MSI address). Vectors without one, like everything
+ * behind the legacy PIC, can only be delivered to the boot CPU.
+ * 
+ * @param vector Interrupt vector
+ * @param cpu Destination CPU
+ * @return 0 on success, -1 if the controller cannot deliver there
+ */
+typedef int (*irq_route_fn_t)(uint8_t vector, unsigned int cpu);
+
+/**
+ * @brief Register the controller hook for a vector
+ * 
+ * @param vector Interrupt vector
+ * @param route Retargeting function, or NULL for a fixed destination
+ */
+void irq_set_router(uint8_t vector, irq_route_fn_t route);
+
+/**
+ * @brief Restrict the CPUs a vector may be delivered to
+ * 
+ * The balancer places the vector within the mask. If the current
+ * destination falls outside it, the vector is moved right away.
+ * 
+ * @param vector Interrupt vector
+ * @param mask Allowed CPUs (CPUMASK_ALL for any)
+ * @return 0 on success, -1 if no allowed CPU is online
+ */
+int irq_set_affinity(uint8_t vector, cpumask_t mask);
+
+/**
+ * @brief Get the CPUs a vector may be delivered to
+ * 
+ * @param vector Interrupt vector
+ * @return Allowed CPUs
+ */
+cpumask_t irq_get_affinity(uint8_t vector);
+
+/**
+ * @brief Get the CPU a vector is currently delivered to
+ * 
+ * @param vector Interrupt vector
+ * @return CPU number
+ */
+unsigned int irq_effective_cpu(uint8_t vector);
+
+/**
+ * @brief Pin a vector to a CPU
+ * 
+ * For latency-sensitive devices: the vector is moved now and the
+ * balancer leaves it alone until irq_unpin().
+ * 
+ * @param vector Interrupt vector
+ * @param cpu Destination CPU
+ * @return 0 on success, -1 if the CPU is offline or unreachable
+ */
+int irq_pin(uint8_t vector, unsigned int cpu);
+
+/**
+ * @brief Hand a pinned vector back to the balancer
+ * 
+ * @param vector Interrupt vector
+ */
+void irq_unpin(uint8_t vector);
+
+/**
+ * @brief Name the CPU that consumes a vector's work
+ * 
+ * The balancer prefers that CPU while it is not overloaded, so the
+ * handler and its consumer share a cache.
+ * 
+ * @param vector Interrupt vector
+ * @param cpu Consumer CPU, or -1 for none
+ */
+void irq_set_consumer_hint(uint8_t vector, int cpu);
+
+/**
+ * @brief Mark a CPU as able to take interrupts
+ * 
+ * The boot CPU is online from the start; APs call this once their IDT
+ * and IRQ stack are set up.
+ * 
+ * @param cpu CPU number
+ */
+void irq_affinity_cpu_online(unsigned int cpu);
+
+/**
+ * @brief Run one balancing pass
+ * 
+ * Measures each vector's handler time since the last pass, then moves
+ * vectors from the busiest to the least busy CPUs.
+ * 
+ * @return Number of vectors moved
+ */
+int irq_balance(void);
+
+/**
+ * @brief Run a balancing pass if the interval has elapsed
+ * 
+ * Called from the idle loop.
+ */
+void irq_balance_poll(void);
+
+/**
+ * @brief Print every vector's affinity, destination and load
+ */
+void irq_affinity_dump(void);
+
+#endif /* _IRQAFFINITY_H */
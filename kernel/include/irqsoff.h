@@ -0,0 +1,49 @@
+/**
+ * @file irqsoff.h
+ * @brief Interrupts-off latency tracer
+ */
+
+#ifndef _IRQSOFF_H
+#define _IRQSOFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Tracer geometry
+ */
+#define IRQSOFF_HIST_BUCKETS 64                 // log2(cycles) histogram buckets
+#define IRQSOFF_MAX_DEPTH    16                 // Frames kept for the worst case
+
+/**
+ * @brief Start or stop measuring interrupts-off sections
+ * 
+ * While enabled, every cli()/sti() and local_irq_save()/local_irq_restore()
+ * transition is timestamped, as is the time spent in hardware interrupt
+ * handlers. There is no kernel preemption, so no separate
+ * preemption-off measurement exists.
+ * 
+ * @param enable true to start, false to stop
+ */
+void irqsoff_enable(bool enable);
+
+/**
+ * @brief Clear the recorded maximum and histogram
+ */
+void irqsoff_reset(void);
+
+/**
+ * @brief Get the longest interrupts-off section seen so far
+ * 
+ * @return Duration in nanoseconds
+ */
+uint64_t irqsoff_max_ns(void);
+
+/**
+ * @brief Print the worst case with its call sites and backtrace, plus
+ *        the latency histogram
+ */
+void irqsoff_dump(void);
+
+#endif /* _IRQSOFF_H */
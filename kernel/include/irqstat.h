@@ -0,0 +1,74 @@
+/**
+ * @file irqstat.h
+ * @brief Per-vector interrupt statistics
+ */
+
+#ifndef _IRQSTAT_H
+#define _IRQSTAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Statistics geometry
+ */
+#define IRQSTAT_BUCKETS      32                 // log2(cycles) histogram buckets
+#define IRQSTAT_SLOTS        32                 // Distinct vectors tracked per CPU
+
+/**
+ * @brief Statistics for one vector
+ * 
+ * Latency runs from the entry stub to the start of the handler; duration
+ * covers the handler itself. Both are in TSC cycles.
+ */
+typedef struct {
+    uint64_t count;                     // Interrupts handled
+    uint64_t first_tsc;                 // Entry TSC of the first one
+    uint64_t last_tsc;                  // Entry TSC of the latest one
+    uint64_t latency_sum;
+    uint64_t latency_max;
+    uint64_t duration_sum;
+    uint64_t duration_max;
+    uint32_t latency_hist[IRQSTAT_BUCKETS];
+    uint32_t duration_hist[IRQSTAT_BUCKETS];
+} irq_stats_t;
+
+/**
+ * @brief Account one interrupt (called by the interrupt dispatcher)
+ * 
+ * @param vector Interrupt vector
+ * @param entry_tsc TSC taken in the entry stub
+ * @param start_tsc TSC just before the handler ran
+ * @param end_tsc TSC just after the handler returned
+ */
+void irq_stats_record(uint8_t vector, uint64_t entry_tsc, uint64_t start_tsc, uint64_t end_tsc);
+
+/**
+ * @brief Get the statistics for a vector, summed over all CPUs
+ * 
+ * @param vector Interrupt vector
+ * @param stats Where to store the statistics
+ * @return true if the vector has fired since the last reset
+ */
+bool irq_stats_get(uint8_t vector, irq_stats_t* stats);
+
+/**
+ * @brief Get a vector's average rate since it first fired
+ * 
+ * @param stats Statistics from irq_stats_get()
+ * @return Interrupts per second
+ */
+uint64_t irq_stats_rate(const irq_stats_t* stats);
+
+/**
+ * @brief Clear all statistics
+ */
+void irq_stats_reset(void);
+
+/**
+ * @brief Print a summary line and histograms for every active vector
+ */
+void irq_stats_dump(void);
+
+#endif /* _IRQSTAT_H */
@@ -0,0 +1,43 @@
+/**
+ * @file kbench.h
+ * @brief In-kernel microbenchmarks
+ */
+
+#ifndef _KBENCH_H
+#define _KBENCH_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Sampling parameters
+ */
+#define KBENCH_WARMUP        16                 // Samples discarded before measuring
+#define KBENCH_SAMPLES       512                // Samples kept per benchmark
+
+/**
+ * @brief I/O port of QEMU's isa-debug-exit device
+ * 
+ * Writing to it ends a "-device isa-debug-exit,iobase=0xf4,iosize=0x04"
+ * run; on other machines the write is ignored.
+ */
+#define KBENCH_EXIT_PORT     0xF4
+
+/**
+ * @brief Run every microbenchmark and report the results
+ * 
+ * Each benchmark is sampled KBENCH_SAMPLES times with interrupts off,
+ * and the cycles per operation are reported as a single JSON line
+ * prefixed with "KBENCH ":
+ * 
+ *   KBENCH {"version":1,"tsc_khz":N,"results":[{"name":"...","ops":N,
+ *           "mean":N,"min":N,"p50":N,"p90":N,"p99":N,"max":N},...]}
+ * 
+ * scripts/kbench_compare.py compares a run against a stored baseline.
+ * 
+ * @param port Serial port to write to
+ */
+void kbench_run(serial_port_t* port);
+
+#endif /* _KBENCH_H */
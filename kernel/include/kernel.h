@@ -10,6 +10,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include "percpu.h"
+#include "static_key.h"
 
 /**
  * @brief POSIX-compatible type definitions
@@ -59,6 +61,24 @@ typedef struct {
     uint64_t cr0, cr2, cr3, cr4;
 } registers_t;
 
+/**
+ * @brief Interrupt context saved by the IRQ entry path
+ * 
+ * Matches the stack layout built by the vector stubs and irq_common in
+ * idt_asm.asm, lowest address first. Only the registers a C handler may
+ * clobber are saved, plus RBP for stack walks; the callee-saved ones
+ * still hold the interrupted context's values.
+ */
+typedef struct irq_context {
+    uint64_t r11, r10, r9, r8;
+    uint64_t rdi, rsi, rdx, rcx, rax;
+    uint64_t rbp;
+    uint64_t vector;                    // Pushed by the vector's stub
+    
+    // Pushed by the CPU
+    uint64_t rip, cs, rflags, rsp, ss;
+} irq_context_t;
+
 /**
  * @brief VGA color constants
  */
@@ -106,18 +126,88 @@ typedef struct {
 #define WEAK __attribute__((weak))
 #define ALIGN(x) __attribute__((aligned(x)))
 #define SECTION(x) __attribute__((section(x)))
+#define USED __attribute__((used))
 #define ALWAYS_INLINE __attribute__((always_inline))
+#define NOTRACE __attribute__((no_instrument_function))
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
 #define KERNEL_STACK_SIZE 16384
 
+/**
+ * @brief Interrupt stacks
+ * 
+ * Device interrupts run on a per-CPU IRQ stack, so nesting does not eat
+ * into the interrupted code's stack. NMI, double fault and machine check
+ * are switched to Interrupt Stack Table stacks by the CPU itself, which
+ * works even when the current stack is unusable.
+ */
+#define IRQ_STACK_SIZE    16384                 // Also hardcoded in idt_asm.asm
+#define IST_STACK_SIZE    8192
+#define IST_NMI           1                     // TSS IST slots (1-7, 0 = none)
+#define IST_DOUBLE_FAULT  2
+#define IST_MACHINE_CHECK 3
+#define IST_COUNT         3
+
+/**
+ * @brief CPU identification
+ * 
+ * Only the bootstrap processor runs today. The limit sizes the per-CPU
+ * arrays and areas for when APs are brought up (also hardcoded in
+ * linker.ld).
+ */
+#define MAX_CPUS 16
+
+static inline unsigned int smp_processor_id(void) {
+    return this_cpu_read(cpu_number);
+}
+
+/**
+ * @brief Interrupts-off latency tracer hooks (see irqsoff.h)
+ */
+DECLARE_STATIC_KEY(irqsoff_key);
+void irqsoff_start(uintptr_t ip);
+void irqsoff_stop(uintptr_t ip);
+
+/**
+ * @brief RFLAGS bits
+ */
+#define RFLAGS_IF 0x200                         // Interrupt enable flag
+
+/**
+ * @brief Interrupt flag instructions
+ * 
+ * KERNEL_HOSTED builds (the host test harness in tests/host) run in user
+ * mode, where cli/sti fault; there they are only compiler barriers.
+ */
+#ifdef KERNEL_HOSTED
+#define arch_cli() __asm__ volatile("" : : : "memory")
+#define arch_sti() __asm__ volatile("" : : : "memory")
+#else
+#define arch_cli() __asm__ volatile("cli" : : : "memory")
+#define arch_sti() __asm__ volatile("sti" : : : "memory")
+#endif
+
 /**
  * @brief Assembly helpers
  */
+static inline ALWAYS_INLINE uintptr_t current_ip(void) {
+    uintptr_t ip;
+    __asm__ volatile("lea 0(%%rip), %0" : "=r"(ip));
+    return ip;
+}
+
 static inline void cli(void) {
-    __asm__ volatile("cli");
+    arch_cli();
+    if (static_branch_unlikely(&irqsoff_key)) {
+        irqsoff_start(current_ip());
+    }
 }
 
 static inline void sti(void) {
-    __asm__ volatile("sti");
+    if (static_branch_unlikely(&irqsoff_key)) {
+        irqsoff_stop(current_ip());
+    }
+    arch_sti();
 }
 
 static inline void hlt(void) {
@@ -131,11 +221,11 @@ static inline void halt(void) {
 }
 
 static inline void disable_interrupts(void) {
-    __asm__ volatile("cli");
+    cli();
 }
 
 static inline void enable_interrupts(void) {
-    __asm__ volatile("sti");
+    sti();
 }
 
 static inline uint8_t inb(uint16_t port) {
@@ -197,12 +287,44 @@ static inline void wbinvd(void) {
     __asm__ volatile("wbinvd");
 }
 
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpu_relax(void) {
+    __asm__ volatile("pause" : : : "memory");
+}
+
 static inline uint64_t read_flags(void) {
     uint64_t flags;
     __asm__ volatile("pushfq; popq %0" : "=r"(flags));
     return flags;
 }
 
+/**
+ * @brief Disable interrupts, returning the previous RFLAGS
+ * 
+ * Pairs with local_irq_restore(), which only re-enables interrupts if
+ * they were enabled here. Safe to nest and to use in interrupt context,
+ * unlike a bare cli()/sti() pair.
+ */
+static inline uint64_t local_irq_save(void) {
+    uint64_t flags = read_flags();
+    arch_cli();
+    if (static_branch_unlikely(&irqsoff_key) && (flags & RFLAGS_IF)) {
+        irqsoff_start(current_ip());
+    }
+    return flags;
+}
+
+static inline void local_irq_restore(uint64_t flags) {
+    if (flags & RFLAGS_IF) {
+        sti();
+    }
+}
+
 /**
  * @brief Panic-related definitions
  */
@@ -211,10 +333,21 @@ static inline uint64_t read_flags(void) {
 #define PANIC_HOS_BREACH      2
 #define PANIC_HARDWARE_FAULT  3
 
-// Printf output modes
-#define PRINTF_MODE_CONSOLE  0   // Output to console (VGA)
-#define PRINTF_MODE_SERIAL   1   // Output to serial port
-#define PRINTF_MODE_BOTH     2   // Output to console and serial port
+// Printf output sinks, combined as a mask for kprintf_set_mode()
+#define PRINTF_MODE_CONSOLE   0x01  // Output to console (VGA)
+#define PRINTF_MODE_SERIAL    0x02  // Output to serial port
+#define PRINTF_MODE_DEBUGCON  0x04  // Output to the port 0xE9 debug console
+#define PRINTF_MODE_VIRTIO    0x08  // Output to virtio-console
+#define PRINTF_MODE_BOTH      (PRINTF_MODE_CONSOLE | PRINTF_MODE_SERIAL)
+#define PRINTF_SINK_COUNT     4
+
+/**
+ * @brief Printf output sink
+ */
+typedef struct {
+    void (*write)(const char* data, size_t len);   // Write a block of text
+    void (*flush)(void);                            // Push out buffered text (may be NULL)
+} printf_sink_t;
 
 void panic(int type, const char* msg, const char* file, int line) NORETURN;
 void kassertf(bool condition, const char* file, int line, const char* fmt, ...) NORETURN;
@@ -243,6 +376,7 @@ void* memcpy(void* dest, const void* src, size_t n);
 void* memmove(void* dest, const void* src, size_t n);
 void* memset(void* s, int c, size_t n);
 int memcmp(const void* s1, const void* s2, size_t n);
+void* memchr(const void* s, int c, size_t n);
 size_t strlen(const char* s);
 char* strcpy(char* dest, const char* src);
 char* strncpy(char* dest, const char* src, size_t n);
@@ -256,6 +390,11 @@ char* strstr(const char* haystack, const char* needle);
 char* strupr(char* s);
 char* strlwr(char* s);
 char* strdup(const char* s);
+char* strtok_r(char* str, const char* delim, char** saveptr);
+char* strtok(char* str, const char* delim);
+size_t strcspn(const char* str, const char* reject);
+size_t strspn(const char* str, const char* accept);
+char* strpbrk(const char* str, const char* accept);
 
 /**
  * @brief Console/print functions (declared in printf.h)
@@ -266,6 +405,9 @@ int snprintf(char* buffer, size_t size, const char* fmt, ...);
 int vsnprintf(char* buffer, size_t size, const char* fmt, va_list args);
 void kprintf_set_mode(int mode);
 int kprintf_get_mode(void);
+void kprintf_write_sinks(const char* data, size_t len);
+void kprintf_flush_sinks(void);
+void kprintf_register_sink(int mode, const printf_sink_t* sink);
 
 /**
  * @brief VGA console functions (declared in vga.h)
@@ -274,11 +416,23 @@ void vga_init(void);
 void vga_clear_screen(uint8_t color);
 void vga_putchar(char c);
 void vga_print(const char* str);
+void vga_write(const char* data, size_t len);
+void vga_flush(void);
 void vga_set_color(uint8_t fg, uint8_t bg);
 uint8_t vga_make_color(uint8_t fg, uint8_t bg);
 void vga_enable_cursor(bool enable);
 void vga_set_cursor_pos(int x, int y);
 
+/**
+ * @brief Framebuffer console functions (defined in fbcon.c)
+ */
+int fbcon_init(void);
+bool fbcon_is_active(void);
+void fbcon_write(const char* data, size_t len);
+void fbcon_flush(void);
+void fbcon_set_color(uint8_t fg, uint8_t bg);
+void fbcon_clear(uint32_t rgb);
+
 /**
  * @brief Serial port functions (declared in serial.h)
  */
@@ -287,8 +441,11 @@ void serial_init(void);
 void serial_init_all(void);
 bool serial_is_initialized(serial_port_t* port);
 bool serial_write_char(serial_port_t* port, char c);
+bool serial_write(serial_port_t* port, const char* data, size_t len);
 bool serial_write_str(serial_port_t* port, const char* str);
 bool serial_printf(serial_port_t* port, const char* format, ...);
+void serial_flush(serial_port_t* port);
+void serial_panic_flush(void);
 int serial_read_char(serial_port_t* port);
 bool serial_test(serial_port_t* port);
 
@@ -304,7 +461,11 @@ void pic_unmask_irq(uint8_t irq);
 void timer_init(uint32_t frequency);
 uint64_t timer_get_ticks(void);
 uint64_t timer_get_ms(void);
+uint32_t timer_get_frequency(void);
 void timer_wait_ms(uint32_t ms);
+uint64_t tsc_calibrate(void);
+uint64_t tsc_get_khz(void);
+uint64_t tsc_to_ns(uint64_t cycles);
 uint64_t read_flags(void);
 uint64_t get_eflags(void);
 void sleep_timer_init(void);
@@ -312,9 +473,21 @@ void kb_init(void);
 
 /**
  * @brief Interrupt handlers
+ * 
+ * Handlers run with interrupts disabled and return IRQ_HANDLED if their
+ * device raised the interrupt. Several handlers may share a vector when
+ * all of them pass IRQF_SHARED; each one is called in turn.
  */
-typedef void (*interrupt_handler_t)(void);
-void register_interrupt_handler(uint8_t interrupt, interrupt_handler_t handler);
+#define IRQ_NONE        0               // Not our device
+#define IRQ_HANDLED     1               // Interrupt serviced
+
+#define IRQF_SHARED     0x1             // Vector may be shared
+
+typedef int (*irq_handler_t)(irq_context_t* ctx, void* cookie);
+int request_irq(uint8_t vector, irq_handler_t handler, uint32_t flags, const char* name, void* cookie);
+void free_irq(uint8_t vector, void* cookie);
+bool in_interrupt(void);
+irq_context_t* get_irq_regs(void);
 
 /**
  * @brief Hidden OS (hOS) protection
@@ -387,6 +560,7 @@ KERNEL_API extern uint32_t terminal_column;
 /**
  * @brief Framebuffer state
  */
+KERNEL_API extern uint64_t framebuffer_phys;
 KERNEL_API extern void* framebuffer_base;
 KERNEL_API extern uint32_t framebuffer_width;
 KERNEL_API extern uint32_t framebuffer_height;
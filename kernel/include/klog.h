@@ -0,0 +1,100 @@
+/**
+ * @file klog.h
+ * @brief Kernel log ring buffer
+ */
+
+#ifndef _KLOG_H
+#define _KLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Ring geometry
+ * 
+ * Each CPU owns a ring of fixed-size records. Messages longer than one
+ * record are split over consecutive records flagged as continuations.
+ */
+#define KLOG_RECORD_SIZE    128                 // Bytes per record
+#define KLOG_RING_RECORDS   256                 // Records per CPU (power of 2)
+#define KLOG_TEXT_MAX       (KLOG_RECORD_SIZE - 24) // Text bytes per record
+
+/**
+ * @brief Record flags
+ */
+#define KLOG_FLAG_CONT      0x01                // Continues the previous record
+
+/**
+ * @brief Log record
+ * 
+ * The sequence number is cleared while a record is being written and set
+ * to its ring position + 1 on commit, so a reader can detect both
+ * uncommitted and overwritten records without taking a lock.
+ */
+typedef struct {
+    uint64_t seq;                       // Ring position + 1, 0 while being written
+    uint64_t timestamp;                 // TSC at the time of logging
+    uint16_t len;                       // Text length in bytes
+    uint8_t cpu;                        // CPU that logged the record
+    uint8_t flags;                      // KLOG_FLAG_* bits
+    uint32_t reserved;
+    char text[KLOG_TEXT_MAX];           // Message text (not terminated)
+} klog_record_t;
+
+/**
+ * @brief Initialize the kernel log
+ * 
+ * kprintf output stays synchronous until klog_start().
+ */
+void klog_init(void);
+
+/**
+ * @brief Start deferring kprintf output to the rings
+ */
+void klog_start(void);
+
+/**
+ * @brief Check whether kprintf output is being deferred to the ring
+ * 
+ * @return true if output goes to the ring, false if written synchronously
+ */
+bool klog_is_async(void);
+
+/**
+ * @brief Append text to the current CPU's ring
+ * 
+ * Safe to call from interrupt context; never blocks on an output device.
+ * 
+ * @param text Text to append
+ * @param len Length of the text in bytes
+ */
+void klog_write(const char* text, size_t len);
+
+/**
+ * @brief Drain pending records to the output sinks
+ * 
+ * Records from all CPUs are emitted in timestamp order. Returns
+ * immediately if another context is already draining.
+ * 
+ * @param max_records Maximum number of records to emit (0 for no limit)
+ * @return Number of records emitted
+ */
+size_t klog_drain(size_t max_records);
+
+/**
+ * @brief Flush everything synchronously and stop deferring output
+ * 
+ * Used on panic: ignores a drain in progress, since the interrupted
+ * context will never resume.
+ */
+void klog_panic_flush(void);
+
+/**
+ * @brief Get the number of records lost to ring overruns
+ * 
+ * @return Number of dropped records since boot
+ */
+uint64_t klog_get_dropped(void);
+
+#endif /* _KLOG_H */
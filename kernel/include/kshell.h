@@ -0,0 +1,29 @@
+/**
+ * @file kshell.h
+ * @brief Serial debug shell
+ */
+
+#ifndef _KSHELL_H
+#define _KSHELL_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Longest command line accepted
+ */
+#define KSHELL_LINE_MAX      128
+
+/**
+ * @brief Handle pending input on the debug port
+ * 
+ * Never waits for input: called from the idle loop, it consumes what
+ * the UART has buffered and runs any completed command line.
+ * 
+ * @param port Serial port the shell runs on
+ */
+void kshell_poll(serial_port_t* port);
+
+#endif /* _KSHELL_H */
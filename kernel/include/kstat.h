@@ -0,0 +1,126 @@
+/**
+ * @file kstat.h
+ * @brief Named kernel statistics
+ */
+
+#ifndef _KSTAT_H
+#define _KSTAT_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Maximum number of registered statistics
+ */
+#define KSTAT_MAX            128
+
+/**
+ * @brief Statistic types
+ */
+#define KSTAT_TYPE_COUNTER   0                  // Monotonic event count, summed over CPUs
+#define KSTAT_TYPE_GAUGE     1                  // Instantaneous value read on demand
+
+/**
+ * @brief Per-CPU storage of a counter
+ * 
+ * Each CPU only ever adds to its own cache line.
+ */
+typedef struct {
+    struct {
+        volatile uint64_t value;
+    } ALIGN(64) cpu[MAX_CPUS];
+} kstat_counter_t;
+
+/**
+ * @brief Gauge read function
+ */
+typedef uint64_t (*kstat_read_fn_t)(void);
+
+/**
+ * @brief Statistic descriptor, placed in the .kstat section
+ */
+typedef struct {
+    const char* name;                   // Dotted name, e.g. "heap.kmalloc"
+    const char* desc;                   // One-line description
+    kstat_counter_t* counter;           // KSTAT_TYPE_COUNTER storage
+    kstat_read_fn_t read;               // KSTAT_TYPE_GAUGE reader
+    uint32_t type;                      // KSTAT_TYPE_COUNTER or KSTAT_TYPE_GAUGE
+} ALIGN(8) kstat_t;
+
+/**
+ * @brief Define a counter
+ * 
+ *   KSTAT_COUNTER(heap_kmalloc, "heap.kmalloc", "kmalloc calls");
+ *   kstat_inc(heap_kmalloc);
+ * 
+ * @param id Identifier used with kstat_add() and kstat_inc()
+ * @param name Dotted name shown by the shell
+ * @param desc One-line description
+ */
+#define KSTAT_COUNTER(id, name, desc)                                       \
+    static kstat_counter_t __kstat_counter_##id;                            \
+    static const kstat_t __kstat_##id USED SECTION(".kstat") ALIGN(8) =     \
+        { name, desc, &__kstat_counter_##id, NULL, KSTAT_TYPE_COUNTER }
+
+/**
+ * @brief Define a gauge
+ * 
+ * @param id Identifier naming the gauge
+ * @param name Dotted name shown by the shell
+ * @param fn Function returning the current value
+ * @param desc One-line description
+ */
+#define KSTAT_GAUGE(id, name, fn, desc)                                     \
+    static const kstat_t __kstat_##id USED SECTION(".kstat") ALIGN(8) =     \
+        { name, desc, NULL, fn, KSTAT_TYPE_GAUGE }
+
+/**
+ * @brief Add to a counter on the current CPU
+ * 
+ * A plain add: interrupt handlers may update the same counter, so a
+ * racing update can be lost, which statistics tolerate.
+ * 
+ * @param id Counter identifier from KSTAT_COUNTER()
+ * @param n Amount to add
+ */
+#define kstat_add(id, n) \
+    (__kstat_counter_##id.cpu[smp_processor_id()].value += (n))
+
+#define kstat_inc(id) kstat_add(id, 1)
+
+/**
+ * @brief Get the number of registered statistics
+ * 
+ * @return Number of statistics
+ */
+size_t kstat_count(void);
+
+/**
+ * @brief Get a statistic by index
+ * 
+ * Indices are stable for the lifetime of the kernel image.
+ * 
+ * @param index Index below kstat_count()
+ * @return Descriptor, or NULL if out of range
+ */
+const kstat_t* kstat_get(size_t index);
+
+/**
+ * @brief Find a statistic by name
+ * 
+ * @param name Dotted name
+ * @return Descriptor, or NULL if there is none
+ */
+const kstat_t* kstat_find(const char* name);
+
+/**
+ * @brief Read a statistic's current value
+ * 
+ * @param stat Statistic to read
+ * @return Counter sum over all CPUs, or the gauge's value
+ */
+uint64_t kstat_read(const kstat_t* stat);
+
+#endif /* _KSTAT_H */
@@ -0,0 +1,71 @@
+/**
+ * @file ksyms.h
+ * @brief Embedded kernel symbol table
+ */
+
+#ifndef _KSYMS_H
+#define _KSYMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Symbol table layout
+ * 
+ * The table is generated from the first-pass kernel image by
+ * scripts/gen_ksyms.py and linked into the .ksyms section on the second
+ * pass. Entries are sorted by address and stored as 32-bit offsets from
+ * the table base; the last entry is an unnamed end-of-text sentinel.
+ */
+#define KSYMS_MAGIC 0x4d59534b                  // "KSYM"
+
+typedef struct {
+    uint32_t magic;                     // KSYMS_MAGIC
+    uint32_t count;                     // Number of entries, including the sentinel
+    uint64_t base;                      // Address all offsets are relative to
+} ksyms_header_t;
+
+typedef struct {
+    uint32_t offset;                    // Symbol address - base
+    uint32_t name;                      // Offset of the name in the string table
+} ksyms_entry_t;
+
+/**
+ * @brief Find the function containing an address
+ * 
+ * @param addr Address to look up
+ * @param offset Where to store the offset into the function (may be NULL)
+ * @return Function name, or NULL if the address is not in kernel text
+ */
+const char* ksym_lookup(uintptr_t addr, uintptr_t* offset);
+
+/**
+ * @brief Find a function by name
+ * 
+ * @param name Function name
+ * @param size Where to store the function's size in bytes (may be NULL)
+ * @return Function address, or 0 if there is no such symbol
+ */
+uintptr_t ksym_find(const char* name, size_t* size);
+
+/**
+ * @brief Format an address as "name+0xoffset"
+ * 
+ * Falls back to the raw address if it cannot be resolved.
+ * 
+ * @param buffer Output buffer
+ * @param size Size of the output buffer
+ * @param addr Address to format
+ * @return Number of characters written, excluding the terminator
+ */
+int ksym_format(char* buffer, size_t size, uintptr_t addr);
+
+/**
+ * @brief Check whether a symbol table was linked in
+ * 
+ * @return true if lookups can succeed
+ */
+bool ksym_available(void);
+
+#endif /* _KSYMS_H */
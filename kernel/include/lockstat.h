@@ -0,0 +1,148 @@
+/**
+ * @file lockstat.h
+ * @brief Lock contention statistics
+ */
+
+#ifndef _LOCKSTAT_H
+#define _LOCKSTAT_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Contention call sites tracked per class and CPU
+ */
+#define LOCKSTAT_SITES       8
+
+/**
+ * @brief A call site that had to wait for a lock
+ */
+typedef struct {
+    uint64_t site;                      // Address of the spin_lock()
+    uint64_t count;                     // Times it waited
+} lockstat_site_t;
+
+/**
+ * @brief Statistics for one lock class
+ * 
+ * Times are in TSC cycles. Wait time runs from the first failed attempt
+ * to the acquisition, hold time from the acquisition to the release.
+ */
+typedef struct {
+    uint64_t acquisitions;
+    uint64_t contentions;               // Acquisitions that had to wait
+    uint64_t wait_total;
+    uint64_t wait_max;
+    uint64_t hold_total;
+    uint64_t hold_max;
+    lockstat_site_t sites[LOCKSTAT_SITES];
+} lockstat_t;
+
+#ifdef CONFIG_LOCKSTAT
+
+/**
+ * @brief Lock class
+ * 
+ * Every CPU accounts into its own copy of the statistics, and only while
+ * it holds a lock of the class, so updates need no atomics. Classes
+ * shared by several locks can lose the odd count when two of them are
+ * held on different CPUs at once; these are statistics, not accounting.
+ */
+typedef struct lock_class {
+    const char* name;
+    struct {
+        lockstat_t stats;
+    } ALIGN(64) cpu[MAX_CPUS];
+} lock_class_t;
+
+/**
+ * @brief Define a lock class
+ * 
+ * A pointer to the class goes into the .lockclass section, so the dump
+ * finds every class without registration.
+ * 
+ * @param cname Identifier naming the class
+ */
+#define LOCK_CLASS_NAME(cname)  __lock_class_##cname
+#define LOCK_CLASS(cname)                                                   \
+    static lock_class_t LOCK_CLASS_NAME(cname) = { .name = #cname };        \
+    static lock_class_t* const __lock_class_ptr_##cname USED                \
+        SECTION(".lockclass") ALIGN(8) = &LOCK_CLASS_NAME(cname)
+
+/**
+ * @brief Account an acquisition (called with the lock held)
+ * 
+ * @param cls Class of the lock
+ * @param acquired_tsc Where the lock keeps its acquisition time
+ */
+static inline ALWAYS_INLINE void lockstat_acquired(lock_class_t* cls, uint64_t* acquired_tsc) {
+    cls->cpu[smp_processor_id()].stats.acquisitions++;
+    *acquired_tsc = rdtsc();
+}
+
+/**
+ * @brief Account a release (called with the lock still held)
+ * 
+ * @param cls Class of the lock
+ * @param acquired_tsc When the lock was taken
+ */
+static inline ALWAYS_INLINE void lockstat_released(lock_class_t* cls, uint64_t acquired_tsc) {
+    lockstat_t* stats = &cls->cpu[smp_processor_id()].stats;
+    uint64_t held = rdtsc() - acquired_tsc;
+    
+    stats->hold_total += held;
+    if (held > stats->hold_max) {
+        stats->hold_max = held;
+    }
+}
+
+/**
+ * @brief Account a wait for a contended lock (called with the lock held)
+ * 
+ * @param cls Class of the lock
+ * @param wait Cycles spent waiting
+ * @param site Address of the contended spin_lock()
+ */
+void lockstat_contended(lock_class_t* cls, uint64_t wait, uintptr_t site);
+
+/**
+ * @brief Sum a class's statistics over all CPUs
+ * 
+ * Sites are merged and sorted by count, busiest first.
+ * 
+ * @param cls Lock class
+ * @param stats Where to store the statistics
+ */
+void lockstat_get(lock_class_t* cls, lockstat_t* stats);
+
+/**
+ * @brief Clear the statistics of every lock class
+ */
+void lockstat_reset(void);
+
+/**
+ * @brief Print the statistics of every lock class that has been taken
+ */
+void lockstat_dump(void);
+
+#else /* !CONFIG_LOCKSTAT */
+
+// Without lockstat a class only carries its name
+typedef struct lock_class {
+    const char* name;
+} lock_class_t;
+
+#define LOCK_CLASS_NAME(cname)  __lock_class_##cname
+#define LOCK_CLASS(cname)                                                   \
+    static lock_class_t LOCK_CLASS_NAME(cname) __attribute__((unused)) = { #cname }
+
+static inline void lockstat_reset(void) {}
+static inline void lockstat_dump(void) {
+    kprintf("lockstat: not built in (build.sh ... lockstat)\n");
+}
+
+#endif /* CONFIG_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H */
@@ -37,8 +37,31 @@
 #define PTE_DIRTY          (1ULL << 6)          // Page has been written to
 #define PTE_LARGE          (1ULL << 7)          // Page is a large page
 #define PTE_GLOBAL         (1ULL << 8)          // Page is global (not flushed from TLB)
+#define PTE_WC             (1ULL << 9)          // Page is write-combining (PAT entry 4)
 #define PTE_NX             (1ULL << 63)         // Page is non-executable (if supported)
 
+/**
+ * @brief Page attribute table
+ * 
+ * pat_init() keeps the power-on layout except for entry 4, which becomes
+ * write-combining. Entries 0-3 are what PWT/PCD alone select, so
+ * existing mappings keep their meaning.
+ */
+#define MSR_PAT            0x277
+#define PAT_UC             0x00                 // Uncacheable
+#define PAT_WC             0x01                 // Write-combining
+#define PAT_WT             0x04                 // Write-through
+#define PAT_WP             0x05                 // Write-protected
+#define PAT_WB             0x06                 // Write-back
+#define PAT_UC_MINUS       0x07                 // Uncacheable, overridable by MTRRs
+#define PAT_ENTRY(i, type) ((uint64_t)(type) << ((i) * 8))
+
+/**
+ * @brief Virtual window for device mappings
+ */
+#define IOREMAP_BASE       0xFFFFFFFFD0000000   // ioremap()/ioremap_wc() window
+#define IOREMAP_SIZE       0x10000000           // 256 MiB
+
 /**
  * @brief Memory region types
  */
@@ -189,6 +212,43 @@ int unmap_pages(uintptr_t virt_addr, size_t count);
  */
 bool is_page_mapped(uintptr_t virt_addr);
 
+/**
+ * @brief Program the page attribute table on this CPU
+ * 
+ * Must run on every CPU before PTE_WC mappings are used there.
+ */
+void pat_init(void);
+
+/**
+ * @brief Map device memory uncached
+ * 
+ * @param phys_addr Physical address (need not be page aligned)
+ * @param size Size in bytes
+ * @return Virtual address of phys_addr, or NULL if the window is full
+ */
+void* ioremap(uintptr_t phys_addr, size_t size);
+
+/**
+ * @brief Map device memory write-combining
+ * 
+ * For framebuffers and other memory that is written in bulk and never
+ * read back: stores are merged into full-line bursts instead of going
+ * out one by one.
+ * 
+ * @param phys_addr Physical address (need not be page aligned)
+ * @param size Size in bytes
+ * @return Virtual address of phys_addr, or NULL if the window is full
+ */
+void* ioremap_wc(uintptr_t phys_addr, size_t size);
+
+/**
+ * @brief Remove a mapping made by ioremap() or ioremap_wc()
+ * 
+ * @param addr Address returned by the mapping call
+ * @param size Size passed to the mapping call
+ */
+void iounmap(void* addr, size_t size);
+
 /**
  * @brief Kernel heap functions
  */
@@ -0,0 +1,111 @@
+/**
+ * @file pci.h
+ * @brief PCI configuration space access
+ */
+
+#ifndef _PCI_H
+#define _PCI_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Configuration space header offsets
+ */
+#define PCI_VENDOR_ID        0x00
+#define PCI_DEVICE_ID        0x02
+#define PCI_COMMAND          0x04
+#define PCI_STATUS           0x06
+#define PCI_CLASS_REVISION   0x08
+#define PCI_HEADER_TYPE      0x0E
+#define PCI_BAR0             0x10
+#define PCI_SUBSYSTEM_ID     0x2E
+#define PCI_INTERRUPT_LINE   0x3C
+
+/**
+ * @brief Command register bits
+ */
+#define PCI_COMMAND_IO       0x0001             // Respond to I/O space accesses
+#define PCI_COMMAND_MEMORY   0x0002             // Respond to memory space accesses
+#define PCI_COMMAND_MASTER   0x0004             // Allow bus mastering (DMA)
+
+#define PCI_HEADER_MULTIFUNC 0x80               // Device has functions 1-7
+#define PCI_BAR_IO           0x1                // BAR maps I/O space
+#define PCI_BAR_IO_MASK      (~(uint32_t)0x3)
+
+#define PCI_VENDOR_NONE      0xFFFF             // No device at this address
+
+/**
+ * @brief Bus/device/function address of a PCI function
+ */
+typedef struct {
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+} pci_addr_t;
+
+/**
+ * @brief Read a configuration dword
+ * 
+ * @param addr Function to read
+ * @param offset Register offset (dword aligned)
+ * @return Register value
+ */
+uint32_t pci_config_read32(pci_addr_t addr, uint8_t offset);
+
+/**
+ * @brief Read a configuration word
+ * 
+ * @param addr Function to read
+ * @param offset Register offset (word aligned)
+ * @return Register value
+ */
+uint16_t pci_config_read16(pci_addr_t addr, uint8_t offset);
+
+/**
+ * @brief Write a configuration dword
+ * 
+ * @param addr Function to write
+ * @param offset Register offset (dword aligned)
+ * @param value Value to write
+ */
+void pci_config_write32(pci_addr_t addr, uint8_t offset, uint32_t value);
+
+/**
+ * @brief Write a configuration word
+ * 
+ * @param addr Function to write
+ * @param offset Register offset (word aligned)
+ * @param value Value to write
+ */
+void pci_config_write16(pci_addr_t addr, uint8_t offset, uint16_t value);
+
+/**
+ * @brief Find the first function with a vendor and device ID
+ * 
+ * @param vendor Vendor ID
+ * @param device Device ID
+ * @param addr Receives the function's address
+ * @return true if found
+ */
+bool pci_find_device(uint16_t vendor, uint16_t device, pci_addr_t* addr);
+
+/**
+ * @brief Turn on I/O and memory decoding and bus mastering
+ * 
+ * @param addr Function to enable
+ */
+void pci_enable_device(pci_addr_t addr);
+
+/**
+ * @brief Get the I/O port base of an I/O BAR
+ * 
+ * @param addr Function to read
+ * @param bar BAR number (0-5)
+ * @return Port base, or 0 if the BAR is not an I/O BAR
+ */
+uint16_t pci_bar_io(pci_addr_t addr, int bar);
+
+#endif /* _PCI_H */
@@ -0,0 +1,181 @@
+/**
+ * @file percpu.h
+ * @brief Per-CPU data areas
+ * 
+ * Per-CPU variables are defined once with DEFINE_PER_CPU() and linked
+ * into the .percpu section, which serves as a template. Every CPU gets
+ * its own copy of the section, and its GS base holds the distance from
+ * the template to that copy, so `%gs:variable` addresses the running
+ * CPU's instance and this_cpu_read() and friends compile to a single
+ * instruction.
+ * 
+ * Included by kernel.h for smp_processor_id(), so it only depends on the
+ * compiler headers.
+ */
+
+#ifndef _PERCPU_H
+#define _PERCPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief IA32_GS_BASE MSR
+ */
+#define MSR_GS_BASE 0xC0000101
+
+/**
+ * @brief Define or declare a per-CPU variable
+ * 
+ *   DEFINE_PER_CPU(uint32_t, irq_nesting);
+ *   this_cpu_inc(irq_nesting);
+ * 
+ * The variable must only be accessed through the accessors below; its
+ * own address is the template, which no CPU uses once percpu_init() has
+ * run. May be prefixed with static.
+ */
+#define DEFINE_PER_CPU(type, name) \
+    __typeof__(type) name __attribute__((section(".percpu")))
+
+#define DECLARE_PER_CPU(type, name) \
+    extern __typeof__(type) name __attribute__((section(".percpu")))
+
+// Running CPU's number and GS base, set up by percpu_setup_cpu()
+DECLARE_PER_CPU(unsigned int, cpu_number);
+DECLARE_PER_CPU(uintptr_t, this_cpu_off);
+
+// Offset from the template to each CPU's area
+extern uintptr_t per_cpu_offset[];
+
+#ifdef KERNEL_HOSTED
+
+// The host harness runs one thread on the template itself
+#define this_cpu_read(var)          (var)
+#define this_cpu_write(var, val)    ((void)((var) = (val)))
+#define this_cpu_add(var, val)      ((void)((var) += (val)))
+#define this_cpu_ptr(ptr)           (ptr)
+
+#else
+
+/**
+ * @brief Read the running CPU's instance of a per-CPU variable
+ * 
+ * The variable's link-time address is the GS-relative displacement. The
+ * "m" operand is unused by the instruction but tells the compiler which
+ * variable is read.
+ * 
+ * @param var Per-CPU variable (1, 2, 4 or 8 bytes)
+ * @return Its value on this CPU
+ */
+#define this_cpu_read(var) ({                                               \
+    __typeof__(var) __pcp_ret;                                              \
+    switch (sizeof(var)) {                                                  \
+    case 1:                                                                 \
+        __asm__ volatile("movb %%gs:%P1, %b0"                               \
+                         : "=q"(__pcp_ret) : "i"(&(var)), "m"(var));        \
+        break;                                                              \
+    case 2:                                                                 \
+        __asm__ volatile("movw %%gs:%P1, %w0"                               \
+                         : "=r"(__pcp_ret) : "i"(&(var)), "m"(var));        \
+        break;                                                              \
+    case 4:                                                                 \
+        __asm__ volatile("movl %%gs:%P1, %k0"                               \
+                         : "=r"(__pcp_ret) : "i"(&(var)), "m"(var));        \
+        break;                                                              \
+    default:                                                                \
+        __asm__ volatile("movq %%gs:%P1, %q0"                               \
+                         : "=r"(__pcp_ret) : "i"(&(var)), "m"(var));        \
+        break;                                                              \
+    }                                                                       \
+    __pcp_ret;                                                              \
+})
+
+/**
+ * @brief Apply a read-modify-write or store to the running CPU's instance
+ * 
+ * A single instruction, so it is atomic against interrupts on this CPU
+ * without disabling them.
+ */
+#define __this_cpu_op(op, var, val)                                         \
+    do {                                                                    \
+        __typeof__(var) __pcp_val = (__typeof__(var))(val);                 \
+        switch (sizeof(var)) {                                              \
+        case 1:                                                             \
+            __asm__ volatile(op "b %b1, %%gs:%P2"                           \
+                             : "+m"(var) : "qi"(__pcp_val), "i"(&(var)));   \
+            break;                                                          \
+        case 2:                                                             \
+            __asm__ volatile(op "w %w1, %%gs:%P2"                           \
+                             : "+m"(var) : "ri"(__pcp_val), "i"(&(var)));   \
+            break;                                                          \
+        case 4:                                                             \
+            __asm__ volatile(op "l %k1, %%gs:%P2"                           \
+                             : "+m"(var) : "ri"(__pcp_val), "i"(&(var)));   \
+            break;                                                          \
+        default:                                                            \
+            __asm__ volatile(op "q %q1, %%gs:%P2"                           \
+                             : "+m"(var) : "re"(__pcp_val), "i"(&(var)));   \
+            break;                                                          \
+        }                                                                   \
+    } while (0)
+
+#define this_cpu_write(var, val)    __this_cpu_op("mov", var, val)
+#define this_cpu_add(var, val)      __this_cpu_op("add", var, val)
+
+/**
+ * @brief Get a pointer to the running CPU's instance of a per-CPU variable
+ * 
+ * Only stable while the caller cannot migrate, i.e. with interrupts off
+ * once the scheduler moves tasks between CPUs.
+ * 
+ * @param ptr Address of the per-CPU variable
+ */
+#define this_cpu_ptr(ptr) \
+    ((__typeof__(ptr))((uintptr_t)(ptr) + this_cpu_read(this_cpu_off)))
+
+#endif /* KERNEL_HOSTED */
+
+#define this_cpu_inc(var)           this_cpu_add(var, 1)
+#define this_cpu_dec(var)           this_cpu_add(var, -1)
+
+/**
+ * @brief Get a pointer to another CPU's instance of a per-CPU variable
+ * 
+ * @param ptr Address of the per-CPU variable
+ * @param cpu CPU set up with percpu_setup_cpu()
+ */
+#define per_cpu_ptr(ptr, cpu) \
+    ((__typeof__(ptr))((uintptr_t)(ptr) + per_cpu_offset[cpu]))
+
+#define per_cpu(var, cpu)           (*per_cpu_ptr(&(var), (cpu)))
+
+/**
+ * @brief Instantiate a CPU's per-CPU area
+ * 
+ * Copies the .percpu template into the CPU's area. Called by the CPU
+ * bringing the new one up, before it starts.
+ * 
+ * @param cpu CPU number below MAX_CPUS
+ */
+void percpu_setup_cpu(unsigned int cpu);
+
+/**
+ * @brief Point the running CPU's GS base at its per-CPU area
+ * 
+ * Called first thing by each CPU, and again after anything that reloads
+ * the GS selector (which clears the base).
+ * 
+ * @param cpu Number of the running CPU
+ */
+void percpu_load(unsigned int cpu);
+
+/**
+ * @brief Set up the bootstrap processor's per-CPU area
+ * 
+ * Must run after gdt_init() and before anything writes a per-CPU
+ * variable, so the template stays pristine for the APs.
+ */
+void percpu_init(void);
+
+#endif /* _PERCPU_H */
@@ -0,0 +1,150 @@
+/**
+ * @file percpu_counter.h
+ * @brief Scalable per-CPU counters
+ */
+
+#ifndef _PERCPU_COUNTER_H
+#define _PERCPU_COUNTER_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Default folding threshold
+ */
+#define PERCPU_COUNTER_BATCH 32
+
+/**
+ * @brief Per-CPU counter
+ * 
+ * Each CPU accumulates changes in its own cache line and folds them into
+ * the shared count once they reach the batch size, so a hot counter
+ * costs a local add instead of a write to a contended line. The shared
+ * count is therefore only an approximation, off by less than
+ * batch * MAX_CPUS; percpu_counter_sum() gives the exact value.
+ */
+typedef struct {
+    volatile int64_t count;             // Folded value, read without locking
+    int64_t batch;                      // Fold once a CPU's delta reaches this
+    struct {
+        volatile int64_t delta;         // Changes not folded yet
+    } ALIGN(64) cpu[MAX_CPUS];
+} percpu_counter_t;
+
+/**
+ * @brief Static initializer
+ * 
+ * @param value Initial value
+ * @param batch_size Folding threshold (PERCPU_COUNTER_BATCH unless the
+ *                   counter moves in large steps, like byte counts)
+ */
+#define PERCPU_COUNTER_INIT(value, batch_size) { (value), (batch_size), { { 0 } } }
+
+/**
+ * @brief Add to a counter, interrupts already disabled
+ * 
+ * For callers that hold an irqsave lock or run in interrupt context.
+ * 
+ * @param counter Counter to update
+ * @param amount Amount to add (negative to subtract)
+ */
+static inline void __percpu_counter_add(percpu_counter_t* counter, int64_t amount) {
+    volatile int64_t* delta = &counter->cpu[smp_processor_id()].delta;
+    int64_t value = *delta + amount;
+    
+    if (value >= counter->batch || value <= -counter->batch) {
+        __atomic_fetch_add(&counter->count, value, __ATOMIC_RELAXED);
+        value = 0;
+    }
+    *delta = value;
+}
+
+/**
+ * @brief Add to a counter
+ * 
+ * @param counter Counter to update
+ * @param amount Amount to add (negative to subtract)
+ */
+static inline void percpu_counter_add(percpu_counter_t* counter, int64_t amount) {
+    // An interrupt updating the same counter must not split the add
+    uint64_t irq_flags = local_irq_save();
+    __percpu_counter_add(counter, amount);
+    local_irq_restore(irq_flags);
+}
+
+/**
+ * @brief Increment a counter
+ * 
+ * @param counter Counter to update
+ */
+static inline void percpu_counter_inc(percpu_counter_t* counter) {
+    percpu_counter_add(counter, 1);
+}
+
+/**
+ * @brief Decrement a counter
+ * 
+ * @param counter Counter to update
+ */
+static inline void percpu_counter_dec(percpu_counter_t* counter) {
+    percpu_counter_add(counter, -1);
+}
+
+/**
+ * @brief Read the approximate value
+ * 
+ * @param counter Counter to read
+ * @return Folded count, off by less than batch * MAX_CPUS
+ */
+static inline int64_t percpu_counter_read(const percpu_counter_t* counter) {
+    return __atomic_load_n(&counter->count, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Read the approximate value, clamped at zero
+ * 
+ * @param counter Counter to read
+ * @return Folded count, or 0 if it is transiently negative
+ */
+static inline int64_t percpu_counter_read_positive(const percpu_counter_t* counter) {
+    int64_t value = percpu_counter_read(counter);
+    return value > 0 ? value : 0;
+}
+
+/**
+ * @brief Compute the exact value
+ * 
+ * Sums every CPU's unfolded delta; concurrent updates may or may not be
+ * included.
+ * 
+ * @param counter Counter to read
+ * @return Current value
+ */
+int64_t percpu_counter_sum(const percpu_counter_t* counter);
+
+/**
+ * @brief Set a counter, discarding all unfolded deltas
+ * 
+ * Must not race with updates.
+ * 
+ * @param counter Counter to set
+ * @param value New value
+ */
+void percpu_counter_set(percpu_counter_t* counter, int64_t value);
+
+/**
+ * @brief Compare a counter against a value
+ * 
+ * Uses the approximate count when it is far enough from the value to
+ * decide, and falls back to the exact sum otherwise.
+ * 
+ * @param counter Counter to compare
+ * @param value Value to compare with
+ * @return Negative, zero or positive as the counter is below, equal to
+ *         or above the value
+ */
+int percpu_counter_compare(const percpu_counter_t* counter, int64_t value);
+
+#endif /* _PERCPU_COUNTER_H */
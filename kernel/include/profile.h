@@ -0,0 +1,53 @@
+/**
+ * @file profile.h
+ * @brief Statistical sampling profiler
+ */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Sample buffer geometry
+ * 
+ * Each sample takes one header word plus one word per call chain entry.
+ */
+#define PROFILE_BUFFER_WORDS 4096               // Words per CPU
+#define PROFILE_MAX_DEPTH    16                 // Call chain entries per sample
+
+/**
+ * @brief Start sampling
+ * 
+ * Discards any previous samples. One sample is taken per timer tick.
+ */
+void profile_start(void);
+
+/**
+ * @brief Stop sampling
+ */
+void profile_stop(void);
+
+/**
+ * @brief Take a sample of the interrupted context
+ * 
+ * Called from the timer interrupt.
+ * 
+ * @param ctx Context of the interrupted code
+ */
+void profile_tick(const irq_context_t* ctx);
+
+/**
+ * @brief Write the collected samples to a serial port
+ * 
+ * Each sample becomes one symbolized line; scripts/profile_fold.py turns
+ * a capture of the output into folded stacks for flame graphs.
+ * 
+ * @param port Serial port to write to
+ */
+void profile_dump(serial_port_t* port);
+
+#endif /* _PROFILE_H */
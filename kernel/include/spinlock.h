@@ -0,0 +1,152 @@
+/**
+ * @file spinlock.h
+ * @brief Spinlocks
+ */
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "kernel.h"
+#include "lockstat.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Spinlock
+ * 
+ * Lockstat builds tie every lock to a lock class that accumulates its
+ * statistics, and remember when the current holder took it.
+ */
+typedef struct {
+    volatile uint32_t locked;
+#ifdef CONFIG_LOCKSTAT
+    lock_class_t* class;                // Statistics for this lock
+    uint64_t acquired_tsc;              // When the current holder took it
+#endif
+} spinlock_t;
+
+#ifdef CONFIG_LOCKSTAT
+#define SPINLOCK_INIT(cls)      { 0, &(cls), 0 }
+#else
+#define SPINLOCK_INIT(cls)      { 0 }
+#endif
+
+/**
+ * @brief Define a file-local spinlock with a lock class of its own
+ * 
+ *   DEFINE_SPINLOCK(heap_lock);
+ * 
+ * @param name Identifier of the lock, also used as the class name
+ */
+#define DEFINE_SPINLOCK(name)                                               \
+    LOCK_CLASS(name);                                                       \
+    static spinlock_t name = SPINLOCK_INIT(LOCK_CLASS_NAME(name))
+
+/**
+ * @brief Initialize a spinlock at run time
+ * 
+ * Locks embedded in dynamically allocated objects share one class,
+ * declared once with LOCK_CLASS().
+ * 
+ * @param lock Lock to initialize
+ * @param cls Lock class, from LOCK_CLASS_NAME() (ignored without lockstat)
+ */
+static inline void spin_lock_init(spinlock_t* lock, lock_class_t* cls) {
+    lock->locked = 0;
+#ifdef CONFIG_LOCKSTAT
+    lock->class = cls;
+    lock->acquired_tsc = 0;
+#else
+    (void)cls;
+#endif
+}
+
+/**
+ * @brief Try to take a spinlock without waiting
+ * 
+ * @param lock Lock to take
+ * @return true if the lock was taken
+ */
+static inline bool spin_trylock(spinlock_t* lock) {
+    if (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) != 0) {
+        return false;
+    }
+#ifdef CONFIG_LOCKSTAT
+    lockstat_acquired(lock->class, &lock->acquired_tsc);
+#endif
+    return true;
+}
+
+/**
+ * @brief Wait for a contended lock (slow path of spin_lock)
+ * 
+ * Spins on a plain load, so waiters do not bounce the cache line while
+ * the holder works, and only retries the exchange once the lock looks
+ * free.
+ * 
+ * @param lock Lock to take
+ * @param site Address of the contended spin_lock(), for lockstat
+ */
+void spin_lock_contended(spinlock_t* lock, uintptr_t site);
+
+/**
+ * @brief Take a spinlock
+ * 
+ * @param lock Lock to take
+ */
+static inline ALWAYS_INLINE void spin_lock(spinlock_t* lock) {
+    if (likely(__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) == 0)) {
+#ifdef CONFIG_LOCKSTAT
+        lockstat_acquired(lock->class, &lock->acquired_tsc);
+#endif
+        return;
+    }
+    spin_lock_contended(lock, current_ip());
+}
+
+/**
+ * @brief Release a spinlock
+ * 
+ * @param lock Lock to release
+ */
+static inline void spin_unlock(spinlock_t* lock) {
+#ifdef CONFIG_LOCKSTAT
+    // Accounted while still held, so the class counters need no atomics
+    lockstat_released(lock->class, lock->acquired_tsc);
+#endif
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Disable interrupts and take a spinlock
+ * 
+ * Required for locks that are also taken from interrupt handlers.
+ * 
+ * @param lock Lock to take
+ * @return Previous RFLAGS, for spin_unlock_irqrestore()
+ */
+static inline ALWAYS_INLINE uint64_t spin_lock_irqsave(spinlock_t* lock) {
+    uint64_t flags = local_irq_save();
+    if (likely(__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) == 0)) {
+#ifdef CONFIG_LOCKSTAT
+        lockstat_acquired(lock->class, &lock->acquired_tsc);
+#endif
+        return flags;
+    }
+    spin_lock_contended(lock, current_ip());
+    return flags;
+}
+
+/**
+ * @brief Release a spinlock and restore the interrupt state
+ * 
+ * @param lock Lock to release
+ * @param flags RFLAGS returned by spin_lock_irqsave()
+ */
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
+
+#endif /* _SPINLOCK_H */
@@ -0,0 +1,43 @@
+/**
+ * @file stacktrace.h
+ * @brief Frame-pointer stack walking
+ */
+
+#ifndef _STACKTRACE_H
+#define _STACKTRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Walk a frame-pointer chain
+ * 
+ * Stops at the first frame that does not look like a kernel stack frame,
+ * so it is safe to call on a corrupt or foreign chain.
+ * 
+ * @param rbp Frame pointer to start from
+ * @param pcs Where to store return addresses, innermost first
+ * @param max Maximum number of entries to store
+ * @return Number of entries stored
+ */
+size_t stack_trace_walk(uint64_t rbp, uint64_t* pcs, size_t max);
+
+/**
+ * @brief Capture the caller's stack
+ * 
+ * @param pcs Where to store return addresses, innermost first
+ * @param max Maximum number of entries to store
+ * @return Number of entries stored
+ */
+#define stack_trace_save(pcs, max) \
+    stack_trace_walk((uint64_t)__builtin_frame_address(0), (pcs), (max))
+
+/**
+ * @brief Print a captured stack, one symbolized frame per line
+ * 
+ * @param pcs Return addresses, innermost first
+ * @param count Number of entries
+ */
+void stack_trace_print(const uint64_t* pcs, size_t count);
+
+#endif /* _STACKTRACE_H */
@@ -0,0 +1,149 @@
+/**
+ * @file static_key.h
+ * @brief Static keys (runtime-patched branches)
+ * 
+ * Included by kernel.h for the interrupt-flag helpers, so it only depends
+ * on the compiler headers.
+ */
+
+#ifndef _STATIC_KEY_H
+#define _STATIC_KEY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Static key
+ * 
+ * Every static_branch_likely()/static_branch_unlikely() on a key is a
+ * 5-byte NOP or JMP recorded in the __jump_table section. Flipping the
+ * key rewrites all of its sites, so a disabled branch costs a NOP and no
+ * load. Keys are flipped from process context, never from hot paths.
+ */
+typedef struct static_key {
+    volatile int32_t enabled;
+} static_key_t;
+
+#define STATIC_KEY_INIT_FALSE   { 0 }
+#define STATIC_KEY_INIT_TRUE    { 1 }
+
+#define DEFINE_STATIC_KEY_FALSE(name)   static_key_t name = STATIC_KEY_INIT_FALSE
+#define DEFINE_STATIC_KEY_TRUE(name)    static_key_t name = STATIC_KEY_INIT_TRUE
+#define DECLARE_STATIC_KEY(name)        extern static_key_t name
+
+/**
+ * @brief Jump table entry, one per branch site
+ */
+typedef struct {
+    uint64_t code;                      // Address of the 5-byte NOP/JMP
+    uint64_t target;                    // Where the JMP goes
+    uint64_t key;                       // static_key_t*, bit 0 set for likely branches
+} jump_entry_t;
+
+#define JUMP_ENTRY_LIKELY       1ULL
+
+/**
+ * @brief Size of a branch site
+ */
+#define JUMP_LABEL_INSN_SIZE    5
+
+#ifdef KERNEL_HOSTED
+
+// The host harness never patches its text; test the key directly
+#define static_branch_unlikely(key)     __builtin_expect((key)->enabled != 0, 0)
+#define static_branch_likely(key)       __builtin_expect((key)->enabled != 0, 1)
+
+#else
+
+/**
+ * @brief Emit a branch site
+ * 
+ * Assembled as a NOP, so it falls through until jump_label_init() or a
+ * key change turns it into a JMP to l_yes. The site jumps when the key's
+ * state differs from the branch's expected one.
+ * 
+ * @param key Key controlling the site
+ * @param likely_branch true for static_branch_likely()
+ * @return true if the site jumped
+ */
+static inline __attribute__((always_inline)) bool arch_static_branch(static_key_t* key, bool likely_branch) {
+    __asm__ goto("1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t"
+                 ".pushsection __jump_table, \"a\"\n\t"
+                 ".balign 8\n\t"
+                 ".quad 1b, %l[l_yes], %c0 + %c1\n\t"
+                 ".popsection\n\t"
+                 : : "i"(key), "i"(likely_branch) : : l_yes);
+    return false;
+l_yes:
+    return true;
+}
+
+/**
+ * @brief Branch that is expected to be off
+ * 
+ *   if (static_branch_unlikely(&trace_key)) { ... }
+ * 
+ * The body is laid out out of line and reached through the JMP.
+ * 
+ * @param key Key to test
+ * @return true if the key is enabled
+ */
+#define static_branch_unlikely(key)     __builtin_expect(arch_static_branch((key), false), 0)
+
+/**
+ * @brief Branch that is expected to be on
+ * 
+ * The body falls through; disabling the key jumps around it.
+ * 
+ * @param key Key to test
+ * @return true if the key is enabled
+ */
+#define static_branch_likely(key)       __builtin_expect(!arch_static_branch((key), true), 1)
+
+#endif /* KERNEL_HOSTED */
+
+/**
+ * @brief Read a key's state without a branch site
+ * 
+ * For slow paths and state queries.
+ * 
+ * @param key Key to read
+ * @return true if enabled
+ */
+static inline bool static_key_enabled(const static_key_t* key) {
+    return __atomic_load_n(&key->enabled, __ATOMIC_ACQUIRE) != 0;
+}
+
+/**
+ * @brief Enable a key, patching all of its sites in one batch
+ * 
+ * @param key Key to enable
+ */
+void static_key_enable(static_key_t* key);
+
+/**
+ * @brief Disable a key, patching all of its sites in one batch
+ * 
+ * @param key Key to disable
+ */
+void static_key_disable(static_key_t* key);
+
+/**
+ * @brief Set a key's state
+ * 
+ * @param key Key to change
+ * @param enable New state
+ */
+void static_key_set(static_key_t* key, bool enable);
+
+/**
+ * @brief Bring every branch site in line with its key's initial state
+ * 
+ * Sites are assembled as NOPs, which is already right for keys that
+ * start in their expected state; the others are patched here. Runs at
+ * boot as soon as the IDT can take the breakpoints patching relies on.
+ */
+void jump_label_init(void);
+
+#endif /* _STATIC_KEY_H */
@@ -0,0 +1,47 @@
+/**
+ * @file text_poke.h
+ * @brief Live kernel text patching
+ */
+
+#ifndef _TEXT_POKE_H
+#define _TEXT_POKE_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Batch geometry
+ */
+#define TEXT_POKE_MAX_INSN   8                  // Longest instruction that can be patched
+#define TEXT_POKE_BATCH      64                 // Sites patched per round
+
+/**
+ * @brief Queue an instruction rewrite
+ * 
+ * The rewrite happens in text_poke_finish(), or earlier when the batch
+ * is full. Callers serialize among themselves.
+ * 
+ * @param addr Instruction to replace
+ * @param insn New instruction, the same length as the old one
+ * @param len Length in bytes (at most TEXT_POKE_MAX_INSN)
+ */
+void text_poke_queue(void* addr, const void* insn, size_t len);
+
+/**
+ * @brief Apply every queued rewrite
+ */
+void text_poke_finish(void);
+
+/**
+ * @brief Handle a breakpoint hit on a site being rewritten
+ * 
+ * Called by the #BP handler before anything else.
+ * 
+ * @param rip Return address of the breakpoint (one past the int3)
+ * @return Address to resume at, or 0 if the breakpoint is not ours
+ */
+uint64_t text_poke_int3_handler(uint64_t rip);
+
+#endif /* _TEXT_POKE_H */
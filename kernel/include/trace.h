@@ -0,0 +1,130 @@
+/**
+ * @file trace.h
+ * @brief Binary event tracing
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Trace event table
+ * 
+ * Each entry is X(id, name, kind, args): the kind is 'i' for an instant
+ * event, 'B' or 'E' for the start or end of a span, and args names the
+ * recorded arguments in order. The table is emitted in the dump header,
+ * so the host decoder never needs to be kept in sync with it.
+ * 
+ * There is no scheduler yet; the timer tick stands in for it until one
+ * exists.
+ */
+#define TRACE_EVENTS(X) \
+    X(TRACE_IRQ_ENTRY,   "irq_entry",   'B', "vector")          \
+    X(TRACE_IRQ_EXIT,    "irq_exit",    'E', "vector")          \
+    X(TRACE_TIMER_TICK,  "timer_tick",  'i', "tick")            \
+    X(TRACE_PAGE_ALLOC,  "page_alloc",  'i', "phys,count")      \
+    X(TRACE_PAGE_FREE,   "page_free",   'i', "phys,count")      \
+    X(TRACE_KMALLOC,     "kmalloc",     'i', "ptr,size,align")  \
+    X(TRACE_KFREE,       "kfree",       'i', "ptr,size")        \
+    X(TRACE_KREALLOC,    "krealloc",    'i', "old,new,size")    \
+    X(TRACE_MAP_PAGE,    "map_page",    'i', "virt,phys,flags") \
+    X(TRACE_UNMAP_PAGE,  "unmap_page",  'i', "virt")
+
+#define TRACE_EVENT_ID(id, name, kind, args) id,
+typedef enum {
+    TRACE_EVENTS(TRACE_EVENT_ID)
+    TRACE_EVENT_COUNT
+} trace_event_id_t;
+#undef TRACE_EVENT_ID
+
+/**
+ * @brief Buffer geometry
+ */
+#define TRACE_BUFFER_RECORDS 1024               // Records per CPU (power of 2)
+#define TRACE_MAX_ARGS       3                  // Arguments per record
+
+/**
+ * @brief Trace record
+ * 
+ * Records are stored and dumped in this exact little-endian layout.
+ */
+typedef struct {
+    uint64_t tsc;                       // TSC when the event fired
+    uint16_t id;                        // trace_event_id_t
+    uint8_t cpu;                        // CPU the event fired on
+    uint8_t reserved[5];
+    uint64_t args[TRACE_MAX_ARGS];      // Event arguments
+} trace_record_t;
+
+// Global switch and per-event mask, checked inline at every tracepoint
+DECLARE_STATIC_KEY(trace_key);
+extern volatile uint64_t trace_event_mask;
+
+/**
+ * @brief Record an event (slow path of trace_event)
+ * 
+ * @param id Event identifier
+ * @param a0 First argument
+ * @param a1 Second argument
+ * @param a2 Third argument
+ */
+void trace_record(uint16_t id, uint64_t a0, uint64_t a1, uint64_t a2);
+
+/**
+ * @brief Tracepoint
+ * 
+ * Costs a NOP while tracing is off. Unused arguments are passed as 0.
+ */
+#define trace_event(id, a0, a1, a2)                                         \
+    do {                                                                    \
+        if (static_branch_unlikely(&trace_key) &&                           \
+            (trace_event_mask & (1ULL << (id))))                            \
+            trace_record((id), (uint64_t)(a0), (uint64_t)(a1),              \
+                         (uint64_t)(a2));                                   \
+    } while (0)
+
+/**
+ * @brief Initialize the trace buffers (tracing stays off)
+ */
+void trace_init(void);
+
+/**
+ * @brief Start recording
+ * 
+ * @param mask Bitmask of events to record (1 << id), or 0 for all events
+ */
+void trace_start(uint64_t mask);
+
+/**
+ * @brief Find an event by name
+ * 
+ * @param name Event name, as in the dump header
+ * @return Event identifier, or -1 if there is no such event
+ */
+int trace_event_lookup(const char* name);
+
+/**
+ * @brief Stop recording
+ */
+void trace_stop(void);
+
+/**
+ * @brief Discard all recorded events
+ */
+void trace_reset(void);
+
+/**
+ * @brief Write the recorded events to a serial port as a binary stream
+ * 
+ * Tracing is stopped for the duration of the dump. The stream is decoded
+ * on the host by scripts/trace_decode.py.
+ * 
+ * @param port Serial port to write to
+ */
+void trace_dump(serial_port_t* port);
+
+#endif /* _TRACE_H */
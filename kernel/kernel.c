@@ -6,19 +6,26 @@
  */
 
 #include <kernel.h>
+#include <klog.h>
+#include <trace.h>
+#include <ftrace.h>
+#include <boottime.h>
+#include <initcall.h>
+#include <kbench.h>
+#include <alloctrace.h>
+#include <kshell.h>
+#include <irqaffinity.h>
+#include <percpu.h>
+#include <memory.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdarg.h>
 
 // Forward declarations for subsystem init functions
 void gdt_init(void);
 void idt_init(void);
 void mm_init(uintptr_t mem_upper);
-void serial_init(void);
-void vga_init(void);
 void pic_init(void);
 void timer_init(uint32_t frequency);
-void kbd_init(void);
 void hos_init(void);
 void sched_init(void);
 
@@ -32,69 +39,43 @@ bool recovery_mode = false;  // Recovery mode flag
 uint32_t terminal_row = 0;
 uint32_t terminal_column = 0;
 
-// Framebuffer state
+// Framebuffer state (physical address from the bootloader, mapped at boot)
+uint64_t framebuffer_phys = 0;
 void* framebuffer_base = NULL;
 uint32_t framebuffer_width = 0;
 uint32_t framebuffer_height = 0;
 uint32_t framebuffer_pitch = 0;
 uint32_t framebuffer_bpp = 0;
 
-// Early VGA console support for debugging
-#define VGA_WIDTH 80
-#define VGA_HEIGHT 25
-#define VGA_MEMORY 0xB8000
+// Multiboot2 boot information, as handed over by the loader in EBX
+#define MB2_TAG_END             0
+#define MB2_TAG_FRAMEBUFFER     8
+#define MB2_FB_TYPE_RGB         1               // Direct color
+#define MB2_INFO_LIMIT          0x40000000      // The boot page tables map the first 1 GiB
+#define MB2_INFO_MAX_SIZE       0x10000
 
-static uint16_t* vga_buffer = (uint16_t*)VGA_MEMORY;
-static uint8_t vga_color = 0x07; // Light gray on black
-static int vga_row = 0;
-static int vga_col = 0;
+typedef struct PACKED {
+    uint32_t type;
+    uint32_t size;
+} mb2_tag_t;
+
+typedef struct PACKED {
+    mb2_tag_t tag;
+    uint64_t addr;                      // Physical address
+    uint32_t pitch;                     // Bytes per scanline
+    uint32_t width;
+    uint32_t height;
+    uint8_t bpp;
+    uint8_t fb_type;                    // MB2_FB_TYPE_*
+    uint16_t reserved;
+    uint8_t red_pos, red_size;          // Direct color layout
+    uint8_t green_pos, green_size;
+    uint8_t blue_pos, blue_size;
+} mb2_tag_framebuffer_t;
 
 // COM1 port for serial output
 #define COM1 0x3F8
 
-/**
- * @brief Put a character to the VGA console
- * 
- * @param c Character to display
- */
-static void vga_putchar(char c) {
-    if (c == '\n') {
-        vga_col = 0;
-        vga_row++;
-        if (vga_row >= VGA_HEIGHT) {
-            // Scroll screen
-            for (int y = 0; y < VGA_HEIGHT - 1; y++) {
-                for (int x = 0; x < VGA_WIDTH; x++) {
-                    vga_buffer[y * VGA_WIDTH + x] = vga_buffer[(y + 1) * VGA_WIDTH + x];
-                }
-            }
-            
-            // Clear bottom row
-            for (int x = 0; x < VGA_WIDTH; x++) {
-                vga_buffer[(VGA_HEIGHT - 1) * VGA_WIDTH + x] = (vga_color << 8) | ' ';
-            }
-            vga_row = VGA_HEIGHT - 1;
-        }
-        return;
-    }
-    
-    if (c == '\r') {
-        vga_col = 0;
-        return;
-    }
-    
-    vga_buffer[vga_row * VGA_WIDTH + vga_col] = (vga_color << 8) | c;
-    vga_col++;
-    
-    if (vga_col >= VGA_WIDTH) {
-        vga_col = 0;
-        vga_row++;
-        if (vga_row >= VGA_HEIGHT) {
-            vga_row = 0; // Wrap to top
-        }
-    }
-}
-
 /**
  * @brief Put a character to the serial port
  * 
@@ -108,40 +89,6 @@ static void serial_putchar(char c) {
     outb(COM1, c);
 }
 
-/**
- * @brief Clear the VGA screen
- */
-static void vga_clear(void) {
-    for (int y = 0; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            vga_buffer[y * VGA_WIDTH + x] = (vga_color << 8) | ' ';
-        }
-    }
-    vga_row = 0;
-    vga_col = 0;
-}
-
-/**
- * @brief Set the VGA console color
- * 
- * @param fg Foreground color (0-15)
- * @param bg Background color (0-7)
- */
-static void vga_set_color(uint8_t fg, uint8_t bg) {
-    vga_color = (bg << 4) | (fg & 0x0F);
-}
-
-/**
- * @brief Write a string to the VGA console
- * 
- * @param str String to write
- */
-static void vga_puts(const char* str) {
-    for (size_t i = 0; str[i] != '\0'; i++) {
-        vga_putchar(str[i]);
-    }
-}
-
 /**
  * @brief Write a string to the serial port
  * 
@@ -154,244 +101,74 @@ static void serial_puts(const char* str) {
 }
 
 /**
- * @brief Convert an integer to a string
+ * @brief Take the framebuffer the loader set up from a Multiboot2 tag
  * 
- * @param num Integer to convert
- * @param base Base for conversion (10 for decimal, 16 for hex)
- * @param buf Buffer to store result
- * @param width Minimum field width
- * @param pad Padding character
- * @return Length of the resulting string
- */
-static int itoa(uint64_t num, int base, char* buf, int width, char pad) {
-    static const char digits[] = "0123456789ABCDEF";
-    char tmp[64];
-    int i = 0, len;
-    
-    // Handle special case of zero
-    if (num == 0) {
-        tmp[i++] = '0';
-    } else {
-        // Convert to string in reverse order
-        while (num > 0) {
-            tmp[i++] = digits[num % base];
-            num /= base;
-        }
-    }
-    
-    // Determine actual length
-    len = i;
-    
-    // Pad if needed
-    while (i < width) {
-        tmp[i++] = pad;
-    }
-    
-    // Reverse the string into the output buffer
-    while (i > 0) {
-        *buf++ = tmp[--i];
-    }
-    
-    return len;
-}
-
-/**
- * @brief Print formatted output to debug console
+ * Only the layouts fbcon draws in are accepted: 0xRRGGBB in 24 or 32
+ * bpp, and RGB 5:6:5 in 16 bpp.
  * 
- * @param fmt Format string (printf-style)
- * @param ... Format arguments
+ * @param fb Framebuffer tag
  */
-int kprintf(const char* fmt, ...) {
-    char buf[1024];
-    va_list args;
-    int i = 0;
-
-    va_start(args, fmt);
-    
-    for (const char* p = fmt; *p != '\0'; p++) {
-        if (*p != '%') {
-            buf[i++] = *p;
-            continue;
-        }
-        
-        // Handle format specifier
-        p++;
-        
-        // Check for width/padding
-        int width = 0;
-        char pad = ' ';
-        
-        if (*p == '0') {
-            pad = '0';
-            p++;
-        }
-        
-        while (*p >= '0' && *p <= '9') {
-            width = width * 10 + (*p - '0');
-            p++;
-        }
-        
-        switch (*p) {
-            case 'd': {
-                int val = va_arg(args, int);
-                if (val < 0) {
-                    buf[i++] = '-';
-                    val = -val;
-                }
-                i += itoa(val, 10, &buf[i], width, pad);
-                break;
-            }
-            
-            case 'u':
-                i += itoa(va_arg(args, unsigned int), 10, &buf[i], width, pad);
-                break;
-                
-            case 'x':
-                i += itoa(va_arg(args, unsigned int), 16, &buf[i], width, pad);
-                break;
-                
-            case 'p':
-                buf[i++] = '0';
-                buf[i++] = 'x';
-                i += itoa(va_arg(args, uintptr_t), 16, &buf[i], width ? width : 16, pad ? pad : '0');
-                break;
-                
-            case 'c':
-                buf[i++] = va_arg(args, int);
-                break;
-                
-            case 's': {
-                const char* s = va_arg(args, const char*);
-                if (!s) s = "(null)";
-                while (*s) {
-                    buf[i++] = *s++;
-                }
-                break;
-            }
-            
-            default:
-                buf[i++] = *p;
-                break;
-        }
+static void boot_info_framebuffer(const mb2_tag_framebuffer_t* fb) {
+    if (fb->tag.size < sizeof(*fb) || fb->fb_type != MB2_FB_TYPE_RGB || fb->addr == 0) {
+        return;
     }
     
-    va_end(args);
-    
-    // Null-terminate and print
-    buf[i] = '\0';
-    
-    // Output to both VGA and serial
-    vga_puts(buf);
-    serial_puts(buf);
+    bool rgb888 = (fb->bpp == 24 || fb->bpp == 32) &&
+                  fb->red_pos == 16 && fb->green_pos == 8 && fb->blue_pos == 0;
+    bool rgb565 = fb->bpp == 16 &&
+                  fb->red_pos == 11 && fb->green_pos == 5 && fb->blue_pos == 0;
+    if (!rgb888 && !rgb565) {
+        kprintf("Boot: unsupported %u bpp framebuffer layout\n", fb->bpp);
+        return;
+    }
     
-    return i; // Return the number of characters printed
+    framebuffer_phys = fb->addr;
+    framebuffer_width = fb->width;
+    framebuffer_height = fb->height;
+    framebuffer_pitch = fb->pitch;
+    framebuffer_bpp = fb->bpp;
+    kprintf("Boot: framebuffer %ux%u %u bpp at 0x%llx\n", fb->width, fb->height, fb->bpp,
+            (unsigned long long)fb->addr);
 }
 
 /**
- * @brief Trigger a kernel panic (non-returning)
+ * @brief Walk the Multiboot2 tags
  * 
- * @param type Type of panic (PANIC_* constants)
- * @param msg Error message
- * @param file Source file where panic was triggered
- * @param line Line number where panic was triggered
+ * @param mb_info Physical address of the boot information
  */
-void panic(int type, const char* msg, const char* file, int line) {
-    // Disable interrupts
-    cli();
-    
-    // Set panic colors based on type
-    switch (type) {
-        case PANIC_HOS_BREACH:
-            vga_set_color(0x0F, 0x04); // White on red
-            break;
-            
-        case PANIC_HARDWARE_FAULT:
-            vga_set_color(0x0F, 0x01); // White on blue
-            break;
-            
-        default:
-            vga_set_color(0x0F, 0x00); // White on black
-            break;
+static void boot_info_parse(uintptr_t mb_info) {
+    if (mb_info == 0 || (mb_info & 7) != 0 || mb_info >= MB2_INFO_LIMIT - MB2_INFO_MAX_SIZE) {
+        return;
     }
     
-    // Clear screen
-    vga_clear();
-    
-    // Print panic message
-    kprintf("*** KERNEL PANIC ***\n\n");
-    kprintf("Error: %s\n", msg);
-    kprintf("Location: %s:%d\n\n", file, line);
-    
-    // Print register dump
-    uint64_t rax, rbx, rcx, rdx, rsi, rdi, rbp, rsp, r8, r9, r10, r11, r12, r13, r14, r15, rflags;
-    
-    asm volatile (
-        "mov %%rax, %0\n"
-        "mov %%rbx, %1\n"
-        "mov %%rcx, %2\n"
-        "mov %%rdx, %3\n"
-        "mov %%rsi, %4\n"
-        "mov %%rdi, %5\n"
-        "mov %%rbp, %6\n"
-        "mov %%rsp, %7\n"
-        "mov %%r8, %8\n"
-        "mov %%r9, %9\n"
-        "mov %%r10, %10\n"
-        "mov %%r11, %11\n"
-        "mov %%r12, %12\n"
-        "mov %%r13, %13\n"
-        "mov %%r14, %14\n"
-        "mov %%r15, %15\n"
-        : "=m"(rax), "=m"(rbx), "=m"(rcx), "=m"(rdx),
-          "=m"(rsi), "=m"(rdi), "=m"(rbp), "=m"(rsp),
-          "=m"(r8), "=m"(r9), "=m"(r10), "=m"(r11),
-          "=m"(r12), "=m"(r13), "=m"(r14), "=m"(r15)
-        :
-        : "memory"
-    );
-    
-    rflags = read_flags();
-    
-    kprintf("Register dump:\n");
-    kprintf("RAX: 0x%016x  RBX: 0x%016x  RCX: 0x%016x  RDX: 0x%016x\n", rax, rbx, rcx, rdx);
-    kprintf("RSI: 0x%016x  RDI: 0x%016x  RBP: 0x%016x  RSP: 0x%016x\n", rsi, rdi, rbp, rsp);
-    kprintf("R8:  0x%016x  R9:  0x%016x  R10: 0x%016x  R11: 0x%016x\n", r8, r9, r10, r11);
-    kprintf("R12: 0x%016x  R13: 0x%016x  R14: 0x%016x  R15: 0x%016x\n", r12, r13, r14, r15);
-    kprintf("RFLAGS: 0x%016x\n\n", rflags);
-    
-    if (type == PANIC_HOS_BREACH) {
-        kprintf("SECURITY BREACH DETECTED IN HIDDEN OS PROTECTION\n");
-        kprintf("SYSTEM HALTED\n");
-    } else {
-        kprintf("System halted.\n");
+    const uint8_t* info = (const uint8_t*)(KERNEL_VIRTUAL_BASE + mb_info);
+    uint32_t total_size = *(const uint32_t*)info;
+    if (total_size < 16 || total_size > MB2_INFO_MAX_SIZE) {
+        return;
     }
     
-    // Hang forever
-    while (1) {
-        hlt();
+    // Tags follow the 8-byte header, each padded to 8 bytes
+    for (uint32_t offset = 8; offset + sizeof(mb2_tag_t) <= total_size;) {
+        const mb2_tag_t* tag = (const mb2_tag_t*)(info + offset);
+        if (tag->type == MB2_TAG_END || tag->size < sizeof(mb2_tag_t) ||
+            tag->size > total_size - offset) {
+            break;
+        }
+        
+        if (tag->type == MB2_TAG_FRAMEBUFFER) {
+            boot_info_framebuffer((const mb2_tag_framebuffer_t*)tag);
+        }
+        offset += (tag->size + 7) & ~7u;
     }
 }
 
-/**
- * @brief Report a breach in the Hidden OS protection system
- * 
- * @param reason String describing the breach reason
- * @param addr Address where breach was detected
- */
-void hos_breach(const char* reason, uintptr_t addr) {
-    char buf[256];
-    snprintf(buf, sizeof(buf), "HOS breach: %s at address 0x%016llx", reason, addr);
-    panic(PANIC_HOS_BREACH, buf, __FILE__, __LINE__);
-}
-
 /**
  * @brief Extract boot information
  * 
  * @param mb_info Multiboot information structure
  */
 static void extract_boot_info(uintptr_t mb_info) {
-    // For now, we'll just check if we're in recovery mode
-    // In a full implementation, we would extract more boot information
+    boot_info_parse(mb_info);
     
     // Check if recovery flag is set
     extern uint8_t recoveryFlag;
@@ -429,16 +206,46 @@ static void early_serial_init(void) {
     serial_puts("dsOS kernel serial console initialized\r\n");
 }
 
+/**
+ * @brief Map the boot framebuffer write-combining
+ * 
+ * Pixel writes then go out as full-line bursts instead of one uncached
+ * store at a time. Everything that draws (fbcon, the boot logo, panic)
+ * goes through framebuffer_base.
+ * 
+ * framebuffer_phys and its geometry come from the Multiboot2
+ * framebuffer tag; without one there is nothing to map.
+ */
+static void framebuffer_map(void) {
+    if (framebuffer_phys == 0 || framebuffer_base != NULL) {
+        return;
+    }
+    
+    framebuffer_base = ioremap_wc(framebuffer_phys, (size_t)framebuffer_pitch * framebuffer_height);
+    if (framebuffer_base == NULL) {
+        kprintf("Framebuffer: cannot map 0x%llx\n", (unsigned long long)framebuffer_phys);
+    }
+}
+
 /**
  * @brief Kernel entry point
  * 
  * @param mb_info Multiboot information structure
  */
 void kernel_main(uintptr_t mb_info) {
+    // Start the boot timeline before anything else
+    boot_timeline_init();
+    
     // Initialize early console for debug output
-    vga_clear();
+    vga_init();
     early_serial_init();
     
+    // Set up the kernel log ring; output stays synchronous during boot
+    klog_init();
+    trace_init();
+    ftrace_init();
+    boot_mark("early_console");
+    
     // Display welcome message
     kprintf("dKernel v%d.%d.%d starting...\n",
             KERNEL_VERSION_MAJOR,
@@ -451,55 +258,95 @@ void kernel_main(uintptr_t mb_info) {
     // Initialize CPU-specific structures
     kprintf("Initializing CPU structures... ");
     gdt_init();
+    boot_mark("gdt_init");
+    percpu_init();
+    boot_mark("percpu_init");
+    pat_init();
+    boot_mark("pat_init");
     idt_init();
+    boot_mark("idt_init");
+    jump_label_init();
+    boot_mark("jump_label_init");
     kprintf("done\n");
     
     // Initialize memory management
     kprintf("Initializing memory management... ");
     mm_init(0); // placeholder, will be replaced with actual memory size
+    boot_mark("mm_init");
     kprintf("done\n");
     
-    // Initialize device drivers
-    kprintf("Initializing device drivers... ");
-    serial_init();
-    vga_init();
+#ifdef CONFIG_ALLOCTRACE
+    // Record every heap call from here on; streamed once serial is up
+    alloctrace_start();
+#endif
+    
+    // Initialize the interrupt controller
+    kprintf("Initializing interrupt controller... ");
     pic_init();
+    boot_mark("pic_init");
     kprintf("done\n");
     
     // Initialize timer and enable interrupts
     kprintf("Initializing system timer... ");
     timer_init(100); // 100 Hz = 10ms per tick
+    boot_mark("timer_init");
     sti(); // Enable interrupts
     kprintf("done\n");
     
-    // Initialize keyboard
-    kprintf("Initializing keyboard... ");
-    kbd_init();
-    kbd_ready = true;
-    kprintf("done\n");
+    // Probe device drivers in dependency order
+    kprintf("Initializing device drivers...\n");
+    initcall_run_all();
     
     // Initialize hidden OS protection
     kprintf("Initializing Hidden OS protection... ");
     hos_init();
+    boot_mark("hos_init");
     kprintf("done\n");
     
     // Initialize scheduler
     kprintf("Initializing process scheduler... ");
     sched_init();
+    boot_mark("sched_init");
     kprintf("done\n");
     
     // Kernel initialization complete
     kprintf("Kernel initialization complete\n");
+    boot_timeline_report(debug_port);
     init_done = true;
     
-    // Initialize framebuffer for GUI
-    fb_ready = true;
+    // Defer console output to the kernel log ring from here on
+    klog_start();
+    
+    // Initialize framebuffer for GUI, and move the console onto it
+    framebuffer_map();
+    fb_ready = framebuffer_base != NULL;
+    if (fb_ready && fbcon_init() != 0) {
+        kprintf("Framebuffer: console stays on VGA text mode\n");
+    }
+    
+    // Every driver probe must have finished before userspace starts
+    initcall_wait_all();
+    
+#ifdef CONFIG_KBENCH
+    // Benchmark boot: report, then leave QEMU (or stop here on hardware)
+    kbench_run(debug_port);
+    outb(KBENCH_EXIT_PORT, 0);
+    while (1) {
+        hlt();
+    }
+#endif
     
     // TODO: Pass control to userspace init process
     kprintf("Waiting for userspace to start...\n");
     
-    // For now, just wait in a loop
+    // For now, just wait in a loop, draining the kernel log and the
+    // allocation trace, balancing interrupts and serving the debug shell
+    // when idle
     while (1) {
+        klog_drain(0);
+        alloctrace_flush(debug_port);
+        irq_balance_poll();
+        kshell_poll(debug_port);
         hlt();
     }
 }
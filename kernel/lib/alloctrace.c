@@ -0,0 +1,189 @@
+/**
+ * @file alloctrace.c
+ * @brief Heap allocation trace recorder
+ * 
+ * While enabled, every kmalloc, kmalloc_aligned, krealloc and kfree call
+ * stores a fixed-size binary record (TSC, pointers, size, alignment and
+ * call site) in a per-CPU ring. Unlike the flight recorders in trace.c,
+ * a replay needs every call, so full rings drop new records and count
+ * them instead of overwriting unsent ones. The rings are streamed to a
+ * serial port from the idle loop, and tests/host/alloc_replay replays
+ * the capture against candidate allocators on the host.
+ * 
+ * Stream layout (all integers little-endian):
+ * 
+ *   header   "DSALLOC1", u32 version, u32 record_size
+ *   chunks   "DSAC", u16 cpu, u16 record_count, u32 tsc_khz,
+ *            u32 reserved, u64 lost, record_count x alloctrace_record_t
+ *   trailer  "DSAEND01"
+ * 
+ * lost is the running total of records the CPU dropped. Log text may
+ * appear between chunks; the decoder skips it.
+ */
+
+#include "../include/kernel.h"
+#include "../include/alloctrace.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ALLOCTRACE_RING_MASK (ALLOCTRACE_RING_RECORDS - 1)
+#define ALLOCTRACE_VERSION   1
+
+// Per-CPU ring, filled with interrupts off and drained by the idle loop
+typedef struct {
+    volatile uint64_t head;             // Records written
+    volatile uint64_t tail;             // Records streamed
+    uint64_t lost;                      // Records dropped on a full ring
+    alloctrace_record_t records[ALLOCTRACE_RING_RECORDS];
+} ALIGN(64) alloctrace_ring_t;
+
+// Chunk header preceding each run of records in the stream
+typedef struct {
+    char magic[4];
+    uint16_t cpu;
+    uint16_t count;
+    uint32_t tsc_khz;
+    uint32_t reserved;
+    uint64_t lost;
+} PACKED alloctrace_chunk_t;
+
+static alloctrace_ring_t alloctrace_rings[MAX_CPUS];
+
+DEFINE_STATIC_KEY_FALSE(alloctrace_key);
+
+// Set while a context is streaming the rings
+static volatile uint32_t alloctrace_flush_busy = 0;
+
+// Whether the stream header has gone out
+static bool alloctrace_header_sent = false;
+
+/**
+ * @brief Start recording heap calls
+ */
+void alloctrace_start(void) {
+    static_key_enable(&alloctrace_key);
+}
+
+/**
+ * @brief Stop recording and write the end-of-stream trailer
+ * 
+ * @param port Serial port the stream goes to
+ */
+void alloctrace_stop(serial_port_t* port) {
+    static_key_disable(&alloctrace_key);
+    
+    alloctrace_flush(port);
+    if (alloctrace_header_sent && port != NULL && serial_is_initialized(port)) {
+        serial_write(port, "DSAEND01", 8);
+    }
+}
+
+/**
+ * @brief Record a heap call (slow path of alloctrace)
+ * 
+ * @param op ALLOCTRACE_* operation
+ * @param ptr Returned or freed pointer
+ * @param old_ptr Pointer passed to krealloc
+ * @param size Requested size
+ * @param align Requested alignment
+ * @param site Return address of the caller
+ */
+void alloctrace_record(uint8_t op, void* ptr, void* old_ptr, size_t size, size_t align, void* site) {
+    // Keeps a heap call from an interrupt handler off a half-written slot
+    uint64_t irq_flags = local_irq_save();
+    
+    unsigned int cpu = smp_processor_id();
+    alloctrace_ring_t* ring = &alloctrace_rings[cpu];
+    uint64_t head = ring->head;
+    
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ALLOCTRACE_RING_RECORDS) {
+        ring->lost++;
+        local_irq_restore(irq_flags);
+        return;
+    }
+    
+    alloctrace_record_t* rec = &ring->records[head & ALLOCTRACE_RING_MASK];
+    rec->tsc = rdtsc();
+    rec->ptr = (uint64_t)(uintptr_t)ptr;
+    rec->old_ptr = (uint64_t)(uintptr_t)old_ptr;
+    rec->size = size;
+    rec->site = (uint64_t)(uintptr_t)site;
+    rec->align = (uint32_t)align;
+    rec->op = op;
+    rec->cpu = (uint8_t)cpu;
+    
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    local_irq_restore(irq_flags);
+}
+
+/**
+ * @brief Stream recorded calls to a serial port
+ * 
+ * @param port Serial port to write to
+ * @return Number of records written
+ */
+size_t alloctrace_flush(serial_port_t* port) {
+    if (port == NULL || !serial_is_initialized(port)) {
+        return 0;
+    }
+    
+    if (__atomic_exchange_n(&alloctrace_flush_busy, 1, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    
+    size_t written = 0;
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        alloctrace_ring_t* ring = &alloctrace_rings[cpu];
+        
+        for (;;) {
+            uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            uint64_t tail = ring->tail;
+            if (head == tail) {
+                break;
+            }
+            
+            // A chunk never wraps, so its records go out in one write
+            uint64_t start = tail & ALLOCTRACE_RING_MASK;
+            uint64_t count = head - tail;
+            if (count > ALLOCTRACE_CHUNK_RECORDS) {
+                count = ALLOCTRACE_CHUNK_RECORDS;
+            }
+            if (count > ALLOCTRACE_RING_RECORDS - start) {
+                count = ALLOCTRACE_RING_RECORDS - start;
+            }
+            
+            if (!alloctrace_header_sent) {
+                struct {
+                    char magic[8];
+                    uint32_t version;
+                    uint32_t record_size;
+                } PACKED header = {
+                    { 'D', 'S', 'A', 'L', 'L', 'O', 'C', '1' },
+                    ALLOCTRACE_VERSION,
+                    sizeof(alloctrace_record_t),
+                };
+                serial_write(port, (const char*)&header, sizeof(header));
+                alloctrace_header_sent = true;
+            }
+            
+            alloctrace_chunk_t chunk = {
+                .magic = { 'D', 'S', 'A', 'C' },
+                .cpu = (uint16_t)cpu,
+                .count = (uint16_t)count,
+                .tsc_khz = (uint32_t)tsc_get_khz(),
+                .reserved = 0,
+                .lost = ring->lost,
+            };
+            serial_write(port, (const char*)&chunk, sizeof(chunk));
+            serial_write(port, (const char*)&ring->records[start], count * sizeof(alloctrace_record_t));
+            
+            __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+            written += count;
+        }
+    }
+    
+    __atomic_store_n(&alloctrace_flush_busy, 0, __ATOMIC_RELEASE);
+    return written;
+}
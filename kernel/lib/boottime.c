@@ -0,0 +1,118 @@
+/**
+ * @file boottime.c
+ * @brief Boot timeline profiler
+ * 
+ * TSC timestamps are taken at stage 2 entry and hand-off (when booted by
+ * dsBoot), at _start and just before kernel_main() in boot.asm, and after
+ * each init step in kernel_main(). The TSC is not calibrated until the
+ * timer is up, so raw values are kept and only converted when the report
+ * is written.
+ */
+
+#include "../include/kernel.h"
+#include "../include/boottime.h"
+#include "../include/memory.h"
+#include "../include/klog.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Set by boot.asm
+extern uint64_t boot_tsc_start;
+extern uint64_t boot_tsc_kernel_main;
+
+typedef struct {
+    const char* name;
+    uint64_t tsc;
+} boot_mark_t;
+
+static boot_mark_t boot_marks[BOOT_MARKS_MAX];
+static size_t boot_mark_count = 0;
+
+/**
+ * @brief Append a timeline entry
+ */
+static void boot_mark_at(const char* name, uint64_t tsc) {
+    if (boot_mark_count < BOOT_MARKS_MAX) {
+        boot_marks[boot_mark_count].name = name;
+        boot_marks[boot_mark_count].tsc = tsc;
+        boot_mark_count++;
+    }
+}
+
+/**
+ * @brief Start the timeline
+ */
+void boot_timeline_init(void) {
+    boot_mark_count = 0;
+    
+    volatile boot_ts_block_t* block = (volatile boot_ts_block_t*)(KERNEL_VIRTUAL_BASE + BOOT_TS_ADDR);
+    
+    // Stage 2 ran on this boot only if its timestamps precede ours
+    if (block->magic == BOOT_TS_MAGIC && block->stage2_entry < boot_tsc_start) {
+        boot_mark_at("stage2_entry", block->stage2_entry);
+        if (block->stage2_handoff >= block->stage2_entry &&
+            block->stage2_handoff < boot_tsc_start) {
+            boot_mark_at("stage2_handoff", block->stage2_handoff);
+        }
+    }
+    
+    // Do not let a later warm boot through another loader pick these up
+    block->magic = 0;
+    
+    boot_mark_at("_start", boot_tsc_start);
+    boot_mark_at("kernel_main", boot_tsc_kernel_main);
+}
+
+/**
+ * @brief Record the end of a boot step
+ * 
+ * @param name Step name (must be a string literal)
+ */
+void boot_mark(const char* name) {
+    boot_mark_at(name, rdtsc());
+}
+
+/**
+ * @brief Convert a TSC delta to microseconds
+ */
+static uint64_t boot_us(uint64_t cycles) {
+    return tsc_to_ns(cycles) / 1000;
+}
+
+/**
+ * @brief Write the timeline to a serial port as a single JSON line
+ * 
+ * @param port Serial port to write to
+ */
+void boot_timeline_report(serial_port_t* port) {
+    if (port == NULL || !serial_is_initialized(port) || boot_mark_count == 0) {
+        return;
+    }
+    
+    // Keep log text from being interleaved with the report
+    klog_drain(0);
+    
+    char buf[160];
+    int len;
+    uint64_t origin = boot_marks[0].tsc;
+    uint64_t last = boot_marks[boot_mark_count - 1].tsc;
+    
+    len = snprintf(buf, sizeof(buf), "BOOTTIME {\"tsc_khz\":%llu,\"total_us\":%llu,\"steps\":[",
+                   tsc_get_khz(), boot_us(last - origin));
+    serial_write(port, buf, (size_t)len);
+    
+    for (size_t i = 0; i < boot_mark_count; i++) {
+        const boot_mark_t* mark = &boot_marks[i];
+        uint64_t prev = (i > 0) ? boot_marks[i - 1].tsc : mark->tsc;
+        
+        len = snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"tsc\":%llu,\"at_us\":%llu,\"delta_us\":%llu}",
+                       (i > 0) ? "," : "", mark->name, mark->tsc,
+                       boot_us(mark->tsc - origin), boot_us(mark->tsc - prev));
+        if (len >= (int)sizeof(buf)) {
+            len = sizeof(buf) - 1;
+        }
+        serial_write(port, buf, (size_t)len);
+    }
+    
+    serial_write(port, "]}\n", 3);
+}
@@ -0,0 +1,398 @@
+/**
+ * @file ftrace.c
+ * @brief Function-entry tracer
+ * 
+ * In ftrace builds (scripts/build.sh ftrace) every instrumented function
+ * starts with a 5-byte NOP whose address the compiler records in the
+ * __mcount_loc section. Enabling a function rewrites its NOP into a call
+ * to __fentry__, which logs the entry and swaps the function's return
+ * address for ftrace_return_trampoline so the return can be timed as
+ * well. Entries and exits go to per-CPU flight-recorder rings.
+ * Functions are switched on and off at runtime from the kshell "ftrace"
+ * command.
+ * 
+ * This file is never instrumented itself (see NOTRACE_SOURCES in
+ * scripts/build.sh).
+ */
+
+#include "../include/kernel.h"
+#include "../include/ftrace.h"
+#include "../include/ksyms.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef CONFIG_FTRACE
+
+#define FTRACE_RING_MASK    (FTRACE_RING_RECORDS - 1)
+#define FTRACE_INSN_SIZE    5
+
+// Return address saved when a traced function's return was hijacked
+typedef struct {
+    uint64_t func;                      // Traced function
+    uint64_t ret;                       // Original return address
+    uint64_t tsc;                       // TSC at entry
+} ftrace_frame_t;
+
+// Per-CPU tracer state
+typedef struct {
+    volatile uint64_t head;             // Total records written
+    volatile uint64_t depth;            // Hijacked returns outstanding
+    ftrace_frame_t stack[FTRACE_MAX_DEPTH];
+    ftrace_record_t records[FTRACE_RING_RECORDS];
+} ALIGN(64) ftrace_cpu_t;
+
+static ftrace_cpu_t ftrace_cpus[MAX_CPUS];
+
+// Set while the rings are being printed, so the dump does not trace itself
+static volatile bool ftrace_paused = false;
+
+// Patch sites collected by the linker
+extern const uint64_t __start_mcount_loc[];
+extern const uint64_t __stop_mcount_loc[];
+
+// Assembly entry points
+void __fentry__(void);
+void ftrace_return_trampoline(void);
+
+// What -mnop-mcount leaves at every patch site
+static const uint8_t ftrace_nop[FTRACE_INSN_SIZE] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
+
+void ftrace_entry(uint64_t func, uint64_t* ret_slot);
+uint64_t ftrace_exit(void);
+
+/*
+ * __fentry__ runs before the traced function's prologue, so every
+ * argument register is live and must be preserved. The traced function's
+ * own return address sits just above ours on the stack.
+ * 
+ * ftrace_return_trampoline is "returned to" in place of the original
+ * caller; it keeps the return value registers intact and jumps to the
+ * address ftrace_exit() hands back.
+ */
+__asm__(
+    ".text\n"
+    ".globl __fentry__\n"
+    ".type __fentry__, @function\n"
+    "__fentry__:\n"
+    "    push %rax\n"
+    "    push %rcx\n"
+    "    push %rdx\n"
+    "    push %rsi\n"
+    "    push %rdi\n"
+    "    push %r8\n"
+    "    push %r9\n"
+    "    push %r10\n"
+    "    push %r11\n"
+    "    sub $8, %rsp\n"                // Keep the stack 16-byte aligned
+    "    mov 80(%rsp), %rdi\n"          // Return address into the traced function
+    "    sub $5, %rdi\n"                // ... minus the call is the function itself
+    "    lea 88(%rsp), %rsi\n"          // Slot holding the traced function's return address
+    "    call ftrace_entry\n"
+    "    add $8, %rsp\n"
+    "    pop %r11\n"
+    "    pop %r10\n"
+    "    pop %r9\n"
+    "    pop %r8\n"
+    "    pop %rdi\n"
+    "    pop %rsi\n"
+    "    pop %rdx\n"
+    "    pop %rcx\n"
+    "    pop %rax\n"
+    "    ret\n"
+    ".size __fentry__, .-__fentry__\n"
+    "\n"
+    ".globl ftrace_return_trampoline\n"
+    ".type ftrace_return_trampoline, @function\n"
+    "ftrace_return_trampoline:\n"
+    "    push %rax\n"
+    "    push %rdx\n"
+    "    call ftrace_exit\n"
+    "    mov %rax, %r11\n"
+    "    pop %rdx\n"
+    "    pop %rax\n"
+    "    jmp *%r11\n"
+    ".size ftrace_return_trampoline, .-ftrace_return_trampoline\n"
+);
+
+/**
+ * @brief Append a record to the current CPU's ring
+ */
+static NOTRACE void ftrace_log(ftrace_cpu_t* state, unsigned int cpu, uint8_t type,
+                               uint64_t func, uint64_t data, uint64_t depth, uint64_t tsc) {
+    uint64_t pos = __atomic_fetch_add(&state->head, 1, __ATOMIC_RELAXED);
+    ftrace_record_t* rec = &state->records[pos & FTRACE_RING_MASK];
+    
+    rec->tsc = tsc;
+    rec->func = func;
+    rec->data = data;
+    rec->type = type;
+    rec->depth = (uint8_t)depth;
+    rec->cpu = (uint8_t)cpu;
+}
+
+/**
+ * @brief Called from __fentry__ on entry to a traced function
+ * 
+ * @param func Address of the traced function
+ * @param ret_slot Stack slot holding the function's return address
+ */
+NOTRACE void ftrace_entry(uint64_t func, uint64_t* ret_slot) {
+    if (ftrace_paused) {
+        return;
+    }
+    
+    uint64_t now = rdtsc();
+    unsigned int cpu = smp_processor_id();
+    ftrace_cpu_t* state = &ftrace_cpus[cpu];
+    
+    // Reserve a frame before filling it so a nested interrupt takes the next one
+    uint64_t depth = __atomic_fetch_add(&state->depth, 1, __ATOMIC_RELAXED);
+    if (depth >= FTRACE_MAX_DEPTH) {
+        // Too deep to time: log the call but leave the return alone
+        __atomic_fetch_sub(&state->depth, 1, __ATOMIC_RELAXED);
+        ftrace_log(state, cpu, FTRACE_ENTRY, func, *ret_slot, depth, now);
+        return;
+    }
+    
+    ftrace_frame_t* frame = &state->stack[depth];
+    frame->func = func;
+    frame->ret = *ret_slot;
+    frame->tsc = now;
+    
+    ftrace_log(state, cpu, FTRACE_ENTRY, func, frame->ret, depth, now);
+    *ret_slot = (uint64_t)ftrace_return_trampoline;
+}
+
+/**
+ * @brief Called from ftrace_return_trampoline when a traced function returns
+ * 
+ * @return Original return address to continue at
+ */
+NOTRACE uint64_t ftrace_exit(void) {
+    uint64_t now = rdtsc();
+    unsigned int cpu = smp_processor_id();
+    ftrace_cpu_t* state = &ftrace_cpus[cpu];
+    
+    uint64_t depth = state->depth - 1;
+    ftrace_frame_t* frame = &state->stack[depth];
+    uint64_t ret = frame->ret;
+    
+    ftrace_log(state, cpu, FTRACE_EXIT, frame->func, now - frame->tsc, depth, now);
+    
+    // Release the frame only after it has been read
+    __atomic_fetch_sub(&state->depth, 1, __ATOMIC_RELAXED);
+    return ret;
+}
+
+/**
+ * @brief Rewrite one patch site
+ * 
+ * The caller runs with interrupts disabled, so no CPU can be executing
+ * the site while its five bytes are replaced. Only the BSP runs today;
+ * with APs the sites would have to be patched under a rendezvous.
+ * 
+ * @param site Address of the patch site
+ * @param enable true for a call to __fentry__, false for the NOP
+ * @return true if the site was changed
+ */
+static NOTRACE bool ftrace_patch(uint8_t* site, bool enable) {
+    uint8_t insn[FTRACE_INSN_SIZE];
+    
+    if (enable) {
+        int32_t rel = (int32_t)((intptr_t)__fentry__ - (intptr_t)(site + FTRACE_INSN_SIZE));
+        insn[0] = 0xe8;
+        insn[1] = (uint8_t)rel;
+        insn[2] = (uint8_t)(rel >> 8);
+        insn[3] = (uint8_t)(rel >> 16);
+        insn[4] = (uint8_t)(rel >> 24);
+    } else {
+        for (int i = 0; i < FTRACE_INSN_SIZE; i++) {
+            insn[i] = ftrace_nop[i];
+        }
+    }
+    
+    bool changed = false;
+    for (int i = 0; i < FTRACE_INSN_SIZE; i++) {
+        if (site[i] != insn[i]) {
+            changed = true;
+        }
+    }
+    
+    if (changed) {
+        // Plain byte stores: memcpy is itself instrumented
+        volatile uint8_t* dst = site;
+        for (int i = 0; i < FTRACE_INSN_SIZE; i++) {
+            dst[i] = insn[i];
+        }
+    }
+    
+    return changed;
+}
+
+/**
+ * @brief Validate the patch sites recorded by the compiler
+ */
+void ftrace_init(void) {
+    size_t bad = 0;
+    
+    for (const uint64_t* loc = __start_mcount_loc; loc < __stop_mcount_loc; loc++) {
+        const uint8_t* site = (const uint8_t*)*loc;
+        for (int i = 0; i < FTRACE_INSN_SIZE; i++) {
+            if (site[i] != ftrace_nop[i]) {
+                bad++;
+                break;
+            }
+        }
+    }
+    
+    ftrace_reset();
+    
+    kprintf("ftrace: %llu patch sites", (unsigned long long)ftrace_site_count());
+    if (bad > 0) {
+        kprintf(", %llu not in the expected state", (unsigned long long)bad);
+    }
+    kprintf("\n");
+}
+
+/**
+ * @brief Enable or disable tracing of every function in an address range
+ * 
+ * @param start First address of the range
+ * @param end Address one past the end of the range
+ * @param enable true to patch in the tracer call, false to restore the NOP
+ * @return Number of sites changed
+ */
+size_t ftrace_set_range(uintptr_t start, uintptr_t end, bool enable) {
+    size_t changed = 0;
+    
+    uint64_t irq_flags = local_irq_save();
+    
+    for (const uint64_t* loc = __start_mcount_loc; loc < __stop_mcount_loc; loc++) {
+        if (*loc >= start && *loc < end && ftrace_patch((uint8_t*)*loc, enable)) {
+            changed++;
+        }
+    }
+    
+    local_irq_restore(irq_flags);
+    
+    return changed;
+}
+
+/**
+ * @brief Enable or disable tracing of one function
+ * 
+ * @param func Function to trace
+ * @param enable true to trace, false to stop
+ * @return true if the function has a patch site
+ */
+bool ftrace_set_function(void* func, bool enable) {
+    uintptr_t addr = (uintptr_t)func;
+    
+    for (const uint64_t* loc = __start_mcount_loc; loc < __stop_mcount_loc; loc++) {
+        if (*loc == addr) {
+            ftrace_set_range(addr, addr + 1, enable);
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Enable or disable tracing of every instrumented function
+ * 
+ * @param enable true to trace, false to stop
+ */
+void ftrace_set_all(bool enable) {
+    ftrace_set_range(0, UINTPTR_MAX, enable);
+}
+
+/**
+ * @brief Get the number of patch sites in the kernel image
+ * 
+ * @return Number of instrumented functions
+ */
+size_t ftrace_site_count(void) {
+    return (size_t)(__stop_mcount_loc - __start_mcount_loc);
+}
+
+/**
+ * @brief Discard all recorded calls
+ * 
+ * Outstanding hijacked returns are kept, since those functions still
+ * have to return through the trampoline.
+ */
+void ftrace_reset(void) {
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        ftrace_cpus[cpu].head = 0;
+    }
+}
+
+/**
+ * @brief Print a duration in microseconds with nanosecond precision
+ */
+static void ftrace_print_duration(uint64_t cycles) {
+    uint64_t ns = tsc_to_ns(cycles);
+    kprintf("%llu.%03llu us", ns / 1000, ns % 1000);
+}
+
+/**
+ * @brief Print the recorded call graph with durations
+ * 
+ * A call with nothing traced inside it is printed on a single line;
+ * otherwise its entry opens a block that its exit closes.
+ */
+void ftrace_dump(void) {
+    static const char indent[] = "                                                                ";
+    const size_t max_indent = sizeof(indent) - 1;
+    
+    ftrace_paused = true;
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        ftrace_cpu_t* state = &ftrace_cpus[cpu];
+        uint64_t head = state->head;
+        if (head == 0) {
+            continue;
+        }
+        
+        uint64_t first = (head > FTRACE_RING_RECORDS) ? head - FTRACE_RING_RECORDS : 0;
+        kprintf("ftrace: cpu%d, %llu records (%llu overwritten)\n", cpu, head - first, first);
+        
+        for (uint64_t pos = first; pos < head; pos++) {
+            const ftrace_record_t* rec = &state->records[pos & FTRACE_RING_MASK];
+            const ftrace_record_t* next = (pos + 1 < head) ?
+                &state->records[(pos + 1) & FTRACE_RING_MASK] : NULL;
+            
+            size_t depth = (size_t)rec->depth * 2;
+            const char* pad = indent + max_indent - (depth < max_indent ? depth : max_indent);
+            
+            char name[96];
+            const char* sym = ksym_lookup(rec->func, NULL);
+            if (sym != NULL) {
+                snprintf(name, sizeof(name), "%s", sym);
+            } else {
+                snprintf(name, sizeof(name), "0x%llx", rec->func);
+            }
+            
+            if (rec->type == FTRACE_ENTRY && next != NULL && next->type == FTRACE_EXIT &&
+                next->func == rec->func && next->depth == rec->depth) {
+                // Leaf call
+                kprintf("%s%s();  ", pad, name);
+                ftrace_print_duration(next->data);
+                kprintf("\n");
+                pos++;
+            } else if (rec->type == FTRACE_ENTRY) {
+                kprintf("%s%s() {\n", pad, name);
+            } else {
+                kprintf("%s}  ", pad);
+                ftrace_print_duration(rec->data);
+                kprintf("  /* %s */\n", name);
+            }
+        }
+    }
+    
+    ftrace_paused = false;
+}
+
+#endif /* CONFIG_FTRACE */
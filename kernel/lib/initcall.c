@@ -0,0 +1,235 @@
+/**
+ * @file initcall.c
+ * @brief Dependency-ordered initcalls
+ * 
+ * Subsystems register initcalls with INITCALL() instead of being called
+ * one after another from kernel_main(). The runner resolves the
+ * dependency names into a graph and executes it a wave at a time; every
+ * member of a wave only depends on earlier waves, so a wave can be spread
+ * over as many CPUs as are online and its wall-clock cost is that of its
+ * slowest member. The dispatcher runs a call on the CPU it is given and
+ * is the only place that needs to change once APs take work.
+ */
+
+#include "../include/kernel.h"
+#include "../include/initcall.h"
+#include "../include/boottime.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define INITCALL_MAX_DEPS   8           // Dependencies per initcall
+
+// Linker-provided bounds of the .initcall section
+extern const initcall_t __start_initcall[];
+extern const initcall_t __stop_initcall[];
+
+typedef enum {
+    INITCALL_PENDING,
+    INITCALL_DONE,
+    INITCALL_FAILED,
+    INITCALL_SKIPPED
+} initcall_state_t;
+
+typedef struct {
+    const initcall_t* call;
+    initcall_state_t state;
+    size_t dep_count;
+    uint16_t deps[INITCALL_MAX_DEPS];   // Indices into initcall_nodes
+} initcall_node_t;
+
+static initcall_node_t initcall_nodes[INITCALL_MAX];
+static size_t initcall_count = 0;
+
+// Initcalls dispatched but not yet finished
+static volatile uint32_t initcall_outstanding = 0;
+
+/**
+ * @brief Find an initcall by name
+ * 
+ * @param name Name to look up (not NUL-terminated)
+ * @param len Length of the name
+ * @return Index of the initcall, or -1 if there is none
+ */
+static int initcall_find(const char* name, size_t len) {
+    for (size_t i = 0; i < initcall_count; i++) {
+        const char* candidate = initcall_nodes[i].call->name;
+        if (strncmp(candidate, name, len) == 0 && candidate[len] == '\0') {
+            return (int)i;
+        }
+    }
+    
+    return -1;
+}
+
+/**
+ * @brief Resolve the dependency names of an initcall
+ * 
+ * @param node Initcall to resolve
+ * @return true if every dependency exists
+ */
+static bool initcall_resolve(initcall_node_t* node) {
+    const char* p = node->call->deps;
+    node->dep_count = 0;
+    
+    while (p != NULL && *p != '\0') {
+        if (*p == ' ') {
+            p++;
+            continue;
+        }
+        
+        size_t len = 0;
+        while (p[len] != '\0' && p[len] != ' ') {
+            len++;
+        }
+        
+        int dep = initcall_find(p, len);
+        if (dep < 0) {
+            kprintf("Initcall: %s has an unknown dependency in \"%s\"\n", node->call->name, node->call->deps);
+            return false;
+        }
+        if (node->dep_count >= INITCALL_MAX_DEPS) {
+            kprintf("Initcall: %s has too many dependencies\n", node->call->name);
+            return false;
+        }
+        
+        node->deps[node->dep_count++] = (uint16_t)dep;
+        p += len;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Run one initcall
+ * 
+ * Runs on the calling CPU for now; this is where a wave is fanned out to
+ * other CPUs once they are brought up.
+ * 
+ * @param node Initcall to run
+ */
+static void initcall_dispatch(initcall_node_t* node) {
+    __atomic_fetch_add(&initcall_outstanding, 1, __ATOMIC_RELAXED);
+    
+    int ret = node->call->fn();
+    if (ret < 0) {
+        kprintf("Initcall: %s failed (%d)\n", node->call->name, ret);
+    }
+    node->state = (ret < 0) ? INITCALL_FAILED : INITCALL_DONE;
+    boot_mark(node->call->name);
+    
+    __atomic_fetch_sub(&initcall_outstanding, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Run every registered initcall in dependency order
+ * 
+ * @return Number of initcalls that failed or were skipped
+ */
+int initcall_run_all(void) {
+    size_t total = (size_t)(__stop_initcall - __start_initcall);
+    if (total > INITCALL_MAX) {
+        kprintf("Initcall: %u initcalls registered, only running the first %u\n",
+                (unsigned int)total, INITCALL_MAX);
+        total = INITCALL_MAX;
+    }
+    
+    initcall_count = total;
+    for (size_t i = 0; i < total; i++) {
+        initcall_nodes[i].call = &__start_initcall[i];
+        initcall_nodes[i].state = INITCALL_PENDING;
+    }
+    
+    // Names must all be known before any dependency can be resolved
+    for (size_t i = 0; i < total; i++) {
+        if (!initcall_resolve(&initcall_nodes[i])) {
+            initcall_nodes[i].state = INITCALL_FAILED;
+        }
+    }
+    
+    size_t remaining = 0;
+    for (size_t i = 0; i < total; i++) {
+        if (initcall_nodes[i].state == INITCALL_PENDING) {
+            remaining++;
+        }
+    }
+    
+    int waves = 0;
+    uint16_t wave[INITCALL_MAX];
+    
+    while (remaining > 0) {
+        size_t ready = 0;
+        
+        // Collect the calls whose dependencies have all succeeded, and skip
+        // those that can no longer run
+        for (size_t i = 0; i < total; i++) {
+            initcall_node_t* node = &initcall_nodes[i];
+            if (node->state != INITCALL_PENDING) {
+                continue;
+            }
+            
+            bool blocked = false;
+            bool doomed = false;
+            for (size_t d = 0; d < node->dep_count; d++) {
+                initcall_state_t dep_state = initcall_nodes[node->deps[d]].state;
+                if (dep_state == INITCALL_PENDING) {
+                    blocked = true;
+                } else if (dep_state != INITCALL_DONE) {
+                    doomed = true;
+                }
+            }
+            
+            if (doomed) {
+                kprintf("Initcall: skipping %s, a dependency did not complete\n", node->call->name);
+                node->state = INITCALL_SKIPPED;
+                remaining--;
+            } else if (!blocked) {
+                wave[ready++] = (uint16_t)i;
+            }
+        }
+        
+        if (ready == 0) {
+            if (remaining == 0) {
+                break;
+            }
+            
+            // Everything left waits on something else that is left
+            for (size_t i = 0; i < total; i++) {
+                if (initcall_nodes[i].state == INITCALL_PENDING) {
+                    kprintf("Initcall: %s is part of a dependency cycle\n", initcall_nodes[i].call->name);
+                    initcall_nodes[i].state = INITCALL_FAILED;
+                }
+            }
+            break;
+        }
+        
+        // Members of a wave are independent of each other
+        for (size_t w = 0; w < ready; w++) {
+            initcall_dispatch(&initcall_nodes[wave[w]]);
+        }
+        initcall_wait_all();
+        
+        remaining -= ready;
+        waves++;
+    }
+    
+    int failed = 0;
+    for (size_t i = 0; i < total; i++) {
+        if (initcall_nodes[i].state != INITCALL_DONE) {
+            failed++;
+        }
+    }
+    
+    kprintf("Initcall: ran %u initcalls in %d waves, %d failed or skipped\n",
+            (unsigned int)total, waves, failed);
+    return failed;
+}
+
+/**
+ * @brief Wait until every dispatched initcall has finished
+ */
+void initcall_wait_all(void) {
+    while (__atomic_load_n(&initcall_outstanding, __ATOMIC_ACQUIRE) != 0) {
+        cpu_relax();
+    }
+}
@@ -0,0 +1,389 @@
+/**
+ * @file irqaffinity.c
+ * @brief Interrupt CPU affinity and balancing
+ * 
+ * Every vector has a set of allowed CPUs and a current destination. The
+ * balancer runs from the idle loop once per IRQ_BALANCE_INTERVAL_MS and
+ * charges each vector's handler time since the previous pass (from the
+ * irqstat duration sums) to the CPU it was delivered to. It then moves
+ * vectors whose consumer sits on another, less loaded CPU, and after
+ * that moves load from the busiest CPU to the least busy one until they
+ * are within an eighth of each other.
+ * 
+ * Moving a vector needs an interrupt controller that can retarget it,
+ * registered with irq_set_router(). Nothing does yet, since everything
+ * is still delivered through the legacy PIC, so every vector stays on
+ * the boot CPU until IOAPIC or MSI support registers routers.
+ */
+
+#include "../include/kernel.h"
+#include "../include/irqaffinity.h"
+#include "../include/irqstat.h"
+#include "../include/kstat.h"
+#include "../include/spinlock.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Per-vector state; all zeroes means any CPU, delivered to the boot CPU
+typedef struct {
+    irq_route_fn_t route;               // Controller hook, NULL if fixed
+    cpumask_t allowed;                  // Allowed CPUs, CPUMASK_NONE for any
+    uint8_t cpu;                        // Current destination
+    uint8_t consumer;                   // Consumer CPU, if has_consumer
+    bool has_consumer;
+    bool pinned;                        // Left alone by the balancer
+    uint64_t last_cycles;               // Handler cycles at the previous pass
+    uint64_t load;                      // Handler cycles during the last interval
+} irq_affinity_t;
+
+static irq_affinity_t irq_affinity[256];
+
+// CPUs that take interrupts
+static cpumask_t irq_online_mask = 1;
+
+// Load per CPU over the last interval, in handler cycles
+static uint64_t irq_cpu_load[MAX_CPUS];
+
+static uint64_t irq_balance_last_ms = 0;
+
+// Protects all of the above
+DEFINE_SPINLOCK(irq_affinity_lock);
+
+KSTAT_COUNTER(irq_migrations, "irq.migrations", "vectors moved to another CPU");
+
+/**
+ * @brief Get the online CPUs a vector may go to
+ */
+static cpumask_t irq_allowed(const irq_affinity_t* irq) {
+    cpumask_t allowed = irq->allowed != CPUMASK_NONE ? irq->allowed : CPUMASK_ALL;
+    return allowed & irq_online_mask;
+}
+
+/**
+ * @brief Find the least loaded CPU in a mask
+ * 
+ * @return CPU number, or -1 if the mask is empty
+ */
+static int irq_least_loaded(cpumask_t mask) {
+    int best = -1;
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpumask_test(mask, cpu) && (best < 0 || irq_cpu_load[cpu] < irq_cpu_load[best])) {
+            best = cpu;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Deliver a vector to another CPU
+ * 
+ * Moves its load along with it. Called with irq_affinity_lock held.
+ * 
+ * @return 0 on success, -1 if the vector cannot be delivered there
+ */
+static int irq_move(uint8_t vector, unsigned int cpu) {
+    irq_affinity_t* irq = &irq_affinity[vector];
+    
+    if (irq->cpu == cpu) {
+        return 0;
+    }
+    if (irq->route == NULL || irq->route(vector, cpu) != 0) {
+        return -1;
+    }
+    
+    irq_cpu_load[irq->cpu] -= irq->load;
+    irq_cpu_load[cpu] += irq->load;
+    irq->cpu = (uint8_t)cpu;
+    kstat_inc(irq_migrations);
+    return 0;
+}
+
+/**
+ * @brief Register the controller hook for a vector
+ * 
+ * @param vector Interrupt vector
+ * @param route Retargeting function, or NULL for a fixed destination
+ */
+void irq_set_router(uint8_t vector, irq_route_fn_t route) {
+    uint64_t flags = spin_lock_irqsave(&irq_affinity_lock);
+    irq_affinity[vector].route = route;
+    spin_unlock_irqrestore(&irq_affinity_lock, flags);
+}
+
+/**
+ * @brief Restrict the CPUs a vector may be delivered to
+ * 
+ * @param vector Interrupt vector
+ * @param mask Allowed CPUs (CPUMASK_ALL for any)
+ * @return 0 on success, -1 if no allowed CPU is online
+ */
+int irq_set_affinity(uint8_t vector, cpumask_t mask) {
+    irq_affinity_t* irq = &irq_affinity[vector];
+    int ret = 0;
+    
+    uint64_t flags = spin_lock_irqsave(&irq_affinity_lock);
+    
+    if ((mask & irq_online_mask) == CPUMASK_NONE) {
+        spin_unlock_irqrestore(&irq_affinity_lock, flags);
+        return -1;
+    }
+    
+    irq->allowed = mask & CPUMASK_ALL;
+    if (!cpumask_test(irq_allowed(irq), irq->cpu)) {
+        ret = irq_move(vector, (unsigned int)irq_least_loaded(irq_allowed(irq)));
+    }
+    
+    spin_unlock_irqrestore(&irq_affinity_lock, flags);
+    return ret;
+}
+
+/**
+ * @brief Get the CPUs a vector may be delivered to
+ * 
+ * @param vector Interrupt vector
+ * @return Allowed CPUs
+ */
+cpumask_t irq_get_affinity(uint8_t vector) {
+    cpumask_t allowed = irq_affinity[vector].allowed;
+    return allowed != CPUMASK_NONE ? allowed : CPUMASK_ALL;
+}
+
+/**
+ * @brief Get the CPU a vector is currently delivered to
+ * 
+ * @param vector Interrupt vector
+ * @return CPU number
+ */
+unsigned int irq_effective_cpu(uint8_t vector) {
+    return irq_affinity[vector].cpu;
+}
+
+/**
+ * @brief Pin a vector to a CPU
+ * 
+ * @param vector Interrupt vector
+ * @param cpu Destination CPU
+ * @return 0 on success, -1 if the CPU is offline or unreachable
+ */
+int irq_pin(uint8_t vector, unsigned int cpu) {
+    if (cpu >= MAX_CPUS) {
+        return -1;
+    }
+    
+    uint64_t flags = spin_lock_irqsave(&irq_affinity_lock);
+    
+    int ret = -1;
+    if (cpumask_test(irq_online_mask, cpu)) {
+        ret = irq_move(vector, cpu);
+    }
+    if (ret == 0) {
+        irq_affinity[vector].pinned = true;
+    }
+    
+    spin_unlock_irqrestore(&irq_affinity_lock, flags);
+    return ret;
+}
+
+/**
+ * @brief Hand a pinned vector back to the balancer
+ * 
+ * @param vector Interrupt vector
+ */
+void irq_unpin(uint8_t vector) {
+    uint64_t flags = spin_lock_irqsave(&irq_affinity_lock);
+    irq_affinity[vector].pinned = false;
+    spin_unlock_irqrestore(&irq_affinity_lock, flags);
+}
+
+/**
+ * @brief Name the CPU that consumes a vector's work
+ * 
+ * @param vector Interrupt vector
+ * @param cpu Consumer CPU, or -1 for none
+ */
+void irq_set_consumer_hint(uint8_t vector, int cpu) {
+    uint64_t flags = spin_lock_irqsave(&irq_affinity_lock);
+    irq_affinity[vector].has_consumer = cpu >= 0 && cpu < MAX_CPUS;
+    irq_affinity[vector].consumer = irq_affinity[vector].has_consumer ? (uint8_t)cpu : 0;
+    spin_unlock_irqrestore(&irq_affinity_lock, flags);
+}
+
+/**
+ * @brief Mark a CPU as able to take interrupts
+ * 
+ * @param cpu CPU number
+ */
+void irq_affinity_cpu_online(unsigned int cpu) {
+    if (cpu >= MAX_CPUS) {
+        return;
+    }
+    
+    uint64_t flags = spin_lock_irqsave(&irq_affinity_lock);
+    irq_online_mask |= cpumask_of(cpu);
+    spin_unlock_irqrestore(&irq_affinity_lock, flags);
+}
+
+/**
+ * @brief Charge each vector's handler time since the last pass to its CPU
+ */
+static void irq_balance_measure(void) {
+    irq_stats_t stats;
+    
+    memset(irq_cpu_load, 0, sizeof(irq_cpu_load));
+    
+    for (int vector = 32; vector < 256; vector++) {
+        irq_affinity_t* irq = &irq_affinity[vector];
+        uint64_t cycles = irq_stats_get((uint8_t)vector, &stats) ? stats.duration_sum : 0;
+        
+        // A statistics reset starts the sums over
+        irq->load = cycles >= irq->last_cycles ? cycles - irq->last_cycles : cycles;
+        irq->last_cycles = cycles;
+        irq_cpu_load[irq->cpu] += irq->load;
+    }
+}
+
+/**
+ * @brief Check whether the balancer may move a vector to a CPU
+ */
+static bool irq_movable(const irq_affinity_t* irq, int cpu) {
+    return !irq->pinned && irq->route != NULL && irq->load > 0 && cpu >= 0 &&
+           (unsigned int)cpu != irq->cpu && cpumask_test(irq_allowed(irq), cpu);
+}
+
+/**
+ * @brief Move vectors to their consumer's CPU where that costs no balance
+ * 
+ * @param budget Moves left in this pass
+ * @return Number of vectors moved
+ */
+static int irq_balance_locality(int budget) {
+    int moved = 0;
+    
+    for (int vector = 32; vector < 256 && moved < budget; vector++) {
+        irq_affinity_t* irq = &irq_affinity[vector];
+        if (!irq->has_consumer || !irq_movable(irq, irq->consumer)) {
+            continue;
+        }
+        
+        // Only if the consumer ends up no busier than the source was
+        if (irq_cpu_load[irq->consumer] + irq->load <= irq_cpu_load[irq->cpu] &&
+            irq_move((uint8_t)vector, irq->consumer) == 0) {
+            moved++;
+        }
+    }
+    return moved;
+}
+
+/**
+ * @brief Move one vector off the busiest CPU
+ * 
+ * Picks the vector that leaves the two CPUs closest to even.
+ * 
+ * @return true if a vector was moved
+ */
+static bool irq_balance_one(void) {
+    int busiest = -1;
+    int idlest = irq_least_loaded(irq_online_mask);
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpumask_test(irq_online_mask, cpu) && (busiest < 0 || irq_cpu_load[cpu] > irq_cpu_load[busiest])) {
+            busiest = cpu;
+        }
+    }
+    
+    uint64_t high = irq_cpu_load[busiest];
+    uint64_t low = irq_cpu_load[idlest];
+    if (busiest == idlest || high < IRQ_BALANCE_MIN_CYCLES || (high - low) * 8 < high) {
+        return false;
+    }
+    
+    int best = -1;
+    uint64_t best_gap = high - low;
+    
+    for (int vector = 32; vector < 256; vector++) {
+        irq_affinity_t* irq = &irq_affinity[vector];
+        if (irq->cpu != (unsigned int)busiest || !irq_movable(irq, idlest)) {
+            continue;
+        }
+        
+        // Moving must leave the pair closer to even than now
+        uint64_t from = high - irq->load;
+        uint64_t to = low + irq->load;
+        uint64_t gap = from > to ? from - to : to - from;
+        if (gap < best_gap) {
+            best_gap = gap;
+            best = vector;
+        }
+    }
+    
+    return best >= 0 && irq_move((uint8_t)best, (unsigned int)idlest) == 0;
+}
+
+/**
+ * @brief Run one balancing pass
+ * 
+ * @return Number of vectors moved
+ */
+int irq_balance(void) {
+    uint64_t flags = spin_lock_irqsave(&irq_affinity_lock);
+    
+    irq_balance_measure();
+    
+    int moved = irq_balance_locality(IRQ_BALANCE_MAX_MOVES);
+    while (moved < IRQ_BALANCE_MAX_MOVES && irq_balance_one()) {
+        moved++;
+    }
+    
+    spin_unlock_irqrestore(&irq_affinity_lock, flags);
+    return moved;
+}
+
+/**
+ * @brief Run a balancing pass if the interval has elapsed
+ */
+void irq_balance_poll(void) {
+    uint64_t now = timer_get_ms();
+    
+    if (now - irq_balance_last_ms < IRQ_BALANCE_INTERVAL_MS) {
+        return;
+    }
+    irq_balance_last_ms = now;
+    
+    irq_balance();
+}
+
+/**
+ * @brief Print every vector's affinity, destination and load
+ * 
+ * Reads without the lock, like the other debug dumps; a line may mix
+ * the states before and after a concurrent change.
+ */
+void irq_affinity_dump(void) {
+    kprintf("vector  cpu  allowed  consumer  pinned  routable  load cycles\n");
+    
+    for (int vector = 32; vector < 256; vector++) {
+        const irq_affinity_t* irq = &irq_affinity[vector];
+        if (irq->load == 0 && irq->route == NULL && !irq->pinned &&
+            irq->allowed == CPUMASK_NONE && !irq->has_consumer) {
+            continue;
+        }
+        
+        char consumer[8];
+        if (irq->has_consumer) {
+            snprintf(consumer, sizeof(consumer), "%u", irq->consumer);
+        } else {
+            strcpy(consumer, "-");
+        }
+        
+        kprintf("%6d %4u  %07x %9s %7s %9s  %llu\n", vector, irq->cpu, irq_get_affinity((uint8_t)vector),
+                consumer, irq->pinned ? "yes" : "no", irq->route ? "yes" : "no", irq->load);
+    }
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpumask_test(irq_online_mask, cpu)) {
+            kprintf("cpu%d: %llu cycles in handlers over the last interval\n", cpu, irq_cpu_load[cpu]);
+        }
+    }
+}
@@ -0,0 +1,167 @@
+/**
+ * @file irqsoff.c
+ * @brief Interrupts-off latency tracer
+ * 
+ * cli() and local_irq_save() call irqsoff_start() when they turn
+ * interrupts off, and sti() and local_irq_restore() call irqsoff_stop()
+ * just before turning them back on. Both run with interrupts disabled,
+ * so the per-CPU state needs no further protection. Each section's
+ * length goes into a log2 histogram; a new worst case also records where
+ * interrupts were disabled and re-enabled, and the stack at that point.
+ */
+
+#include "../include/kernel.h"
+#include "../include/irqsoff.h"
+#include "../include/stacktrace.h"
+#include "../include/ksyms.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Per-CPU tracer state
+typedef struct {
+    bool active;                        // Inside an interrupts-off section
+    uint64_t start_tsc;                 // TSC when interrupts went off
+    uintptr_t start_ip;                 // Where interrupts went off
+    
+    uint64_t max_cycles;                // Longest section seen
+    uintptr_t max_start_ip;             // ... where it started
+    uintptr_t max_end_ip;               // ... where it ended
+    size_t max_depth;                   // ... and the stack at its end
+    uint64_t max_trace[IRQSOFF_MAX_DEPTH];
+    
+    uint64_t hist[IRQSOFF_HIST_BUCKETS];
+} ALIGN(64) irqsoff_cpu_t;
+
+static irqsoff_cpu_t irqsoff_cpus[MAX_CPUS];
+
+DEFINE_STATIC_KEY_FALSE(irqsoff_key);
+
+/**
+ * @brief Called when interrupts are turned off
+ * 
+ * @param ip Call site
+ */
+void irqsoff_start(uintptr_t ip) {
+    irqsoff_cpu_t* state = &irqsoff_cpus[smp_processor_id()];
+    
+    // Nested cli() inside a section that is already being timed
+    if (state->active) {
+        return;
+    }
+    
+    state->active = true;
+    state->start_ip = ip;
+    state->start_tsc = rdtsc();
+}
+
+/**
+ * @brief Called just before interrupts are turned back on
+ * 
+ * @param ip Call site
+ */
+void irqsoff_stop(uintptr_t ip) {
+    uint64_t now = rdtsc();
+    irqsoff_cpu_t* state = &irqsoff_cpus[smp_processor_id()];
+    
+    if (!state->active) {
+        return;
+    }
+    state->active = false;
+    
+    uint64_t cycles = now - state->start_tsc;
+    int bucket = (cycles == 0) ? 0 : 63 - __builtin_clzll(cycles);
+    state->hist[bucket]++;
+    
+    if (cycles > state->max_cycles) {
+        state->max_cycles = cycles;
+        state->max_start_ip = state->start_ip;
+        state->max_end_ip = ip;
+        state->max_depth = stack_trace_save(state->max_trace, IRQSOFF_MAX_DEPTH);
+    }
+}
+
+/**
+ * @brief Start or stop measuring interrupts-off sections
+ * 
+ * @param enable true to start, false to stop
+ */
+void irqsoff_enable(bool enable) {
+    uint64_t irq_flags = local_irq_save();
+    
+    // Sections already in progress were not timed from their start
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        irqsoff_cpus[cpu].active = false;
+    }
+    static_key_set(&irqsoff_key, enable);
+    
+    local_irq_restore(irq_flags);
+}
+
+/**
+ * @brief Clear the recorded maximum and histogram
+ */
+void irqsoff_reset(void) {
+    uint64_t irq_flags = local_irq_save();
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        irqsoff_cpu_t* state = &irqsoff_cpus[cpu];
+        state->max_cycles = 0;
+        state->max_start_ip = 0;
+        state->max_end_ip = 0;
+        state->max_depth = 0;
+        memset(state->hist, 0, sizeof(state->hist));
+    }
+    
+    local_irq_restore(irq_flags);
+}
+
+/**
+ * @brief Get the longest interrupts-off section seen so far
+ * 
+ * @return Duration in nanoseconds
+ */
+uint64_t irqsoff_max_ns(void) {
+    uint64_t max = 0;
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (irqsoff_cpus[cpu].max_cycles > max) {
+            max = irqsoff_cpus[cpu].max_cycles;
+        }
+    }
+    
+    return tsc_to_ns(max);
+}
+
+/**
+ * @brief Print the worst case and the latency histogram
+ */
+void irqsoff_dump(void) {
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        irqsoff_cpu_t* state = &irqsoff_cpus[cpu];
+        if (state->max_cycles == 0) {
+            continue;
+        }
+        
+        char start[96];
+        char end[96];
+        ksym_format(start, sizeof(start), state->max_start_ip);
+        ksym_format(end, sizeof(end), state->max_end_ip);
+        
+        uint64_t ns = tsc_to_ns(state->max_cycles);
+        kprintf("irqsoff: cpu%d max %llu.%03llu us, disabled at %s, enabled at %s\n",
+                cpu, ns / 1000, ns % 1000, start, end);
+        stack_trace_print(state->max_trace, state->max_depth);
+        
+        kprintf("irqsoff: cpu%d latency histogram\n", cpu);
+        for (int bucket = 0; bucket < IRQSOFF_HIST_BUCKETS; bucket++) {
+            if (state->hist[bucket] == 0) {
+                continue;
+            }
+            
+            uint64_t lo = tsc_to_ns(1ULL << bucket);
+            uint64_t hi = tsc_to_ns(bucket < 63 ? (1ULL << (bucket + 1)) : ~0ULL);
+            kprintf("  %10llu - %10llu ns: %llu\n", lo, hi, state->hist[bucket]);
+        }
+    }
+}
@@ -0,0 +1,196 @@
+/**
+ * @file irqstat.c
+ * @brief Per-vector interrupt statistics
+ * 
+ * Each CPU keeps its own statistics, written only from its interrupt
+ * dispatcher, so recording needs no locking. Slots are handed out to
+ * vectors the first time they fire on a CPU; vectors beyond the slot
+ * limit are counted as overflow.
+ */
+
+#include "../include/kernel.h"
+#include "../include/irqstat.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Per-CPU statistics
+typedef struct {
+    uint8_t slot_of[256];               // Vector -> slot + 1, 0 if unassigned
+    uint32_t used;                      // Slots handed out
+    uint64_t overflow;                  // Interrupts on vectors without a slot
+    irq_stats_t slots[IRQSTAT_SLOTS];
+} ALIGN(64) irqstat_cpu_t;
+
+static irqstat_cpu_t irqstat_cpus[MAX_CPUS];
+
+/**
+ * @brief Get the log2 histogram bucket for a cycle count
+ */
+static inline int irqstat_bucket(uint64_t cycles) {
+    int bucket = (cycles == 0) ? 0 : 63 - __builtin_clzll(cycles);
+    return (bucket < IRQSTAT_BUCKETS) ? bucket : IRQSTAT_BUCKETS - 1;
+}
+
+/**
+ * @brief Account one interrupt
+ * 
+ * @param vector Interrupt vector
+ * @param entry_tsc TSC taken in the entry stub
+ * @param start_tsc TSC just before the handler ran
+ * @param end_tsc TSC just after the handler returned
+ */
+void irq_stats_record(uint8_t vector, uint64_t entry_tsc, uint64_t start_tsc, uint64_t end_tsc) {
+    irqstat_cpu_t* cpu = &irqstat_cpus[smp_processor_id()];
+    
+    uint8_t slot = cpu->slot_of[vector];
+    if (slot == 0) {
+        if (cpu->used == IRQSTAT_SLOTS) {
+            cpu->overflow++;
+            return;
+        }
+        slot = (uint8_t)++cpu->used;
+        cpu->slot_of[vector] = slot;
+    }
+    
+    irq_stats_t* stats = &cpu->slots[slot - 1];
+    uint64_t latency = start_tsc - entry_tsc;
+    uint64_t duration = end_tsc - start_tsc;
+    
+    if (stats->count == 0) {
+        stats->first_tsc = entry_tsc;
+    }
+    stats->count++;
+    stats->last_tsc = entry_tsc;
+    
+    stats->latency_sum += latency;
+    if (latency > stats->latency_max) {
+        stats->latency_max = latency;
+    }
+    stats->latency_hist[irqstat_bucket(latency)]++;
+    
+    stats->duration_sum += duration;
+    if (duration > stats->duration_max) {
+        stats->duration_max = duration;
+    }
+    stats->duration_hist[irqstat_bucket(duration)]++;
+}
+
+/**
+ * @brief Get the statistics for a vector, summed over all CPUs
+ * 
+ * @param vector Interrupt vector
+ * @param stats Where to store the statistics
+ * @return true if the vector has fired since the last reset
+ */
+bool irq_stats_get(uint8_t vector, irq_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    
+    for (int i = 0; i < MAX_CPUS; i++) {
+        irqstat_cpu_t* cpu = &irqstat_cpus[i];
+        uint8_t slot = cpu->slot_of[vector];
+        if (slot == 0) {
+            continue;
+        }
+        
+        const irq_stats_t* src = &cpu->slots[slot - 1];
+        if (src->count == 0) {
+            continue;
+        }
+        
+        if (stats->count == 0 || src->first_tsc < stats->first_tsc) {
+            stats->first_tsc = src->first_tsc;
+        }
+        if (src->last_tsc > stats->last_tsc) {
+            stats->last_tsc = src->last_tsc;
+        }
+        stats->count += src->count;
+        
+        stats->latency_sum += src->latency_sum;
+        stats->duration_sum += src->duration_sum;
+        if (src->latency_max > stats->latency_max) {
+            stats->latency_max = src->latency_max;
+        }
+        if (src->duration_max > stats->duration_max) {
+            stats->duration_max = src->duration_max;
+        }
+        
+        for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+            stats->latency_hist[b] += src->latency_hist[b];
+            stats->duration_hist[b] += src->duration_hist[b];
+        }
+    }
+    
+    return stats->count != 0;
+}
+
+/**
+ * @brief Get a vector's average rate since it first fired
+ * 
+ * @param stats Statistics from irq_stats_get()
+ * @return Interrupts per second
+ */
+uint64_t irq_stats_rate(const irq_stats_t* stats) {
+    if (stats->count < 2) {
+        return 0;
+    }
+    
+    uint64_t ns = tsc_to_ns(stats->last_tsc - stats->first_tsc);
+    if (ns == 0) {
+        return 0;
+    }
+    
+    return ((stats->count - 1) * 1000000000ULL) / ns;
+}
+
+/**
+ * @brief Clear all statistics
+ */
+void irq_stats_reset(void) {
+    uint64_t irq_flags = local_irq_save();
+    memset(irqstat_cpus, 0, sizeof(irqstat_cpus));
+    local_irq_restore(irq_flags);
+}
+
+/**
+ * @brief Print one histogram, skipping empty buckets
+ */
+static void irq_stats_print_hist(const char* name, const uint32_t* hist) {
+    kprintf("    %s:", name);
+    for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+        if (hist[b] != 0) {
+            kprintf(" <%lluns:%u", tsc_to_ns(2ULL << b), hist[b]);
+        }
+    }
+    kprintf("\n");
+}
+
+/**
+ * @brief Print a summary line and histograms for every active vector
+ */
+void irq_stats_dump(void) {
+    irq_stats_t stats;
+    uint64_t overflow = 0;
+    
+    kprintf("vector      count     rate/s  avg lat ns  max lat ns  avg dur ns  max dur ns\n");
+    
+    for (int vector = 0; vector < 256; vector++) {
+        if (!irq_stats_get((uint8_t)vector, &stats)) {
+            continue;
+        }
+        
+        kprintf("%6d %10llu %10llu %11llu %11llu %11llu %11llu\n",
+                vector, stats.count, irq_stats_rate(&stats),
+                tsc_to_ns(stats.latency_sum / stats.count), tsc_to_ns(stats.latency_max),
+                tsc_to_ns(stats.duration_sum / stats.count), tsc_to_ns(stats.duration_max));
+        irq_stats_print_hist("latency", stats.latency_hist);
+        irq_stats_print_hist("duration", stats.duration_hist);
+    }
+    
+    for (int i = 0; i < MAX_CPUS; i++) {
+        overflow += irqstat_cpus[i].overflow;
+    }
+    if (overflow > 0) {
+        kprintf("irqstat: %llu interrupts on untracked vectors\n", overflow);
+    }
+}
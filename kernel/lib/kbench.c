@@ -0,0 +1,370 @@
+/**
+ * @file kbench.c
+ * @brief In-kernel microbenchmarks
+ * 
+ * Built into every kernel, run on boot by the kbench flavour
+ * ("build.sh release kbench"). Every benchmark is a function that
+ * performs a fixed number of operations; it is timed with the TSC as a
+ * whole, so cheap operations are batched to keep the cost of reading the
+ * TSC out of the result. Samples are sorted to report percentiles, which
+ * makes the occasional SMI or cache-cold outlier visible without letting
+ * it move the median.
+ */
+
+#include "../include/kernel.h"
+#include "../include/kbench.h"
+#include "../include/memory.h"
+#include "../include/klog.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KBENCH_VERSION       1
+#define KBENCH_IRQ_VECTOR    47                 // IRQ15 slot, idle without an ATA driver
+#define KBENCH_MAP_VIRT      0xFFFFFFFFC0000000 // Scratch window for map_pages
+#define KBENCH_MAP_PAGES     16
+#define KBENCH_COPY_SIZE     4096
+#define KBENCH_MIXED_OBJECTS 32
+#define KBENCH_PEER_STACK    8192
+
+typedef struct {
+    const char* name;
+    void (*run)(void);                  // Performs ops operations
+    uint32_t ops;                       // Operations per run
+} kbench_t;
+
+static uint64_t kbench_samples[KBENCH_SAMPLES];
+
+// Buffers shared by the benchmarks
+static uint8_t* kbench_src;
+static uint8_t* kbench_dst;
+static uintptr_t kbench_map_phys;
+
+// Allocations that failed during the current benchmark
+static uint64_t kbench_alloc_failures;
+
+/**
+ * @brief Read the TSC once all earlier instructions have completed
+ */
+static inline uint64_t kbench_now(void) {
+    __asm__ volatile("lfence" : : : "memory");
+    return rdtsc();
+}
+
+/**
+ * @brief Allocate and free single physical pages
+ */
+static void bench_page_alloc(void) {
+    for (int i = 0; i < 8; i++) {
+        uintptr_t page = alloc_physical_page();
+        if (page == 0) {
+            kbench_alloc_failures++;
+            continue;
+        }
+        free_physical_page(page);
+    }
+}
+
+/**
+ * @brief Allocate and free a contiguous run of physical pages
+ */
+static void bench_pages_alloc_16(void) {
+    uintptr_t pages = alloc_physical_pages(16);
+    if (pages == 0) {
+        kbench_alloc_failures++;
+        return;
+    }
+    free_physical_pages(pages, 16);
+}
+
+/**
+ * @brief Allocate and free small heap blocks
+ */
+static void bench_kmalloc_64(void) {
+    for (int i = 0; i < 8; i++) {
+        void* ptr = kmalloc(64);
+        if (ptr == NULL) {
+            kbench_alloc_failures++;
+        }
+        kfree(ptr);
+    }
+}
+
+/**
+ * @brief Allocate and free a page-sized heap block
+ */
+static void bench_kmalloc_4k(void) {
+    void* ptr = kmalloc(4096);
+    if (ptr == NULL) {
+        kbench_alloc_failures++;
+    }
+    kfree(ptr);
+}
+
+/**
+ * @brief Allocate a mix of sizes, then free them out of order
+ */
+static void bench_kmalloc_mixed(void) {
+    static const size_t sizes[] = { 16, 200, 48, 1024, 32, 512, 96, 4000 };
+    void* objects[KBENCH_MIXED_OBJECTS];
+    
+    for (int i = 0; i < KBENCH_MIXED_OBJECTS; i++) {
+        objects[i] = kmalloc(sizes[i % ARRAY_SIZE(sizes)]);
+        if (objects[i] == NULL) {
+            kbench_alloc_failures++;
+        }
+    }
+    
+    // Free out of allocation order to exercise coalescing
+    for (int i = 0; i < KBENCH_MIXED_OBJECTS; i += 2) {
+        kfree(objects[i]);
+    }
+    for (int i = KBENCH_MIXED_OBJECTS - 1; i > 0; i -= 2) {
+        kfree(objects[i]);
+    }
+}
+
+/**
+ * @brief Map and unmap a run of pages in a scratch window
+ */
+static void bench_map_pages_16(void) {
+    map_pages(kbench_map_phys, KBENCH_MAP_VIRT, KBENCH_MAP_PAGES, PTE_PRESENT | PTE_WRITABLE);
+    unmap_pages(KBENCH_MAP_VIRT, KBENCH_MAP_PAGES);
+}
+
+/**
+ * @brief Copy a page
+ */
+static void bench_memcpy_4k(void) {
+    for (int i = 0; i < 4; i++) {
+        memcpy(kbench_dst, kbench_src, KBENCH_COPY_SIZE);
+    }
+}
+
+/**
+ * @brief Fill a page
+ */
+static void bench_memset_4k(void) {
+    for (int i = 0; i < 4; i++) {
+        memset(kbench_dst, i, KBENCH_COPY_SIZE);
+    }
+}
+
+/*
+ * Context switch. There is no scheduler yet, so this measures the part
+ * every switch will pay: saving the callee-saved registers, swapping
+ * stacks and restoring the other context's registers. The benchmark
+ * ping-pongs with a peer context that switches straight back.
+ */
+
+// Switch stacks: saves callee-saved registers, stores the stack pointer
+// in *from, loads to and restores the registers saved there
+void kbench_switch(uint64_t* from, uint64_t to);
+
+__asm__(
+    ".text\n"
+    ".global kbench_switch\n"
+    "kbench_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+);
+
+static uint64_t kbench_main_rsp;
+static uint64_t kbench_peer_rsp;
+static uint8_t kbench_peer_stack[KBENCH_PEER_STACK] ALIGN(16);
+
+/**
+ * @brief Peer context: hand control straight back on every switch
+ */
+static void NORETURN kbench_peer(void) {
+    for (;;) {
+        kbench_switch(&kbench_peer_rsp, kbench_main_rsp);
+    }
+}
+
+/**
+ * @brief Build the peer's initial stack so the first switch enters kbench_peer
+ */
+static void kbench_peer_init(void) {
+    uint64_t* sp = (uint64_t*)(kbench_peer_stack + KBENCH_PEER_STACK);
+    
+    *--sp = 0;                          // Return address of kbench_peer (never used)
+    *--sp = (uint64_t)kbench_peer;      // Where the first switch returns to
+    for (int i = 0; i < 6; i++) {
+        *--sp = 0;                      // rbp (ends stack walks), rbx, r12-r15
+    }
+    kbench_peer_rsp = (uint64_t)sp;
+}
+
+/**
+ * @brief Switch to the peer and back
+ */
+static void bench_ctx_switch(void) {
+    for (int i = 0; i < 8; i++) {
+        kbench_switch(&kbench_main_rsp, kbench_peer_rsp);
+    }
+}
+
+/**
+ * @brief Handler for the round-trip vector
+ * 
+ * @param ctx Interrupted context
+ * @param cookie Unused
+ * @return IRQ_HANDLED
+ */
+static int kbench_irq_handler(irq_context_t* ctx, void* cookie) {
+    (void)ctx;
+    (void)cookie;
+    return IRQ_HANDLED;
+}
+
+/**
+ * @brief Raise a software interrupt
+ * 
+ * It goes through the same stub, irq_common and interrupt_handler() as a
+ * device interrupt, minus the PIC.
+ */
+static void bench_irq_roundtrip(void) {
+    for (int i = 0; i < 8; i++) {
+        __asm__ volatile("int %0" : : "i"(KBENCH_IRQ_VECTOR) : "memory");
+    }
+}
+
+static const kbench_t kbench_suite[] = {
+    { "page_alloc",      bench_page_alloc,     8 },
+    { "pages_alloc_16",  bench_pages_alloc_16, 1 },
+    { "kmalloc_64",      bench_kmalloc_64,     8 },
+    { "kmalloc_4k",      bench_kmalloc_4k,     1 },
+    { "kmalloc_mixed",   bench_kmalloc_mixed,  KBENCH_MIXED_OBJECTS * 2 },
+    { "map_pages_16",    bench_map_pages_16,   1 },
+    { "memcpy_4k",       bench_memcpy_4k,      4 },
+    { "memset_4k",       bench_memset_4k,      4 },
+    { "ctx_switch",      bench_ctx_switch,     16 },
+    { "irq_roundtrip",   bench_irq_roundtrip,  8 },
+};
+
+/**
+ * @brief Sort samples in place (insertion sort; the array is small)
+ */
+static void kbench_sort(uint64_t* samples, size_t count) {
+    for (size_t i = 1; i < count; i++) {
+        uint64_t value = samples[i];
+        size_t j = i;
+        while (j > 0 && samples[j - 1] > value) {
+            samples[j] = samples[j - 1];
+            j--;
+        }
+        samples[j] = value;
+    }
+}
+
+/**
+ * @brief Run one benchmark and write its JSON object
+ * 
+ * Interrupts stay off while sampling, so ticks do not land in the results.
+ */
+static void kbench_one(serial_port_t* port, const kbench_t* bench, bool first) {
+    uint64_t irq_flags = local_irq_save();
+    
+    kbench_alloc_failures = 0;
+    for (int i = 0; i < KBENCH_WARMUP; i++) {
+        bench->run();
+    }
+    
+    for (int i = 0; i < KBENCH_SAMPLES; i++) {
+        uint64_t start = kbench_now();
+        bench->run();
+        kbench_samples[i] = kbench_now() - start;
+    }
+    
+    local_irq_restore(irq_flags);
+    
+    kbench_sort(kbench_samples, KBENCH_SAMPLES);
+    
+    uint64_t total = 0;
+    for (int i = 0; i < KBENCH_SAMPLES; i++) {
+        total += kbench_samples[i];
+    }
+    
+    // Everything is reported in cycles per operation
+    uint64_t ops = bench->ops;
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf),
+                       "%s{\"name\":\"%s\",\"ops\":%llu,\"mean\":%llu,\"min\":%llu,"
+                       "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu,\"failed\":%llu}",
+                       first ? "" : ",", bench->name, ops,
+                       total / (KBENCH_SAMPLES * ops),
+                       kbench_samples[0] / ops,
+                       kbench_samples[KBENCH_SAMPLES / 2] / ops,
+                       kbench_samples[KBENCH_SAMPLES * 90 / 100] / ops,
+                       kbench_samples[KBENCH_SAMPLES * 99 / 100] / ops,
+                       kbench_samples[KBENCH_SAMPLES - 1] / ops,
+                       kbench_alloc_failures);
+    if (len >= (int)sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    serial_write(port, buf, (size_t)len);
+}
+
+/**
+ * @brief Run every microbenchmark and report the results
+ * 
+ * @param port Serial port to write to
+ */
+void kbench_run(serial_port_t* port) {
+    if (port == NULL || !serial_is_initialized(port)) {
+        return;
+    }
+    
+    kbench_src = kmalloc(KBENCH_COPY_SIZE);
+    kbench_dst = kmalloc(KBENCH_COPY_SIZE);
+    kbench_map_phys = alloc_physical_pages(KBENCH_MAP_PAGES);
+    if (kbench_src == NULL || kbench_dst == NULL || kbench_map_phys == 0) {
+        kprintf("kbench: out of memory\n");
+        if (kbench_map_phys != 0) {
+            free_physical_pages(kbench_map_phys, KBENCH_MAP_PAGES);
+        }
+        kfree(kbench_dst);
+        kfree(kbench_src);
+        return;
+    }
+    memset(kbench_src, 0xA5, KBENCH_COPY_SIZE);
+    
+    kbench_peer_init();
+    request_irq(KBENCH_IRQ_VECTOR, kbench_irq_handler, 0, "kbench", NULL);
+    
+    // Keep log text from being interleaved with the report
+    klog_drain(0);
+    
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "KBENCH {\"version\":%d,\"tsc_khz\":%llu,\"results\":[",
+                       KBENCH_VERSION, tsc_get_khz());
+    serial_write(port, buf, (size_t)len);
+    
+    for (size_t i = 0; i < ARRAY_SIZE(kbench_suite); i++) {
+        kbench_one(port, &kbench_suite[i], i == 0);
+    }
+    
+    serial_write(port, "]}\n", 3);
+    
+    // The caller may leave QEMU right after this
+    serial_flush(port);
+    
+    free_irq(KBENCH_IRQ_VECTOR, NULL);
+    free_physical_pages(kbench_map_phys, KBENCH_MAP_PAGES);
+    kfree(kbench_dst);
+    kfree(kbench_src);
+}
@@ -0,0 +1,303 @@
+/**
+ * @file klog.c
+ * @brief Kernel log ring buffer
+ * 
+ * kprintf output is appended to a per-CPU ring of timestamped records
+ * instead of being written to the console and serial port synchronously.
+ * Producers reserve slots with a single atomic add and publish them by
+ * storing the record's sequence number, so logging from interrupt
+ * context never waits on a device. The rings are drained to the output
+ * sinks from the idle loop, and synchronously on panic.
+ * 
+ * Output is only deferred once boot is complete (klog_start()). Until
+ * then kprintf writes synchronously, so a boot that hangs or resets
+ * without a panic still shows how far it got.
+ */
+
+#include "../include/kernel.h"
+#include "../include/klog.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KLOG_RING_MASK      (KLOG_RING_RECORDS - 1)
+
+// Drain from the writer's context once a ring is this full
+#define KLOG_BACKPRESSURE   ((KLOG_RING_RECORDS * 3) / 4)
+
+// Per-CPU log ring
+typedef struct {
+    volatile uint64_t head;             // Next position to reserve (producer side)
+    uint64_t tail;                      // Next position to read (consumer side)
+    bool line_start;                    // Next emitted byte starts a new line
+    bool has_pending;                   // pending holds the record at tail
+    klog_record_t pending;              // Record copied out for timestamp merging
+    klog_record_t records[KLOG_RING_RECORDS];
+} ALIGN(64) klog_ring_t;
+
+static klog_ring_t klog_rings[MAX_CPUS];
+
+// Whether kprintf output is deferred to the rings
+static volatile bool klog_async = false;
+
+// Set while a context is draining the rings
+static volatile uint32_t klog_drain_busy = 0;
+
+// Records lost because a ring wrapped before it was drained
+static uint64_t klog_dropped = 0;
+
+/**
+ * @brief Initialize the kernel log
+ * 
+ * kprintf output stays synchronous until klog_start().
+ */
+void klog_init(void) {
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        klog_ring_t* ring = &klog_rings[cpu];
+        ring->head = 0;
+        ring->tail = 0;
+        ring->line_start = true;
+        ring->has_pending = false;
+        
+        for (int i = 0; i < KLOG_RING_RECORDS; i++) {
+            ring->records[i].seq = 0;
+        }
+    }
+    
+    klog_dropped = 0;
+    klog_async = false;
+}
+
+/**
+ * @brief Start deferring kprintf output to the rings
+ */
+void klog_start(void) {
+    klog_async = true;
+}
+
+/**
+ * @brief Check whether kprintf output is being deferred to the ring
+ * 
+ * @return true if output goes to the ring, false if written synchronously
+ */
+bool klog_is_async(void) {
+    return klog_async;
+}
+
+/**
+ * @brief Append text to the current CPU's ring
+ * 
+ * @param text Text to append
+ * @param len Length of the text in bytes
+ */
+void klog_write(const char* text, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    
+    // Anything that cannot fit in one lap of the ring is truncated
+    size_t count = DIV_ROUND_UP(len, KLOG_TEXT_MAX);
+    if (count > KLOG_RING_RECORDS) {
+        count = KLOG_RING_RECORDS;
+        len = count * KLOG_TEXT_MAX;
+    }
+    
+    unsigned int cpu = smp_processor_id();
+    klog_ring_t* ring = &klog_rings[cpu];
+    
+    // Reserve all records at once so a message stays contiguous even if
+    // an interrupt logs in the middle of it
+    uint64_t pos = __atomic_fetch_add(&ring->head, count, __ATOMIC_RELAXED);
+    uint64_t timestamp = rdtsc();
+    
+    for (size_t i = 0; i < count; i++) {
+        klog_record_t* rec = &ring->records[(pos + i) & KLOG_RING_MASK];
+        size_t chunk = (len > KLOG_TEXT_MAX) ? KLOG_TEXT_MAX : len;
+        
+        // Invalidate the slot before overwriting it
+        __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        
+        rec->timestamp = timestamp;
+        rec->len = (uint16_t)chunk;
+        rec->cpu = (uint8_t)cpu;
+        rec->flags = (i > 0) ? KLOG_FLAG_CONT : 0;
+        memcpy(rec->text, text, chunk);
+        
+        // Publish
+        __atomic_store_n(&rec->seq, pos + i + 1, __ATOMIC_RELEASE);
+        
+        text += chunk;
+        len -= chunk;
+    }
+    
+    // Keep the ring from wrapping during log-heavy stretches outside interrupts
+    if (!in_interrupt() && (pos + count) - ring->tail >= KLOG_BACKPRESSURE) {
+        klog_drain(0);
+    }
+}
+
+/**
+ * @brief Copy the record at a ring's tail into its pending slot
+ * 
+ * Skips records that were overwritten before they could be read.
+ * 
+ * @param ring Ring to read from
+ * @return true if a committed record is pending, false if the ring is empty
+ *         or the next record is still being written
+ */
+static bool klog_fetch(klog_ring_t* ring) {
+    if (ring->has_pending) {
+        return true;
+    }
+    
+    for (;;) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (ring->tail == head) {
+            return false;
+        }
+        
+        // The producer lapped us: everything older than one ring is gone
+        if (head - ring->tail > KLOG_RING_RECORDS) {
+            klog_dropped += (head - KLOG_RING_RECORDS) - ring->tail;
+            ring->tail = head - KLOG_RING_RECORDS;
+            ring->line_start = true;
+        }
+        
+        klog_record_t* rec = &ring->records[ring->tail & KLOG_RING_MASK];
+        uint64_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        
+        if (seq != ring->tail + 1) {
+            if (seq > ring->tail + 1) {
+                // Already reused for a newer record
+                klog_dropped++;
+                ring->tail++;
+                continue;
+            }
+            
+            // Reserved but not yet committed
+            return false;
+        }
+        
+        memcpy(&ring->pending, rec, sizeof(klog_record_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        
+        // Discard the copy if the slot was reused while we read it
+        if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != seq) {
+            klog_dropped++;
+            ring->tail++;
+            continue;
+        }
+        
+        ring->has_pending = true;
+        return true;
+    }
+}
+
+/**
+ * @brief Emit a record to the output sinks
+ * 
+ * Each line gets a "[seconds.micros]" prefix taken from the record's
+ * timestamp.
+ * 
+ * @param ring Ring the record belongs to
+ * @param rec Record to emit
+ */
+static void klog_emit(klog_ring_t* ring, const klog_record_t* rec) {
+    const char* text = rec->text;
+    size_t len = rec->len;
+    
+    while (len > 0) {
+        if (ring->line_start) {
+            char prefix[32];
+            uint64_t us = tsc_to_ns(rec->timestamp) / 1000;
+            int n = snprintf(prefix, sizeof(prefix), "[%5llu.%06llu] ",
+                             us / 1000000, us % 1000000);
+            kprintf_write_sinks(prefix, (size_t)n);
+            ring->line_start = false;
+        }
+        
+        // Emit up to and including the next newline
+        size_t chunk = 0;
+        while (chunk < len && text[chunk] != '\n') {
+            chunk++;
+        }
+        if (chunk < len) {
+            chunk++;
+            ring->line_start = true;
+        }
+        
+        kprintf_write_sinks(text, chunk);
+        text += chunk;
+        len -= chunk;
+    }
+}
+
+/**
+ * @brief Drain pending records to the output sinks
+ * 
+ * @param max_records Maximum number of records to emit (0 for no limit)
+ * @return Number of records emitted
+ */
+size_t klog_drain(size_t max_records) {
+    if (__atomic_exchange_n(&klog_drain_busy, 1, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    
+    size_t emitted = 0;
+    
+    while (max_records == 0 || emitted < max_records) {
+        klog_ring_t* oldest = NULL;
+        
+        // Merge the rings by timestamp
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            klog_ring_t* ring = &klog_rings[cpu];
+            if (!klog_fetch(ring)) {
+                continue;
+            }
+            if (oldest == NULL || ring->pending.timestamp < oldest->pending.timestamp) {
+                oldest = ring;
+            }
+        }
+        
+        if (oldest == NULL) {
+            break;
+        }
+        
+        klog_emit(oldest, &oldest->pending);
+        oldest->has_pending = false;
+        oldest->tail++;
+        emitted++;
+    }
+    
+    if (emitted > 0) {
+        kprintf_flush_sinks();
+    }
+    
+    __atomic_store_n(&klog_drain_busy, 0, __ATOMIC_RELEASE);
+    return emitted;
+}
+
+/**
+ * @brief Flush everything synchronously and stop deferring output
+ */
+void klog_panic_flush(void) {
+    klog_async = false;
+    
+    // Whoever held the drain is not coming back
+    klog_drain_busy = 0;
+    klog_drain(0);
+    
+    if (klog_dropped > 0) {
+        kprintf("klog: %llu records were dropped\n", klog_dropped);
+    }
+}
+
+/**
+ * @brief Get the number of records lost to ring overruns
+ * 
+ * @return Number of dropped records since boot
+ */
+uint64_t klog_get_dropped(void) {
+    return klog_dropped;
+}
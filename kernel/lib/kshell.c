@@ -0,0 +1,456 @@
+/**
+ * @file kshell.c
+ * @brief Serial debug shell
+ * 
+ * A line-oriented command shell on the serial debug port, polled from
+ * the idle loop, for looking at the kernel while it runs:
+ * 
+ *   stats [prefix]     list statistics
+ *   snap               remember the current values
+ *   diff [prefix]      show the change since the last snap
+ *   scrape             print every statistic as one JSON line
+ *   lockstat [reset]   lock contention statistics
+ *   irqstat [reset]    per-vector interrupt statistics
+ *   irqaff [...]       interrupt affinity (see kshell_irqaff())
+ *   profile [...]      sampling profiler (start, stop, dump)
+ *   trace [...]        binary event trace (see kshell_trace())
+ *   ftrace [...]       function-entry tracer (see kshell_ftrace())
+ *   irqsoff [...]      interrupts-off latency tracer
+ * 
+ * scrape is meant for monitoring: it writes a single line prefixed with
+ * "KSTAT " that a host-side collector (scripts/kstat_scrape.py) can
+ * pick out of the console stream, and needs no snap of its own.
+ */
+
+#include "../include/kernel.h"
+#include "../include/kshell.h"
+#include "../include/kstat.h"
+#include "../include/lockstat.h"
+#include "../include/irqstat.h"
+#include "../include/irqaffinity.h"
+#include "../include/profile.h"
+#include "../include/trace.h"
+#include "../include/ftrace.h"
+#include "../include/irqsoff.h"
+#include "../include/ksyms.h"
+#include "../include/klog.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KSHELL_PROMPT        "dsos> "
+#define KSHELL_MAX_ARGS      8
+
+typedef struct {
+    const char* name;
+    void (*run)(serial_port_t* port, int argc, char** argv);
+    const char* help;
+} kshell_cmd_t;
+
+// Line being typed
+static char kshell_line[KSHELL_LINE_MAX];
+static size_t kshell_len = 0;
+static bool kshell_prompted = false;
+static bool kshell_after_cr = false;            // Swallow the LF of a CR LF
+
+// Values remembered by "snap"
+static uint64_t kshell_snap[KSTAT_MAX];
+static uint64_t kshell_snap_ms = 0;
+static bool kshell_snap_valid = false;
+
+/**
+ * @brief Check whether a name starts with a prefix (NULL matches all)
+ */
+static bool kshell_match(const char* name, const char* prefix) {
+    return prefix == NULL || strncmp(name, prefix, strlen(prefix)) == 0;
+}
+
+/**
+ * @brief stats [prefix]: list statistics with their descriptions
+ */
+static void kshell_stats(serial_port_t* port, int argc, char** argv) {
+    const char* prefix = argc > 1 ? argv[1] : NULL;
+    
+    for (size_t i = 0; i < kstat_count(); i++) {
+        const kstat_t* stat = kstat_get(i);
+        if (kshell_match(stat->name, prefix)) {
+            serial_printf(port, "%s %llu  (%s%s)\n", stat->name, kstat_read(stat),
+                          stat->type == KSTAT_TYPE_COUNTER ? "counter: " : "gauge: ", stat->desc);
+        }
+    }
+}
+
+/**
+ * @brief snap: remember the current value of every statistic
+ */
+static void kshell_snapshot(serial_port_t* port, int argc, char** argv) {
+    (void)argc; (void)argv;
+    
+    for (size_t i = 0; i < kstat_count(); i++) {
+        kshell_snap[i] = kstat_read(kstat_get(i));
+    }
+    kshell_snap_ms = timer_get_ms();
+    kshell_snap_valid = true;
+    
+    serial_printf(port, "snapshot of %llu statistics taken\n", (uint64_t)kstat_count());
+}
+
+/**
+ * @brief diff [prefix]: show what changed since the last snap
+ * 
+ * Counters also show their rate over the interval.
+ */
+static void kshell_diff(serial_port_t* port, int argc, char** argv) {
+    const char* prefix = argc > 1 ? argv[1] : NULL;
+    
+    if (!kshell_snap_valid) {
+        serial_printf(port, "no snapshot, run snap first\n");
+        return;
+    }
+    
+    uint64_t elapsed_ms = timer_get_ms() - kshell_snap_ms;
+    serial_printf(port, "%llu ms since snap\n", elapsed_ms);
+    
+    for (size_t i = 0; i < kstat_count(); i++) {
+        const kstat_t* stat = kstat_get(i);
+        if (!kshell_match(stat->name, prefix)) {
+            continue;
+        }
+        
+        uint64_t now = kstat_read(stat);
+        uint64_t then = kshell_snap[i];
+        if (stat->type == KSTAT_TYPE_COUNTER) {
+            uint64_t delta = now - then;
+            serial_printf(port, "%s +%llu (%llu/s)\n", stat->name, delta,
+                          elapsed_ms ? delta * 1000 / elapsed_ms : 0);
+        } else if (now >= then) {
+            serial_printf(port, "%s %llu (+%llu)\n", stat->name, now, now - then);
+        } else {
+            serial_printf(port, "%s %llu (-%llu)\n", stat->name, now, then - now);
+        }
+    }
+}
+
+/**
+ * @brief scrape: every statistic as one machine-readable line
+ */
+static void kshell_scrape(serial_port_t* port, int argc, char** argv) {
+    (void)argc; (void)argv;
+    char buf[160];
+    int len;
+    
+    len = snprintf(buf, sizeof(buf), "KSTAT {\"uptime_ms\":%llu,\"tsc\":%llu,\"stats\":{",
+                   timer_get_ms(), rdtsc());
+    serial_write(port, buf, (size_t)len);
+    
+    for (size_t i = 0; i < kstat_count(); i++) {
+        const kstat_t* stat = kstat_get(i);
+        len = snprintf(buf, sizeof(buf), "%s\"%s\":%llu", i == 0 ? "" : ",",
+                       stat->name, kstat_read(stat));
+        if (len >= (int)sizeof(buf)) {
+            len = sizeof(buf) - 1;
+        }
+        serial_write(port, buf, (size_t)len);
+    }
+    
+    serial_write(port, "}}\r\n", 4);
+}
+
+/**
+ * @brief lockstat [reset]: print or clear lock statistics
+ */
+static void kshell_lockstat(serial_port_t* port, int argc, char** argv) {
+    (void)port;
+    
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        lockstat_reset();
+        return;
+    }
+    lockstat_dump();
+}
+
+/**
+ * @brief irqstat [reset]: print or clear interrupt statistics
+ */
+static void kshell_irqstat(serial_port_t* port, int argc, char** argv) {
+    (void)port;
+    
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        irq_stats_reset();
+        return;
+    }
+    irq_stats_dump();
+}
+
+/**
+ * @brief Parse a decimal number
+ * 
+ * @return true if the whole string was a number no larger than max
+ */
+static bool kshell_parse_uint(const char* str, unsigned int max, unsigned int* value) {
+    unsigned int result = 0;
+    
+    if (*str == '\0') {
+        return false;
+    }
+    for (; *str != '\0'; str++) {
+        if (*str < '0' || *str > '9') {
+            return false;
+        }
+        result = result * 10 + (unsigned int)(*str - '0');
+        if (result > max) {
+            return false;
+        }
+    }
+    
+    *value = result;
+    return true;
+}
+
+/**
+ * @brief irqaff: show or change interrupt affinity
+ * 
+ *   irqaff                   list vectors and per-CPU load
+ *   irqaff pin <vec> <cpu>   pin a vector to a CPU
+ *   irqaff unpin <vec>       hand a vector back to the balancer
+ *   irqaff balance           run a balancing pass now
+ */
+static void kshell_irqaff(serial_port_t* port, int argc, char** argv) {
+    unsigned int vector, cpu;
+    
+    if (argc == 1) {
+        irq_affinity_dump();
+    } else if (strcmp(argv[1], "balance") == 0) {
+        serial_printf(port, "%d vectors moved\n", irq_balance());
+    } else if (strcmp(argv[1], "pin") == 0 && argc == 4 &&
+               kshell_parse_uint(argv[2], 255, &vector) && kshell_parse_uint(argv[3], MAX_CPUS - 1, &cpu)) {
+        if (irq_pin((uint8_t)vector, cpu) != 0) {
+            serial_printf(port, "vector %u cannot be delivered to cpu%u\n", vector, cpu);
+        }
+    } else if (strcmp(argv[1], "unpin") == 0 && argc == 3 && kshell_parse_uint(argv[2], 255, &vector)) {
+        irq_unpin((uint8_t)vector);
+    } else {
+        serial_printf(port, "usage: irqaff [pin <vec> <cpu> | unpin <vec> | balance]\n");
+    }
+}
+
+/**
+ * @brief profile start|stop|dump: sampling profiler
+ * 
+ * dump writes the DSPROF1 report for scripts/profile_fold.py.
+ */
+static void kshell_profile(serial_port_t* port, int argc, char** argv) {
+    if (argc == 2 && strcmp(argv[1], "start") == 0) {
+        profile_start();
+    } else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        profile_stop();
+    } else if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+        profile_dump(port);
+    } else {
+        serial_printf(port, "usage: profile start|stop|dump\n");
+    }
+}
+
+/**
+ * @brief trace: binary event tracing
+ * 
+ *   trace start [event...]   record the named events, or all of them
+ *   trace stop               stop recording
+ *   trace reset              discard recorded events
+ *   trace dump               write the DSTRACE1 stream for
+ *                            scripts/trace_decode.py
+ */
+static void kshell_trace(serial_port_t* port, int argc, char** argv) {
+    if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+        uint64_t mask = 0;
+        for (int i = 2; i < argc; i++) {
+            int id = trace_event_lookup(argv[i]);
+            if (id < 0) {
+                serial_printf(port, "unknown event '%s'\n", argv[i]);
+                return;
+            }
+            mask |= 1ULL << id;
+        }
+        trace_start(mask);
+    } else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        trace_stop();
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        trace_reset();
+    } else if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+        trace_dump(port);
+        serial_write_str(port, "\n");
+    } else {
+        serial_printf(port, "usage: trace start [event...] | stop | reset | dump\n");
+    }
+}
+
+/**
+ * @brief ftrace: function-entry tracing (ftrace builds only)
+ * 
+ *   ftrace                   show the number of patch sites
+ *   ftrace <func>            trace a function
+ *   ftrace all               trace every instrumented function
+ *   ftrace off [func]        stop tracing a function, or everything
+ *   ftrace reset             discard recorded calls
+ *   ftrace dump              print the recorded call graph
+ */
+static void kshell_ftrace(serial_port_t* port, int argc, char** argv) {
+    if (ftrace_site_count() == 0) {
+        serial_printf(port, "kernel built without ftrace (build.sh ... ftrace)\n");
+        return;
+    }
+    
+    bool enable = true;
+    const char* func = argc > 1 ? argv[1] : NULL;
+    
+    if (argc == 1) {
+        serial_printf(port, "%llu patch sites\n", (uint64_t)ftrace_site_count());
+        return;
+    } else if (argc == 2 && strcmp(func, "all") == 0) {
+        ftrace_set_all(true);
+        return;
+    } else if (argc == 2 && strcmp(func, "reset") == 0) {
+        ftrace_reset();
+        return;
+    } else if (argc == 2 && strcmp(func, "dump") == 0) {
+        ftrace_dump();
+        return;
+    } else if (strcmp(func, "off") == 0) {
+        if (argc == 2) {
+            ftrace_set_all(false);
+            return;
+        }
+        enable = false;
+        func = argv[2];
+    } else if (argc != 2) {
+        serial_printf(port, "usage: ftrace [<func> | all | off [func] | reset | dump]\n");
+        return;
+    }
+    
+    size_t size;
+    uintptr_t addr = ksym_find(func, &size);
+    if (addr == 0) {
+        serial_printf(port, "no symbol '%s'\n", func);
+    } else if (ftrace_set_range(addr, addr + size, enable) == 0 && enable) {
+        serial_printf(port, "%s is not instrumented\n", func);
+    }
+}
+
+/**
+ * @brief irqsoff [on|off|reset|dump]: interrupts-off latency tracer
+ * 
+ * With no argument, prints the longest section seen so far.
+ */
+static void kshell_irqsoff(serial_port_t* port, int argc, char** argv) {
+    if (argc == 1) {
+        serial_printf(port, "max %llu ns\n", irqsoff_max_ns());
+    } else if (argc == 2 && strcmp(argv[1], "on") == 0) {
+        irqsoff_enable(true);
+    } else if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        irqsoff_enable(false);
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        irqsoff_reset();
+    } else if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+        irqsoff_dump();
+    } else {
+        serial_printf(port, "usage: irqsoff [on|off|reset|dump]\n");
+    }
+}
+
+static void kshell_help(serial_port_t* port, int argc, char** argv);
+
+static const kshell_cmd_t kshell_cmds[] = {
+    { "help",     kshell_help,     "list commands" },
+    { "stats",    kshell_stats,    "[prefix] list statistics" },
+    { "snap",     kshell_snapshot, "remember the current values" },
+    { "diff",     kshell_diff,     "[prefix] show changes since snap" },
+    { "scrape",   kshell_scrape,   "print all statistics as one KSTAT JSON line" },
+    { "lockstat", kshell_lockstat, "[reset] lock contention statistics" },
+    { "irqstat",  kshell_irqstat,  "[reset] interrupt statistics" },
+    { "irqaff",   kshell_irqaff,   "[pin <vec> <cpu> | unpin <vec> | balance] interrupt affinity" },
+    { "profile",  kshell_profile,  "start|stop|dump sampling profiler" },
+    { "trace",    kshell_trace,    "start [event...] | stop | reset | dump event trace" },
+    { "ftrace",   kshell_ftrace,   "[<func> | all | off [func] | reset | dump] function tracer" },
+    { "irqsoff",  kshell_irqsoff,  "[on|off|reset|dump] interrupts-off latency" },
+};
+
+/**
+ * @brief help: list commands
+ */
+static void kshell_help(serial_port_t* port, int argc, char** argv) {
+    (void)argc; (void)argv;
+    
+    for (size_t i = 0; i < ARRAY_SIZE(kshell_cmds); i++) {
+        serial_printf(port, "%s %s\n", kshell_cmds[i].name, kshell_cmds[i].help);
+    }
+}
+
+/**
+ * @brief Split a command line into words and run the command
+ */
+static void kshell_execute(serial_port_t* port, char* line) {
+    char* argv[KSHELL_MAX_ARGS];
+    char* save = NULL;
+    int argc = 0;
+    
+    for (char* word = strtok_r(line, " \t", &save); word != NULL && argc < KSHELL_MAX_ARGS;
+         word = strtok_r(NULL, " \t", &save)) {
+        argv[argc++] = word;
+    }
+    if (argc == 0) {
+        return;
+    }
+    
+    for (size_t i = 0; i < ARRAY_SIZE(kshell_cmds); i++) {
+        if (strcmp(argv[0], kshell_cmds[i].name) == 0) {
+            kshell_cmds[i].run(port, argc, argv);
+            return;
+        }
+    }
+    serial_printf(port, "unknown command '%s', try help\n", argv[0]);
+}
+
+/**
+ * @brief Handle pending input on the debug port
+ * 
+ * @param port Serial port the shell runs on
+ */
+void kshell_poll(serial_port_t* port) {
+    if (port == NULL || !serial_is_initialized(port)) {
+        return;
+    }
+    
+    if (!kshell_prompted) {
+        serial_write_str(port, KSHELL_PROMPT);
+        kshell_prompted = true;
+    }
+    
+    int c;
+    while ((c = serial_read_char(port)) >= 0) {
+        bool after_cr = kshell_after_cr;
+        kshell_after_cr = (c == '\r');
+        
+        if (c == '\n' && after_cr) {
+            continue;
+        }
+        
+        if (c == '\r' || c == '\n') {
+            serial_write_str(port, "\n");
+            kshell_line[kshell_len] = '\0';
+            kshell_len = 0;
+            kshell_execute(port, kshell_line);
+            
+            // Commands that print through kprintf finish before the prompt
+            klog_drain(0);
+            serial_write_str(port, KSHELL_PROMPT);
+        } else if (c == '\b' || c == 0x7F) {
+            if (kshell_len > 0) {
+                kshell_len--;
+                serial_write_str(port, "\b \b");
+            }
+        } else if (c >= ' ' && c < 0x7F && kshell_len < KSHELL_LINE_MAX - 1) {
+            kshell_line[kshell_len++] = (char)c;
+            serial_write_char(port, (char)c);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/**
+ * @file kstat.c
+ * @brief Named kernel statistics
+ * 
+ * Subsystems define counters and gauges next to the code they describe
+ * with KSTAT_COUNTER() and KSTAT_GAUGE(); the linker collects the
+ * descriptors into the .kstat section, so there is no registration step
+ * and the set is fixed at build time. Counters are only summed over the
+ * CPUs when read, which keeps updates to a plain add on a local line.
+ */
+
+#include "../include/kernel.h"
+#include "../include/kstat.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Statistic descriptors, collected by the linker
+extern const kstat_t __start_kstat[];
+extern const kstat_t __stop_kstat[];
+
+/**
+ * @brief Get the number of registered statistics
+ * 
+ * @return Number of statistics
+ */
+size_t kstat_count(void) {
+    size_t count = (size_t)(__stop_kstat - __start_kstat);
+    return count < KSTAT_MAX ? count : KSTAT_MAX;
+}
+
+/**
+ * @brief Get a statistic by index
+ * 
+ * @param index Index below kstat_count()
+ * @return Descriptor, or NULL if out of range
+ */
+const kstat_t* kstat_get(size_t index) {
+    if (index >= kstat_count()) {
+        return NULL;
+    }
+    return &__start_kstat[index];
+}
+
+/**
+ * @brief Find a statistic by name
+ * 
+ * @param name Dotted name
+ * @return Descriptor, or NULL if there is none
+ */
+const kstat_t* kstat_find(const char* name) {
+    for (size_t i = 0; i < kstat_count(); i++) {
+        if (strcmp(__start_kstat[i].name, name) == 0) {
+            return &__start_kstat[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Read a statistic's current value
+ * 
+ * @param stat Statistic to read
+ * @return Counter sum over all CPUs, or the gauge's value
+ */
+uint64_t kstat_read(const kstat_t* stat) {
+    if (stat->type == KSTAT_TYPE_GAUGE) {
+        return stat->read ? stat->read() : 0;
+    }
+    
+    uint64_t sum = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        sum += stat->counter->cpu[cpu].value;
+    }
+    return sum;
+}
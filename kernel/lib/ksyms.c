@@ -0,0 +1,130 @@
+/**
+ * @file ksyms.c
+ * @brief Embedded kernel symbol table
+ */
+
+#include "../include/kernel.h"
+#include "../include/ksyms.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Table bounds from the linker script; empty on the first link pass
+extern const uint8_t __ksyms_start[];
+extern const uint8_t __ksyms_end[];
+
+/**
+ * @brief Get the table header if a valid table is present
+ * 
+ * @return Table header, or NULL
+ */
+static const ksyms_header_t* ksyms_table(void) {
+    size_t size = (size_t)(__ksyms_end - __ksyms_start);
+    if (size < sizeof(ksyms_header_t)) {
+        return NULL;
+    }
+    
+    const ksyms_header_t* header = (const ksyms_header_t*)__ksyms_start;
+    if (header->magic != KSYMS_MAGIC || header->count < 2 ||
+        sizeof(ksyms_header_t) + header->count * sizeof(ksyms_entry_t) > size) {
+        return NULL;
+    }
+    
+    return header;
+}
+
+/**
+ * @brief Check whether a symbol table was linked in
+ * 
+ * @return true if lookups can succeed
+ */
+bool ksym_available(void) {
+    return ksyms_table() != NULL;
+}
+
+/**
+ * @brief Find the function containing an address
+ * 
+ * @param addr Address to look up
+ * @param offset Where to store the offset into the function (may be NULL)
+ * @return Function name, or NULL if the address is not in kernel text
+ */
+const char* ksym_lookup(uintptr_t addr, uintptr_t* offset) {
+    const ksyms_header_t* header = ksyms_table();
+    if (header == NULL || addr < header->base) {
+        return NULL;
+    }
+    
+    const ksyms_entry_t* entries = (const ksyms_entry_t*)(header + 1);
+    const char* names = (const char*)(entries + header->count);
+    uint64_t rel = addr - header->base;
+    
+    // Past the end-of-text sentinel
+    if (rel >= entries[header->count - 1].offset) {
+        return NULL;
+    }
+    
+    // Last entry whose offset is <= rel
+    uint32_t lo = 0;
+    uint32_t hi = header->count - 1;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].offset <= rel) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    if (offset) {
+        *offset = rel - entries[lo].offset;
+    }
+    return names + entries[lo].name;
+}
+
+/**
+ * @brief Find a function by name
+ * 
+ * @param name Function name
+ * @param size Where to store the function's size in bytes (may be NULL)
+ * @return Function address, or 0 if there is no such symbol
+ */
+uintptr_t ksym_find(const char* name, size_t* size) {
+    const ksyms_header_t* header = ksyms_table();
+    if (header == NULL) {
+        return 0;
+    }
+    
+    const ksyms_entry_t* entries = (const ksyms_entry_t*)(header + 1);
+    const char* names = (const char*)(entries + header->count);
+    
+    // Names are not sorted; the table is only searched this way by hand
+    for (uint32_t i = 0; i < header->count - 1; i++) {
+        if (strcmp(names + entries[i].name, name) == 0) {
+            if (size) {
+                *size = entries[i + 1].offset - entries[i].offset;
+            }
+            return header->base + entries[i].offset;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Format an address as "name+0xoffset"
+ * 
+ * @param buffer Output buffer
+ * @param size Size of the output buffer
+ * @param addr Address to format
+ * @return Number of characters written, excluding the terminator
+ */
+int ksym_format(char* buffer, size_t size, uintptr_t addr) {
+    uintptr_t offset;
+    const char* name = ksym_lookup(addr, &offset);
+    
+    if (name == NULL) {
+        return snprintf(buffer, size, "0x%llx", (unsigned long long)addr);
+    }
+    return snprintf(buffer, size, "%s+0x%llx", name, (unsigned long long)offset);
+}
@@ -0,0 +1,164 @@
+/**
+ * @file lockstat.c
+ * @brief Lock contention statistics
+ * 
+ * Built with the lockstat flavour ("build.sh release lockstat"). Lock
+ * classes are found through the .lockclass section; each CPU accounts
+ * into its own copy of a class's statistics, which are only summed when
+ * they are read. Contention sites are tracked per CPU in a small table
+ * that evicts the least frequent site, so the busiest ones survive
+ * without a table per call site.
+ */
+
+#include "../include/kernel.h"
+#include "../include/lockstat.h"
+#include "../include/ksyms.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef CONFIG_LOCKSTAT
+
+// Lock classes defined with LOCK_CLASS(), collected by the linker
+extern lock_class_t* const __start_lockclass[];
+extern lock_class_t* const __stop_lockclass[];
+
+// Contention sites printed per class
+#define LOCKSTAT_DUMP_SITES  4
+
+/**
+ * @brief Account a wait for a contended lock
+ * 
+ * @param cls Class of the lock
+ * @param wait Cycles spent waiting
+ * @param site Address of the contended spin_lock()
+ */
+void lockstat_contended(lock_class_t* cls, uint64_t wait, uintptr_t site) {
+    lockstat_t* stats = &cls->cpu[smp_processor_id()].stats;
+    lockstat_site_t* victim = &stats->sites[0];
+    
+    stats->contentions++;
+    stats->wait_total += wait;
+    if (wait > stats->wait_max) {
+        stats->wait_max = wait;
+    }
+    
+    for (int i = 0; i < LOCKSTAT_SITES; i++) {
+        if (stats->sites[i].site == site) {
+            stats->sites[i].count++;
+            return;
+        }
+        if (stats->sites[i].count < victim->count) {
+            victim = &stats->sites[i];
+        }
+    }
+    
+    // A new site inherits the evicted count, so it must earn its place
+    victim->site = site;
+    victim->count++;
+}
+
+/**
+ * @brief Add a site count to a merged site table
+ */
+static void lockstat_merge_site(lockstat_site_t* sites, size_t* used, const lockstat_site_t* site) {
+    for (size_t i = 0; i < *used; i++) {
+        if (sites[i].site == site->site) {
+            sites[i].count += site->count;
+            return;
+        }
+    }
+    sites[(*used)++] = *site;
+}
+
+/**
+ * @brief Sum a class's statistics over all CPUs
+ * 
+ * @param cls Lock class
+ * @param stats Where to store the statistics
+ */
+void lockstat_get(lock_class_t* cls, lockstat_t* stats) {
+    lockstat_site_t sites[LOCKSTAT_SITES * MAX_CPUS];
+    size_t used = 0;
+    
+    memset(stats, 0, sizeof(*stats));
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        const lockstat_t* c = &cls->cpu[cpu].stats;
+        
+        stats->acquisitions += c->acquisitions;
+        stats->contentions += c->contentions;
+        stats->wait_total += c->wait_total;
+        stats->hold_total += c->hold_total;
+        if (c->wait_max > stats->wait_max) {
+            stats->wait_max = c->wait_max;
+        }
+        if (c->hold_max > stats->hold_max) {
+            stats->hold_max = c->hold_max;
+        }
+        
+        for (int i = 0; i < LOCKSTAT_SITES; i++) {
+            if (c->sites[i].count != 0) {
+                lockstat_merge_site(sites, &used, &c->sites[i]);
+            }
+        }
+    }
+    
+    // Selection sort of the busiest sites into the result
+    for (size_t i = 0; i < LOCKSTAT_SITES && i < used; i++) {
+        size_t best = i;
+        for (size_t j = i + 1; j < used; j++) {
+            if (sites[j].count > sites[best].count) {
+                best = j;
+            }
+        }
+        lockstat_site_t tmp = sites[i];
+        sites[i] = sites[best];
+        sites[best] = tmp;
+        stats->sites[i] = sites[i];
+    }
+}
+
+/**
+ * @brief Clear the statistics of every lock class
+ */
+void lockstat_reset(void) {
+    uint64_t irq_flags = local_irq_save();
+    
+    for (lock_class_t* const* cls = __start_lockclass; cls < __stop_lockclass; cls++) {
+        memset((*cls)->cpu, 0, sizeof((*cls)->cpu));
+    }
+    
+    local_irq_restore(irq_flags);
+}
+
+/**
+ * @brief Print the statistics of every lock class that has been taken
+ */
+void lockstat_dump(void) {
+    lockstat_t stats;
+    
+    kprintf("  acquired  contended  avg wait ns  max wait ns  avg hold ns  max hold ns  class\n");
+    
+    for (lock_class_t* const* cls = __start_lockclass; cls < __stop_lockclass; cls++) {
+        lockstat_get(*cls, &stats);
+        if (stats.acquisitions == 0) {
+            continue;
+        }
+        
+        kprintf("%10llu %10llu %12llu %12llu %12llu %12llu  %s\n",
+                stats.acquisitions, stats.contentions,
+                tsc_to_ns(stats.contentions ? stats.wait_total / stats.contentions : 0),
+                tsc_to_ns(stats.wait_max),
+                tsc_to_ns(stats.hold_total / stats.acquisitions),
+                tsc_to_ns(stats.hold_max), (*cls)->name);
+        
+        for (int i = 0; i < LOCKSTAT_DUMP_SITES && stats.sites[i].count != 0; i++) {
+            char site[64];
+            ksym_format(site, sizeof(site), stats.sites[i].site);
+            kprintf("%21llu  contended at %s\n", stats.sites[i].count, site);
+        }
+    }
+}
+
+#endif /* CONFIG_LOCKSTAT */
@@ -4,6 +4,7 @@
  */
 
 #include "../include/kernel.h"
+#include "../include/klog.h"
 #include <stdarg.h>
 #include <stdbool.h>
 
@@ -52,8 +53,12 @@ void panic(int type, const char* msg, const char* file, int line) {
     // Disable interrupts
     disable_interrupts();
     
-    // Switch to console output mode
-    kprintf_set_mode(PRINTF_MODE_BOTH);
+    // Push out buffered log records and write synchronously from here on
+    serial_panic_flush();
+    klog_panic_flush();
+    
+    // Add the console and serial port to whatever sinks are active
+    kprintf_set_mode(kprintf_get_mode() | PRINTF_MODE_BOTH);
     
     // If we have a framebuffer, draw screen with appropriate color
     if (fb_ready && framebuffer_base != NULL) {
@@ -131,8 +136,12 @@ void kassertf(bool condition, const char* file, int line, const char* fmt, ...)
     // Disable interrupts
     disable_interrupts();
     
-    // Switch to console output mode
-    kprintf_set_mode(PRINTF_MODE_BOTH);
+    // Push out buffered log records and write synchronously from here on
+    serial_panic_flush();
+    klog_panic_flush();
+    
+    // Add the console and serial port to whatever sinks are active
+    kprintf_set_mode(kprintf_get_mode() | PRINTF_MODE_BOTH);
     
     // If we have a framebuffer, draw blue screen
     if (fb_ready && framebuffer_base != NULL) {
@@ -180,8 +189,12 @@ void hos_breach(const char* reason, uintptr_t addr) {
     // Disable interrupts
     disable_interrupts();
     
-    // Switch to console output mode
-    kprintf_set_mode(PRINTF_MODE_BOTH);
+    // Push out buffered log records and write synchronously from here on
+    serial_panic_flush();
+    klog_panic_flush();
+    
+    // Add the console and serial port to whatever sinks are active
+    kprintf_set_mode(kprintf_get_mode() | PRINTF_MODE_BOTH);
     
     // If we have a framebuffer, draw red screen
     if (fb_ready && framebuffer_base != NULL) {
@@ -270,9 +283,14 @@ static void fill_screen(uint32_t color) {
         return;
     }
     
-    uint32_t* fb = (uint32_t*)framebuffer_base;
-    for (uint32_t i = 0; i < framebuffer_width * framebuffer_height; i++) {
-        fb[i] = color;
+    if (fbcon_is_active()) {
+        // Panic text goes through the console, so let it paint
+        fbcon_clear(color);
+    } else {
+        uint32_t* fb = (uint32_t*)framebuffer_base;
+        for (uint32_t i = 0; i < framebuffer_width * framebuffer_height; i++) {
+            fb[i] = color;
+        }
     }
     
     // Reset terminal position
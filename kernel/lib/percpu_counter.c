@@ -0,0 +1,70 @@
+/**
+ * @file percpu_counter.c
+ * @brief Scalable per-CPU counters
+ * 
+ * Updates stay in the updating CPU's cache line until they add up to the
+ * counter's batch, so the hot paths of the allocators never write a line
+ * shared with another CPU. Only the slow operations here walk all CPUs.
+ */
+
+#include "../include/kernel.h"
+#include "../include/percpu_counter.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Compute the exact value
+ * 
+ * @param counter Counter to read
+ * @return Current value
+ */
+int64_t percpu_counter_sum(const percpu_counter_t* counter) {
+    int64_t sum = percpu_counter_read(counter);
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        sum += counter->cpu[cpu].delta;
+    }
+    return sum;
+}
+
+/**
+ * @brief Set a counter, discarding all unfolded deltas
+ * 
+ * @param counter Counter to set
+ * @param value New value
+ */
+void percpu_counter_set(percpu_counter_t* counter, int64_t value) {
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        counter->cpu[cpu].delta = 0;
+    }
+    __atomic_store_n(&counter->count, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Compare a counter against a value
+ * 
+ * @param counter Counter to compare
+ * @param value Value to compare with
+ * @return Negative, zero or positive as the counter is below, equal to
+ *         or above the value
+ */
+int percpu_counter_compare(const percpu_counter_t* counter, int64_t value) {
+    int64_t count = percpu_counter_read(counter);
+    
+    // Unfolded deltas are each below the batch, so a large enough gap
+    // decides the comparison without touching the other CPUs' lines
+    int64_t slack = counter->batch * MAX_CPUS;
+    if (count - value > slack) {
+        return 1;
+    }
+    if (value - count > slack) {
+        return -1;
+    }
+    
+    count = percpu_counter_sum(counter);
+    if (count > value) {
+        return 1;
+    }
+    return count < value ? -1 : 0;
+}
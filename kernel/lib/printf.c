@@ -1,32 +1,103 @@
 /**
  * @file printf.c
  * @brief Kernel printf implementation
+ * 
+ * Output is formatted into a buffer first and then handed to each sink
+ * (VGA console, serial port, debugcon, virtio-console) in bulk, so the
+ * per-character cost is a store into the buffer rather than a sink
+ * dispatch and a device poll.
+ * Once the kernel log is up, kprintf output goes to the log ring and the
+ * sinks are written when the ring is drained.
  */
 
 #include "../include/kernel.h"
+#include "../include/klog.h"
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
-// Maximum number conversion length
-#define MAX_NUMBER_LENGTH 32
+// Maximum number conversion length (64-bit value in binary)
+#define MAX_NUMBER_LENGTH 64
 
-// Print mode flags
-#define PRINTF_MODE_CONSOLE  0   // Output to console (VGA)
-#define PRINTF_MODE_SERIAL   1   // Output to serial port
-#define PRINTF_MODE_BOTH     2   // Output to console and serial port
+// Size of the on-stack formatting buffer used by kprintf
+#define PRINTF_BUFFER_SIZE 256
 
 // Current output mode
 static int printf_mode = PRINTF_MODE_CONSOLE;
 
-// Forward declaration of console putchar function (defined in vga.c)
-extern void terminal_putchar(char c);
+// Console write and flush functions (defined in vga.c)
+extern void terminal_write(const char* data, size_t len);
+extern void terminal_flush(void);
+
+// Two-digit lookup table for fast decimal conversion
+static const char decimal_pairs[200] = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+    '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+    '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+    '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+    '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+    '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+    '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+    '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+    '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
+
+static const char hex_digits_lower[16] = "0123456789abcdef";
+static const char hex_digits_upper[16] = "0123456789ABCDEF";
+
+// Formatting target: either a caller buffer (snprintf) or a flushing stack buffer (kprintf)
+typedef struct {
+    char* buffer;     // Destination buffer
+    size_t size;      // Usable capacity of the buffer
+    size_t pos;       // Current write position
+    int count;        // Characters produced so far (including truncated ones)
+    bool flush;       // Flush to the sinks when full instead of truncating
+} printf_output_t;
+
+/**
+ * @brief Write to the VGA console sink
+ * 
+ * @param data Text to write
+ * @param len Number of bytes to write
+ */
+static void printf_console_write(const char* data, size_t len) {
+    terminal_write(data, len);
+}
+
+/**
+ * @brief Write to the serial debug port sink
+ * 
+ * @param data Text to write
+ * @param len Number of bytes to write
+ */
+static void printf_serial_write(const char* data, size_t len) {
+    if (debug_port != NULL && serial_is_initialized(debug_port)) {
+        serial_write(debug_port, data, len);
+    }
+}
+
+/**
+ * @brief Push console text to the screen
+ */
+static void printf_console_flush(void) {
+    terminal_flush();
+}
+
+static const printf_sink_t printf_console_sink = { printf_console_write, printf_console_flush };
+static const printf_sink_t printf_serial_sink = { printf_serial_write, NULL };
+
+// Sinks indexed by the bit number of their PRINTF_MODE_* flag
+static const printf_sink_t* printf_sinks[PRINTF_SINK_COUNT] = {
+    &printf_console_sink,
+    &printf_serial_sink,
+};
 
 /**
  * @brief Set the printf output mode
  * 
- * @param mode Target mode (CONSOLE, SERIAL, or BOTH)
+ * @param mode Mask of PRINTF_MODE_* sinks to write to
  */
 void kprintf_set_mode(int mode) {
     printf_mode = mode;
@@ -35,137 +106,272 @@ void kprintf_set_mode(int mode) {
 /**
  * @brief Get the current printf output mode
  * 
- * @return Current mode
+ * @return Mask of active PRINTF_MODE_* sinks
  */
 int kprintf_get_mode(void) {
     return printf_mode;
 }
 
 /**
- * @brief Output a character to the appropriate destination(s)
+ * @brief Register the driver behind a PRINTF_MODE_* flag
+ * 
+ * Registering does not enable the sink; add its flag to the mode for that.
  * 
- * @param c Character to output
- * @return Number of characters written (0 or 1)
+ * @param mode Single PRINTF_MODE_* flag
+ * @param sink Sink to call, or NULL to detach the flag
  */
-static int print_char(char c) {
-    switch (printf_mode) {
-        case PRINTF_MODE_CONSOLE:
-            terminal_putchar(c);
-            break;
-            
-        case PRINTF_MODE_SERIAL:
-            if (debug_port != NULL && serial_is_initialized(debug_port)) {
-                serial_write_char(debug_port, c);
-            }
-            break;
-            
-        case PRINTF_MODE_BOTH:
-            terminal_putchar(c);
-            if (debug_port != NULL && serial_is_initialized(debug_port)) {
-                serial_write_char(debug_port, c);
-            }
-            break;
-            
-        default:
-            return 0;
+void kprintf_register_sink(int mode, const printf_sink_t* sink) {
+    if (mode <= 0 || (mode & (mode - 1)) != 0) {
+        return;
+    }
+    
+    int index = __builtin_ctz((unsigned int)mode);
+    if (index < PRINTF_SINK_COUNT) {
+        printf_sinks[index] = sink;
+    }
+}
+
+/**
+ * @brief Write a block of formatted text to the active sink(s)
+ * 
+ * Each sink is called once per block rather than once per character.
+ * 
+ * @param data Text to write
+ * @param len Number of bytes to write
+ */
+void kprintf_write_sinks(const char* data, size_t len) {
+    if (len == 0) {
+        return;
     }
     
-    return 1;
+    int mode = printf_mode;
+    for (int i = 0; i < PRINTF_SINK_COUNT; i++) {
+        const printf_sink_t* sink = printf_sinks[i];
+        if ((mode & (1 << i)) && sink != NULL) {
+            sink->write(data, len);
+        }
+    }
+}
+
+/**
+ * @brief Push out text the active sinks are still buffering
+ * 
+ * Buffered sinks (virtio-console) batch writes into large transfers and
+ * only hand them to the device when full or flushed.
+ */
+void kprintf_flush_sinks(void) {
+    int mode = printf_mode;
+    for (int i = 0; i < PRINTF_SINK_COUNT; i++) {
+        const printf_sink_t* sink = printf_sinks[i];
+        if ((mode & (1 << i)) && sink != NULL && sink->flush != NULL) {
+            sink->flush();
+        }
+    }
+}
+
+/**
+ * @brief Hand a block of kprintf output to the log ring or the sinks
+ * 
+ * @param data Text to write
+ * @param len Number of bytes to write
+ */
+static void printf_emit(const char* data, size_t len) {
+    if (klog_is_async()) {
+        klog_write(data, len);
+    } else {
+        kprintf_write_sinks(data, len);
+        kprintf_flush_sinks();
+    }
+}
+
+/**
+ * @brief Append a character to the output
+ * 
+ * @param out Output state
+ * @param c Character to append
+ */
+static inline void out_char(printf_output_t* out, char c) {
+    if (out->pos >= out->size) {
+        if (!out->flush) {
+            out->count++;
+            return;
+        }
+        printf_emit(out->buffer, out->pos);
+        out->pos = 0;
+    }
+    out->buffer[out->pos++] = c;
+    out->count++;
 }
 
 /**
- * @brief Output a string to the appropriate destination(s)
+ * @brief Append a run of characters to the output
  * 
- * @param str String to output
- * @return Number of characters written
+ * @param out Output state
+ * @param data Characters to append
+ * @param len Number of characters
  */
-static int print_string(const char* str) {
-    int count = 0;
+static void out_write(printf_output_t* out, const char* data, size_t len) {
+    out->count += (int)len;
     
-    if (str == NULL) {
-        return print_string("(null)");
+    while (len > 0) {
+        if (out->pos >= out->size) {
+            if (!out->flush) {
+                return;
+            }
+            printf_emit(out->buffer, out->pos);
+            out->pos = 0;
+        }
+        
+        size_t chunk = out->size - out->pos;
+        if (chunk > len) {
+            chunk = len;
+        }
+        
+        memcpy(out->buffer + out->pos, data, chunk);
+        out->pos += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+/**
+ * @brief Append a character repeated a number of times
+ * 
+ * @param out Output state
+ * @param c Character to repeat
+ * @param n Repeat count
+ */
+static void out_repeat(printf_output_t* out, char c, int n) {
+    while (n-- > 0) {
+        out_char(out, c);
     }
+}
+
+/**
+ * @brief Convert an unsigned value to text
+ * 
+ * Digits are written backwards ending at @p end. Decimal conversion emits
+ * two digits per division using a lookup table; power-of-two bases use shifts.
+ * 
+ * @param value Value to convert
+ * @param base Number base (2, 8, 10 or 16)
+ * @param uppercase Whether to use uppercase letters for hex digits
+ * @param end One past the last byte of the scratch buffer
+ * @return Pointer to the first digit
+ */
+static char* format_unsigned(unsigned long long value, int base, bool uppercase, char* end) {
+    char* p = end;
     
-    while (*str) {
-        count += print_char(*str++);
+    switch (base) {
+        case 10:
+            while (value >= 100) {
+                unsigned int idx = (unsigned int)(value % 100) * 2;
+                value /= 100;
+                *--p = decimal_pairs[idx + 1];
+                *--p = decimal_pairs[idx];
+            }
+            if (value >= 10) {
+                unsigned int idx = (unsigned int)value * 2;
+                *--p = decimal_pairs[idx + 1];
+                *--p = decimal_pairs[idx];
+            } else {
+                *--p = (char)('0' + value);
+            }
+            break;
+        
+        case 16: {
+            const char* digits = uppercase ? hex_digits_upper : hex_digits_lower;
+            do {
+                *--p = digits[value & 0xF];
+                value >>= 4;
+            } while (value != 0);
+            break;
+        }
+        
+        case 8:
+            do {
+                *--p = (char)('0' + (value & 0x7));
+                value >>= 3;
+            } while (value != 0);
+            break;
+        
+        case 2:
+            do {
+                *--p = (char)('0' + (value & 0x1));
+                value >>= 1;
+            } while (value != 0);
+            break;
+        
+        default:
+            do {
+                *--p = hex_digits_lower[value % base];
+                value /= base;
+            } while (value != 0);
+            break;
     }
     
-    return count;
+    return p;
 }
 
 /**
  * @brief Print a number with the specified base
  * 
+ * @param out Output state
  * @param value Value to print
  * @param base Number base (e.g., 10 for decimal, 16 for hex)
  * @param uppercase Whether to use uppercase letters for hex digits
  * @param width Minimum field width
  * @param pad Padding character
  * @param is_signed Whether to handle as a signed value
- * @return Number of characters written
  */
-static int print_number(long long value, int base, bool uppercase, int width, char pad, bool is_signed) {
+static void print_number(printf_output_t* out, long long value, int base, bool uppercase,
+                         int width, char pad, bool is_signed) {
     char buffer[MAX_NUMBER_LENGTH];
-    char* digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
-    int count = 0;
-    int i = 0;
+    char* end = buffer + sizeof(buffer);
     bool negative = false;
     unsigned long long abs_value;
     
     // Handle negative numbers
     if (is_signed && value < 0) {
         negative = true;
-        abs_value = -value;
+        abs_value = -(unsigned long long)value;
     } else {
         abs_value = (unsigned long long)value;
     }
     
-    // Handle zero specially
-    if (abs_value == 0) {
-        buffer[i++] = '0';
+    char* digits = format_unsigned(abs_value, base, uppercase, end);
+    int len = (int)(end - digits);
+    int padding = width - len - (negative ? 1 : 0);
+    
+    // Zero padding goes between the sign and the digits, space padding before the sign
+    if (pad == '0') {
+        if (negative) {
+            out_char(out, '-');
+        }
+        out_repeat(out, '0', padding);
     } else {
-        // Convert number to string (in reverse)
-        while (abs_value > 0) {
-            buffer[i++] = digits[abs_value % base];
-            abs_value /= base;
+        out_repeat(out, pad, padding);
+        if (negative) {
+            out_char(out, '-');
         }
     }
     
-    // Account for negative sign in width
-    if (negative) {
-        width--;
-    }
-    
-    // Pad if needed
-    while (i < width) {
-        buffer[i++] = pad;
-    }
-    
-    // Add negative sign if needed
-    if (negative) {
-        buffer[i++] = '-';
-    }
-    
-    // Print in reverse order
-    while (i > 0) {
-        count += print_char(buffer[--i]);
-    }
-    
-    return count;
+    out_write(out, digits, len);
 }
 
 /**
  * @brief Print an unsigned number with the specified base
  * 
+ * @param out Output state
  * @param value Value to print
  * @param base Number base
  * @param uppercase Whether to use uppercase letters for hex digits
  * @param width Minimum field width
  * @param pad Padding character
- * @return Number of characters written
  */
-static int print_unsigned(unsigned long long value, int base, bool uppercase, int width, char pad) {
-    return print_number(value, base, uppercase, width, pad, false);
+static void print_unsigned(printf_output_t* out, unsigned long long value, int base,
+                           bool uppercase, int width, char pad) {
+    print_number(out, (long long)value, base, uppercase, width, pad, false);
 }
 
 /**
@@ -211,32 +417,25 @@ static void parse_format_flags(const char** format, int* width, char* pad, int*
 }
 
 /**
- * Helper function to add a character to a buffer or print it directly
+ * @brief Fetch an unsigned integer argument of the given length
+ * 
+ * @param args Variable arguments
+ * @param is_long Length modifier (0 = int, 1 = long, 2 = long long)
+ * @return Argument value
  */
-static void add_char_to_buffer(char c, char* buffer, size_t size, int* pos, int* count, bool buffered) {
-    if (buffered) {
-        if ((size_t)(*pos) < size - 1) {
-            buffer[(*pos)++] = c;
-        }
-    } else {
-        print_char(c);
-    }
-    (*count)++;
-}
+#define FETCH_UNSIGNED(args, is_long) \
+    ((is_long) == 0 ? (unsigned long long)va_arg(args, unsigned int) : \
+     (is_long) == 1 ? (unsigned long long)va_arg(args, unsigned long) : \
+                      va_arg(args, unsigned long long))
 
 /**
- * @brief Print formatted data to a buffer
+ * @brief Format a string into an output target
  * 
- * @param buffer Buffer to store output, or NULL to print directly
- * @param size Buffer size (if buffer is not NULL)
+ * @param out Output state
  * @param format Format string
  * @param args Variable arguments
- * @return Number of characters written or that would have been written
  */
-static int vprintf_internal(char* buffer, size_t size, const char* format, va_list args) {
-    int count = 0;
-    bool buffered = (buffer != NULL);
-    int pos = 0;
+static void vprintf_internal(printf_output_t* out, const char* format, va_list args) {
     int width = 0;
     char pad = ' ';
     int is_long = 0;
@@ -244,8 +443,12 @@ static int vprintf_internal(char* buffer, size_t size, const char* format, va_li
     // Parse format string
     while (*format) {
         if (*format != '%') {
-            // Regular character
-            add_char_to_buffer(*format++, buffer, size, &pos, &count, buffered);
+            // Copy the literal run up to the next specifier in one go
+            const char* start = format;
+            while (*format && *format != '%') {
+                format++;
+            }
+            out_write(out, start, (size_t)(format - start));
             continue;
         }
         
@@ -254,26 +457,22 @@ static int vprintf_internal(char* buffer, size_t size, const char* format, va_li
         
         // Handle %% (literal %)
         if (*format == '%') {
-            add_char_to_buffer('%', buffer, size, &pos, &count, buffered);
+            out_char(out, '%');
             format++;
             continue;
         }
         
         // Parse flags and modifiers
-        width = 0;
-        pad = ' ';
-        is_long = 0;
         parse_format_flags(&format, &width, &pad, &is_long);
         
         // Handle the format specifier
         switch (*format) {
             case 'c': {
                 // Character
-                char c = (char)va_arg(args, int);
-                add_char_to_buffer(c, buffer, size, &pos, &count, buffered);
+                out_char(out, (char)va_arg(args, int));
                 break;
             }
-                
+            
             case 's': {
                 // String
                 const char* str = va_arg(args, const char*);
@@ -281,130 +480,73 @@ static int vprintf_internal(char* buffer, size_t size, const char* format, va_li
                     str = "(null)";
                 }
                 
-                // Calculate string length
-                int len = 0;
-                const char* s = str;
-                while (*s) {
-                    len++;
-                    s++;
-                }
+                int len = (int)strlen(str);
                 
                 // Pad if necessary
-                while (len < width) {
-                    add_char_to_buffer(pad, buffer, size, &pos, &count, buffered);
-                    width--;
-                }
+                out_repeat(out, pad, width - len);
                 
                 // Output the string
-                while (*str) {
-                    add_char_to_buffer(*str++, buffer, size, &pos, &count, buffered);
-                }
+                out_write(out, str, len);
                 break;
             }
-                
+            
             case 'd':
             case 'i': {
                 // Signed decimal
+                long long value;
                 if (is_long == 0) {
-                    int value = va_arg(args, int);
-                    count += print_number(value, 10, false, width, pad, true);
+                    value = va_arg(args, int);
                 } else if (is_long == 1) {
-                    long value = va_arg(args, long);
-                    count += print_number(value, 10, false, width, pad, true);
+                    value = va_arg(args, long);
                 } else {
-                    long long value = va_arg(args, long long);
-                    count += print_number(value, 10, false, width, pad, true);
+                    value = va_arg(args, long long);
                 }
+                print_number(out, value, 10, false, width, pad, true);
                 break;
             }
-                
-            case 'u': {
+            
+            case 'u':
                 // Unsigned decimal
-                if (is_long == 0) {
-                    unsigned int value = va_arg(args, unsigned int);
-                    count += print_unsigned(value, 10, false, width, pad);
-                } else if (is_long == 1) {
-                    unsigned long value = va_arg(args, unsigned long);
-                    count += print_unsigned(value, 10, false, width, pad);
-                } else {
-                    unsigned long long value = va_arg(args, unsigned long long);
-                    count += print_unsigned(value, 10, false, width, pad);
-                }
+                print_unsigned(out, FETCH_UNSIGNED(args, is_long), 10, false, width, pad);
                 break;
-            }
-                
+            
             case 'x':
-            case 'X': {
+            case 'X':
                 // Hexadecimal
-                bool uppercase = (*format == 'X');
-                if (is_long == 0) {
-                    unsigned int value = va_arg(args, unsigned int);
-                    count += print_unsigned(value, 16, uppercase, width, pad);
-                } else if (is_long == 1) {
-                    unsigned long value = va_arg(args, unsigned long);
-                    count += print_unsigned(value, 16, uppercase, width, pad);
-                } else {
-                    unsigned long long value = va_arg(args, unsigned long long);
-                    count += print_unsigned(value, 16, uppercase, width, pad);
-                }
+                print_unsigned(out, FETCH_UNSIGNED(args, is_long), 16, (*format == 'X'), width, pad);
                 break;
-            }
-                
+            
             case 'p': {
                 // Pointer (treat as %#lx)
-                add_char_to_buffer('0', buffer, size, &pos, &count, buffered);
-                add_char_to_buffer('x', buffer, size, &pos, &count, buffered);
+                out_write(out, "0x", 2);
                 void* value = va_arg(args, void*);
-                count += print_unsigned((unsigned long)value, 16, false, width, pad);
+                print_unsigned(out, (uintptr_t)value, 16, false, width, pad);
                 break;
             }
-                
-            case 'o': {
+            
+            case 'o':
                 // Octal
-                if (is_long == 0) {
-                    unsigned int value = va_arg(args, unsigned int);
-                    count += print_unsigned(value, 8, false, width, pad);
-                } else if (is_long == 1) {
-                    unsigned long value = va_arg(args, unsigned long);
-                    count += print_unsigned(value, 8, false, width, pad);
-                } else {
-                    unsigned long long value = va_arg(args, unsigned long long);
-                    count += print_unsigned(value, 8, false, width, pad);
-                }
+                print_unsigned(out, FETCH_UNSIGNED(args, is_long), 8, false, width, pad);
                 break;
-            }
-                
-            case 'b': {
+            
+            case 'b':
                 // Binary (non-standard)
-                if (is_long == 0) {
-                    unsigned int value = va_arg(args, unsigned int);
-                    count += print_unsigned(value, 2, false, width, pad);
-                } else if (is_long == 1) {
-                    unsigned long value = va_arg(args, unsigned long);
-                    count += print_unsigned(value, 2, false, width, pad);
-                } else {
-                    unsigned long long value = va_arg(args, unsigned long long);
-                    count += print_unsigned(value, 2, false, width, pad);
-                }
+                print_unsigned(out, FETCH_UNSIGNED(args, is_long), 2, false, width, pad);
                 break;
-            }
-                
+            
+            case '\0':
+                // Format string ended inside a specifier
+                return;
+            
             default:
                 // Unknown format specifier, just print it
-                add_char_to_buffer('%', buffer, size, &pos, &count, buffered);
-                add_char_to_buffer(*format, buffer, size, &pos, &count, buffered);
+                out_char(out, '%');
+                out_char(out, *format);
                 break;
         }
         
         format++;
     }
-    
-    // Null-terminate the buffer if buffered
-    if (buffered && size > 0) {
-        buffer[pos] = '\0';
-    }
-    
-    return count;
 }
 
 /**
@@ -417,7 +559,7 @@ static int vprintf_internal(char* buffer, size_t size, const char* format, va_li
 int kprintf(const char* format, ...) {
     va_list args;
     va_start(args, format);
-    int ret = vprintf_internal(NULL, 0, format, args);
+    int ret = vkprintf(format, args);
     va_end(args);
     return ret;
 }
@@ -430,7 +572,19 @@ int kprintf(const char* format, ...) {
  * @return Number of characters printed
  */
 int vkprintf(const char* format, va_list args) {
-    return vprintf_internal(NULL, 0, format, args);
+    char buffer[PRINTF_BUFFER_SIZE];
+    printf_output_t out = {
+        .buffer = buffer,
+        .size = sizeof(buffer),
+        .pos = 0,
+        .count = 0,
+        .flush = true
+    };
+    
+    vprintf_internal(&out, format, args);
+    printf_emit(out.buffer, out.pos);
+    
+    return out.count;
 }
 
 /**
@@ -460,5 +614,20 @@ int snprintf(char* buffer, size_t size, const char* format, ...) {
  * @return Number of characters (excluding null terminator) that would have been written
  */
 int vsnprintf(char* buffer, size_t size, const char* format, va_list args) {
-    return vprintf_internal(buffer, size, format, args);
+    printf_output_t out = {
+        .buffer = buffer,
+        .size = (size > 0) ? size - 1 : 0,  // Leave room for the terminator
+        .pos = 0,
+        .count = 0,
+        .flush = false
+    };
+    
+    vprintf_internal(&out, format, args);
+    
+    // Null-terminate the buffer
+    if (buffer != NULL && size > 0) {
+        buffer[out.pos] = '\0';
+    }
+    
+    return out.count;
 }
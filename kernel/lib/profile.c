@@ -0,0 +1,174 @@
+/**
+ * @file profile.c
+ * @brief Statistical sampling profiler
+ * 
+ * On every timer tick the interrupted RIP and its frame-pointer call
+ * chain are appended to a per-CPU sample buffer.
+ * 
+ * There is no local APIC support yet, so samples come from the PIT
+ * interrupt rather than an NMI: code running with interrupts disabled is
+ * attributed to the point where it re-enables them.
+ */
+
+#include "../include/kernel.h"
+#include "../include/profile.h"
+#include "../include/ksyms.h"
+#include "../include/stacktrace.h"
+#include "../include/klog.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Sample header word: call chain length in the low byte, CPU above it
+#define PROFILE_HDR_DEPTH(h)    ((h) & 0xFF)
+#define PROFILE_HDR_CPU(h)      (((h) >> 8) & 0xFF)
+
+// Per-CPU sample buffer; fills up instead of wrapping
+typedef struct {
+    uint64_t used;                      // Words in use
+    uint64_t samples;                   // Samples stored
+    uint64_t lost;                      // Samples dropped because the buffer was full
+    uint64_t words[PROFILE_BUFFER_WORDS];
+} ALIGN(64) profile_buffer_t;
+
+static profile_buffer_t profile_buffers[MAX_CPUS];
+
+static volatile bool profile_active = false;
+
+/**
+ * @brief Start sampling
+ */
+void profile_start(void) {
+    profile_active = false;
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        profile_buffers[cpu].used = 0;
+        profile_buffers[cpu].samples = 0;
+        profile_buffers[cpu].lost = 0;
+    }
+    
+    __atomic_store_n(&profile_active, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Stop sampling
+ */
+void profile_stop(void) {
+    __atomic_store_n(&profile_active, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Take a sample of the interrupted context
+ * 
+ * @param ctx Context of the interrupted code
+ */
+void profile_tick(const irq_context_t* ctx) {
+    if (!profile_active || ctx == NULL) {
+        return;
+    }
+    
+    unsigned int cpu = smp_processor_id();
+    profile_buffer_t* buf = &profile_buffers[cpu];
+    
+    // Only kernel code is sampled
+    if ((ctx->cs & 3) != 0) {
+        return;
+    }
+    
+    uint64_t pcs[PROFILE_MAX_DEPTH];
+    pcs[0] = ctx->rip;
+    size_t depth = 1 + stack_trace_walk(ctx->rbp, pcs + 1, PROFILE_MAX_DEPTH - 1);
+    
+    if (buf->used + 1 + depth > PROFILE_BUFFER_WORDS) {
+        buf->lost++;
+        return;
+    }
+    
+    uint64_t* out = &buf->words[buf->used];
+    out[0] = depth | ((uint64_t)cpu << 8);
+    for (size_t i = 0; i < depth; i++) {
+        out[1 + i] = pcs[i];
+    }
+    
+    buf->used += 1 + depth;
+    buf->samples++;
+}
+
+/**
+ * @brief Write a formatted line to the serial port
+ */
+static void profile_emit(serial_port_t* port, const char* fmt, ...) {
+    char line[128];
+    va_list args;
+    
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+    }
+    serial_write(port, line, (size_t)len);
+}
+
+/**
+ * @brief Write the collected samples to a serial port
+ * 
+ * Output format:
+ * 
+ *   DSPROF1 begin hz=<rate> samples=<n> lost=<n>
+ *   S <cpu> <leaf> <caller> ... <outermost>
+ *   DSPROF1 end
+ * 
+ * Frames are "name+0xoffset" when a symbol table is linked in, raw
+ * addresses otherwise.
+ * 
+ * @param port Serial port to write to
+ */
+void profile_dump(serial_port_t* port) {
+    if (port == NULL || !serial_is_initialized(port)) {
+        return;
+    }
+    
+    bool was_active = profile_active;
+    profile_stop();
+    
+    // Keep log text from landing in the middle of the report
+    klog_drain(0);
+    
+    uint64_t samples = 0;
+    uint64_t lost = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        samples += profile_buffers[cpu].samples;
+        lost += profile_buffers[cpu].lost;
+    }
+    
+    profile_emit(port, "DSPROF1 begin hz=%u samples=%llu lost=%llu\n",
+                 timer_get_frequency(), samples, lost);
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        profile_buffer_t* buf = &profile_buffers[cpu];
+        
+        for (uint64_t pos = 0; pos < buf->used; ) {
+            uint64_t header = buf->words[pos];
+            size_t depth = PROFILE_HDR_DEPTH(header);
+            
+            profile_emit(port, "S %u", (unsigned int)PROFILE_HDR_CPU(header));
+            for (size_t i = 0; i < depth; i++) {
+                char sym[96];
+                ksym_format(sym, sizeof(sym), buf->words[pos + 1 + i]);
+                profile_emit(port, " %s", sym);
+            }
+            serial_write(port, "\n", 1);
+            
+            pos += 1 + depth;
+        }
+    }
+    
+    profile_emit(port, "DSPROF1 end\n");
+    
+    // Resume without profile_start(), which would discard the samples
+    if (was_active) {
+        __atomic_store_n(&profile_active, true, __ATOMIC_RELEASE);
+    }
+}
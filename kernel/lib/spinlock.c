@@ -0,0 +1,38 @@
+/**
+ * @file spinlock.c
+ * @brief Spinlock slow path
+ * 
+ * The uncontended path is inline in spinlock.h; only a caller that finds
+ * the lock taken comes here.
+ */
+
+#include "../include/kernel.h"
+#include "../include/spinlock.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Wait for a contended lock (slow path of spin_lock)
+ * 
+ * @param lock Lock to take
+ * @param site Address of the contended spin_lock(), for lockstat
+ */
+void spin_lock_contended(spinlock_t* lock, uintptr_t site) {
+#ifdef CONFIG_LOCKSTAT
+    uint64_t start = rdtsc();
+#else
+    (void)site;
+#endif
+    
+    do {
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) != 0) {
+            cpu_relax();
+        }
+    } while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) != 0);
+
+#ifdef CONFIG_LOCKSTAT
+    lockstat_acquired(lock->class, &lock->acquired_tsc);
+    lockstat_contended(lock->class, lock->acquired_tsc - start, site);
+#endif
+}
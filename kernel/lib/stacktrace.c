@@ -0,0 +1,67 @@
+/**
+ * @file stacktrace.c
+ * @brief Frame-pointer stack walking
+ * 
+ * The kernel is built with -fno-omit-frame-pointer, so every frame starts
+ * with the caller's RBP followed by the return address.
+ */
+
+#include "../include/kernel.h"
+#include "../include/stacktrace.h"
+#include "../include/ksyms.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Frames further apart than this are treated as a corrupt chain
+#define STACK_MAX_FRAME     (64 * 1024)
+
+// Lowest address a kernel stack frame can live at
+#define STACK_MIN_ADDR      0xFFFFFFFF80000000ULL
+
+/**
+ * @brief Walk a frame-pointer chain
+ * 
+ * @param rbp Frame pointer to start from
+ * @param pcs Where to store return addresses, innermost first
+ * @param max Maximum number of entries to store
+ * @return Number of entries stored
+ */
+size_t stack_trace_walk(uint64_t rbp, uint64_t* pcs, size_t max) {
+    size_t depth = 0;
+    
+    while (depth < max) {
+        if (rbp < STACK_MIN_ADDR || (rbp & 7) != 0) {
+            break;
+        }
+        
+        const uint64_t* fp = (const uint64_t*)rbp;
+        uint64_t ret = fp[1];
+        if (ret == 0) {
+            break;
+        }
+        pcs[depth++] = ret;
+        
+        // Caller frames live at higher addresses on the same stack
+        uint64_t next = fp[0];
+        if (next <= rbp || next - rbp > STACK_MAX_FRAME) {
+            break;
+        }
+        rbp = next;
+    }
+    
+    return depth;
+}
+
+/**
+ * @brief Print a captured stack, one symbolized frame per line
+ * 
+ * @param pcs Return addresses, innermost first
+ * @param count Number of entries
+ */
+void stack_trace_print(const uint64_t* pcs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        char sym[96];
+        ksym_format(sym, sizeof(sym), pcs[i]);
+        kprintf("  [%d] %s\n", (int)i, sym);
+    }
+}
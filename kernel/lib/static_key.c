@@ -0,0 +1,115 @@
+/**
+ * @file static_key.c
+ * @brief Static keys (runtime-patched branches)
+ * 
+ * The compiler leaves a 5-byte NOP at every static_branch_*() site and
+ * records it in __jump_table. Changing a key walks the table and queues
+ * a NOP or a JMP for each of the key's sites, and the whole set is
+ * rewritten in one text_poke batch.
+ */
+
+#include "../include/kernel.h"
+#include "../include/static_key.h"
+#include "../include/text_poke.h"
+#include "../include/spinlock.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Branch sites collected by the linker
+extern const jump_entry_t __start_jump_table[];
+extern const jump_entry_t __stop_jump_table[];
+
+static const uint8_t jump_label_nop[JUMP_LABEL_INSN_SIZE] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
+
+// Serializes key changes, and with them the text_poke batch
+DEFINE_SPINLOCK(jump_label_lock);
+
+/**
+ * @brief Get the key of a jump table entry
+ * 
+ * @param entry Jump table entry
+ * @return Key controlling the site
+ */
+static static_key_t* jump_entry_key(const jump_entry_t* entry) {
+    return (static_key_t*)(uintptr_t)(entry->key & ~JUMP_ENTRY_LIKELY);
+}
+
+/**
+ * @brief Queue the instruction a site needs for a key state
+ * 
+ * @param entry Site to update
+ * @param enabled State of its key
+ */
+static void jump_label_queue(const jump_entry_t* entry, bool enabled) {
+    uint8_t insn[JUMP_LABEL_INSN_SIZE];
+    bool likely_branch = (entry->key & JUMP_ENTRY_LIKELY) != 0;
+    
+    if (enabled != likely_branch) {
+        int32_t rel = (int32_t)(entry->target - (entry->code + JUMP_LABEL_INSN_SIZE));
+        insn[0] = 0xe9;
+        memcpy(&insn[1], &rel, sizeof(rel));
+    } else {
+        memcpy(insn, jump_label_nop, JUMP_LABEL_INSN_SIZE);
+    }
+    
+    text_poke_queue((void*)(uintptr_t)entry->code, insn, JUMP_LABEL_INSN_SIZE);
+}
+
+/**
+ * @brief Set a key's state
+ * 
+ * @param key Key to change
+ * @param enable New state
+ */
+void static_key_set(static_key_t* key, bool enable) {
+    spin_lock(&jump_label_lock);
+    
+    if (static_key_enabled(key) != enable) {
+        // Slow paths see the new state before any site does
+        __atomic_store_n(&key->enabled, enable ? 1 : 0, __ATOMIC_RELEASE);
+        
+        for (const jump_entry_t* entry = __start_jump_table; entry < __stop_jump_table; entry++) {
+            if (jump_entry_key(entry) == key) {
+                jump_label_queue(entry, enable);
+            }
+        }
+        text_poke_finish();
+    }
+    
+    spin_unlock(&jump_label_lock);
+}
+
+/**
+ * @brief Enable a key, patching all of its sites in one batch
+ * 
+ * @param key Key to enable
+ */
+void static_key_enable(static_key_t* key) {
+    static_key_set(key, true);
+}
+
+/**
+ * @brief Disable a key, patching all of its sites in one batch
+ * 
+ * @param key Key to disable
+ */
+void static_key_disable(static_key_t* key) {
+    static_key_set(key, false);
+}
+
+/**
+ * @brief Bring every branch site in line with its key's initial state
+ */
+void jump_label_init(void) {
+    size_t count = (size_t)(__stop_jump_table - __start_jump_table);
+    
+    spin_lock(&jump_label_lock);
+    for (const jump_entry_t* entry = __start_jump_table; entry < __stop_jump_table; entry++) {
+        jump_label_queue(entry, static_key_enabled(jump_entry_key(entry)));
+    }
+    text_poke_finish();
+    spin_unlock(&jump_label_lock);
+    
+    kprintf("jump_label: %llu branch sites\n", (unsigned long long)count);
+}
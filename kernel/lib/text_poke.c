@@ -0,0 +1,144 @@
+/**
+ * @file text_poke.c
+ * @brief Live kernel text patching
+ * 
+ * A multi-byte instruction cannot be replaced with one store while
+ * another CPU may be executing it, so a batch is rewritten in three
+ * rounds with a serializing sync after each:
+ * 
+ *   1. an int3 goes over the first byte of every site;
+ *   2. the remaining bytes are written, unseen behind the int3;
+ *   3. the first byte of the new instruction replaces the int3.
+ * 
+ * A CPU that runs into a site in between takes #BP, and
+ * text_poke_int3_handler() emulates the new instruction. Only jumps and
+ * NOPs are emulated, which is all static keys need. Interrupts stay on
+ * throughout, so code the patcher itself runs through can be patched.
+ */
+
+#include "../include/kernel.h"
+#include "../include/text_poke.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TEXT_POKE_INT3      0xcc
+#define TEXT_POKE_JMP32     0xe9
+
+typedef struct {
+    uint8_t* addr;
+    uint8_t len;
+    uint8_t insn[TEXT_POKE_MAX_INSN];
+} text_poke_t;
+
+static text_poke_t text_poke_batch[TEXT_POKE_BATCH];
+static size_t text_poke_count = 0;
+
+// Sites the #BP handler must recognize, set while a batch is applied
+static volatile size_t text_poke_active = 0;
+
+/**
+ * @brief Serialize instruction fetch after modifying code
+ * 
+ * cpuid is serializing. Only the BSP runs today; once APs do, every
+ * other CPU must run this too (by IPI) before the next round starts.
+ */
+static void text_poke_sync(void) {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx) : : "memory");
+}
+
+/**
+ * @brief Rewrite every site of the batch and empty it
+ */
+static void text_poke_apply(void) {
+    if (text_poke_count == 0) {
+        return;
+    }
+    
+    __atomic_store_n(&text_poke_active, text_poke_count, __ATOMIC_RELEASE);
+    text_poke_sync();
+    
+    for (size_t i = 0; i < text_poke_count; i++) {
+        *(volatile uint8_t*)text_poke_batch[i].addr = TEXT_POKE_INT3;
+    }
+    text_poke_sync();
+    
+    for (size_t i = 0; i < text_poke_count; i++) {
+        volatile uint8_t* dst = text_poke_batch[i].addr;
+        for (size_t b = 1; b < text_poke_batch[i].len; b++) {
+            dst[b] = text_poke_batch[i].insn[b];
+        }
+    }
+    text_poke_sync();
+    
+    for (size_t i = 0; i < text_poke_count; i++) {
+        *(volatile uint8_t*)text_poke_batch[i].addr = text_poke_batch[i].insn[0];
+    }
+    text_poke_sync();
+    
+    __atomic_store_n(&text_poke_active, 0, __ATOMIC_RELEASE);
+    text_poke_count = 0;
+}
+
+/**
+ * @brief Queue an instruction rewrite
+ * 
+ * @param addr Instruction to replace
+ * @param insn New instruction, the same length as the old one
+ * @param len Length in bytes (at most TEXT_POKE_MAX_INSN)
+ */
+void text_poke_queue(void* addr, const void* insn, size_t len) {
+    if (len == 0 || len > TEXT_POKE_MAX_INSN) {
+        return;
+    }
+    if (memcmp(addr, insn, len) == 0) {
+        return;
+    }
+    
+    if (text_poke_count == TEXT_POKE_BATCH) {
+        text_poke_apply();
+    }
+    
+    text_poke_t* poke = &text_poke_batch[text_poke_count];
+    poke->addr = (uint8_t*)addr;
+    poke->len = (uint8_t)len;
+    memcpy(poke->insn, insn, len);
+    text_poke_count++;
+}
+
+/**
+ * @brief Apply every queued rewrite
+ */
+void text_poke_finish(void) {
+    text_poke_apply();
+}
+
+/**
+ * @brief Handle a breakpoint hit on a site being rewritten
+ * 
+ * @param rip Return address of the breakpoint (one past the int3)
+ * @return Address to resume at, or 0 if the breakpoint is not ours
+ */
+uint64_t text_poke_int3_handler(uint64_t rip) {
+    size_t count = __atomic_load_n(&text_poke_active, __ATOMIC_ACQUIRE);
+    
+    for (size_t i = 0; i < count; i++) {
+        const text_poke_t* poke = &text_poke_batch[i];
+        uint64_t addr = (uint64_t)(uintptr_t)poke->addr;
+        
+        if (addr + 1 != rip) {
+            continue;
+        }
+        
+        // Act as if the new instruction had run
+        if (poke->insn[0] == TEXT_POKE_JMP32 && poke->len == 5) {
+            int32_t rel;
+            memcpy(&rel, &poke->insn[1], sizeof(rel));
+            return addr + 5 + (int64_t)rel;
+        }
+        return addr + poke->len;
+    }
+    
+    return 0;
+}
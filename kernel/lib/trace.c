@@ -0,0 +1,231 @@
+/**
+ * @file trace.c
+ * @brief Binary event tracing
+ * 
+ * Tracepoints store fixed-size binary records (TSC, event id, CPU and up
+ * to three raw arguments) in per-CPU flight-recorder buffers. Nothing is
+ * formatted in the kernel: trace_dump() writes the buffers to a serial
+ * port as-is, preceded by the event table, and scripts/trace_decode.py
+ * turns the stream into text or Chrome trace JSON on the host.
+ * 
+ * Dump stream layout (all integers little-endian):
+ * 
+ *   header   "DSTRACE1", u32 version, u32 tsc_khz,
+ *            u16 event_count, u16 cpu_count, u16 record_size, u16 reserved
+ *   events   event_count x { u16 id, u8 kind, u8 name_len, u8 args_len,
+ *                            name bytes, args bytes }
+ *   cpus     cpu_count x { u16 cpu, u16 reserved, u32 record_count,
+ *                          u64 lost, record_count x trace_record_t }
+ *   trailer  "DSTREND1"
+ */
+
+#include "../include/kernel.h"
+#include "../include/trace.h"
+#include "../include/klog.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACE_BUFFER_MASK   (TRACE_BUFFER_RECORDS - 1)
+#define TRACE_VERSION       1
+
+// Per-CPU flight recorder; the oldest records are overwritten on wrap
+typedef struct {
+    volatile uint64_t head;             // Total records written
+    trace_record_t records[TRACE_BUFFER_RECORDS];
+} ALIGN(64) trace_buffer_t;
+
+static trace_buffer_t trace_buffers[MAX_CPUS];
+
+DEFINE_STATIC_KEY_FALSE(trace_key);
+volatile uint64_t trace_event_mask = 0;
+
+// Event descriptions emitted in the dump header
+typedef struct {
+    const char* name;
+    char kind;
+    const char* args;
+} trace_event_desc_t;
+
+#define TRACE_EVENT_DESC(id, name, kind, args) { name, kind, args },
+static const trace_event_desc_t trace_event_descs[TRACE_EVENT_COUNT] = {
+    TRACE_EVENTS(TRACE_EVENT_DESC)
+};
+#undef TRACE_EVENT_DESC
+
+/**
+ * @brief Initialize the trace buffers (tracing stays off)
+ */
+void trace_init(void) {
+    static_key_disable(&trace_key);
+    trace_event_mask = 0;
+    trace_reset();
+}
+
+/**
+ * @brief Start recording
+ * 
+ * @param mask Bitmask of events to record (1 << id), or 0 for all events
+ */
+void trace_start(uint64_t mask) {
+    if (mask == 0) {
+        mask = (1ULL << TRACE_EVENT_COUNT) - 1;
+    }
+    
+    trace_event_mask = mask;
+    static_key_enable(&trace_key);
+}
+
+/**
+ * @brief Find an event by name
+ * 
+ * @param name Event name, as in the dump header
+ * @return Event identifier, or -1 if there is no such event
+ */
+int trace_event_lookup(const char* name) {
+    for (int id = 0; id < TRACE_EVENT_COUNT; id++) {
+        if (strcmp(trace_event_descs[id].name, name) == 0) {
+            return id;
+        }
+    }
+    
+    return -1;
+}
+
+/**
+ * @brief Stop recording
+ */
+void trace_stop(void) {
+    static_key_disable(&trace_key);
+}
+
+/**
+ * @brief Discard all recorded events
+ */
+void trace_reset(void) {
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        trace_buffers[cpu].head = 0;
+    }
+}
+
+/**
+ * @brief Record an event (slow path of trace_event)
+ * 
+ * @param id Event identifier
+ * @param a0 First argument
+ * @param a1 Second argument
+ * @param a2 Third argument
+ */
+void trace_record(uint16_t id, uint64_t a0, uint64_t a1, uint64_t a2) {
+    unsigned int cpu = smp_processor_id();
+    trace_buffer_t* buf = &trace_buffers[cpu];
+    
+    // A tracepoint hit from an interrupt simply takes the next slot
+    uint64_t pos = __atomic_fetch_add(&buf->head, 1, __ATOMIC_RELAXED);
+    trace_record_t* rec = &buf->records[pos & TRACE_BUFFER_MASK];
+    
+    rec->tsc = rdtsc();
+    rec->id = id;
+    rec->cpu = (uint8_t)cpu;
+    rec->args[0] = a0;
+    rec->args[1] = a1;
+    rec->args[2] = a2;
+}
+
+/**
+ * @brief Write the recorded events to a serial port as a binary stream
+ * 
+ * @param port Serial port to write to
+ */
+void trace_dump(serial_port_t* port) {
+    if (port == NULL || !serial_is_initialized(port)) {
+        return;
+    }
+    
+    bool was_enabled = static_key_enabled(&trace_key);
+    trace_stop();
+    
+    // Get pending log text out first so it does not land inside the stream
+    klog_drain(0);
+    
+    uint16_t cpu_count = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (trace_buffers[cpu].head != 0) {
+            cpu_count++;
+        }
+    }
+    
+    struct PACKED {
+        char magic[8];
+        uint32_t version;
+        uint32_t tsc_khz;
+        uint16_t event_count;
+        uint16_t cpu_count;
+        uint16_t record_size;
+        uint16_t reserved;
+    } header = {
+        { 'D', 'S', 'T', 'R', 'A', 'C', 'E', '1' },
+        TRACE_VERSION,
+        (uint32_t)tsc_get_khz(),
+        TRACE_EVENT_COUNT,
+        cpu_count,
+        sizeof(trace_record_t),
+        0
+    };
+    serial_write(port, (const char*)&header, sizeof(header));
+    
+    for (int id = 0; id < TRACE_EVENT_COUNT; id++) {
+        const trace_event_desc_t* desc = &trace_event_descs[id];
+        size_t name_len = strlen(desc->name);
+        size_t args_len = strlen(desc->args);
+        
+        struct PACKED {
+            uint16_t id;
+            uint8_t kind;
+            uint8_t name_len;
+            uint8_t args_len;
+        } entry = { (uint16_t)id, (uint8_t)desc->kind, (uint8_t)name_len, (uint8_t)args_len };
+        
+        serial_write(port, (const char*)&entry, sizeof(entry));
+        serial_write(port, desc->name, name_len);
+        serial_write(port, desc->args, args_len);
+    }
+    
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        trace_buffer_t* buf = &trace_buffers[cpu];
+        uint64_t head = buf->head;
+        if (head == 0) {
+            continue;
+        }
+        
+        // Only the most recent lap of the buffer survives
+        uint64_t first = (head > TRACE_BUFFER_RECORDS) ? head - TRACE_BUFFER_RECORDS : 0;
+        
+        struct PACKED {
+            uint16_t cpu;
+            uint16_t reserved;
+            uint32_t record_count;
+            uint64_t lost;
+        } section = { (uint16_t)cpu, 0, (uint32_t)(head - first), first };
+        serial_write(port, (const char*)&section, sizeof(section));
+        
+        // Records are written oldest first, in at most two runs
+        uint64_t start = first & TRACE_BUFFER_MASK;
+        uint64_t count = head - first;
+        uint64_t run = TRACE_BUFFER_RECORDS - start;
+        if (run > count) {
+            run = count;
+        }
+        
+        serial_write(port, (const char*)&buf->records[start], run * sizeof(trace_record_t));
+        if (count > run) {
+            serial_write(port, (const char*)&buf->records[0], (count - run) * sizeof(trace_record_t));
+        }
+    }
+    
+    serial_write(port, "DSTREND1", 8);
+    
+    if (was_enabled) {
+        trace_start(trace_event_mask);
+    }
+}
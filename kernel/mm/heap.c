@@ -5,6 +5,11 @@
 
 #include "../include/kernel.h"
 #include "../include/memory.h"
+#include "../include/trace.h"
+#include "../include/alloctrace.h"
+#include "../include/spinlock.h"
+#include "../include/kstat.h"
+#include "../include/percpu_counter.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -19,14 +24,24 @@ typedef struct heap_block {
 
 // Heap statistics
 static size_t heap_size = 0;     // Total heap size
-static size_t heap_used = 0;     // Used heap memory
-static size_t alloc_count = 0;   // Number of active allocations
+
+// Updated on every allocation and free, so kept per CPU. Bytes move in
+// large steps and fold in bigger batches than the block count.
+static percpu_counter_t heap_used = PERCPU_COUNTER_INIT(0, 16 * 1024);              // Used heap memory
+static percpu_counter_t alloc_count = PERCPU_COUNTER_INIT(0, PERCPU_COUNTER_BATCH); // Number of active allocations
 
 // Heap control
 static uintptr_t heap_start = 0; // Start address of the heap
 static uintptr_t heap_end = 0;   // End address of the heap
 static heap_block_t* free_list = NULL; // Start of the free list
 
+// Protects the block list and the statistics
+DEFINE_SPINLOCK(heap_lock);
+
+KSTAT_COUNTER(heap_allocs, "heap.alloc", "successful heap allocations");
+KSTAT_COUNTER(heap_frees, "heap.free", "heap blocks freed");
+KSTAT_COUNTER(heap_failures, "heap.alloc_failed", "heap allocations that found no block");
+
 // Magic values for checking heap integrity
 #define HEAP_MAGIC          0x4845415042524B00ULL // "HEAPBRK\0"
 #define HEAP_BLOCK_MAGIC    0x424C4F434B00ULL     // "BLOCK\0\0"
@@ -51,8 +66,8 @@ void heap_init(uintptr_t start, size_t size) {
     heap_start = start;
     heap_size = size;
     heap_end = start + size;
-    heap_used = 0;
-    alloc_count = 0;
+    percpu_counter_set(&heap_used, 0);
+    percpu_counter_set(&alloc_count, 0);
     
     // Initialize the free list with a single block covering the entire heap
     free_list = (heap_block_t*)start;
@@ -66,12 +81,12 @@ void heap_init(uintptr_t start, size_t size) {
 }
 
 /**
- * @brief Allocate memory from the kernel heap
+ * @brief Allocate memory from the kernel heap (untraced)
  * 
  * @param size Size to allocate in bytes
  * @return Pointer to the allocated memory, or NULL if allocation failed
  */
-void* kmalloc(size_t size) {
+static void* heap_alloc(size_t size) {
     // Handle 0-size allocations
     if (size == 0) {
         return NULL;
@@ -87,6 +102,7 @@ void* kmalloc(size_t size) {
     heap_block_t* block = find_free_block(required_size, sizeof(void*));
     if (!block) {
         // Out of memory
+        kstat_inc(heap_failures);
         return NULL;
     }
     
@@ -99,21 +115,24 @@ void* kmalloc(size_t size) {
     block->free = false;
     
     // Update statistics
-    heap_used += block->size;
-    alloc_count++;
+    __percpu_counter_add(&heap_used, (int64_t)block->size);
+    __percpu_counter_add(&alloc_count, 1);
+    kstat_inc(heap_allocs);
     
     // Return pointer to the data area
-    return (void*)((uintptr_t)block + sizeof(heap_block_t));
+    void* ptr = (void*)((uintptr_t)block + sizeof(heap_block_t));
+    trace_event(TRACE_KMALLOC, ptr, size, sizeof(void*));
+    return ptr;
 }
 
 /**
- * @brief Allocate aligned memory from the kernel heap
+ * @brief Allocate aligned memory from the kernel heap (untraced)
  * 
  * @param size Size to allocate in bytes
  * @param align Alignment boundary (must be a power of 2)
  * @return Pointer to the allocated memory, or NULL if allocation failed
  */
-void* kmalloc_aligned(size_t size, size_t align) {
+static void* heap_alloc_aligned(size_t size, size_t align) {
     // Handle 0-size allocations
     if (size == 0) {
         return NULL;
@@ -125,82 +144,77 @@ void* kmalloc_aligned(size_t size, size_t align) {
         return NULL;
     }
     
-    // Calculate required size with header
-    size_t required_size = size + sizeof(heap_block_t) + align;
+    // Block headers must stay 8-byte aligned
+    if (align < 8) {
+        align = 8;
+    }
     
-    // Align to 8-byte boundary
-    required_size = (required_size + 7) & ~7;
+    // Room for the header and data, plus the worst-case gap in front of
+    // the aligned data, which must be able to hold a header of its own
+    size_t data_size = (size + 7) & ~7;
+    size_t required_size = data_size + 2 * sizeof(heap_block_t) + align;
     
     // Find a suitable free block
     heap_block_t* block = find_free_block(required_size, align);
     if (!block) {
         // Out of memory
+        kstat_inc(heap_failures);
         return NULL;
     }
     
     // Calculate aligned address
     uintptr_t data_addr = (uintptr_t)block + sizeof(heap_block_t);
     uintptr_t aligned_addr = (data_addr + align - 1) & ~(align - 1);
+    
+    // A gap too small for a header is widened in alignment steps
+    while (aligned_addr != data_addr && aligned_addr - data_addr < sizeof(heap_block_t)) {
+        aligned_addr += align;
+    }
     size_t padding = aligned_addr - data_addr;
     
-    // If there's padding, we need to create a new block
+    // The gap in front of the aligned data stays behind as a free block
     if (padding > 0) {
-        // We need enough space for a new block header + the aligned data
-        if (padding >= sizeof(heap_block_t)) {
-            // Create a new block for the padding
-            heap_block_t* padding_block = (heap_block_t*)((uintptr_t)block + sizeof(heap_block_t) + padding - sizeof(heap_block_t));
-            padding_block->size = block->size - padding;
-            padding_block->free = false;
-            padding_block->next = block->next;
-            padding_block->prev = block;
-            
-            if (block->next) {
-                block->next->prev = padding_block;
-            }
-            
-            block->next = padding_block;
-            block->size = padding;
-            
-            block = padding_block;
+        heap_block_t* aligned_block = (heap_block_t*)(aligned_addr - sizeof(heap_block_t));
+        aligned_block->size = block->size - padding;
+        aligned_block->free = false;
+        aligned_block->next = block->next;
+        aligned_block->prev = block;
+        
+        if (block->next) {
+            block->next->prev = aligned_block;
         }
+        
+        block->next = aligned_block;
+        block->size = padding;
+        
+        block = aligned_block;
     }
     
     // Split the block if it's much larger than needed
-    if (block->size > size + sizeof(heap_block_t) + 16) {
-        split_block(block, size + sizeof(heap_block_t));
+    if (block->size > data_size + 2 * sizeof(heap_block_t) + 16) {
+        split_block(block, data_size + sizeof(heap_block_t));
     }
     
     // Mark the block as used
     block->free = false;
     
     // Update statistics
-    heap_used += block->size;
-    alloc_count++;
+    __percpu_counter_add(&heap_used, (int64_t)block->size);
+    __percpu_counter_add(&alloc_count, 1);
+    kstat_inc(heap_allocs);
     
     // Return pointer to the data area
-    return (void*)((uintptr_t)block + sizeof(heap_block_t));
-}
-
-/**
- * @brief Allocate zero-initialized memory from the kernel heap
- * 
- * @param size Size to allocate in bytes
- * @return Pointer to the allocated memory, or NULL if allocation failed
- */
-void* kzalloc(size_t size) {
-    void* ptr = kmalloc(size);
-    if (ptr) {
-        memset(ptr, 0, size);
-    }
+    void* ptr = (void*)((uintptr_t)block + sizeof(heap_block_t));
+    trace_event(TRACE_KMALLOC, ptr, size, align);
     return ptr;
 }
 
 /**
- * @brief Free memory allocated from the kernel heap
+ * @brief Free memory allocated from the kernel heap (untraced)
  * 
  * @param ptr Pointer to the memory to free
  */
-void kfree(void* ptr) {
+static void heap_free(void* ptr) {
     // Handle NULL pointer
     if (!ptr) {
         return;
@@ -220,8 +234,11 @@ void kfree(void* ptr) {
     }
     
     // Update statistics
-    heap_used -= block->size;
-    alloc_count--;
+    __percpu_counter_add(&heap_used, -(int64_t)block->size);
+    __percpu_counter_add(&alloc_count, -1);
+    kstat_inc(heap_frees);
+    
+    trace_event(TRACE_KFREE, ptr, block->size, 0);
     
     // Mark the block as free
     block->free = true;
@@ -231,21 +248,21 @@ void kfree(void* ptr) {
 }
 
 /**
- * @brief Reallocate memory from the kernel heap
+ * @brief Reallocate memory from the kernel heap (untraced)
  * 
  * @param ptr Pointer to the memory to reallocate
  * @param size New size in bytes
  * @return Pointer to the reallocated memory, or NULL if reallocation failed
  */
-void* krealloc(void* ptr, size_t size) {
+static void* heap_realloc(void* ptr, size_t size) {
     // Handle NULL pointer (equivalent to kmalloc)
     if (!ptr) {
-        return kmalloc(size);
+        return heap_alloc(size);
     }
     
     // Handle 0-size (equivalent to kfree)
     if (size == 0) {
-        kfree(ptr);
+        heap_free(ptr);
         return NULL;
     }
     
@@ -262,10 +279,15 @@ void* krealloc(void* ptr, size_t size) {
         required_size = (required_size + 7) & ~7;
         
         if (block->size > required_size + sizeof(heap_block_t) + 16) {
+            size_t old_size = block->size;
             split_block(block, required_size);
-            heap_used -= (block->size - required_size);
+            __percpu_counter_add(&heap_used, -(int64_t)(old_size - block->size));
+            
+            // Coalesce the released tail with a free block after it
+            merge_adjacent_blocks(block->next);
         }
         
+        trace_event(TRACE_KREALLOC, ptr, ptr, size);
         return ptr;
     }
     
@@ -274,6 +296,7 @@ void* krealloc(void* ptr, size_t size) {
         block->size + block->next->size >= size + sizeof(heap_block_t)) {
         
         // Merge the blocks
+        size_t old_size = block->size;
         block->size += block->next->size;
         block->next = block->next->next;
         if (block->next) {
@@ -287,12 +310,14 @@ void* krealloc(void* ptr, size_t size) {
         if (block->size > required_size + sizeof(heap_block_t) + 16) {
             split_block(block, required_size);
         }
+        __percpu_counter_add(&heap_used, (int64_t)(block->size - old_size));
         
+        trace_event(TRACE_KREALLOC, ptr, ptr, size);
         return ptr;
     }
     
     // Allocate a new, larger block
-    void* new_ptr = kmalloc(size);
+    void* new_ptr = heap_alloc(size);
     if (!new_ptr) {
         return NULL;
     }
@@ -301,8 +326,93 @@ void* krealloc(void* ptr, size_t size) {
     memcpy(new_ptr, ptr, current_size);
     
     // Free the old block
-    kfree(ptr);
+    heap_free(ptr);
     
+    trace_event(TRACE_KREALLOC, ptr, new_ptr, size);
+    return new_ptr;
+}
+
+/*
+ * Public entry points. Each takes the heap lock around the untraced
+ * helper and records itself for the allocation trace, so the heap's own
+ * nested calls (krealloc moving a block) are not recorded a second time.
+ */
+
+/**
+ * @brief Allocate memory from the kernel heap
+ * 
+ * @param size Size to allocate in bytes
+ * @return Pointer to the allocated memory, or NULL if allocation failed
+ */
+void* kmalloc(size_t size) {
+    uint64_t irq_flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = heap_alloc(size);
+    spin_unlock_irqrestore(&heap_lock, irq_flags);
+    
+    alloctrace(ALLOCTRACE_KMALLOC, ptr, NULL, size, 0);
+    return ptr;
+}
+
+/**
+ * @brief Allocate aligned memory from the kernel heap
+ * 
+ * @param size Size to allocate in bytes
+ * @param align Alignment boundary (must be a power of 2)
+ * @return Pointer to the allocated memory, or NULL if allocation failed
+ */
+void* kmalloc_aligned(size_t size, size_t align) {
+    uint64_t irq_flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = heap_alloc_aligned(size, align);
+    spin_unlock_irqrestore(&heap_lock, irq_flags);
+    
+    alloctrace(ALLOCTRACE_KMALLOC_ALIGNED, ptr, NULL, size, align);
+    return ptr;
+}
+
+/**
+ * @brief Allocate zero-initialized memory from the kernel heap
+ * 
+ * @param size Size to allocate in bytes
+ * @return Pointer to the allocated memory, or NULL if allocation failed
+ */
+void* kzalloc(size_t size) {
+    uint64_t irq_flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = heap_alloc(size);
+    spin_unlock_irqrestore(&heap_lock, irq_flags);
+    
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    alloctrace(ALLOCTRACE_KMALLOC, ptr, NULL, size, 0);
+    return ptr;
+}
+
+/**
+ * @brief Free memory allocated from the kernel heap
+ * 
+ * @param ptr Pointer to the memory to free
+ */
+void kfree(void* ptr) {
+    alloctrace(ALLOCTRACE_KFREE, ptr, NULL, 0, 0);
+    
+    uint64_t irq_flags = spin_lock_irqsave(&heap_lock);
+    heap_free(ptr);
+    spin_unlock_irqrestore(&heap_lock, irq_flags);
+}
+
+/**
+ * @brief Reallocate memory from the kernel heap
+ * 
+ * @param ptr Pointer to the memory to reallocate
+ * @param size New size in bytes
+ * @return Pointer to the reallocated memory, or NULL if reallocation failed
+ */
+void* krealloc(void* ptr, size_t size) {
+    uint64_t irq_flags = spin_lock_irqsave(&heap_lock);
+    void* new_ptr = heap_realloc(ptr, size);
+    spin_unlock_irqrestore(&heap_lock, irq_flags);
+    
+    alloctrace(ALLOCTRACE_KREALLOC, new_ptr, ptr, size, 0);
     return new_ptr;
 }
 
@@ -339,10 +449,35 @@ size_t ksize(void* ptr) {
  */
 void heap_get_info(size_t* total, size_t* used, size_t* count) {
     if (total) *total = heap_size;
-    if (used) *used = heap_used;
-    if (count) *count = alloc_count;
+    if (used) *used = (size_t)percpu_counter_sum(&heap_used);
+    if (count) *count = (size_t)percpu_counter_sum(&alloc_count);
+}
+
+/**
+ * @brief Read the bytes in use, for the heap.used_bytes gauge
+ */
+static uint64_t heap_stat_used(void) {
+    return (uint64_t)percpu_counter_sum(&heap_used);
+}
+
+/**
+ * @brief Read the number of live blocks, for the heap.live_blocks gauge
+ */
+static uint64_t heap_stat_live(void) {
+    return (uint64_t)percpu_counter_sum(&alloc_count);
 }
 
+/**
+ * @brief Read the heap size, for the heap.total_bytes gauge
+ */
+static uint64_t heap_stat_total(void) {
+    return heap_size;
+}
+
+KSTAT_GAUGE(heap_used, "heap.used_bytes", heap_stat_used, "heap bytes in use, headers included");
+KSTAT_GAUGE(heap_live, "heap.live_blocks", heap_stat_live, "heap blocks allocated");
+KSTAT_GAUGE(heap_total, "heap.total_bytes", heap_stat_total, "heap size");
+
 /**
  * @brief Find a free block of the given size
  * 
@@ -0,0 +1,93 @@
+/**
+ * @file ioremap.c
+ * @brief Device memory mappings
+ * 
+ * Mappings are carved from the IOREMAP_BASE window with a bump pointer.
+ * Device mappings are made at boot and live for the life of the system,
+ * so iounmap() removes the pages but does not recycle the addresses.
+ */
+
+#include "../include/kernel.h"
+#include "../include/memory.h"
+#include "../include/spinlock.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Next free address in the window
+static uintptr_t ioremap_next = IOREMAP_BASE;
+
+DEFINE_SPINLOCK(ioremap_lock);
+
+/**
+ * @brief Map device memory with the given caching flags
+ * 
+ * @param phys_addr Physical address (need not be page aligned)
+ * @param size Size in bytes
+ * @param cache_flags PTE_WC, or PTE_CACHE_DISABLE | PTE_WRITE_THROUGH
+ * @return Virtual address of phys_addr, or NULL on failure
+ */
+static void* ioremap_prot(uintptr_t phys_addr, size_t size, uint64_t cache_flags) {
+    if (size == 0) {
+        return NULL;
+    }
+    
+    uintptr_t offset = phys_addr & PAGE_OFFSET_MASK;
+    uintptr_t phys_base = phys_addr & PAGE_MASK;
+    size_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    
+    uint64_t flags = spin_lock_irqsave(&ioremap_lock);
+    if (pages > (IOREMAP_BASE + IOREMAP_SIZE - ioremap_next) / PAGE_SIZE) {
+        spin_unlock_irqrestore(&ioremap_lock, flags);
+        return NULL;
+    }
+    uintptr_t virt_base = ioremap_next;
+    ioremap_next += pages * PAGE_SIZE;
+    spin_unlock_irqrestore(&ioremap_lock, flags);
+    
+    if (map_pages(phys_base, virt_base, pages,
+                  PTE_PRESENT | PTE_WRITABLE | PTE_GLOBAL | PTE_NX | cache_flags) != 0) {
+        return NULL;
+    }
+    
+    return (void*)(virt_base + offset);
+}
+
+/**
+ * @brief Map device memory uncached
+ * 
+ * @param phys_addr Physical address (need not be page aligned)
+ * @param size Size in bytes
+ * @return Virtual address of phys_addr, or NULL if the window is full
+ */
+void* ioremap(uintptr_t phys_addr, size_t size) {
+    return ioremap_prot(phys_addr, size, PTE_CACHE_DISABLE | PTE_WRITE_THROUGH);
+}
+
+/**
+ * @brief Map device memory write-combining
+ * 
+ * @param phys_addr Physical address (need not be page aligned)
+ * @param size Size in bytes
+ * @return Virtual address of phys_addr, or NULL if the window is full
+ */
+void* ioremap_wc(uintptr_t phys_addr, size_t size) {
+    return ioremap_prot(phys_addr, size, PTE_WC);
+}
+
+/**
+ * @brief Remove a mapping made by ioremap() or ioremap_wc()
+ * 
+ * @param addr Address returned by the mapping call
+ * @param size Size passed to the mapping call
+ */
+void iounmap(void* addr, size_t size) {
+    uintptr_t virt = (uintptr_t)addr;
+    
+    if (virt < IOREMAP_BASE || virt >= IOREMAP_BASE + IOREMAP_SIZE || size == 0) {
+        return;
+    }
+    
+    uintptr_t offset = virt & PAGE_OFFSET_MASK;
+    unmap_pages(virt & PAGE_MASK, (offset + size + PAGE_SIZE - 1) / PAGE_SIZE);
+}
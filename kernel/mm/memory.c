@@ -5,6 +5,9 @@
 
 #include "../include/kernel.h"
 #include "../include/memory.h"
+#include "../include/trace.h"
+#include "../include/spinlock.h"
+#include "../include/kstat.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -18,6 +21,13 @@ static uint64_t total_pages = 0;     // Total number of physical pages
 static uint64_t free_pages = 0;      // Number of free physical pages
 static uint64_t total_memory = 0;    // Total physical memory in bytes
 
+// Protects the bitmap and free_pages
+DEFINE_SPINLOCK(pmm_lock);
+
+KSTAT_COUNTER(pmm_allocs, "pmm.pages_alloc", "physical pages allocated");
+KSTAT_COUNTER(pmm_frees, "pmm.pages_free", "physical pages freed");
+KSTAT_COUNTER(pmm_failures, "pmm.alloc_failed", "physical allocations that found no pages");
+
 // Boot memory allocator state
 static uintptr_t boot_alloc_next = 0;
 static uintptr_t boot_alloc_end = 0;
@@ -151,12 +161,13 @@ static inline bool bitmap_test(uint64_t page_num) {
  * @return Physical address of the allocated page, or 0 if allocation failed
  */
 uintptr_t alloc_physical_page(void) {
-    // Lock interrupts for atomic operation
-    cli();
+    // Keep other CPUs and interrupt handlers out of the bitmap
+    uint64_t irq_flags = spin_lock_irqsave(&pmm_lock);
     
     // Check if we have free pages
     if (free_pages == 0) {
-        sti();
+        kstat_inc(pmm_failures);
+        spin_unlock_irqrestore(&pmm_lock, irq_flags);
         return 0;
     }
     
@@ -175,11 +186,13 @@ uintptr_t alloc_physical_page(void) {
                     // Mark the page as allocated
                     physical_bitmap[i] |= bit;
                     free_pages--;
+                    kstat_inc(pmm_allocs);
                     
                     // Calculate physical address
                     uintptr_t phys_addr = page_num * PAGE_SIZE;
+                    trace_event(TRACE_PAGE_ALLOC, phys_addr, 1, 0);
                     
-                    sti();
+                    spin_unlock_irqrestore(&pmm_lock, irq_flags);
                     return phys_addr;
                 }
             }
@@ -187,7 +200,8 @@ uintptr_t alloc_physical_page(void) {
     }
     
     // No free pages found
-    sti();
+    kstat_inc(pmm_failures);
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
     return 0;
 }
 
@@ -206,12 +220,13 @@ uintptr_t alloc_physical_pages(size_t count) {
         return alloc_physical_page();
     }
     
-    // Lock interrupts for atomic operation
-    cli();
+    // Keep other CPUs and interrupt handlers out of the bitmap
+    uint64_t irq_flags = spin_lock_irqsave(&pmm_lock);
     
     // Check if we have enough free pages
     if (free_pages < count) {
-        sti();
+        kstat_inc(pmm_failures);
+        spin_unlock_irqrestore(&pmm_lock, irq_flags);
         return 0;
     }
     
@@ -238,14 +253,17 @@ uintptr_t alloc_physical_pages(size_t count) {
             }
             
             free_pages -= count;
+            kstat_add(pmm_allocs, count);
+            trace_event(TRACE_PAGE_ALLOC, start_page * PAGE_SIZE, count, 0);
             
-            sti();
+            spin_unlock_irqrestore(&pmm_lock, irq_flags);
             return start_page * PAGE_SIZE;
         }
     }
     
     // No contiguous region found
-    sti();
+    kstat_inc(pmm_failures);
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
     return 0;
 }
 
@@ -255,29 +273,31 @@ uintptr_t alloc_physical_pages(size_t count) {
  * @param phys_addr Physical address of the page to free
  */
 void free_physical_page(uintptr_t phys_addr) {
-    // Lock interrupts for atomic operation
-    cli();
+    // Keep other CPUs and interrupt handlers out of the bitmap
+    uint64_t irq_flags = spin_lock_irqsave(&pmm_lock);
     
     // Calculate page number
     uint64_t page_num = phys_addr / PAGE_SIZE;
     
     // Bounds check
     if (page_num >= total_pages) {
-        sti();
+        spin_unlock_irqrestore(&pmm_lock, irq_flags);
         return;
     }
     
     // Check if the page is already free
     if (!bitmap_test(page_num)) {
-        sti();
+        spin_unlock_irqrestore(&pmm_lock, irq_flags);
         return;
     }
     
     // Mark the page as free
     bitmap_clear(page_num);
     free_pages++;
+    kstat_inc(pmm_frees);
+    trace_event(TRACE_PAGE_FREE, phys_addr, 1, 0);
     
-    sti();
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
 }
 
 /**
@@ -287,8 +307,8 @@ void free_physical_page(uintptr_t phys_addr) {
  * @param count Number of pages to free
  */
 void free_physical_pages(uintptr_t phys_addr, size_t count) {
-    // Lock interrupts for atomic operation
-    cli();
+    // Keep other CPUs and interrupt handlers out of the bitmap
+    uint64_t irq_flags = spin_lock_irqsave(&pmm_lock);
     
     // Free each page in the range
     for (size_t i = 0; i < count; i++) {
@@ -307,9 +327,12 @@ void free_physical_pages(uintptr_t phys_addr, size_t count) {
         // Mark the page as free
         bitmap_clear(page_num);
         free_pages++;
+        kstat_inc(pmm_frees);
     }
     
-    sti();
+    trace_event(TRACE_PAGE_FREE, phys_addr, count, 0);
+    
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
 }
 
 /**
@@ -340,3 +363,6 @@ uint64_t get_physical_memory_size(void) {
 uint64_t get_free_physical_memory(void) {
     return free_pages * PAGE_SIZE;
 }
+
+KSTAT_GAUGE(mem_free, "mem.free_bytes", get_free_physical_memory, "free physical memory");
+KSTAT_GAUGE(mem_total, "mem.total_bytes", get_physical_memory_size, "physical memory managed by the PMM");
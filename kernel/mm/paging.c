@@ -5,6 +5,7 @@
 
 #include "../include/kernel.h"
 #include "../include/memory.h"
+#include "../include/trace.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -28,6 +29,7 @@ static uint64_t* pml4_table = NULL;
 #define PF_ACCESSED              0x0020
 #define PF_DIRTY                 0x0040
 #define PF_LARGE_PAGE            0x0080
+#define PF_PAT                   0x0080     // PAT index bit 2, in 4 KiB PTEs
 #define PF_GLOBAL                0x0100
 #define PF_NX                    0x8000000000000000
 
@@ -85,11 +87,15 @@ int map_page(uintptr_t phys_addr, uintptr_t virt_addr, uint64_t flags) {
         entry_flags |= PF_WRITE_THROUGH;
     if (flags & PTE_CACHE_DISABLE)
         entry_flags |= PF_CACHE_DISABLE;
+    if (flags & PTE_WC)
+        entry_flags = (entry_flags & ~(PF_WRITE_THROUGH | PF_CACHE_DISABLE)) | PF_PAT;
     if (flags & PTE_GLOBAL)
         entry_flags |= PF_GLOBAL;
     if (flags & PTE_NX)
         entry_flags |= PF_NX;
     
+    trace_event(TRACE_MAP_PAGE, virt_addr, phys_addr, flags);
+    
     // Map the page
     return map_page_internal(phys_addr, virt_addr, entry_flags);
 }
@@ -107,8 +113,9 @@ static int map_page_internal(uintptr_t phys_addr, uintptr_t virt_addr, uint64_t
     if (is_page_mapped(virt_addr)) {
         uint64_t* pt_entry = get_pt_entry(virt_addr);
         
-        // Update flags if needed
+        // Update flags if needed; a caching change needs the old entry gone
         *pt_entry = (phys_addr & PAGE_MASK) | flags;
+        __asm__ volatile("invlpg (%0)" : : "r"(virt_addr) : "memory");
         return 0;
     }
     
@@ -193,6 +200,8 @@ int unmap_page(uintptr_t virt_addr) {
     // Invalidate TLB entry
     __asm__ volatile("invlpg (%0)" : : "r"(virt_addr) : "memory");
     
+    trace_event(TRACE_UNMAP_PAGE, virt_addr, 0, 0);
+    
     return 0;
 }
 
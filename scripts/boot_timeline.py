@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+# dsOS Boot Timeline
+# Extracts the BOOTTIME report from a serial capture, prints it as a table
+# and optionally compares it against a baseline capture
+
+import argparse
+import json
+import sys
+
+
+def read_timeline(path):
+    """Return the last BOOTTIME report in a capture."""
+    report = None
+    with open(path, "r", errors="replace") as f:
+        for line in f:
+            pos = line.find("BOOTTIME ")
+            if pos >= 0:
+                report = json.loads(line[pos + len("BOOTTIME "):])
+    if report is None:
+        sys.exit("no BOOTTIME report found in %s" % path)
+    return report
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Show or compare dsOS boot timelines")
+    parser.add_argument("capture", help="serial capture of the boot to inspect")
+    parser.add_argument("-b", "--baseline", help="serial capture of a baseline boot")
+    parser.add_argument("-t", "--threshold", type=float, default=10.0,
+                        help="regression threshold in percent (default: 10)")
+    args = parser.parse_args()
+    
+    current = read_timeline(args.capture)
+    baseline = read_timeline(args.baseline) if args.baseline else None
+    base_steps = {step["name"]: step for step in baseline["steps"]} if baseline else {}
+    
+    regressions = 0
+    print("%-16s %12s %12s %12s" % ("step", "at_us", "delta_us", "baseline"))
+    for step in current["steps"]:
+        line = "%-16s %12d %12d" % (step["name"], step["at_us"], step["delta_us"])
+        base = base_steps.get(step["name"])
+        if base is not None:
+            line += " %12d" % base["delta_us"]
+            limit = base["delta_us"] * (1.0 + args.threshold / 100.0)
+            if step["delta_us"] > limit and step["delta_us"] - base["delta_us"] > 1:
+                line += "  REGRESSION"
+                regressions += 1
+        print(line)
+    
+    print("total %d us" % current["total_us"], end="")
+    if baseline:
+        print(" (baseline %d us)" % baseline["total_us"], end="")
+    print()
+    
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
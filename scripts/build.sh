@@ -12,11 +12,21 @@ SYSROOT_DIR="$ROOT_DIR/sysroot"
 ISO_ROOT="$ROOT_DIR/iso_root"
 
 # Compiler settings
-export CFLAGS_DEBUG="-Og -g -Wall -Wextra"
-export CFLAGS_RELEASE="-O2 -Wall -Wextra"
+export CFLAGS_DEBUG="-Og -g -fno-omit-frame-pointer -Wall -Wextra"
+export CFLAGS_RELEASE="-O2 -fno-omit-frame-pointer -Wall -Wextra"
 export CFLAGS="$CFLAGS_RELEASE"
 export LDFLAGS="-T $ROOT_DIR/kernel/arch/x86_64/linker.ld"
 
+# Function-entry tracing flavour: every function starts with a 5-byte NOP
+# recorded in __mcount_loc, which the kernel patches into a call at runtime
+export CFLAGS_FTRACE="-pg -mfentry -mnop-mcount -mrecord-mcount -fcf-protection=none -DCONFIG_FTRACE"
+
+# Sources that must never be instrumented (the tracer itself)
+NOTRACE_SOURCES="ftrace.c"
+
+# Extra kernel-only flags set by build flavours
+KERNEL_DEFINES=""
+
 # Determine if we're building in debug mode
 if [ "$1" = "debug" ]; then
     export CFLAGS="$CFLAGS_DEBUG"
@@ -25,6 +35,32 @@ else
     echo "Building in RELEASE mode"
 fi
 
+# Optional build flavours, given after the mode (e.g. "build.sh debug ftrace")
+FTRACE=0
+for flavour in "$@"; do
+    case "$flavour" in
+        ftrace)
+            FTRACE=1
+            echo "Function-entry tracing enabled"
+            ;;
+        kbench)
+            # Boot straight into the microbenchmarks and exit QEMU
+            KERNEL_DEFINES="$KERNEL_DEFINES -DCONFIG_KBENCH"
+            echo "Microbenchmark boot enabled"
+            ;;
+        alloctrace)
+            # Record every heap call from boot and stream it over serial
+            KERNEL_DEFINES="$KERNEL_DEFINES -DCONFIG_ALLOCTRACE"
+            echo "Allocation tracing enabled"
+            ;;
+        lockstat)
+            # Per-lock-class acquisition, contention, wait and hold statistics
+            KERNEL_DEFINES="$KERNEL_DEFINES -DCONFIG_LOCKSTAT"
+            echo "Lock statistics enabled"
+            ;;
+    esac
+done
+
 # Create necessary directories
 mkdir -p "$BUILD_DIR"
 mkdir -p "$SYSROOT_DIR/System/bin"
@@ -59,14 +95,32 @@ build_kernel() {
     KERNEL_OBJECTS="$BUILD_DIR/boot.o"
     for src in $KERNEL_SOURCES; do
         obj="$BUILD_DIR/$(basename "${src%.c}.o")"
-        gcc -c $CFLAGS -ffreestanding -mcmodel=kernel -mno-red-zone -mno-mmx -mno-sse \
+        
+        # Instrument everything except the tracer when tracing is enabled
+        SRC_CFLAGS="$CFLAGS $KERNEL_DEFINES"
+        if [ "$FTRACE" = "1" ]; then
+            case " $NOTRACE_SOURCES " in
+                *" $(basename "$src") "*) SRC_CFLAGS="$SRC_CFLAGS -DCONFIG_FTRACE" ;;
+                *) SRC_CFLAGS="$SRC_CFLAGS $CFLAGS_FTRACE" ;;
+            esac
+        fi
+        
+        gcc -c $SRC_CFLAGS -ffreestanding -mcmodel=kernel -mno-red-zone -mno-mmx -mno-sse \
             -I"$ROOT_DIR/kernel/include" -o "$obj" "$src"
         KERNEL_OBJECTS="$KERNEL_OBJECTS $obj"
     done
     
-    # Link the kernel
+    # Link the kernel (first pass, without a symbol table)
     ld -o "$BUILD_DIR/kernel.elf" $LDFLAGS $KERNEL_OBJECTS
     
+    # Generate the symbol table from the first pass and link it in
+    nm -n -S --defined-only "$BUILD_DIR/kernel.elf" | \
+        python3 "$SCRIPT_DIR/gen_ksyms.py" > "$BUILD_DIR/ksyms.bin"
+    objcopy -I binary -O elf64-x86-64 -B i386:x86-64 \
+        --rename-section .data=.ksyms,alloc,load,readonly,data,contents \
+        "$BUILD_DIR/ksyms.bin" "$BUILD_DIR/ksyms.o"
+    ld -o "$BUILD_DIR/kernel.elf" $LDFLAGS $KERNEL_OBJECTS "$BUILD_DIR/ksyms.o"
+    
     # Extract binary
     objcopy -O binary "$BUILD_DIR/kernel.elf" "$BUILD_DIR/kernel.bin"
     
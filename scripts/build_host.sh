@@ -0,0 +1,91 @@
+#!/bin/bash
+# dsOS Host Test Build
+# Compiles kernel/mm and kernel/lib for Linux userspace against the mock
+# arch layer in tests/host, then builds the stress tests, benchmarks,
+# fuzzers and the allocation trace replay tool. Pass "run" to also run
+# the stress tests and a short fuzz pass.
+
+set -e
+
+# Directory setup
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+ROOT_DIR="$(dirname "$SCRIPT_DIR")"
+HOST_DIR="$ROOT_DIR/tests/host"
+BUILD_DIR="$ROOT_DIR/build/host"
+
+# Compiler settings. Loop-to-memcpy conversion is off so the kernel's
+# memcpy cannot be compiled into a call to itself.
+CC="${CC:-gcc}"
+HOST_CFLAGS="-g -O2 -Wall -Wextra -fno-builtin -fno-tree-loop-distribute-patterns -fno-omit-frame-pointer -DKERNEL_HOSTED"
+SANITIZE="-fsanitize=address,undefined -fno-sanitize-recover=undefined"
+
+# Kernel modules under test
+KERNEL_MODULES="kernel/mm/heap.c kernel/mm/memory.c kernel/lib/spinlock.c kernel/lib/percpu_counter.c kernel/lib/string.c kernel/lib/printf.c"
+
+# Modules whose symbols clash with the C library and get a kernel_ prefix
+RENAMED_MODULES="string printf"
+
+# Compile the kernel modules into $BUILD_DIR/<flavour>
+build_kernel_objects() {
+    local flavour="$1" cc="$2" flags="$3"
+    local out="$BUILD_DIR/$flavour"
+    mkdir -p "$out"
+    
+    KERNEL_OBJECTS=""
+    for src in $KERNEL_MODULES; do
+        obj="$out/$(basename "${src%.c}.o")"
+        $cc -c $HOST_CFLAGS $flags -I"$ROOT_DIR/kernel/include" -o "$obj" "$ROOT_DIR/$src"
+        KERNEL_OBJECTS="$KERNEL_OBJECTS $obj"
+    done
+    
+    # Rename definitions and references alike, so heap.c still reaches the
+    # kernel's memcpy while the test code can use the C library's
+    for module in $RENAMED_MODULES; do
+        nm -g --defined-only "$out/$module.o" | awk '{ print $3 " kernel_" $3 }'
+    done > "$out/rename.map"
+    for obj in $KERNEL_OBJECTS; do
+        objcopy --redefine-syms="$out/rename.map" "$obj"
+    done
+}
+
+# Link a harness program against the kernel objects of the current flavour
+link_program() {
+    local cc="$1" flags="$2" output="$3"
+    shift 3
+    $cc $HOST_CFLAGS $flags -o "$BUILD_DIR/$output" "$@" "$HOST_DIR/mock_arch.c" $KERNEL_OBJECTS
+}
+
+mkdir -p "$BUILD_DIR"
+
+echo "Building host stress tests (ASan + UBSan)..."
+build_kernel_objects sanitize "$CC" "$SANITIZE"
+link_program "$CC" "$SANITIZE" heap_stress "$HOST_DIR/heap_stress.c"
+
+# Stand-alone driver for the fuzz target: replays files or random inputs
+link_program "$CC" "$SANITIZE" fuzz_heap_driver "$HOST_DIR/fuzz_heap.c" "$HOST_DIR/fuzz_driver.c"
+
+echo "Building host benchmarks..."
+build_kernel_objects bench "$CC" ""
+link_program "$CC" "" heap_bench "$HOST_DIR/heap_bench.c"
+
+# Replays allocation traces captured from an alloctrace kernel
+link_program "$CC" "" alloc_replay "$HOST_DIR/alloc_replay.c"
+
+# Coverage-guided fuzzing needs clang's libFuzzer
+if command -v clang > /dev/null 2>&1; then
+    echo "Building libFuzzer target..."
+    FUZZ_FLAGS="-fsanitize=fuzzer-no-link,address,undefined"
+    build_kernel_objects fuzz clang "$FUZZ_FLAGS"
+    link_program clang "-fsanitize=fuzzer,address,undefined" fuzz_heap "$HOST_DIR/fuzz_heap.c"
+else
+    echo "clang not found, skipping the libFuzzer target (fuzz_heap_driver still works)"
+fi
+
+echo "Host harness built in $BUILD_DIR"
+
+if [ "$1" = "run" ]; then
+    "$BUILD_DIR/heap_stress"
+    "$BUILD_DIR/fuzz_heap_driver" -runs=2000
+fi
+
+exit 0
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+# dsOS Symbol Table Generator
+# Turns "nm -n -S --defined-only kernel.elf" output into the binary table
+# linked into the kernel's .ksyms section (see kernel/include/ksyms.h)
+
+import struct
+import sys
+
+KSYMS_MAGIC = 0x4d59534b
+TEXT_TYPES = "tTwW"
+
+
+def read_symbols(lines):
+    """Collect text symbols as (address, size, name), sorted by address."""
+    symbols = {}
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 4:
+            addr, size, kind, name = fields
+            size = int(size, 16)
+        elif len(fields) == 3:
+            addr, kind, name = fields
+            size = 0
+        else:
+            continue
+        
+        if kind not in TEXT_TYPES:
+            continue
+        
+        addr = int(addr, 16)
+        
+        # Prefer global names over local aliases at the same address
+        if addr not in symbols or (kind.isupper() and not symbols[addr][2].isupper()):
+            symbols[addr] = (size, name, kind)
+    
+    return [(addr, size, name) for addr, (size, name, _) in sorted(symbols.items())]
+
+
+def build_table(symbols):
+    if not symbols:
+        return b""
+    
+    base = symbols[0][0]
+    end = max(addr + size for addr, size, _ in symbols)
+    end = max(end, symbols[-1][0] + 1)
+    
+    names = bytearray()
+    entries = []
+    for addr, _, name in symbols:
+        entries.append((addr - base, len(names)))
+        names += name.encode("ascii", "replace") + b"\0"
+    
+    # Unnamed sentinel marking the end of kernel text
+    entries.append((end - base, len(names)))
+    names += b"\0"
+    
+    table = bytearray(struct.pack("<IIQ", KSYMS_MAGIC, len(entries), base))
+    for offset, name in entries:
+        table += struct.pack("<II", offset, name)
+    table += names
+    return bytes(table)
+
+
+def main():
+    sys.stdout.buffer.write(build_table(read_symbols(sys.stdin)))
+
+
+if __name__ == "__main__":
+    main()
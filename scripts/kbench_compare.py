@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+# dsOS Microbenchmark Runner
+# Boots a kbench kernel under QEMU and compares results against a baseline
+
+import argparse
+import json
+import subprocess
+import sys
+
+QEMU_ARGS = [
+    "qemu-system-x86_64", "-nographic", "-no-reboot", "-m", "512M",
+    "-device", "isa-debug-exit,iobase=0xf4,iosize=0x04",
+]
+
+
+def extract(text):
+    """Return the last KBENCH report in a serial capture."""
+    report = None
+    for line in text.splitlines():
+        pos = line.find("KBENCH ")
+        if pos >= 0:
+            report = json.loads(line[pos + len("KBENCH "):])
+    return report
+
+
+def load(path):
+    """Load a report from a saved JSON file or a raw serial capture."""
+    with open(path, "r", errors="replace") as f:
+        text = f.read()
+    try:
+        return json.loads(text)
+    except ValueError:
+        report = extract(text)
+        if report is None:
+            sys.exit("no KBENCH report found in %s" % path)
+        return report
+
+
+def run(args):
+    cmd = QEMU_ARGS + ["-cdrom", args.iso, "-boot", "d"] + args.qemu_arg
+    try:
+        proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                              timeout=args.timeout)
+        output = proc.stdout
+    except subprocess.TimeoutExpired as err:
+        output = err.stdout or b""
+    
+    report = extract(output.decode("ascii", "replace"))
+    if report is None:
+        sys.exit("kernel did not produce a KBENCH report (was it built with the kbench flavour?)")
+    
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2)
+        f.write("\n")
+    print("saved %d results to %s" % (len(report["results"]), args.output))
+
+
+def compare(args):
+    baseline = load(args.baseline)
+    current = load(args.current)
+    base = {result["name"]: result for result in baseline["results"]}
+    
+    regressions = 0
+    print("%-16s %10s %10s %8s %10s %10s" % ("benchmark", "base p50", "p50", "change", "base p99", "p99"))
+    for result in current["results"]:
+        old = base.get(result["name"])
+        if old is None:
+            print("%-16s %10s %10d %8s %10s %10d" % (result["name"], "-", result["p50"], "new", "-", result["p99"]))
+            continue
+        
+        change = (result[args.metric] - old[args.metric]) * 100.0 / max(old[args.metric], 1)
+        line = "%-16s %10d %10d %+7.1f%% %10d %10d" % (
+            result["name"], old["p50"], result["p50"], change, old["p99"], result["p99"])
+        if change > args.threshold:
+            line += "  REGRESSION"
+            regressions += 1
+        print(line)
+    
+    if baseline.get("tsc_khz") != current.get("tsc_khz"):
+        print("note: TSC rates differ (%s vs %s kHz), cycle counts may not be comparable"
+              % (baseline.get("tsc_khz"), current.get("tsc_khz")))
+    
+    sys.exit(1 if regressions else 0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run and compare dsOS kbench results")
+    sub = parser.add_subparsers(dest="command", required=True)
+    
+    run_parser = sub.add_parser("run", help="boot a kbench ISO under QEMU and save the report")
+    run_parser.add_argument("iso", help="ISO built with 'build.sh release kbench'")
+    run_parser.add_argument("-o", "--output", default="kbench.json", help="report file to write")
+    run_parser.add_argument("-t", "--timeout", type=int, default=120, help="seconds before giving up")
+    run_parser.add_argument("--qemu-arg", action="append", default=[], help="extra QEMU argument")
+    run_parser.set_defaults(func=run)
+    
+    cmp_parser = sub.add_parser("compare", help="compare a report against a baseline")
+    cmp_parser.add_argument("baseline", help="baseline report (JSON or serial capture)")
+    cmp_parser.add_argument("current", help="report to check (JSON or serial capture)")
+    cmp_parser.add_argument("-m", "--metric", choices=("p50", "p90", "p99", "mean", "min"), default="p50",
+                            help="statistic to compare (default: p50)")
+    cmp_parser.add_argument("-t", "--threshold", type=float, default=5.0,
+                            help="regression threshold in percent (default: 5)")
+    cmp_parser.set_defaults(func=compare)
+    
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
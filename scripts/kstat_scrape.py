@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+# dsOS Statistics Scraper
+# Polls the debug shell's "scrape" command over a serial connection and
+# prints each sample as JSON, Prometheus text, or per-second rates.
+#
+# Run QEMU with the debug port on a socket, e.g.
+#   -serial tcp:127.0.0.1:4555,server,nowait
+
+import argparse
+import json
+import os
+import socket
+import sys
+import time
+
+PREFIX = "KSTAT "
+
+
+class Connection:
+    """Line-oriented connection to a TCP socket or a serial device."""
+    
+    def __init__(self, target):
+        if ":" in target and not os.path.exists(target):
+            host, port = target.rsplit(":", 1)
+            self.sock = socket.create_connection((host, int(port)))
+            self.fd = None
+        else:
+            self.sock = None
+            self.fd = os.open(target, os.O_RDWR | os.O_NOCTTY)
+        self.buffer = b""
+    
+    def send(self, data):
+        if self.sock:
+            self.sock.sendall(data)
+        else:
+            os.write(self.fd, data)
+    
+    def recv(self):
+        data = self.sock.recv(4096) if self.sock else os.read(self.fd, 4096)
+        if not data:
+            raise EOFError("connection closed")
+        return data
+    
+    def scrape(self, timeout):
+        """Send one scrape command and return the decoded sample."""
+        self.send(b"scrape\r")
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            while b"\n" in self.buffer:
+                line, self.buffer = self.buffer.split(b"\n", 1)
+                text = line.decode("ascii", "replace").strip()
+                pos = text.find(PREFIX)
+                if pos >= 0:
+                    return json.loads(text[pos + len(PREFIX):])
+            self.buffer += self.recv()
+        raise TimeoutError("no KSTAT line within %.1f s" % timeout)
+
+
+def prometheus(sample):
+    lines = ["dsos_uptime_ms %d" % sample["uptime_ms"]]
+    for name, value in sorted(sample["stats"].items()):
+        lines.append("dsos_%s %d" % (name.replace(".", "_"), value))
+    return "\n".join(lines)
+
+
+def rates(previous, sample):
+    elapsed = (sample["uptime_ms"] - previous["uptime_ms"]) / 1000.0
+    if elapsed <= 0:
+        return ""
+    lines = []
+    for name, value in sorted(sample["stats"].items()):
+        delta = value - previous["stats"].get(name, value)
+        lines.append("%-24s %14d %12.1f/s" % (name, value, delta / elapsed))
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Scrape dsOS kernel statistics over serial")
+    parser.add_argument("target", help="host:port of a QEMU serial socket, or a serial device")
+    parser.add_argument("-f", "--format", choices=("json", "prometheus", "rates"), default="json")
+    parser.add_argument("-i", "--interval", type=float, default=0,
+                        help="seconds between samples (default: take one sample)")
+    parser.add_argument("-t", "--timeout", type=float, default=5.0)
+    args = parser.parse_args()
+    
+    # Rates need two samples
+    if args.format == "rates" and args.interval <= 0:
+        args.interval = 1.0
+    
+    conn = Connection(args.target)
+    previous = None
+    while True:
+        sample = conn.scrape(args.timeout)
+        if args.format == "json":
+            print(json.dumps(sample))
+        elif args.format == "prometheus":
+            print(prometheus(sample) + "\n")
+        elif previous is not None:
+            print(rates(previous, sample) + "\n")
+        previous = sample
+        sys.stdout.flush()
+        
+        if args.interval <= 0:
+            break
+        time.sleep(args.interval)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# dsOS Profile Folder
+# Turns the report written by profile_dump() ("profile dump" in kshell) into
+# folded stacks ("outer;inner;leaf count") for flamegraph.pl or speedscope
+
+import argparse
+import collections
+import subprocess
+import sys
+
+
+def load_symbols(elf):
+    """Read text symbols from an ELF image for resolving raw addresses."""
+    out = subprocess.run(["nm", "-n", "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in "tTwW":
+            symbols.append((int(fields[0], 16), fields[2]))
+    return symbols
+
+
+def resolve(frame, symbols):
+    """Reduce a frame to its function name."""
+    if frame.startswith("0x"):
+        if not symbols:
+            return frame
+        addr = int(frame, 16)
+        lo, hi = 0, len(symbols)
+        while lo < hi:
+            mid = (lo + hi) // 2
+            if symbols[mid][0] <= addr:
+                lo = mid + 1
+            else:
+                hi = mid
+        return symbols[lo - 1][1] if lo > 0 else frame
+    return frame.split("+", 1)[0]
+
+
+def read_samples(lines):
+    """Yield (cpu, frames innermost first) for the last report in a capture."""
+    report = None
+    last = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("DSPROF1 begin"):
+            report = []
+        elif line.startswith("DSPROF1 end"):
+            if report is not None:
+                last = report
+            report = None
+        elif report is not None and line.startswith("S "):
+            fields = line.split()
+            report.append((int(fields[1]), fields[2:]))
+    if last is None:
+        sys.exit("no complete profile report found")
+    return last
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Fold dsOS profiler samples")
+    parser.add_argument("capture", help="serial capture containing a profile report")
+    parser.add_argument("-e", "--elf", help="kernel.elf for resolving raw addresses")
+    parser.add_argument("--per-cpu", action="store_true", help="prefix stacks with the CPU")
+    args = parser.parse_args()
+    
+    symbols = load_symbols(args.elf) if args.elf else []
+    
+    with open(args.capture, "r", errors="replace") as f:
+        samples = read_samples(f)
+    
+    folded = collections.Counter()
+    for cpu, frames in samples:
+        stack = [resolve(frame, symbols) for frame in reversed(frames)]
+        if args.per_cpu:
+            stack.insert(0, "cpu%d" % cpu)
+        folded[";".join(stack)] += 1
+    
+    for stack, count in sorted(folded.items()):
+        print("%s %d" % (stack, count))
+
+
+if __name__ == "__main__":
+    main()
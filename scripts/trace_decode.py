@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+# dsOS Trace Decoder
+# Decodes the binary stream written by trace_dump() ("trace dump" in kshell)
+# out of a serial capture
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b"DSTRACE1"
+TRAILER = b"DSTREND1"
+
+HEADER = struct.Struct("<8sIIHHHH")
+EVENT = struct.Struct("<HBBB")
+SECTION = struct.Struct("<HHIQ")
+RECORD = struct.Struct("<QHB5x3Q")
+
+
+class TraceError(Exception):
+    pass
+
+
+class Reader:
+    def __init__(self, data, pos):
+        self.data = data
+        self.pos = pos
+    
+    def take(self, size):
+        if self.pos + size > len(self.data):
+            raise TraceError("stream truncated at offset %d" % self.pos)
+        chunk = self.data[self.pos:self.pos + size]
+        self.pos += size
+        return chunk
+    
+    def unpack(self, fmt):
+        return fmt.unpack(self.take(fmt.size))
+
+
+def parse(data, pos):
+    """Parse one trace dump starting at pos; returns (trace, end offset)."""
+    r = Reader(data, pos)
+    magic, version, tsc_khz, event_count, cpu_count, record_size, _ = r.unpack(HEADER)
+    if version != 1:
+        raise TraceError("unsupported trace version %d" % version)
+    if record_size != RECORD.size:
+        raise TraceError("unexpected record size %d" % record_size)
+    
+    events = {}
+    for _ in range(event_count):
+        event_id, kind, name_len, args_len = r.unpack(EVENT)
+        name = r.take(name_len).decode("ascii")
+        args = r.take(args_len).decode("ascii")
+        events[event_id] = {
+            "name": name,
+            "kind": chr(kind),
+            "args": args.split(",") if args else [],
+        }
+    
+    records = []
+    lost = {}
+    for _ in range(cpu_count):
+        cpu, _, count, dropped = r.unpack(SECTION)
+        lost[cpu] = dropped
+        for _ in range(count):
+            tsc, event_id, rec_cpu, a0, a1, a2 = r.unpack(RECORD)
+            records.append((tsc, rec_cpu, event_id, (a0, a1, a2)))
+    
+    if r.take(len(TRAILER)) != TRAILER:
+        raise TraceError("missing trailer")
+    
+    records.sort(key=lambda rec: rec[0])
+    return {"tsc_khz": tsc_khz, "events": events, "records": records, "lost": lost}, r.pos
+
+
+def find_dumps(data):
+    """Yield every trace dump embedded in a serial capture."""
+    pos = data.find(MAGIC)
+    while pos >= 0:
+        try:
+            trace, end = parse(data, pos)
+        except TraceError as err:
+            print("warning: skipping dump at offset %d: %s" % (pos, err), file=sys.stderr)
+            end = pos + len(MAGIC)
+        else:
+            yield trace
+        pos = data.find(MAGIC, end)
+
+
+def tsc_to_us(trace, tsc, base):
+    khz = trace["tsc_khz"] or 1000000
+    return (tsc - base) * 1000.0 / khz
+
+
+def describe(trace, event_id):
+    return trace["events"].get(event_id, {"name": "event_%d" % event_id, "kind": "i", "args": []})
+
+
+def write_text(trace, out):
+    for cpu, dropped in sorted(trace["lost"].items()):
+        if dropped:
+            out.write("# cpu %d: %d older records were overwritten\n" % (cpu, dropped))
+    
+    base = trace["records"][0][0] if trace["records"] else 0
+    for tsc, cpu, event_id, args in trace["records"]:
+        desc = describe(trace, event_id)
+        fields = " ".join("%s=0x%x" % (name, value) for name, value in zip(desc["args"], args))
+        out.write("%14.3f us  cpu%-2d %-12s %s\n" % (tsc_to_us(trace, tsc, base), cpu, desc["name"], fields))
+
+
+def write_chrome(trace, out):
+    base = trace["records"][0][0] if trace["records"] else 0
+    events = []
+    for tsc, cpu, event_id, args in trace["records"]:
+        desc = describe(trace, event_id)
+        name = desc["name"]
+        kind = desc["kind"]
+        
+        # Both ends of a span must share a name
+        if kind in "BE":
+            for suffix in ("_entry", "_exit"):
+                if name.endswith(suffix):
+                    name = name[:-len(suffix)]
+        
+        event = {
+            "name": name,
+            "ph": kind,
+            "ts": tsc_to_us(trace, tsc, base),
+            "pid": 0,
+            "tid": cpu,
+            "args": {arg: "0x%x" % value for arg, value in zip(desc["args"], args)},
+        }
+        if kind == "i":
+            event["s"] = "t"
+        events.append(event)
+    
+    json.dump({"traceEvents": events, "displayTimeUnit": "ns"}, out)
+    out.write("\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode dsOS binary trace dumps")
+    parser.add_argument("capture", help="raw serial capture containing one or more dumps")
+    parser.add_argument("-f", "--format", choices=("text", "chrome"), default="text")
+    parser.add_argument("-o", "--output", help="output file (default: stdout)")
+    parser.add_argument("-n", "--dump", type=int, default=-1,
+                        help="index of the dump to decode (default: last)")
+    args = parser.parse_args()
+    
+    with open(args.capture, "rb") as f:
+        dumps = list(find_dumps(f.read()))
+    if not dumps:
+        sys.exit("no trace dump found in %s" % args.capture)
+    
+    trace = dumps[args.dump]
+    out = open(args.output, "w") if args.output else sys.stdout
+    if args.format == "chrome":
+        write_chrome(trace, out)
+    else:
+        write_text(trace, out)
+
+
+if __name__ == "__main__":
+    main()
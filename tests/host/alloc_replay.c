@@ -0,0 +1,757 @@
+/**
+ * @file alloc_replay.c
+ * @brief Offline replay of kernel allocation traces
+ * 
+ * Reads a serial capture from an alloctrace kernel ("build.sh release
+ * alloctrace"), rebuilds the kmalloc/kmalloc_aligned/krealloc/kfree call
+ * sequence in TSC order, and replays it against candidate allocators:
+ * 
+ *   dsos       the kernel heap itself (kernel/mm/heap.c)
+ *   sizeclass  power-of-two size classes on 4 KiB pages, page runs above
+ *   libc       the host malloc, as a latency reference only
+ * 
+ * For each candidate it reports the peak footprint (high-water mark of
+ * the arena), fragmentation (share of that footprint not holding live
+ * data at the peak, and of the live extent at the end of the trace),
+ * failed requests and per-call latency. Pointers in the trace are mapped
+ * to replay pointers, so calls on blocks allocated before recording
+ * started are skipped and counted.
+ * 
+ * usage: alloc_replay [-a name] [-m arena_mb] [-s sites] capture
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hosted.h"
+
+#define TRACE_MAGIC         "DSALLOC1"
+#define TRACE_CHUNK_MAGIC   "DSAC"
+#define TRACE_TRAILER       "DSAEND01"
+#define TRACE_VERSION       1
+#define TRACE_MAX_CPUS      16
+
+#define OP_KMALLOC          0
+#define OP_KMALLOC_ALIGNED  1
+#define OP_KREALLOC         2
+#define OP_KFREE            3
+
+#define DEFAULT_ARENA_MB    64
+
+// Mirrors alloctrace_record_t
+typedef struct {
+    uint64_t tsc;
+    uint64_t ptr;
+    uint64_t old_ptr;
+    uint64_t size;
+    uint64_t site;
+    uint32_t align;
+    uint8_t op;
+    uint8_t cpu;
+    uint8_t reserved[2];
+} trace_record_t;
+
+// Mirrors the chunk header written by alloctrace_flush()
+typedef struct {
+    char magic[4];
+    uint16_t cpu;
+    uint16_t count;
+    uint32_t tsc_khz;
+    uint32_t reserved;
+    uint64_t lost;
+} __attribute__((packed)) trace_chunk_t;
+
+typedef struct {
+    trace_record_t* records;
+    size_t count;
+    size_t capacity;
+    uint32_t tsc_khz;
+    uint64_t lost[TRACE_MAX_CPUS];
+    bool complete;                      // Trailer seen
+} trace_t;
+
+/*
+ * Trace loading
+ */
+
+static void trace_append(trace_t* trace, const trace_record_t* rec) {
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 4096;
+        trace->records = realloc(trace->records, trace->capacity * sizeof(trace_record_t));
+        if (trace->records == NULL) {
+            perror("alloc_replay");
+            exit(1);
+        }
+    }
+    trace->records[trace->count++] = *rec;
+}
+
+static const uint8_t* find_bytes(const uint8_t* p, const uint8_t* end, const char* needle) {
+    size_t len = strlen(needle);
+    for (; p + len <= end; p++) {
+        if (memcmp(p, needle, len) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Records of one CPU are in order, so the merge only has to break ties
+static int compare_records(const void* a, const void* b) {
+    const trace_record_t* x = a;
+    const trace_record_t* y = b;
+    if (x->tsc != y->tsc) {
+        return x->tsc < y->tsc ? -1 : 1;
+    }
+    return (x > y) - (x < y);
+}
+
+static bool trace_load(const char* path, trace_t* trace) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* data = malloc(size > 0 ? (size_t)size : 1);
+    if (data == NULL || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(f);
+        free(data);
+        return false;
+    }
+    fclose(f);
+    
+    const uint8_t* end = data + size;
+    const uint8_t* p = find_bytes(data, end, TRACE_MAGIC);
+    if (p == NULL || p + 16 > end) {
+        fprintf(stderr, "%s: no allocation trace found\n", path);
+        free(data);
+        return false;
+    }
+    
+    uint32_t version, record_size;
+    memcpy(&version, p + 8, sizeof(version));
+    memcpy(&record_size, p + 12, sizeof(record_size));
+    if (version != TRACE_VERSION || record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "%s: unsupported trace (version %u, record size %u)\n",
+                path, version, record_size);
+        free(data);
+        return false;
+    }
+    p += 16;
+    
+    // Chunks may be separated by log text
+    while (p < end) {
+        const uint8_t* chunk_at = find_bytes(p, end, TRACE_CHUNK_MAGIC);
+        const uint8_t* trailer_at = find_bytes(p, end, TRACE_TRAILER);
+        if (trailer_at != NULL && (chunk_at == NULL || trailer_at < chunk_at)) {
+            trace->complete = true;
+            break;
+        }
+        if (chunk_at == NULL || chunk_at + sizeof(trace_chunk_t) > end) {
+            break;
+        }
+        
+        trace_chunk_t chunk;
+        memcpy(&chunk, chunk_at, sizeof(chunk));
+        const uint8_t* records = chunk_at + sizeof(chunk);
+        if (chunk.cpu >= TRACE_MAX_CPUS || records + chunk.count * sizeof(trace_record_t) > end) {
+            fprintf(stderr, "%s: truncated chunk at offset %ld\n", path, (long)(chunk_at - data));
+            break;
+        }
+        
+        for (uint16_t i = 0; i < chunk.count; i++) {
+            trace_record_t rec;
+            memcpy(&rec, records + i * sizeof(rec), sizeof(rec));
+            trace_append(trace, &rec);
+        }
+        if (chunk.tsc_khz != 0) {
+            trace->tsc_khz = chunk.tsc_khz;
+        }
+        trace->lost[chunk.cpu] = chunk.lost;
+        p = records + chunk.count * sizeof(trace_record_t);
+    }
+    
+    free(data);
+    qsort(trace->records, trace->count, sizeof(trace_record_t), compare_records);
+    return true;
+}
+
+/*
+ * Candidate: the kernel heap
+ */
+
+static uintptr_t dsos_init(size_t arena) {
+    return (uintptr_t)host_heap_init(arena);
+}
+
+static void* dsos_alloc(size_t size, size_t align) {
+    return align ? kmalloc_aligned(size, align) : kmalloc(size);
+}
+
+static void* dsos_realloc(void* ptr, size_t size) {
+    return krealloc(ptr, size);
+}
+
+static void dsos_free(void* ptr) {
+    kfree(ptr);
+}
+
+/*
+ * Candidate: segregated size classes
+ * 
+ * Blocks of up to 2 KiB come from pages dedicated to one power-of-two
+ * class, kept on per-class free lists with no headers; anything larger
+ * takes a first-fit run of whole pages. Class pages are never returned.
+ */
+
+#define SC_PAGE             4096
+#define SC_MIN_SHIFT        4
+#define SC_CLASSES          8                   // 16 .. 2048 bytes
+#define SC_FREE             0
+#define SC_RUN_TAIL         0xFE                // Page inside a large run
+#define SC_RUN_HEAD         0xFF                // First page of a large run
+
+static uint8_t* sc_arena;
+static size_t sc_pages;
+static uint8_t* sc_owner;                       // Class + 1, SC_RUN_* or SC_FREE
+static uint32_t* sc_run_pages;                  // Run length at each run head
+static void* sc_free_lists[SC_CLASSES];
+static size_t sc_first_free;                    // No free page below this
+
+static uintptr_t sc_init(size_t arena) {
+    free(sc_arena);
+    free(sc_owner);
+    free(sc_run_pages);
+    
+    sc_pages = arena / SC_PAGE;
+    sc_arena = aligned_alloc(SC_PAGE, sc_pages * SC_PAGE);
+    sc_owner = calloc(sc_pages, 1);
+    sc_run_pages = calloc(sc_pages, sizeof(uint32_t));
+    if (sc_arena == NULL || sc_owner == NULL || sc_run_pages == NULL) {
+        perror("sizeclass");
+        exit(1);
+    }
+    memset(sc_free_lists, 0, sizeof(sc_free_lists));
+    sc_first_free = 0;
+    return (uintptr_t)sc_arena;
+}
+
+static int sc_class(size_t size) {
+    int cls = 0;
+    while (cls < SC_CLASSES && ((size_t)1 << (cls + SC_MIN_SHIFT)) < size) {
+        cls++;
+    }
+    return cls;
+}
+
+// First fit for a run of pages starting on a multiple of align_pages
+static void* sc_alloc_pages(size_t count, size_t align_pages) {
+    size_t start = (sc_first_free + align_pages - 1) / align_pages * align_pages;
+    
+    while (start + count <= sc_pages) {
+        size_t n = 0;
+        while (n < count && sc_owner[start + n] == SC_FREE) {
+            n++;
+        }
+        if (n == count) {
+            memset(sc_owner + start, SC_RUN_TAIL, count);
+            sc_owner[start] = SC_RUN_HEAD;
+            sc_run_pages[start] = (uint32_t)count;
+            while (sc_first_free < sc_pages && sc_owner[sc_first_free] != SC_FREE) {
+                sc_first_free++;
+            }
+            return sc_arena + start * SC_PAGE;
+        }
+        start = (start + n + 1 + align_pages - 1) / align_pages * align_pages;
+    }
+    return NULL;
+}
+
+static void* sc_alloc(size_t size, size_t align) {
+    size_t need = size > align ? size : align;
+    
+    if (need > ((size_t)SC_PAGE >> 1)) {
+        size_t align_pages = align > SC_PAGE ? align / SC_PAGE : 1;
+        return sc_alloc_pages((size + SC_PAGE - 1) / SC_PAGE, align_pages);
+    }
+    
+    int cls = sc_class(need);
+    if (sc_free_lists[cls] == NULL) {
+        uint8_t* page = sc_alloc_pages(1, 1);
+        if (page == NULL) {
+            return NULL;
+        }
+        sc_owner[(page - sc_arena) / SC_PAGE] = (uint8_t)(cls + 1);
+        
+        // Thread the new page's blocks onto the class list
+        size_t block = (size_t)1 << (cls + SC_MIN_SHIFT);
+        for (size_t off = SC_PAGE; off >= block; off -= block) {
+            void** obj = (void**)(page + off - block);
+            *obj = sc_free_lists[cls];
+            sc_free_lists[cls] = obj;
+        }
+    }
+    
+    void** obj = sc_free_lists[cls];
+    sc_free_lists[cls] = *obj;
+    return obj;
+}
+
+static size_t sc_capacity(void* ptr) {
+    size_t page = ((uint8_t*)ptr - sc_arena) / SC_PAGE;
+    uint8_t owner = sc_owner[page];
+    if (owner == SC_RUN_HEAD) {
+        return (size_t)sc_run_pages[page] * SC_PAGE;
+    }
+    return (size_t)1 << (owner - 1 + SC_MIN_SHIFT);
+}
+
+static void sc_free(void* ptr) {
+    size_t page = ((uint8_t*)ptr - sc_arena) / SC_PAGE;
+    
+    if (sc_owner[page] == SC_RUN_HEAD) {
+        memset(sc_owner + page, SC_FREE, sc_run_pages[page]);
+        if (page < sc_first_free) {
+            sc_first_free = page;
+        }
+        return;
+    }
+    
+    int cls = sc_owner[page] - 1;
+    *(void**)ptr = sc_free_lists[cls];
+    sc_free_lists[cls] = ptr;
+}
+
+static void* sc_realloc(void* ptr, size_t size) {
+    size_t capacity = sc_capacity(ptr);
+    if (size <= capacity && size > capacity / 2) {
+        return ptr;
+    }
+    
+    void* new_ptr = sc_alloc(size, 0);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, ptr, size < capacity ? size : capacity);
+        sc_free(ptr);
+    }
+    return new_ptr;
+}
+
+/*
+ * Candidate: the host C library
+ */
+
+static uintptr_t libc_init(size_t arena) {
+    (void)arena;
+    return 0;
+}
+
+static void* libc_alloc(size_t size, size_t align) {
+    if (align == 0) {
+        return malloc(size);
+    }
+    void* ptr = NULL;
+    return posix_memalign(&ptr, align < sizeof(void*) ? sizeof(void*) : align, size) == 0 ? ptr : NULL;
+}
+
+static void* libc_realloc(void* ptr, size_t size) {
+    return realloc(ptr, size);
+}
+
+static void libc_free(void* ptr) {
+    free(ptr);
+}
+
+typedef struct {
+    const char* name;
+    uintptr_t (*init)(size_t arena);            // Returns the arena base, 0 if opaque
+    void* (*alloc)(size_t size, size_t align);
+    void* (*realloc)(void* ptr, size_t size);
+    void (*free)(void* ptr);
+} candidate_t;
+
+static const candidate_t candidates[] = {
+    { "dsos",      dsos_init, dsos_alloc, dsos_realloc, dsos_free },
+    { "sizeclass", sc_init,   sc_alloc,   sc_realloc,   sc_free },
+    { "libc",      libc_init, libc_alloc, libc_realloc, libc_free },
+};
+
+#define CANDIDATE_COUNT (sizeof(candidates) / sizeof(candidates[0]))
+
+/*
+ * Replay
+ */
+
+// Trace pointer to replay pointer, open addressing with tombstones
+typedef struct {
+    uint64_t key;                       // 0 empty, 1 tombstone
+    void* ptr;
+    size_t size;
+} live_entry_t;
+
+static live_entry_t* live_table;
+static size_t live_slots;
+
+static size_t live_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t)key & (live_slots - 1);
+}
+
+static live_entry_t* live_find(uint64_t key) {
+    for (size_t i = live_hash(key);; i = (i + 1) & (live_slots - 1)) {
+        if (live_table[i].key == key) {
+            return &live_table[i];
+        }
+        if (live_table[i].key == 0) {
+            return NULL;
+        }
+    }
+}
+
+static void live_insert(uint64_t key, void* ptr, size_t size) {
+    for (size_t i = live_hash(key);; i = (i + 1) & (live_slots - 1)) {
+        if (live_table[i].key <= 1) {
+            live_table[i].key = key;
+            live_table[i].ptr = ptr;
+            live_table[i].size = size;
+            return;
+        }
+    }
+}
+
+typedef struct {
+    uintptr_t base;                     // Arena base, 0 if opaque
+    size_t calls;
+    size_t failed;                      // Requests the candidate could not satisfy
+    size_t skipped;                     // Calls on blocks from before the trace
+    size_t live;
+    size_t peak_live;
+    uintptr_t extent;                   // High-water mark above the arena base
+    size_t live_at_extent;              // Live bytes when the extent last grew
+    uint32_t* alloc_ns;
+    size_t alloc_samples;
+    uint32_t* free_ns;
+    size_t free_samples;
+} replay_stats_t;
+
+static void note_extent(replay_stats_t* stats, void* ptr, size_t size) {
+    if (stats->base != 0) {
+        uintptr_t top = (uintptr_t)ptr + size - stats->base;
+        if (top > stats->extent) {
+            stats->extent = top;
+            stats->live_at_extent = stats->live;
+        }
+    }
+}
+
+static void replay(const candidate_t* cand, const trace_t* trace, size_t arena, replay_stats_t* stats) {
+    stats->base = cand->init(arena);
+    
+    for (live_slots = 1024; live_slots < trace->count * 2; live_slots *= 2) {
+    }
+    live_table = calloc(live_slots, sizeof(live_entry_t));
+    stats->alloc_ns = malloc(trace->count * sizeof(uint32_t) + 1);
+    stats->free_ns = malloc(trace->count * sizeof(uint32_t) + 1);
+    if (live_table == NULL || stats->alloc_ns == NULL || stats->free_ns == NULL) {
+        perror("alloc_replay");
+        exit(1);
+    }
+    
+    for (size_t i = 0; i < trace->count; i++) {
+        const trace_record_t* rec = &trace->records[i];
+        uint64_t start, elapsed;
+        void* ptr;
+        live_entry_t* entry;
+        
+        switch (rec->op) {
+        case OP_KMALLOC:
+        case OP_KMALLOC_ALIGNED:
+            // The kernel's own failures are not replayed
+            if (rec->ptr == 0) {
+                continue;
+            }
+            start = host_now_ns();
+            ptr = cand->alloc(rec->size, rec->op == OP_KMALLOC_ALIGNED ? rec->align : 0);
+            elapsed = host_now_ns() - start;
+            stats->alloc_ns[stats->alloc_samples++] = (uint32_t)elapsed;
+            if (ptr == NULL) {
+                stats->failed++;
+                break;
+            }
+            live_insert(rec->ptr, ptr, rec->size);
+            stats->live += rec->size;
+            note_extent(stats, ptr, rec->size);
+            break;
+        
+        case OP_KREALLOC:
+            if (rec->old_ptr == 0) {
+                if (rec->ptr == 0) {
+                    continue;
+                }
+                start = host_now_ns();
+                ptr = cand->alloc(rec->size, 0);
+                elapsed = host_now_ns() - start;
+                stats->alloc_ns[stats->alloc_samples++] = (uint32_t)elapsed;
+                if (ptr == NULL) {
+                    stats->failed++;
+                    break;
+                }
+                live_insert(rec->ptr, ptr, rec->size);
+                stats->live += rec->size;
+                note_extent(stats, ptr, rec->size);
+                break;
+            }
+            
+            entry = live_find(rec->old_ptr);
+            if (entry == NULL) {
+                stats->skipped++;
+                continue;
+            }
+            
+            // krealloc(ptr, 0) frees; a failed kernel realloc leaves the block
+            if (rec->size == 0) {
+                start = host_now_ns();
+                cand->free(entry->ptr);
+                stats->free_ns[stats->free_samples++] = (uint32_t)(host_now_ns() - start);
+                stats->live -= entry->size;
+                entry->key = 1;
+                break;
+            }
+            if (rec->ptr == 0) {
+                continue;
+            }
+            
+            start = host_now_ns();
+            ptr = cand->realloc(entry->ptr, rec->size);
+            elapsed = host_now_ns() - start;
+            stats->alloc_ns[stats->alloc_samples++] = (uint32_t)elapsed;
+            if (ptr == NULL) {
+                stats->failed++;
+                break;
+            }
+            stats->live = stats->live - entry->size + rec->size;
+            entry->key = 1;
+            live_insert(rec->ptr, ptr, rec->size);
+            note_extent(stats, ptr, rec->size);
+            break;
+        
+        case OP_KFREE:
+            if (rec->ptr == 0) {
+                continue;
+            }
+            entry = live_find(rec->ptr);
+            if (entry == NULL) {
+                stats->skipped++;
+                continue;
+            }
+            start = host_now_ns();
+            cand->free(entry->ptr);
+            stats->free_ns[stats->free_samples++] = (uint32_t)(host_now_ns() - start);
+            stats->live -= entry->size;
+            entry->key = 1;
+            break;
+        
+        default:
+            continue;
+        }
+        
+        stats->calls++;
+        if (stats->live > stats->peak_live) {
+            stats->peak_live = stats->live;
+        }
+    }
+}
+
+// Highest byte still in use at the end of the replay, then release everything
+static uintptr_t replay_finish(const candidate_t* cand, uintptr_t base) {
+    uintptr_t top = 0;
+    
+    for (size_t i = 0; i < live_slots; i++) {
+        if (live_table[i].key > 1) {
+            uintptr_t end = (uintptr_t)live_table[i].ptr + live_table[i].size - base;
+            if (base != 0 && end > top) {
+                top = end;
+            }
+            cand->free(live_table[i].ptr);
+        }
+    }
+    free(live_table);
+    live_table = NULL;
+    return top;
+}
+
+/*
+ * Reporting
+ */
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void format_latency(char* buf, size_t len, uint32_t* samples, size_t count) {
+    if (count == 0) {
+        snprintf(buf, len, "%8s %8s %8s", "-", "-", "-");
+        return;
+    }
+    qsort(samples, count, sizeof(uint32_t), compare_u32);
+    snprintf(buf, len, "%8u %8u %8u", samples[count / 2], samples[count * 99 / 100], samples[count - 1]);
+}
+
+static void report(const candidate_t* cand, replay_stats_t* stats, uintptr_t end_top, size_t end_live) {
+    char extent[16], peak_frag[16], end_frag[16], alloc_lat[40], free_lat[40];
+    
+    if (stats->extent != 0) {
+        snprintf(extent, sizeof(extent), "%zu", (size_t)(stats->extent / 1024));
+        snprintf(peak_frag, sizeof(peak_frag), "%.1f",
+                 100.0 * (1.0 - (double)stats->live_at_extent / (double)stats->extent));
+    } else {
+        strcpy(extent, "-");
+        strcpy(peak_frag, "-");
+    }
+    if (end_top != 0) {
+        snprintf(end_frag, sizeof(end_frag), "%.1f", 100.0 * (1.0 - (double)end_live / (double)end_top));
+    } else {
+        strcpy(end_frag, "-");
+    }
+    
+    format_latency(alloc_lat, sizeof(alloc_lat), stats->alloc_ns, stats->alloc_samples);
+    format_latency(free_lat, sizeof(free_lat), stats->free_ns, stats->free_samples);
+    
+    printf("%-10s %10s %7s %7s %7zu %s %s\n", cand->name, extent, peak_frag, end_frag,
+           stats->failed, alloc_lat, free_lat);
+}
+
+typedef struct {
+    uint64_t site;
+    size_t calls;
+    uint64_t bytes;
+} site_stats_t;
+
+static int compare_sites(const void* a, const void* b) {
+    const site_stats_t* x = a;
+    const site_stats_t* y = b;
+    return (x->calls < y->calls) - (x->calls > y->calls);
+}
+
+// Busiest allocation call sites, for addr2line against kernel.elf
+static void report_sites(const trace_t* trace, size_t top) {
+    site_stats_t* sites = calloc(trace->count + 1, sizeof(site_stats_t));
+    size_t count = 0;
+    
+    for (size_t i = 0; i < trace->count; i++) {
+        const trace_record_t* rec = &trace->records[i];
+        if (rec->op == OP_KFREE) {
+            continue;
+        }
+        size_t j = 0;
+        while (j < count && sites[j].site != rec->site) {
+            j++;
+        }
+        if (j == count) {
+            sites[count++].site = rec->site;
+        }
+        sites[j].calls++;
+        sites[j].bytes += rec->size;
+    }
+    
+    qsort(sites, count, sizeof(site_stats_t), compare_sites);
+    printf("\n%-18s %10s %12s\n", "call site", "calls", "bytes");
+    for (size_t i = 0; i < count && i < top; i++) {
+        printf("0x%016llx %10zu %12llu\n", (unsigned long long)sites[i].site,
+               sites[i].calls, (unsigned long long)sites[i].bytes);
+    }
+    free(sites);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: alloc_replay [-a dsos|sizeclass|libc] [-m arena_mb] [-s sites] capture\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* only = NULL;
+    const char* path = NULL;
+    size_t arena_mb = DEFAULT_ARENA_MB;
+    size_t top_sites = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            arena_mb = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            top_sites = strtoul(argv[++i], NULL, 0);
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if (path == NULL || arena_mb == 0) {
+        usage();
+    }
+    
+    trace_t trace = { 0 };
+    if (!trace_load(path, &trace)) {
+        return 1;
+    }
+    
+    uint64_t lost = 0;
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS; cpu++) {
+        lost += trace.lost[cpu];
+    }
+    double span_ms = 0;
+    if (trace.count > 1 && trace.tsc_khz != 0) {
+        span_ms = (double)(trace.records[trace.count - 1].tsc - trace.records[0].tsc) / trace.tsc_khz;
+    }
+    printf("%zu calls over %.1f ms, %llu lost%s\n", trace.count, span_ms,
+           (unsigned long long)lost, trace.complete ? "" : " (no trailer, capture may be cut short)");
+    if (lost != 0) {
+        printf("warning: records were dropped, frees may not match their allocations\n");
+    }
+    
+    printf("\n%-10s %10s %7s %7s %7s %8s %8s %8s %8s %8s %8s\n", "allocator", "peak KiB",
+           "frag%", "end%", "failed", "a.p50", "a.p99", "a.max", "f.p50", "f.p99", "f.max");
+    
+    bool found = false;
+    size_t skipped = 0;
+    for (size_t c = 0; c < CANDIDATE_COUNT; c++) {
+        const candidate_t* cand = &candidates[c];
+        if (only != NULL && strcmp(only, cand->name) != 0) {
+            continue;
+        }
+        found = true;
+        
+        replay_stats_t stats = { 0 };
+        replay(cand, &trace, arena_mb * 1024 * 1024, &stats);
+        
+        size_t end_live = stats.live;
+        uintptr_t end_top = replay_finish(cand, stats.base);
+        
+        report(cand, &stats, end_top, end_live);
+        skipped = stats.skipped;
+        free(stats.alloc_ns);
+        free(stats.free_ns);
+    }
+    if (!found) {
+        usage();
+    }
+    
+    if (skipped != 0) {
+        printf("%zu calls on unknown blocks (allocated before recording, or failed here) were skipped\n", skipped);
+    }
+    printf("latency in ns; frag%% is the share of the peak footprint not holding live data\n");
+    
+    if (top_sites > 0) {
+        report_sites(&trace, top_sites);
+    }
+    
+    free(trace.records);
+    return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file fuzz_heap.c
+ * @brief libFuzzer target for kmalloc/krealloc/kfree sequences
+ * 
+ * The input is a program for the allocator: each operation is one opcode
+ * byte followed by a slot byte and, for allocations, two size bytes.
+ * Every live block is filled with a pattern derived from its slot, and
+ * the pattern is checked before the block is touched again, so blocks
+ * that overlap or get corrupted by the allocator's metadata are caught
+ * on the next operation. Allocator panics abort and count as crashes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hosted.h"
+
+#define FUZZ_HEAP_SIZE      (256 * 1024)
+#define FUZZ_SLOTS          64
+#define FUZZ_MAX_SIZE       16384
+
+typedef struct {
+    uint8_t* ptr;
+    size_t size;
+} fuzz_slot_t;
+
+static fuzz_slot_t fuzz_slots[FUZZ_SLOTS];
+
+static uint8_t pattern(size_t slot, size_t i) {
+    return (uint8_t)(slot * 37 + i);
+}
+
+static void fill(size_t slot) {
+    for (size_t i = 0; i < fuzz_slots[slot].size; i++) {
+        fuzz_slots[slot].ptr[i] = pattern(slot, i);
+    }
+}
+
+static void verify(size_t slot, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (fuzz_slots[slot].ptr[i] != pattern(slot, i)) {
+            fprintf(stderr, "slot %zu: byte %zu of %zu corrupted\n", slot, i, fuzz_slots[slot].size);
+            abort();
+        }
+    }
+}
+
+static void check_block(size_t slot, size_t align) {
+    uintptr_t lo, hi;
+    uintptr_t p = (uintptr_t)fuzz_slots[slot].ptr;
+    
+    host_heap_bounds(&lo, &hi);
+    if (p < lo || p + fuzz_slots[slot].size > hi) {
+        fprintf(stderr, "slot %zu: block %p outside the heap\n", slot, (void*)p);
+        abort();
+    }
+    if (align != 0 && (p & (align - 1)) != 0) {
+        fprintf(stderr, "slot %zu: block %p not aligned to %zu\n", slot, (void*)p, align);
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static bool initialized = false;
+    if (!initialized) {
+        host_heap_init(FUZZ_HEAP_SIZE);
+        initialized = true;
+    } else {
+        uintptr_t lo, hi;
+        host_heap_bounds(&lo, &hi);
+        heap_init(lo, hi - lo);
+    }
+    memset(fuzz_slots, 0, sizeof(fuzz_slots));
+    
+    size_t pos = 0;
+    while (pos + 4 <= size) {
+        uint8_t op = data[pos] % 5;
+        size_t slot = data[pos + 1] % FUZZ_SLOTS;
+        size_t len = ((size_t)data[pos + 2] | ((size_t)data[pos + 3] << 8)) % FUZZ_MAX_SIZE;
+        pos += 4;
+        
+        fuzz_slot_t* s = &fuzz_slots[slot];
+        if (s->ptr != NULL) {
+            verify(slot, s->size);
+        }
+        
+        switch (op) {
+            case 0:
+            case 1: {
+                if (s->ptr != NULL) {
+                    break;
+                }
+                size_t align = (op == 1) ? (size_t)8 << (data[pos - 3] % 10) : 0;
+                s->ptr = align ? kmalloc_aligned(len, align) : kmalloc(len);
+                s->size = (s->ptr != NULL) ? len : 0;
+                if (s->ptr != NULL) {
+                    check_block(slot, align);
+                    fill(slot);
+                }
+                break;
+            }
+            
+            case 2:
+                kfree(s->ptr);
+                s->ptr = NULL;
+                s->size = 0;
+                break;
+            
+            case 3: {
+                uint8_t* ptr = krealloc(s->ptr, len);
+                if (len == 0) {
+                    // krealloc(p, 0) frees
+                    s->ptr = NULL;
+                    s->size = 0;
+                } else if (ptr != NULL) {
+                    size_t kept = (len < s->size) ? len : s->size;
+                    s->ptr = ptr;
+                    verify(slot, kept);
+                    s->size = len;
+                    check_block(slot, 0);
+                    fill(slot);
+                }
+                break;
+            }
+            
+            default:
+                if (s->ptr == NULL && len > 0) {
+                    s->ptr = kzalloc(len);
+                    s->size = (s->ptr != NULL) ? len : 0;
+                    for (size_t i = 0; s->ptr != NULL && i < len; i++) {
+                        if (s->ptr[i] != 0) {
+                            fprintf(stderr, "slot %zu: kzalloc byte %zu not zero\n", slot, i);
+                            abort();
+                        }
+                    }
+                    if (s->ptr != NULL) {
+                        check_block(slot, 0);
+                        fill(slot);
+                    }
+                }
+                break;
+        }
+    }
+    
+    for (size_t slot = 0; slot < FUZZ_SLOTS; slot++) {
+        if (fuzz_slots[slot].ptr != NULL) {
+            verify(slot, fuzz_slots[slot].size);
+            kfree(fuzz_slots[slot].ptr);
+        }
+    }
+    
+    size_t count;
+    heap_get_info(NULL, NULL, &count);
+    if (count != 0) {
+        fprintf(stderr, "%zu allocations still counted after freeing everything\n", count);
+        abort();
+    }
+    
+    return 0;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file heap_bench.c
+ * @brief Host throughput and latency benchmarks for the heap, PMM and string code
+ * 
+ * Reports ns/op as mean, p50, p99 and max over batched samples, in the
+ * same spirit as the in-kernel kbench suite but without a boot per run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hosted.h"
+
+#define BENCH_SAMPLES       2000
+#define BENCH_BATCH         64
+#define BENCH_HEAP_SIZE     (16 * 1024 * 1024)
+#define BENCH_MEMORY        (256 * 1024 * 1024)
+
+typedef void (*bench_fn_t)(void);
+
+static uint64_t samples[BENCH_SAMPLES];
+static uint8_t copy_src[65536], copy_dst[65536];
+static size_t copy_size;
+static void* live[1024];
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench(const char* name, bench_fn_t fn, int ops_per_call) {
+    for (int i = 0; i < BENCH_SAMPLES / 10; i++) {
+        fn();
+    }
+    
+    uint64_t total = 0;
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = host_now_ns();
+        for (int b = 0; b < BENCH_BATCH; b++) {
+            fn();
+        }
+        samples[i] = host_now_ns() - start;
+        total += samples[i];
+    }
+    qsort(samples, BENCH_SAMPLES, sizeof(samples[0]), compare_u64);
+    
+    double per_op = (double)BENCH_BATCH * ops_per_call;
+    printf("%-22s %10.1f %10.1f %10.1f %10.1f %12.0f\n", name,
+           total / (BENCH_SAMPLES * per_op),
+           samples[BENCH_SAMPLES / 2] / per_op,
+           samples[BENCH_SAMPLES * 99 / 100] / per_op,
+           samples[BENCH_SAMPLES - 1] / per_op,
+           1e9 * BENCH_SAMPLES * per_op / total);
+}
+
+static void bench_kmalloc_64(void) {
+    kfree(kmalloc(64));
+}
+
+static void bench_kmalloc_4k(void) {
+    kfree(kmalloc(4096));
+}
+
+// Churn one slot of a heap with 1024 live blocks of mixed sizes
+static void bench_kmalloc_fragmented(void) {
+    static unsigned int next = 0;
+    unsigned int i = (next++ * 7919) % 1024;
+    kfree(live[i]);
+    live[i] = kmalloc(16 + (i * 37) % 2000);
+}
+
+static void bench_krealloc_grow(void) {
+    void* p = kmalloc(32);
+    for (size_t size = 64; size <= 4096; size *= 2) {
+        p = krealloc(p, size);
+    }
+    kfree(p);
+}
+
+static void bench_page_alloc(void) {
+    free_physical_page(alloc_physical_page());
+}
+
+static void bench_pages_alloc_16(void) {
+    free_physical_pages(alloc_physical_pages(16), 16);
+}
+
+static void bench_memcpy(void) {
+    kernel_memcpy(copy_dst, copy_src, copy_size);
+}
+
+static void bench_memset(void) {
+    kernel_memset(copy_dst, 0x5A, copy_size);
+}
+
+int main(void) {
+    printf("%-22s %10s %10s %10s %10s %12s\n", "benchmark (ns/op)", "mean", "p50", "p99", "max", "ops/s");
+    
+    host_heap_init(BENCH_HEAP_SIZE);
+    bench("kmalloc_64", bench_kmalloc_64, 1);
+    bench("kmalloc_4k", bench_kmalloc_4k, 1);
+    bench("krealloc_grow", bench_krealloc_grow, 8);
+    
+    for (int i = 0; i < 1024; i++) {
+        live[i] = kmalloc(16 + (i * 37) % 2000);
+    }
+    bench("kmalloc_fragmented", bench_kmalloc_fragmented, 2);
+    
+    host_mm_init(BENCH_MEMORY);
+    bench("page_alloc", bench_page_alloc, 2);
+    bench("pages_alloc_16", bench_pages_alloc_16, 2);
+    
+    // Fill half of memory with scattered single pages to slow the scans
+    for (size_t i = 0; i < BENCH_MEMORY / PAGE_SIZE / 2; i++) {
+        uintptr_t page = alloc_physical_page();
+        if (i % 2 == 0) {
+            free_physical_page(page);
+        }
+    }
+    bench("page_alloc_half_full", bench_page_alloc, 2);
+    bench("pages_alloc_16_full", bench_pages_alloc_16, 2);
+    
+    static const size_t sizes[] = { 64, 4096, 65536 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char name[32];
+        copy_size = sizes[i];
+        snprintf(name, sizeof(name), "memcpy_%zu", copy_size);
+        bench(name, bench_memcpy, 1);
+        snprintf(name, sizeof(name), "memset_%zu", copy_size);
+        bench(name, bench_memset, 1);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,284 @@
+/**
+ * @file heap_stress.c
+ * @brief Randomized stress tests for the heap, PMM and string code
+ * 
+ * Every run is reproducible from its seed, which is printed first and
+ * can be passed back as the only argument.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hosted.h"
+
+#define HEAP_SIZE           (4 * 1024 * 1024)
+#define HEAP_SLOTS          512
+#define HEAP_ROUNDS         200000
+#define PMM_MEMORY          (64 * 1024 * 1024)
+#define PMM_SLOTS           256
+#define PMM_ROUNDS          50000
+#define STRING_ROUNDS       20000
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);        \
+            fprintf(stderr, __VA_ARGS__);                               \
+            fprintf(stderr, "\n");                                      \
+            if (++failures > 20) {                                      \
+                exit(1);                                                \
+            }                                                           \
+        }                                                               \
+    } while (0)
+
+// xorshift64*, so runs do not depend on the C library's rand()
+static uint64_t rng_state;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t rng_size(void) {
+    // Mostly small objects with a long tail, like real kernel callers
+    switch (rng() % 8) {
+        case 0:  return 1 + rng() % 8192;
+        case 1:  return 1 + rng() % 1024;
+        default: return 1 + rng() % 128;
+    }
+}
+
+typedef struct {
+    uint8_t* ptr;
+    size_t size;
+    uint8_t fill;
+} slot_t;
+
+static bool fill_intact(const slot_t* slot) {
+    for (size_t i = 0; i < slot->size; i++) {
+        if (slot->ptr[i] != (uint8_t)(slot->fill + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void fill(slot_t* slot) {
+    slot->fill = (uint8_t)rng();
+    for (size_t i = 0; i < slot->size; i++) {
+        slot->ptr[i] = (uint8_t)(slot->fill + i);
+    }
+}
+
+static void test_heap(void) {
+    static slot_t slots[HEAP_SLOTS];
+    uintptr_t heap_lo, heap_hi;
+    
+    memset(slots, 0, sizeof(slots));
+    host_heap_init(HEAP_SIZE);
+    host_heap_bounds(&heap_lo, &heap_hi);
+    
+    for (int round = 0; round < HEAP_ROUNDS; round++) {
+        slot_t* slot = &slots[rng() % HEAP_SLOTS];
+        
+        if (slot->ptr != NULL) {
+            CHECK(fill_intact(slot), "round %d: block %p (%zu bytes) was overwritten",
+                  round, (void*)slot->ptr, slot->size);
+        }
+        
+        switch (rng() % 4) {
+            case 0:
+            case 1:
+                if (slot->ptr == NULL) {
+                    size_t align = (rng() % 4 == 0) ? (size_t)16 << (rng() % 7) : 0;
+                    slot->size = rng_size();
+                    slot->ptr = align ? kmalloc_aligned(slot->size, align) : kmalloc(slot->size);
+                    if (slot->ptr == NULL) {
+                        break;
+                    }
+                    CHECK((uintptr_t)slot->ptr >= heap_lo && (uintptr_t)slot->ptr + slot->size <= heap_hi,
+                          "round %d: %p outside the heap", round, (void*)slot->ptr);
+                    CHECK(align == 0 || ((uintptr_t)slot->ptr & (align - 1)) == 0,
+                          "round %d: %p not aligned to %zu", round, (void*)slot->ptr, align);
+                    CHECK(ksize(slot->ptr) >= slot->size, "round %d: ksize %zu < %zu",
+                          round, ksize(slot->ptr), slot->size);
+                    fill(slot);
+                }
+                break;
+            
+            case 2:
+                if (slot->ptr != NULL) {
+                    size_t size = rng_size();
+                    uint8_t* ptr = krealloc(slot->ptr, size);
+                    if (ptr == NULL) {
+                        break;
+                    }
+                    
+                    // The common prefix must survive the move
+                    slot_t moved = { ptr, size < slot->size ? size : slot->size, slot->fill };
+                    CHECK(fill_intact(&moved), "round %d: krealloc lost data", round);
+                    slot->ptr = ptr;
+                    slot->size = size;
+                    fill(slot);
+                }
+                break;
+            
+            default:
+                kfree(slot->ptr);
+                slot->ptr = NULL;
+                break;
+        }
+    }
+    
+    size_t live = 0;
+    for (int i = 0; i < HEAP_SLOTS; i++) {
+        if (slots[i].ptr != NULL) {
+            CHECK(fill_intact(&slots[i]), "final check: block %d was overwritten", i);
+            kfree(slots[i].ptr);
+            live++;
+        }
+    }
+    
+    size_t total, used, count;
+    heap_get_info(&total, &used, &count);
+    CHECK(count == 0, "%zu allocations still counted after freeing %zu blocks", count, live);
+    CHECK(kmalloc(HEAP_SIZE / 2) != NULL, "heap did not coalesce back after freeing everything");
+}
+
+static void test_pmm(void) {
+    static uintptr_t pages[PMM_SLOTS];
+    static size_t counts[PMM_SLOTS];
+    static uint8_t owner[PMM_MEMORY / PAGE_SIZE];
+    
+    memset(pages, 0, sizeof(pages));
+    memset(owner, 0, sizeof(owner));
+    host_mm_init(PMM_MEMORY);
+    uint64_t initial_free = get_free_physical_memory();
+    
+    for (int round = 0; round < PMM_ROUNDS; round++) {
+        int i = (int)(rng() % PMM_SLOTS);
+        
+        if (pages[i] == 0) {
+            size_t count = (rng() % 4 == 0) ? 1 + rng() % 32 : 1;
+            uintptr_t phys = (count == 1) ? alloc_physical_page() : alloc_physical_pages(count);
+            if (phys == 0) {
+                continue;
+            }
+            
+            CHECK(phys % PAGE_SIZE == 0, "round %d: unaligned page 0x%lx", round, (unsigned long)phys);
+            for (size_t p = 0; p < count; p++) {
+                size_t page = phys / PAGE_SIZE + p;
+                CHECK(page < PMM_MEMORY / PAGE_SIZE && !owner[page],
+                      "round %d: page 0x%zx handed out twice", round, page * PAGE_SIZE);
+                CHECK(is_physical_page_allocated(page * PAGE_SIZE), "round %d: page not marked", round);
+                owner[page] = 1;
+            }
+            pages[i] = phys;
+            counts[i] = count;
+        } else {
+            for (size_t p = 0; p < counts[i]; p++) {
+                owner[pages[i] / PAGE_SIZE + p] = 0;
+            }
+            if (counts[i] == 1) {
+                free_physical_page(pages[i]);
+            } else {
+                free_physical_pages(pages[i], counts[i]);
+            }
+            pages[i] = 0;
+        }
+    }
+    
+    for (int i = 0; i < PMM_SLOTS; i++) {
+        if (pages[i] != 0) {
+            free_physical_pages(pages[i], counts[i]);
+        }
+    }
+    CHECK(get_free_physical_memory() == initial_free, "free memory %llu after freeing everything, expected %llu",
+          (unsigned long long)get_free_physical_memory(), (unsigned long long)initial_free);
+}
+
+static void test_string(void) {
+    static uint8_t src[512], expect[512], actual[512];
+    
+    for (int round = 0; round < STRING_ROUNDS; round++) {
+        size_t len = rng() % 256;
+        size_t so = rng() % 64, doff = rng() % 64;
+        for (size_t i = 0; i < sizeof(src); i++) {
+            src[i] = (uint8_t)rng();
+        }
+        memcpy(expect, src, sizeof(src));
+        memcpy(actual, src, sizeof(src));
+        
+        switch (round % 4) {
+            case 0:
+                memcpy(expect + doff, src + so, len);
+                kernel_memcpy(actual + doff, src + so, len);
+                break;
+            case 1:
+                memmove(expect + doff, expect + so, len);
+                kernel_memmove(actual + doff, actual + so, len);
+                break;
+            case 2:
+                memset(expect + doff, (int)so, len);
+                kernel_memset(actual + doff, (int)so, len);
+                break;
+            default: {
+                int want = memcmp(src + so, src + doff, len);
+                int got = kernel_memcmp(src + so, src + doff, len);
+                CHECK((want < 0) == (got < 0) && (want > 0) == (got > 0), "memcmp sign mismatch");
+                break;
+            }
+        }
+        CHECK(memcmp(expect, actual, sizeof(expect)) == 0, "round %d: op %d len %zu src+%zu dst+%zu differs",
+              round, round % 4, len, so, doff);
+        
+        // Strings from a small alphabet so searches actually hit
+        char a[64], b[16];
+        size_t alen = rng() % sizeof(a), blen = rng() % sizeof(b);
+        for (size_t i = 0; i < alen; i++) a[i] = (char)('a' + rng() % 3);
+        for (size_t i = 0; i < blen; i++) b[i] = (char)('a' + rng() % 3);
+        a[alen] = '\0';
+        b[blen] = '\0';
+        
+        CHECK(kernel_strlen(a) == strlen(a), "strlen(\"%s\")", a);
+        CHECK((kernel_strcmp(a, b) > 0) == (strcmp(a, b) > 0), "strcmp(\"%s\", \"%s\")", a, b);
+        CHECK(kernel_strstr(a, b) == strstr(a, b), "strstr(\"%s\", \"%s\")", a, b);
+        CHECK(kernel_strchr(a, 'b') == strchr(a, 'b'), "strchr(\"%s\")", a);
+        CHECK(kernel_strrchr(a, 'c') == strrchr(a, 'c'), "strrchr(\"%s\")", a);
+    }
+    
+    // Formatting against the C library for the conversions the kernel uses
+    for (int round = 0; round < STRING_ROUNDS; round++) {
+        char want[64], got[64];
+        unsigned long long v = rng() >> (rng() % 64);
+        size_t size = rng() % sizeof(want);
+        
+        int wn = snprintf(want, size, "%llu:%llx:%d:%s", v, v, (int)v, "abc");
+        int gn = kernel_snprintf(got, size, "%llu:%llx:%d:%s", v, v, (int)v, "abc");
+        CHECK(wn == gn && (size == 0 || strcmp(want, got) == 0),
+              "snprintf size %zu: \"%s\" (%d) vs \"%s\" (%d)", size, want, wn, got, gn);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : host_now_ns();
+    rng_state = seed ? seed : 1;
+    printf("heap_stress: seed %llu\n", (unsigned long long)seed);
+    
+    test_heap();
+    printf("heap: %s\n", failures ? "FAILED" : "ok");
+    
+    int before = failures;
+    test_pmm();
+    printf("pmm: %s\n", failures > before ? "FAILED" : "ok");
+    
+    before = failures;
+    test_string();
+    printf("string: %s\n", failures > before ? "FAILED" : "ok");
+    
+    return failures ? 1 : 0;
+}
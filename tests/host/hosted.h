@@ -0,0 +1,86 @@
+/**
+ * @file hosted.h
+ * @brief Host test harness interface
+ * 
+ * kernel/mm and kernel/lib are compiled for Linux userspace with
+ * KERNEL_HOSTED defined and linked against the mock arch layer in
+ * mock_arch.c. Every symbol defined by kernel/lib/string.c and printf.c
+ * is renamed with a kernel_ prefix after compiling, so the kernel's
+ * versions can be tested side by side with the C library's.
+ */
+
+#ifndef _HOSTED_H
+#define _HOSTED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include "../../kernel/include/memory.h"
+
+/**
+ * @brief Kernel string and formatting functions under test
+ */
+void* kernel_memcpy(void* dest, const void* src, size_t n);
+void* kernel_memmove(void* dest, const void* src, size_t n);
+void* kernel_memset(void* s, int c, size_t n);
+int kernel_memcmp(const void* s1, const void* s2, size_t n);
+void* kernel_memchr(const void* s, int c, size_t n);
+size_t kernel_strlen(const char* s);
+char* kernel_strcpy(char* dest, const char* src);
+char* kernel_strncpy(char* dest, const char* src, size_t n);
+int kernel_strcmp(const char* s1, const char* s2);
+int kernel_strncmp(const char* s1, const char* s2, size_t n);
+char* kernel_strchr(const char* s, int c);
+char* kernel_strrchr(const char* s, int c);
+char* kernel_strstr(const char* haystack, const char* needle);
+int kernel_snprintf(char* buffer, size_t size, const char* fmt, ...);
+
+/**
+ * @brief Simulated physical memory
+ * 
+ * memory.c keeps its bitmap at physical address 0x100000 and never
+ * touches the pages it hands out, so only the bitmap is backed by host
+ * memory; it is mapped at that exact address.
+ */
+#define HOST_BITMAP_ADDR    0x100000
+
+/**
+ * @brief Set up the physical memory manager
+ * 
+ * May be called again to start over with a fresh bitmap.
+ * 
+ * @param mem_bytes Size of the simulated physical memory
+ */
+void host_mm_init(size_t mem_bytes);
+
+/**
+ * @brief Set up the kernel heap on a fresh host buffer
+ * 
+ * Frees the buffer of any earlier call.
+ * 
+ * @param size Heap size in bytes
+ * @return Start of the heap area
+ */
+void* host_heap_init(size_t size);
+
+/**
+ * @brief Get the bounds of the current heap area
+ * 
+ * @param start Where to store the first byte of the heap
+ * @param end Where to store the byte past the end of the heap
+ */
+void host_heap_bounds(uintptr_t* start, uintptr_t* end);
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ */
+uint64_t host_now_ns(void);
+
+/**
+ * @brief Send kernel console output to stderr (off by default)
+ */
+extern bool host_verbose;
+
+#endif /* _HOSTED_H */
@@ -0,0 +1,135 @@
+/**
+ * @file mock_arch.c
+ * @brief Mock arch layer for the host test harness
+ * 
+ * Provides what kernel/mm and kernel/lib expect from the rest of the
+ * kernel: console sinks, the log ring, panic, and the tracer hooks (all
+ * permanently off). A kernel panic is a test failure, so it aborts,
+ * which also makes it a crash for the fuzzers.
+ * 
+ * kernel.h cannot be included next to the C library headers (their
+ * typedefs clash), so the kernel types used here are spelled out: ports
+ * are only ever passed through as opaque pointers.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "hosted.h"
+#include "../../kernel/include/static_key.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE MAP_FIXED
+#endif
+
+bool host_verbose = false;
+
+// Kernel globals referenced by the modules under test
+DEFINE_STATIC_KEY_FALSE(irqsoff_key);
+DEFINE_STATIC_KEY_FALSE(trace_key);
+volatile uint64_t trace_event_mask = 0;
+DEFINE_STATIC_KEY_FALSE(alloctrace_key);
+void* debug_port = NULL;
+
+// Per-CPU variables: the harness runs on the template (see percpu.h)
+unsigned int cpu_number = 0;
+
+static void* host_bitmap = NULL;
+static size_t host_bitmap_size = 0;
+static void* host_heap = NULL;
+static size_t host_heap_size = 0;
+
+void irqsoff_start(uintptr_t ip) {
+    (void)ip;
+}
+
+void irqsoff_stop(uintptr_t ip) {
+    (void)ip;
+}
+
+void trace_record(uint16_t id, uint64_t a0, uint64_t a1, uint64_t a2) {
+    (void)id; (void)a0; (void)a1; (void)a2;
+}
+
+void alloctrace_record(uint8_t op, void* ptr, void* old_ptr, size_t size, size_t align, void* site) {
+    (void)op; (void)ptr; (void)old_ptr; (void)size; (void)align; (void)site;
+}
+
+void terminal_write(const char* data, size_t len) {
+    if (host_verbose) {
+        fwrite(data, 1, len, stderr);
+    }
+}
+
+void terminal_flush(void) {
+}
+
+bool serial_is_initialized(void* port) {
+    (void)port;
+    return false;
+}
+
+bool serial_write(void* port, const char* data, size_t len) {
+    (void)port; (void)data; (void)len;
+    return false;
+}
+
+bool klog_is_async(void) {
+    return false;
+}
+
+void klog_write(const char* text, size_t len) {
+    terminal_write(text, len);
+}
+
+void __attribute__((noreturn)) panic(int type, const char* msg, const char* file, int line) {
+    fprintf(stderr, "KERNEL PANIC (%d): %s at %s:%d\n", type, msg, file, line);
+    abort();
+}
+
+void host_mm_init(size_t mem_bytes) {
+    size_t pages = mem_bytes / PAGE_SIZE;
+    size_t bitmap = (((pages + 63) / 64) * sizeof(uint64_t) + PAGE_SIZE - 1) & PAGE_MASK;
+    
+    if (host_bitmap != NULL) {
+        munmap(host_bitmap, host_bitmap_size);
+    }
+    
+    host_bitmap = mmap((void*)HOST_BITMAP_ADDR, bitmap, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (host_bitmap != (void*)HOST_BITMAP_ADDR) {
+        perror("host_mm_init: cannot map the bitmap at 0x100000");
+        abort();
+    }
+    host_bitmap_size = bitmap;
+    
+    mm_init(mem_bytes);
+}
+
+void* host_heap_init(size_t size) {
+    free(host_heap);
+    
+    host_heap = aligned_alloc(PAGE_SIZE, (size + PAGE_SIZE - 1) & PAGE_MASK);
+    if (host_heap == NULL) {
+        perror("host_heap_init");
+        abort();
+    }
+    host_heap_size = size;
+    
+    heap_init((uintptr_t)host_heap, size);
+    return host_heap;
+}
+
+void host_heap_bounds(uintptr_t* start, uintptr_t* end) {
+    *start = (uintptr_t)host_heap;
+    *end = (uintptr_t)host_heap + host_heap_size;
+}
+
+uint64_t host_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}